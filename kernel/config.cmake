@@ -255,4 +255,14 @@ config_option(KernelDebugDisablePrefetchers DEBUG_DISABLE_PREFETCHERS
     DEPENDS "KernelArchX86 OR KernelPlatformHikey"
 )
 
+config_option(KernelBootTimestamps BOOT_TIMESTAMPS
+    "Record the cycle counter at each phase of kernel boot and pass the values \
+    to the initial thread in the extra bootinfo. On ARM the ELF-loader also records \
+    its own phases and the kernel passes those on. Kernel benchmarking resets the \
+    ARM cycle counter during CPU initialisation, so earlier phases are then not \
+    comparable with later ones."
+    DEFAULT ON
+    DEPENDS "KernelArchX86 OR KernelArchARM;NOT KernelVerificationBuild" DEFAULT_DISABLED OFF
+)
+
 add_config_library(kernel "${configure_string}")
@@ -11,6 +11,7 @@
 #ifndef __ARCH_KERNEL_BOOT_H
 #define __ARCH_KERNEL_BOOT_H
 
+#include <config.h>
 #include <types.h>
 
 cap_t create_unmapped_it_frame_cap(pptr_t pptr, bool_t use_large);
@@ -23,4 +24,11 @@ void init_kernel(
     vptr_t  v_entry
 );
 
+#ifdef CONFIG_BOOT_TIMESTAMPS
+/* record the cycle counter for a seL4_BootPhase */
+void boot_timestamp(word_t phase);
+#else
+static inline void boot_timestamp(word_t phase) {}
+#endif
+
 #endif
@@ -11,10 +11,10 @@
 #ifndef ARMV_BENCHMARK_H
 #define ARMV_BENCHMARK_H
 
-#ifdef CONFIG_ENABLE_BENCHMARKS
-
 #define CCNT "p15, 0, %0, c15, c12, 1"
 
+#ifdef CONFIG_ENABLE_BENCHMARKS
+
 #ifdef CONFIG_BENCHMARK_TRACK_UTILISATION
 extern uint64_t ccnt_num_overflows;
 static inline void benchmark_arch_utilisation_reset(void)
@@ -11,10 +11,10 @@
 #ifndef ARMV_BENCHMARK_H
 #define ARMV_BENCHMARK_H
 
-#ifdef CONFIG_ENABLE_BENCHMARKS
-
 #define CCNT "p15, 0, %0, c9, c13, 0"
 
+#ifdef CONFIG_ENABLE_BENCHMARKS
+
 #ifdef CONFIG_BENCHMARK_TRACK_UTILISATION
 #ifdef CONFIG_ARM_ENABLE_PMU_OVERFLOW_INTERRUPT
 extern uint64_t ccnt_num_overflows;
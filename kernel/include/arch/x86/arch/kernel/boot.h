@@ -50,6 +50,13 @@ bool_t init_cpu(
     bool_t   mask_legacy_irqs
 );
 
+#ifdef CONFIG_BOOT_TIMESTAMPS
+/* record the time stamp counter for a seL4_BootPhase */
+void boot_timestamp(word_t phase);
+#else
+static inline void boot_timestamp(word_t phase) {}
+#endif
+
 bool_t add_allocated_p_region(p_region_t reg);
 void init_allocated_p_regions(void);
 
@@ -89,5 +89,41 @@ typedef struct {
 #define SEL4_BOOTINFO_HEADER_X86_ACPI_RSDP 3
 #define SEL4_BOOTINFO_HEADER_X86_FRAMEBUFFER 4
 #define SEL4_BOOTINFO_HEADER_X86_TSC_FREQ 5 // frequency is in mhz
+#define SEL4_BOOTINFO_HEADER_BOOT_TIMESTAMPS 6
+#define SEL4_BOOTINFO_HEADER_ELFLOADER_TIMESTAMPS 7
+
+/* Points during kernel boot at which the cycle counter is sampled, in the
+ * order in which they are reached */
+enum {
+    seL4_BootPhaseKernelEntry = 0, /* entered from the boot loader */
+    seL4_BootPhaseImageLoad,       /* user image loaded and in place */
+    seL4_BootPhaseCPUInit,         /* boot CPU initialised */
+    seL4_BootPhaseUserImage,       /* initial address space and user image frames created */
+    seL4_BootPhaseUntypeds,        /* untyped caps created */
+    seL4_BootPhaseNodesStarted,    /* all other nodes booted */
+    seL4_BootPhaseKernelExit,      /* about to run the initial thread */
+    seL4_NumBootPhases
+};
+
+/* Cycle counter value at each boot phase. Phases that were not recorded are 0 */
+typedef struct {
+    seL4_BootInfoHeader header;
+    seL4_Uint64 cycles[seL4_NumBootPhases];
+} SEL4_PACKED seL4_BootInfoTimestamps;
+
+/* Points during the ELF-loader at which it samples the cycle counter. The
+ * ELF-loader hands these to the kernel, which passes them on unchanged */
+enum {
+    seL4_ElfloaderPhaseEntry = 0,  /* ELF-loader started */
+    seL4_ElfloaderPhaseKernelLoad, /* kernel image loaded */
+    seL4_ElfloaderPhaseUserLoad,   /* user images loaded */
+    seL4_ElfloaderPhaseHandoff,    /* about to enable the MMU and enter the kernel */
+    seL4_NumElfloaderPhases
+};
+
+typedef struct {
+    seL4_BootInfoHeader header;
+    seL4_Uint64 cycles[seL4_NumElfloaderPhases];
+} SEL4_PACKED seL4_BootInfoElfloaderTimestamps;
 
 #endif // __LIBSEL4_BOOTINFO_TYPES_H
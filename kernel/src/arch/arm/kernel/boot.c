@@ -18,6 +18,7 @@
 #include <arch/kernel/boot.h>
 #include <arch/kernel/vspace.h>
 #include <arch/benchmark.h>
+#include <armv/benchmark.h>
 #include <arch/user_access.h>
 #include <arch/object/iospace.h>
 #include <linker.h>
@@ -34,6 +35,91 @@ extern char ki_boot_end[1];
 /* pointer to end of kernel image */
 extern char ki_end[1];
 
+#ifdef CONFIG_BOOT_TIMESTAMPS
+/* Timestamps are kept here until the extra bootinfo has been allocated, and
+ * written straight to it after that. The boot data is handed out as untyped
+ * memory along with the rest of the boot code */
+static uint64_t boot_timestamps[seL4_NumBootPhases] BOOT_DATA;
+static seL4_BootInfoTimestamps *bi_timestamps BOOT_DATA;
+static seL4_BootInfoElfloaderTimestamps elfloader_timestamps BOOT_DATA;
+
+/* The extra bootinfo holds the kernel and ELF-loader timestamps and a padding header */
+#define EXTRA_BI_SIZE (sizeof(seL4_BootInfoTimestamps) + \
+                       sizeof(seL4_BootInfoElfloaderTimestamps) + sizeof(seL4_BootInfoHeader))
+
+BOOT_CODE void
+boot_timestamp(word_t phase)
+{
+    word_t ccnt;
+    SYSTEM_READ_WORD(CCNT, ccnt);
+    if (bi_timestamps) {
+        bi_timestamps->cycles[phase] = ccnt;
+    } else {
+        boot_timestamps[phase] = ccnt;
+    }
+}
+
+/* The ELF-loader leaves its timestamps in the frame after the one holding the
+ * user image's ELF headers, which is the first page after the image. That
+ * frame is free memory as far as we are concerned, so a copy has to be taken
+ * before anything is allocated */
+BOOT_CODE static void
+read_elfloader_timestamps(paddr_t ui_p_reg_end)
+{
+    paddr_t paddr = ROUND_UP(ui_p_reg_end, PAGE_BITS) + BIT(PAGE_BITS);
+    seL4_BootInfoElfloaderTimestamps *record;
+    word_t i;
+
+    if (paddr + BIT(PAGE_BITS) > PADDR_TOP) {
+        return;
+    }
+    for (i = 0; i < get_num_avail_p_regs(); i++) {
+        p_region_t reg = get_avail_p_reg(i);
+        if (paddr >= reg.start && paddr + BIT(PAGE_BITS) <= reg.end) {
+            record = (seL4_BootInfoElfloaderTimestamps*)paddr_to_pptr(paddr);
+            if (record->header.id == SEL4_BOOTINFO_HEADER_ELFLOADER_TIMESTAMPS &&
+                    record->header.len == sizeof(*record)) {
+                elfloader_timestamps = *record;
+            }
+            return;
+        }
+    }
+}
+
+BOOT_CODE static region_t
+populate_extra_bi(void)
+{
+    region_t extra_bi_region;
+    pptr_t extra_bi_offset = 0;
+    seL4_BootInfoHeader padding_header;
+
+    extra_bi_region = allocate_extra_bi_region(EXTRA_BI_SIZE);
+    if (extra_bi_region.start == 0) {
+        return extra_bi_region;
+    }
+
+    /* pass on the ELF-loader timestamps if there were any */
+    if (elfloader_timestamps.header.id == SEL4_BOOTINFO_HEADER_ELFLOADER_TIMESTAMPS) {
+        memcpy((void*)extra_bi_region.start, &elfloader_timestamps, sizeof(elfloader_timestamps));
+        extra_bi_offset += sizeof(elfloader_timestamps);
+    }
+
+    /* populate boot timestamps block. Later phases are filled in as they happen */
+    bi_timestamps = (seL4_BootInfoTimestamps*)(extra_bi_region.start + extra_bi_offset);
+    bi_timestamps->header.id = SEL4_BOOTINFO_HEADER_BOOT_TIMESTAMPS;
+    bi_timestamps->header.len = sizeof(seL4_BootInfoTimestamps);
+    memcpy(bi_timestamps->cycles, boot_timestamps, sizeof(boot_timestamps));
+    extra_bi_offset += sizeof(seL4_BootInfoTimestamps);
+
+    /* provide a chunk for any leftover padding in the extended boot info */
+    padding_header.id = SEL4_BOOTINFO_HEADER_PADDING;
+    padding_header.len = (extra_bi_region.end - extra_bi_region.start) - extra_bi_offset;
+    *(seL4_BootInfoHeader*)(extra_bi_region.start + extra_bi_offset) = padding_header;
+
+    return extra_bi_region;
+}
+#endif /* CONFIG_BOOT_TIMESTAMPS */
+
 #ifdef ENABLE_SMP_SUPPORT
 /* sync variable to prevent other nodes from booting
  * until kernel data structures initialized */
@@ -375,6 +461,13 @@ try_init_kernel(
     vptr_t bi_frame_vptr;
     vptr_t ipcbuf_vptr;
     create_frames_of_region_ret_t create_frames_ret;
+#ifdef CONFIG_BOOT_TIMESTAMPS
+    vptr_t extra_bi_frame_vptr;
+    region_t extra_bi_region;
+    create_frames_of_region_ret_t extra_bi_ret;
+#endif
+
+    boot_timestamp(seL4_BootPhaseKernelEntry);
 
     /* convert from physical addresses to userland vptrs */
     v_region_t ui_v_reg;
@@ -388,6 +481,10 @@ try_init_kernel(
     /* The region of the initial thread is the user image + ipcbuf and boot info */
     it_v_reg.start = ui_v_reg.start;
     it_v_reg.end = bi_frame_vptr + BIT(PAGE_BITS);
+#ifdef CONFIG_BOOT_TIMESTAMPS
+    extra_bi_frame_vptr = it_v_reg.end;
+    it_v_reg.end = ROUND_UP(extra_bi_frame_vptr + EXTRA_BI_SIZE, PAGE_BITS);
+#endif
 
     if (it_v_reg.end > kernelBase) {
         printf("Userland image virtual end address too high\n");
@@ -397,10 +494,15 @@ try_init_kernel(
     /* setup virtual memory for the kernel */
     map_kernel_window();
 
+#ifdef CONFIG_BOOT_TIMESTAMPS
+    read_elfloader_timestamps(ui_p_reg_end);
+#endif
+
     /* initialise the CPU */
     if (!init_cpu()) {
         return false;
     }
+    boot_timestamp(seL4_BootPhaseCPUInit);
 
     /* debug output via serial port is only available from here */
     printf("Bootstrapping kernel\n");
@@ -434,6 +536,13 @@ try_init_kernel(
         return false;
     }
 
+#ifdef CONFIG_BOOT_TIMESTAMPS
+    extra_bi_region = populate_extra_bi();
+    if (extra_bi_region.start == 0) {
+        return false;
+    }
+#endif
+
     if (config_set(CONFIG_ARM_SMMU)) {
         ndks_boot.bi_frame->ioSpaceCaps = create_iospace_caps(root_cnode_cap);
         if (ndks_boot.bi_frame->ioSpaceCaps.start == 0 &&
@@ -459,6 +568,22 @@ try_init_kernel(
         bi_frame_vptr
     );
 
+#ifdef CONFIG_BOOT_TIMESTAMPS
+    /* create and map extra bootinfo region */
+    extra_bi_ret =
+        create_frames_of_region(
+            root_cnode_cap,
+            it_pd_cap,
+            extra_bi_region,
+            true,
+            pptr_to_paddr((void*)(extra_bi_region.start - extra_bi_frame_vptr))
+        );
+    if (!extra_bi_ret.success) {
+        return false;
+    }
+    ndks_boot.bi_frame->extraBIPages = extra_bi_ret.region;
+#endif
+
     /* create the initial thread's IPC buffer */
     ipcbuf_cap = create_ipcbuf_frame(root_cnode_cap, it_pd_cap, ipcbuf_vptr);
     if (cap_get_capType(ipcbuf_cap) == cap_null_cap) {
@@ -478,6 +603,7 @@ try_init_kernel(
         return false;
     }
     ndks_boot.bi_frame->userImageFrames = create_frames_ret.region;
+    boot_timestamp(seL4_BootPhaseUserImage);
 
     /* create/initialise the initial thread's ASID pool */
     it_ap_cap = create_it_asid_pool(root_cnode_cap);
@@ -522,6 +648,7 @@ try_init_kernel(
             )) {
         return false;
     }
+    boot_timestamp(seL4_BootPhaseUntypeds);
 
     /* no shared-frame caps (ARM has no multikernel support) */
     ndks_boot.bi_frame->sharedFrames = S_REG_EMPTY;
@@ -544,11 +671,13 @@ try_init_kernel(
     /* initialize BKL before booting up other cores */
     SMP_COND_STATEMENT(clh_lock_init());
     SMP_COND_STATEMENT(release_secondary_cpus());
+    boot_timestamp(seL4_BootPhaseNodesStarted);
 
     /* grab BKL before leaving the kernel */
     NODE_LOCK_SYS;
 
     printf("Booting all finished, dropped to user space\n");
+    boot_timestamp(seL4_BootPhaseKernelExit);
 
     /* kernel successfully initialized */
     return true;
@@ -439,8 +439,11 @@ create_it_page_directory_cap(cap_t vspace_cap, pptr_t pptr, vptr_t vptr, asid_t
 /* Create an address space for the initial thread.
  * This includes page directory and page tables */
 BOOT_CODE cap_t
-create_it_address_space(cap_t root_cnode_cap, v_region_t it_v_reg)
+create_it_address_space(cap_t root_cnode_cap, v_region_t it_v_reg, v_region_t large_v_reg)
 {
+    /* the user image is only mapped with large frames on x86_64 */
+    assert(large_v_reg.start == large_v_reg.end);
+
     cap_t      vspace_cap;
     vptr_t     vptr;
     pptr_t     pptr;
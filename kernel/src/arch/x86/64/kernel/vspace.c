@@ -551,6 +551,23 @@ map_it_frame_cap(cap_t pd_cap, cap_t frame_cap)
     assert(pdpte_pdpte_pd_ptr_get_present(pdpt));
     pd = paddr_to_pptr(pdpte_pdpte_pd_ptr_get_pd_base_address(pdpt));
     pd += GET_PD_INDEX(vptr);
+    if (cap_frame_cap_get_capFSize(frame_cap) == X86_LargePage) {
+        assert(!pde_pde_pt_ptr_get_present(pd));
+        *pd = pde_pde_large_new(
+                  0,                      /* xd                   */
+                  pptr_to_paddr(pptr),    /* page_base_address    */
+                  0,                      /* pat                  */
+                  0,                      /* global               */
+                  0,                      /* dirty                */
+                  0,                      /* accessed             */
+                  0,                      /* cache_disabled       */
+                  0,                      /* write_through        */
+                  1,                      /* super_user           */
+                  1,                      /* read_write           */
+                  1                       /* present              */
+              );
+        return;
+    }
     assert(pde_pde_pt_ptr_get_present(pd));
     pt = paddr_to_pptr(pde_pde_pt_ptr_get_pt_base_address(pd));
     *(pt + GET_PT_INDEX(vptr)) = pte_new(
@@ -694,7 +711,7 @@ create_it_pt_cap(cap_t vspace_cap, pptr_t pptr, vptr_t vptr, asid_t asid)
 }
 
 BOOT_CODE cap_t
-create_it_address_space(cap_t root_cnode_cap, v_region_t it_v_reg)
+create_it_address_space(cap_t root_cnode_cap, v_region_t it_v_reg, v_region_t large_v_reg)
 {
     cap_t      vspace_cap;
     vptr_t     vptr;
@@ -751,10 +768,14 @@ create_it_address_space(cap_t root_cnode_cap, v_region_t it_v_reg)
         }
     }
 
-    /* Create any PTs needed for the user land image */
+    /* Create any PTs needed for the user land image, except where it will be
+     * mapped with large frames */
     for (vptr = ROUND_DOWN(it_v_reg.start, PD_INDEX_OFFSET);
             vptr < it_v_reg.end;
             vptr += BIT(PD_INDEX_OFFSET)) {
+        if (vptr >= large_v_reg.start && vptr < large_v_reg.end) {
+            continue;
+        }
         pptr = alloc_region(seL4_PageTableBits);
         if (!pptr) {
             return cap_null_cap_new();
@@ -110,6 +110,15 @@ config_option(KernelHugePage HUGE_PAGE
     DEFAULT ON
     DEPENDS "KernelSel4ArchX86_64" DEFAULT_DISABLED OFF
 )
+config_option(KernelRootserverLargePages ROOTSERVER_LARGE_PAGES
+    "Map the initial thread's image with large frames wherever its virtual and \
+    physical addresses allow. This reduces the number of frame and page table \
+    objects created at boot for large images. The initial thread must then not \
+    assume that userImageFrames are all 4K frames, or that userImagePaging holds \
+    a page table for every 2M of the image."
+    DEFAULT OFF
+    DEPENDS "KernelSel4ArchX86_64;NOT KernelVerificationBuild" DEFAULT_DISABLED OFF
+)
 config_option(KernelSupportPCID SUPPORT_PCID
     "Add support for PCIDs (aka hardware ASIDs). Not all processor models support this feature."
     DEFAULT ON
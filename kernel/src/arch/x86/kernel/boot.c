@@ -239,6 +239,56 @@ init_freemem(p_region_t ui_p_reg, mem_p_regs_t mem_p_regs)
     }
 }
 
+#ifdef CONFIG_BOOT_TIMESTAMPS
+/* Timestamps are kept here until the extra bootinfo has been allocated, and
+ * written straight to it after that. The boot data is handed out as untyped
+ * memory along with the rest of the boot code */
+static uint64_t boot_timestamps[seL4_NumBootPhases] BOOT_DATA;
+static seL4_BootInfoTimestamps *bi_timestamps BOOT_DATA;
+
+BOOT_CODE void
+boot_timestamp(word_t phase)
+{
+    if (bi_timestamps) {
+        bi_timestamps->cycles[phase] = x86_rdtsc();
+    } else {
+        boot_timestamps[phase] = x86_rdtsc();
+    }
+}
+#endif
+
+#ifdef CONFIG_ROOTSERVER_LARGE_PAGES
+/* Create and map the frames of the user image, using large frames for the
+ * part of it in large_v_reg. The caps are provided in order of virtual address */
+BOOT_CODE static create_frames_of_region_ret_t
+create_it_image_frames(
+    cap_t      root_cnode_cap,
+    cap_t      vspace_cap,
+    region_t   reg,
+    sword_t    pv_offset,
+    v_region_t large_v_reg
+)
+{
+    seL4_SlotPos slot_pos_before = ndks_boot.slot_pos_cur;
+    pptr_t f = reg.start;
+
+    while (f < reg.end) {
+        vptr_t vptr = pptr_to_paddr((void*)f) - pv_offset;
+        bool_t use_large = vptr >= large_v_reg.start && vptr < large_v_reg.end;
+        cap_t frame_cap = create_mapped_it_frame_cap(vspace_cap, f, vptr, IT_ASID, use_large, true);
+        if (!provide_cap(root_cnode_cap, frame_cap))
+            return (create_frames_of_region_ret_t) {
+            S_REG_EMPTY, false
+        };
+        f += use_large ? BIT(seL4_LargePageBits) : BIT(PAGE_BITS);
+    }
+
+    return (create_frames_of_region_ret_t) {
+        (seL4_SlotRegion) { slot_pos_before, ndks_boot.slot_pos_cur }, true
+    };
+}
+#endif
+
 /* This function initialises a node's kernel state. It does NOT initialise the CPU. */
 
 BOOT_CODE bool_t
@@ -279,9 +329,20 @@ init_sys_state(
     /* convert from physical addresses to userland vptrs */
     v_region_t ui_v_reg;
     v_region_t it_v_reg;
+    v_region_t large_v_reg = { .start = 0, .end = 0 };
     ui_v_reg.start = ui_info.p_reg.start - ui_info.pv_offset;
     ui_v_reg.end   = ui_info.p_reg.end   - ui_info.pv_offset;
 
+#ifdef CONFIG_ROOTSERVER_LARGE_PAGES
+    /* large frames can only back the parts of the user image whose virtual
+     * and physical addresses line up */
+    if (IS_ALIGNED(ui_info.pv_offset, seL4_LargePageBits) &&
+            ROUND_UP(ui_v_reg.start, seL4_LargePageBits) < ROUND_DOWN(ui_v_reg.end, seL4_LargePageBits)) {
+        large_v_reg.start = ROUND_UP(ui_v_reg.start, seL4_LargePageBits);
+        large_v_reg.end = ROUND_DOWN(ui_v_reg.end, seL4_LargePageBits);
+    }
+#endif
+
     ipcbuf_vptr = ui_v_reg.end;
     bi_frame_vptr = ipcbuf_vptr + BIT(PAGE_BITS);
     extra_bi_frame_vptr = bi_frame_vptr + BIT(PAGE_BITS);
@@ -302,6 +363,10 @@ init_sys_state(
     // room for tsc frequency
     extra_bi_size += sizeof(seL4_BootInfoHeader) + 4;
 
+#ifdef CONFIG_BOOT_TIMESTAMPS
+    extra_bi_size += sizeof(seL4_BootInfoTimestamps);
+#endif
+
     /* The region of the initial thread is the user image + ipcbuf and boot info */
     it_v_reg.start = ui_v_reg.start;
     it_v_reg.end = ROUND_UP(extra_bi_frame_vptr + extra_bi_size, PAGE_BITS);
@@ -388,6 +453,15 @@ init_sys_state(
         extra_bi_offset += 4;
     }
 
+#ifdef CONFIG_BOOT_TIMESTAMPS
+    /* populate boot timestamps block. Later phases are filled in as they happen */
+    bi_timestamps = (seL4_BootInfoTimestamps*)(extra_bi_region.start + extra_bi_offset);
+    bi_timestamps->header.id = SEL4_BOOTINFO_HEADER_BOOT_TIMESTAMPS;
+    bi_timestamps->header.len = sizeof(seL4_BootInfoTimestamps);
+    memcpy(bi_timestamps->cycles, boot_timestamps, sizeof(boot_timestamps));
+    extra_bi_offset += sizeof(seL4_BootInfoTimestamps);
+#endif
+
     /* provde a chunk for any leftover padding in the extended boot info */
     seL4_BootInfoHeader padding_header;
     padding_header.id = SEL4_BOOTINFO_HEADER_PADDING;
@@ -396,7 +470,7 @@ init_sys_state(
 
     /* Construct an initial address space with enough virtual addresses
      * to cover the user image + ipc buffer and bootinfo frames */
-    it_vspace_cap = create_it_address_space(root_cnode_cap, it_v_reg);
+    it_vspace_cap = create_it_address_space(root_cnode_cap, it_v_reg, large_v_reg);
     if (cap_get_capType(it_vspace_cap) == cap_null_cap) {
         return false;
     }
@@ -430,6 +504,16 @@ init_sys_state(
     }
 
     /* create all userland image frames */
+#ifdef CONFIG_ROOTSERVER_LARGE_PAGES
+    create_frames_ret =
+        create_it_image_frames(
+            root_cnode_cap,
+            it_vspace_cap,
+            ui_reg,
+            ui_info.pv_offset,
+            large_v_reg
+        );
+#else
     create_frames_ret =
         create_frames_of_region(
             root_cnode_cap,
@@ -438,10 +522,12 @@ init_sys_state(
             true,
             ui_info.pv_offset
         );
+#endif
     if (!create_frames_ret.success) {
         return false;
     }
     ndks_boot.bi_frame->userImageFrames = create_frames_ret.region;
+    boot_timestamp(seL4_BootPhaseUserImage);
 
     /* create the initial thread's ASID pool */
     it_ap_cap = create_it_asid_pool(root_cnode_cap);
@@ -487,6 +573,7 @@ init_sys_state(
         return false;
     }
     /* WARNING: alloc_region() must not be called anymore after here! */
+    boot_timestamp(seL4_BootPhaseUntypeds);
 
     /* finalise the bootinfo frame */
     bi_finalise();
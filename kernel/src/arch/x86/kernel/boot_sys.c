@@ -225,6 +225,7 @@ try_boot_sys_node(cpu_id_t cpu_id)
     if (!init_cpu(config_set(CONFIG_IRQ_IOAPIC) ? 1 : 0)) {
         return false;
     }
+    boot_timestamp(seL4_BootPhaseCPUInit);
 
     /* initialise NDKS and kernel heap */
     if (!init_sys_state(
@@ -519,6 +520,19 @@ try_boot_sys(void)
 
     /* calculate final location of userland images */
     ui_p_regs.start = boot_state.ki_p_reg.end;
+#ifdef CONFIG_ROOTSERVER_LARGE_PAGES
+    {
+        /* Leave a gap after the kernel so that the image can be mapped with
+         * large frames. The gap is not made available as untyped memory, and
+         * is only left if the image still moves down */
+        vptr_t ui_v_start = boot_state.ui_info.p_reg.start - boot_state.ui_info.pv_offset;
+        paddr_t ui_p_start = ui_p_regs.start + (boot_state.ui_info.p_reg.start - mods_end_paddr);
+        paddr_t aligned = ui_p_regs.start + ((ui_v_start - ui_p_start) & MASK(seL4_LargePageBits));
+        if (aligned <= mods_end_paddr) {
+            ui_p_regs.start = aligned;
+        }
+    }
+#endif
     ui_p_regs.end = ui_p_regs.start + load_paddr - mods_end_paddr;
 
     printf(
@@ -533,6 +547,7 @@ try_boot_sys(void)
     boot_state.ui_info.p_reg.start -= mods_end_paddr - ui_p_regs.start;
     boot_state.ui_info.p_reg.end   -= mods_end_paddr - ui_p_regs.start;
     boot_state.ui_info.pv_offset   -= mods_end_paddr - ui_p_regs.start;
+    boot_timestamp(seL4_BootPhaseImageLoad);
 
     /* ==== following code corresponds to abstract specification after "select" ==== */
 
@@ -555,6 +570,7 @@ try_boot_sys(void)
     /* initialize BKL before booting up APs */
     SMP_COND_STATEMENT(clh_lock_init());
     SMP_COND_STATEMENT(start_boot_aps());
+    boot_timestamp(seL4_BootPhaseNodesStarted);
 
     /* grab BKL before leaving the kernel */
     NODE_LOCK_SYS;
@@ -769,6 +785,8 @@ boot_sys(
 {
     bool_t result = false;
 
+    boot_timestamp(seL4_BootPhaseKernelEntry);
+
     if (multiboot_magic == MULTIBOOT_MAGIC) {
         result = try_boot_sys_mbi1(mbi);
     } else if (multiboot_magic == MULTIBOOT2_MAGIC) {
@@ -788,6 +806,8 @@ boot_sys(
     ARCH_NODE_STATE(x86KScurInterrupt) = int_invalid;
     ARCH_NODE_STATE(x86KSPendingInterrupt) = int_invalid;
 
+    boot_timestamp(seL4_BootPhaseKernelExit);
+
     schedule();
     activateThread();
 }
@@ -18,12 +18,13 @@
 module CapDL.PrintC where
 
 import CapDL.Model
-import CapDL.PrintUtils (sortObjects)
+import CapDL.PrintUtils (sortObjects, sizeOf, objPaddr)
+import CapDL.State (koType)
 
 import Control.Exception (assert)
 import Data.List.Compat
 import Data.List.Utils
-import Data.Maybe (fromJust, fromMaybe, mapMaybe)
+import Data.Maybe (fromJust, fromMaybe, mapMaybe, isJust)
 import Prelude ()
 import Prelude.Compat
 import Data.Map as Map
@@ -379,6 +380,41 @@ extraFrameInfos obj_ids objs =
     where
         frameinfo = showFrameInfos obj_ids objs
 
+-- Objects that the loader can create together with a single retype: they
+-- must agree on type and size and not be placed at a physical address.
+allocKey :: Arch -> KernelObject Word -> Maybe (KOType, Word, Maybe Word)
+allocKey arch obj
+    | isJust (objPaddr obj) = Nothing
+    | notCreated obj = Nothing
+    | otherwise = Just (koType obj, sizeOf arch obj, sizeBitsOf obj)
+    where
+        sizeBitsOf (SC _ sz) = sz
+        sizeBitsOf (Untyped sz _) = sz
+        sizeBitsOf _ = Nothing
+        -- The objects create_objects in the loader skips, which are set up
+        -- along with their IRQ or IO space caps instead
+        notCreated (CNode _ 0) = True
+        notCreated (IOAPICIrq {}) = True
+        notCreated (MSIIrq {}) = True
+        notCreated (IODevice {}) = True
+        notCreated (ARMIODevice {}) = True
+        notCreated _ = False
+
+-- Emit the allocation plan: the runs of consecutive objects, in the final
+-- object order, that share an allocation key. The loader retypes each run
+-- with as few invocations as the untypeds it finds at boot allow.
+memberAllocRuns :: Arch -> [(ObjID, KernelObject Word)] -> String
+memberAllocRuns arch objs =
+    ".num_alloc_runs = " ++ show (length runs) ++ "," +++
+    ".alloc_runs = (CDL_AllocRun[]){" +++
+    join ", " [showRun r | r <- runs] +++
+    "},"
+    where
+        keyed = zip [0 :: Int ..] [allocKey arch obj | (_, obj) <- objs]
+        runs = [(fst (head g), length g) | g <- groupBy (\a b -> snd a == snd b) keyed,
+                                           isJust (snd (head g)), length g > 1]
+        showRun (first, count) = "{.first = " ++ show first ++ ", .count = " ++ show count ++ "}"
+
 printC :: Model Word -> Idents CapName -> CopyMap -> Doc
 printC (Model arch objs irqNode cdt _) _ _ =
     text $
@@ -398,6 +434,7 @@ printC (Model arch objs irqNode cdt _) _ _ =
     memberIRQs obj_ids irqNode arch +++
     memberObjects obj_ids arch objs' irqNode cdt objs +++
     extraFrameInfos obj_ids objs' +++
+    memberAllocRuns arch objs' +++
     "};"
     where
         objs_sz = length $ Map.toList objs
@@ -12,6 +12,10 @@
 
 cmake_minimum_required(VERSION 3.7.2)
 
+# Tool for compressing ELF images before they are placed in the archive
+set(CAPDL_COMPRESS_TOOL "${CMAKE_CURRENT_LIST_DIR}/../python-capdl-tool/capdl/Compress.py"
+    CACHE INTERNAL "")
+
 function(BuildCapDLApplication)
     cmake_parse_arguments(PARSE_ARGV 0 CAPDL_BUILD_APP "" "C_SPEC;OUTPUT" "ELF;DEPENDS")
     if (NOT "${CAPDL_BUILD_APP_UNPARSED_ARGUMENTS}" STREQUAL "")
@@ -24,8 +28,26 @@ function(BuildCapDLApplication)
     if ("${CAPDL_BUILD_APP_OUTPUT}" STREQUAL "")
         message(FATAL_ERROR "OUTPUT is required argument to BuildCapDLApplication")
     endif()
+    set(elf_files "${CAPDL_BUILD_APP_ELF}")
+    if (CapDLLoaderCompressImages)
+        # The archive is built from file basenames, so compressed images
+        # keep their names and are placed in their own directory
+        set(elf_files "")
+        foreach(elf IN LISTS CAPDL_BUILD_APP_ELF)
+            get_filename_component(elf_name "${elf}" NAME)
+            set(compressed "${CMAKE_CURRENT_BINARY_DIR}/compressed/${elf_name}")
+            add_custom_command(OUTPUT "${compressed}"
+                COMMAND ${CMAKE_COMMAND} -E make_directory "${CMAKE_CURRENT_BINARY_DIR}/compressed"
+                COMMAND "${PYTHON}" "${CAPDL_COMPRESS_TOOL}" "${elf}" "${compressed}"
+                DEPENDS "${elf}" "${CAPDL_COMPRESS_TOOL}"
+                VERBATIM
+                COMMENT "Compress ${elf_name} for the capDL loader"
+            )
+            list(APPEND elf_files "${compressed}")
+        endforeach()
+    endif()
     # Build a CPIO archive out of the provided ELF files
-    MakeCPIO(archive.o "${CAPDL_BUILD_APP_ELF}"
+    MakeCPIO(archive.o "${elf_files}"
         CPIO_SYMBOL _capdl_archive
     )
     # Build the application
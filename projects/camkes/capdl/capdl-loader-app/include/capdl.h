@@ -263,6 +263,13 @@ typedef struct {
     char *extra_information;
 } PACKED CDL_FrameFill;
 
+/* AllocRun: a run of consecutive objects of identical type and size that
+ * can be created with a single multi-object retype */
+typedef struct {
+    CDL_ObjID first;
+    seL4_Word count;
+} CDL_AllocRun;
+
 /* CapDLModel: is described by a map from ObjectIDs (array index) to Objects */
 typedef struct {
 
@@ -270,6 +277,8 @@ typedef struct {
     CDL_Object *objects;
     seL4_Word num_frame_fill;
     CDL_FrameFill *frame_fill;
+    seL4_Word num_alloc_runs;
+    CDL_AllocRun *alloc_runs;
 
     CDL_ObjID irqs[CONFIG_CAPDL_LOADER_MAX_IRQS];
 } CDL_Model;
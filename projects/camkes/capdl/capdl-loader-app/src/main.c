@@ -17,6 +17,7 @@
 #include <limits.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <elf/elf.h>
@@ -25,11 +26,17 @@
 #include <simple-default/simple-default.h>
 
 #include <vka/kobject_t.h>
+#include <vka/object.h>
 #include <utils/util.h>
 #include <sel4/sel4.h>
 #include <sel4utils/sel4_zf_logif.h>
+#include <sel4utils/helpers.h>
 #include "capdl.h"
 
+#if defined(CONFIG_CAPDL_LOADER_BOOT_REPORT) && defined(CONFIG_ARCH_X86)
+#include <sel4utils/arch/tsc.h>
+#endif
+
 #include "capdl_spec.h"
 
 #define PML4_SLOT(vaddr) ((vaddr >> (seL4_PDPTIndexBits + seL4_PageDirIndexBits + seL4_PageTableIndexBits + seL4_PageBits)) & MASK(seL4_PML4IndexBits))
@@ -39,6 +46,10 @@
 
 #define CAPDL_SHARED_FRAMES
 
+#if defined(CONFIG_CAPDL_LOADER_PARALLEL_LOAD) && CONFIG_MAX_NUM_NODES > 1 && !defined(CONFIG_KERNEL_RT)
+#define CAPDL_PARALLEL_LOAD
+#endif
+
 #define STACK_ALIGNMENT_BYTES 16
 
 static seL4_CPtr capdl_to_sel4_orig[CONFIG_CAPDL_LOADER_MAX_OBJECTS];
@@ -70,8 +81,10 @@ extern char _end[];
  * 1 frame for bootinfo, and on some platforms an additional 1
  * frame of bootinfo. So we skip three frames and then round up
  * to the next 16mb alignment where we can map in a pagetable.
+ * COPY_WINDOW_SIZE must fit the largest frame that is loaded.
  */
-#define copy_addr ( ROUND_UP(((uintptr_t)_end) + (PAGE_SIZE_4K * 3), 0x1000000))
+#define COPY_WINDOW_SIZE 0x1000000
+#define copy_addr ( ROUND_UP(((uintptr_t)_end) + (PAGE_SIZE_4K * 3), COPY_WINDOW_SIZE))
 
 /* In the case where we just want a 4K page and we cannot allocate
  * a page table ourselves, we use this pre allocated region that
@@ -257,16 +270,13 @@ get_frame_size(CDL_ObjID pd, uintptr_t vaddr, CDL_Model *spec)
     return BIT(CDL_Obj_SizeBits(&spec->objects[CDL_Cap_ObjID(get_cdl_frame_cap(pd, vaddr, spec))]));
 }
 
-void init_copy_frame(seL4_BootInfo *bootinfo)
+/* Find the frame cap that backs a page of the loader's own image. We
+ * locate the frame cap by looking in boot info and knowing that the
+ * userImageFrames are ordered by virtual address in our address space.
+ */
+static seL4_CPtr
+get_user_image_frame(seL4_BootInfo *bootinfo, void *vaddr)
 {
-    /* An original frame will be mapped, backing copy_addr_with_pt. For
-     * correctness we should unmap this before mapping into this
-     * address. We locate the frame cap by looking in boot info
-     * and knowing that the userImageFrames are ordered by virtual
-     * address in our address space. The flush is probably not
-     * required, but doesn't hurt to be cautious.
-     */
-
     /* Find the number of frames in the user image according to
      * bootinfo, and compare that to the number of frames backing
      * the image computed by comparing start and end symbols. If
@@ -280,7 +290,7 @@ void init_copy_frame(seL4_BootInfo *bootinfo)
 
     if (num_user_image_frames_reported < num_user_image_frames_measured) {
         ZF_LOGE("Too few frames caps in bootinfo to back user image");
-        return;
+        return seL4_CapNull;
     }
 
     size_t additional_user_image_bytes =
@@ -288,15 +298,29 @@ void init_copy_frame(seL4_BootInfo *bootinfo)
 
     if (additional_user_image_bytes > (uintptr_t)&__executable_start) {
         ZF_LOGE("User image padding too high to fit before start symbol");
-        return;
+        return seL4_CapNull;
     }
 
     uintptr_t lowest_mapped_vaddr =
         (uintptr_t)&__executable_start - additional_user_image_bytes;
 
-    seL4_CPtr copy_addr_frame = bootinfo->userImageFrames.start +
-                                ((uintptr_t)copy_addr_with_pt) / PAGE_SIZE_4K -
-                                lowest_mapped_vaddr / PAGE_SIZE_4K;
+    return bootinfo->userImageFrames.start +
+           ((uintptr_t)vaddr) / PAGE_SIZE_4K -
+           lowest_mapped_vaddr / PAGE_SIZE_4K;
+}
+
+void init_copy_frame(seL4_BootInfo *bootinfo)
+{
+    /* An original frame will be mapped, backing copy_addr_with_pt. For
+     * correctness we should unmap this before mapping into this
+     * address. The flush is probably not required, but doesn't hurt
+     * to be cautious.
+     */
+    seL4_CPtr copy_addr_frame = get_user_image_frame(bootinfo, copy_addr_with_pt);
+    if (copy_addr_frame == seL4_CapNull) {
+        return;
+    }
+
     /* We currently will assume that we are on a 32-bit platform
      * that has a single PD, followed by all the PTs. So to find
      * our PT in the paging objects list we just need to add 1
@@ -325,9 +349,210 @@ void init_copy_frame(seL4_BootInfo *bootinfo)
     }
 }
 
+/* ELF images in the archive may be compressed by python-capdl-tool's
+ * Compress.py. The ELF and program headers are kept as is, and the file
+ * contents of each loadable segment are stored as blocks split at 4K virtual
+ * address boundaries. See Compress.py for the layout.
+ */
+#define COMPRESSED_ELF_MAGIC "CDLZ"
+#define COMPRESSED_BLOCK_SIZE PAGE_SIZE_4K
+
+enum {
+    COMPRESSED_BLOCK_ZERO = 0,
+    COMPRESSED_BLOCK_RAW,
+    COMPRESSED_BLOCK_LZ4,
+    COMPRESSED_BLOCK_DUPLICATE,
+};
+
+#define COMPRESSED_BLOCK_KIND(info) ((info) >> 30)
+#define COMPRESSED_BLOCK_VALUE(info) ((info) & MASK(30))
+
+typedef struct {
+    char magic[4];
+    uint32_t elf_header_size;
+    uint32_t segments_offset;
+    uint32_t blocks_offset;
+} compressed_elf_t;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t info;
+} compressed_block_t;
+
+static compressed_elf_t *
+get_compressed_elf(void *file, unsigned long size)
+{
+    if (size < sizeof(compressed_elf_t) || memcmp(file, COMPRESSED_ELF_MAGIC, 4) != 0) {
+        return NULL;
+    }
+    return file;
+}
+
+static uint32_t
+compressed_segment_first_block(compressed_elf_t *image, int segment)
+{
+    return ((uint32_t *)((uintptr_t) image + image->segments_offset))[segment];
+}
+
+static compressed_block_t *
+compressed_block(compressed_elf_t *image, uint32_t index)
+{
+    uintptr_t blocks = (uintptr_t) image + image->blocks_offset;
+    ZF_LOGF_IF(index >= *(uint32_t *) blocks, "Compressed ELF block %u out of range", index);
+    return &((compressed_block_t *)(blocks + sizeof(uint32_t)))[index];
+}
+
+/* Decode an LZ4 block, returning the number of bytes produced or 0 if the
+ * block is malformed or does not fit in dst. */
+static size_t
+lz4_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + src_len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_len;
+
+    while (ip < iend) {
+        unsigned int token = *ip++;
+
+        size_t length = token >> 4;
+        if (length == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return 0;
+                }
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        if (length > (size_t)(iend - ip) || length > (size_t)(oend - op)) {
+            return 0;
+        }
+        memcpy(op, ip, length);
+        op += length;
+        ip += length;
+
+        /* The last sequence has only literals */
+        if (ip >= iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return 0;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return 0;
+        }
+
+        length = token & 15;
+        if (length == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return 0;
+                }
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        length += 4;
+        if (length > (size_t)(oend - op)) {
+            return 0;
+        }
+        /* Matches may overlap the bytes they produce, so copy forwards */
+        const uint8_t *match = op - offset;
+        while (length-- > 0) {
+            *op++ = *match++;
+        }
+    }
+    return op - dst;
+}
+
+/* Decode a block into dest. Zero blocks are skipped, as the frames being
+ * filled have just been created and are already zero. */
+static void
+decode_compressed_block(compressed_elf_t *image, uint32_t index, void *dest, size_t len)
+{
+    compressed_block_t *block = compressed_block(image, index);
+    uint32_t value = COMPRESSED_BLOCK_VALUE(block->info);
+    const uint8_t *data = (const uint8_t *)((uintptr_t) image + block->offset);
+
+    switch (COMPRESSED_BLOCK_KIND(block->info)) {
+    case COMPRESSED_BLOCK_ZERO:
+        break;
+    case COMPRESSED_BLOCK_RAW:
+        ZF_LOGF_IF(value != len, "Compressed ELF block %u has size %u, expected %zu", index, value, len);
+        memcpy(dest, data, len);
+        break;
+    case COMPRESSED_BLOCK_LZ4:
+        if (lz4_decompress(data, value, dest, len) != len) {
+            ZF_LOGF("Failed to decompress ELF block %u", index);
+        }
+        break;
+    case COMPRESSED_BLOCK_DUPLICATE:
+        ZF_LOGF_IF(value >= index, "Compressed ELF block %u duplicates later block %u", index, value);
+        decode_compressed_block(image, value, dest, len);
+        break;
+    }
+}
+
+/* Index of the compressed block holding vaddr of a segment */
+static uint32_t
+compressed_block_index(compressed_elf_t *image, int segment, uintptr_t seg_vaddr, uintptr_t vaddr)
+{
+    return compressed_segment_first_block(image, segment) +
+           (ROUND_DOWN(vaddr, COMPRESSED_BLOCK_SIZE) - ROUND_DOWN(seg_vaddr, COMPRESSED_BLOCK_SIZE)) /
+           COMPRESSED_BLOCK_SIZE;
+}
+
+/* Whether [vaddr, vaddr + len) of a segment of a compressed image holds
+ * anything other than zeros. This is read from the block table, so it costs
+ * nothing compared to decompressing the range. */
+static bool
+elf_range_has_data(compressed_elf_t *image, int segment, uintptr_t seg_vaddr,
+                   uintptr_t vaddr, size_t len)
+{
+    for (uintptr_t v = vaddr; v < vaddr + len; v = ROUND_DOWN(v, COMPRESSED_BLOCK_SIZE) + COMPRESSED_BLOCK_SIZE) {
+        uint32_t index = compressed_block_index(image, segment, seg_vaddr, v);
+        if (COMPRESSED_BLOCK_KIND(compressed_block(image, index)->info) != COMPRESSED_BLOCK_ZERO) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Copy [vaddr, vaddr + len) of a segment to dest */
+static void
+elf_copy_range(compressed_elf_t *image, int segment, uintptr_t seg_vaddr, const char *src,
+               uintptr_t vaddr, size_t len, char *dest)
+{
+    if (image == NULL) {
+        memcpy(dest, src + vaddr - seg_vaddr, len);
+        return;
+    }
+
+    uintptr_t v = vaddr;
+    while (v < vaddr + len) {
+        uintptr_t end = MIN(ROUND_DOWN(v, COMPRESSED_BLOCK_SIZE) + COMPRESSED_BLOCK_SIZE, vaddr + len);
+        decode_compressed_block(image, compressed_block_index(image, segment, seg_vaddr, v),
+                                dest + v - vaddr, end - v);
+        v = end;
+    }
+}
+
+/* Load the ELF segments of elf_name into the frames of pd.
+ *
+ * Frames are temporarily mapped at window, which must be aligned to the
+ * largest frame size. If scratch_slot is not 0, a copy of each frame cap is
+ * made in it and mapped instead of the original, so that concurrent loaders
+ * never contend on the mapping of a frame shared between vspaces.
+ */
 static void
 elf_load_frames(const char *elf_name, CDL_ObjID pd, CDL_Model *spec,
-                seL4_BootInfo *bootinfo)
+                seL4_BootInfo *bootinfo, uintptr_t window, seL4_CPtr scratch_slot)
 {
     unsigned long elf_size;
     void *elf_file = cpio_get_file(_capdl_archive, elf_name, &elf_size);
@@ -336,6 +561,11 @@ elf_load_frames(const char *elf_name, CDL_ObjID pd, CDL_Model *spec,
         ZF_LOGF("ELF file %s not found", elf_name);
     }
 
+    compressed_elf_t *image = get_compressed_elf(elf_file, elf_size);
+    if (image != NULL) {
+        elf_file = image + 1;
+    }
+
     if (elf_checkFile(elf_file) != 0) {
         ZF_LOGF("Unable to read elf file %s at %p", elf_name, elf_file);
     }
@@ -347,7 +577,7 @@ elf_load_frames(const char *elf_name, CDL_ObjID pd, CDL_Model *spec,
 
         size_t f_len = elf_getProgramHeaderFileSize(elf_file, i);
         uintptr_t dest = elf_getProgramHeaderVaddr(elf_file, i);
-        uintptr_t src = (uintptr_t) elf_file + elf_getProgramHeaderOffset(elf_file, i);
+        const char *src = image != NULL ? NULL : (char *) elf_file + elf_getProgramHeaderOffset(elf_file, i);
 
         //Skip non loadable headers
         if (elf_getProgramHeaderType(elf_file, i) != PT_LOAD) {
@@ -359,23 +589,48 @@ elf_load_frames(const char *elf_name, CDL_ObjID pd, CDL_Model *spec,
         while (vaddr < dest + f_len) {
             ZF_LOGD(".");
 
-            /* map frame into the loader's address space so we can write to it */
             seL4_CPtr sel4_page = get_frame_cap(pd, vaddr, spec);
             seL4_CPtr sel4_page_pt = get_frame_pt(pd, vaddr, spec);
             size_t sel4_page_size = get_frame_size(pd, vaddr, spec);
+            ZF_LOGF_IF(sel4_page_size > COPY_WINDOW_SIZE, "Frame at %p is larger than the copy window",
+                       (void*)vaddr);
+
+            /* copy until end of section or end of page */
+            size_t len = dest + f_len - vaddr;
+            if (len > sel4_page_size - (vaddr % sel4_page_size)) {
+                len = sel4_page_size - (vaddr % sel4_page_size);
+            }
+
+            /* The frame was zeroed when it was created, so there is no need
+             * to map it if there is nothing but zeros to copy in. Only
+             * compressed images record this; scanning an uncompressed range
+             * would cost as much as copying it */
+            if (image != NULL && !elf_range_has_data(image, i, dest, vaddr, len)) {
+                vaddr += len;
+                continue;
+            }
+
+            /* map frame into the loader's address space so we can write to it */
+            int error;
+            if (scratch_slot != 0) {
+                error = seL4_CNode_Copy(seL4_CapInitThreadCNode, scratch_slot, CONFIG_WORD_SIZE,
+                                        seL4_CapInitThreadCNode, sel4_page, CONFIG_WORD_SIZE, seL4_AllRights);
+                ZF_LOGF_IFERR(error, "");
+                sel4_page = scratch_slot;
+            }
 
             seL4_ARCH_VMAttributes attribs = seL4_ARCH_Default_VMAttributes;
 #ifdef CONFIG_ARCH_ARM
             attribs |= seL4_ARM_ExecuteNever;
 #endif
 
-            int error = seL4_ARCH_Page_Map(sel4_page, seL4_CapInitThreadPD, (seL4_Word)copy_addr,
-                                           seL4_ReadWrite, attribs);
+            error = seL4_ARCH_Page_Map(sel4_page, seL4_CapInitThreadPD, (seL4_Word)window,
+                                       seL4_ReadWrite, attribs);
             if (error == seL4_FailedLookup) {
-                error = seL4_ARCH_PageTable_Map(sel4_page_pt, seL4_CapInitThreadPD, (seL4_Word)copy_addr,
+                error = seL4_ARCH_PageTable_Map(sel4_page_pt, seL4_CapInitThreadPD, (seL4_Word)window,
                                                 seL4_ARCH_Default_VMAttributes);
                 ZF_LOGF_IFERR(error, "");
-                error = seL4_ARCH_Page_Map(sel4_page, seL4_CapInitThreadPD, (seL4_Word)copy_addr,
+                error = seL4_ARCH_Page_Map(sel4_page, seL4_CapInitThreadPD, (seL4_Word)window,
                                            seL4_ReadWrite, attribs);
             }
             if (error) {
@@ -389,16 +644,11 @@ elf_load_frames(const char *elf_name, CDL_ObjID pd, CDL_Model *spec,
                 } else {
                     ZF_LOGD("%p", (void*)addr.paddr);
                 }
-                ZF_LOGD(" -> %p (error = %d)\n", (void*)copy_addr, error);
+                ZF_LOGD(" -> %p (error = %d)\n", (void*)window, error);
                 ZF_LOGF_IFERR(error, "");
             }
 
-            /* copy until end of section or end of page */
-            size_t len = dest + f_len - vaddr;
-            if (len > sel4_page_size - (vaddr % sel4_page_size)) {
-                len = sel4_page_size - (vaddr % sel4_page_size);
-            }
-            memcpy((void *) (copy_addr + vaddr % sel4_page_size), (void *) (src + vaddr - dest), len);
+            elf_copy_range(image, i, dest, src, vaddr, len, (char *)(window + vaddr % sel4_page_size));
 
 #ifdef CONFIG_ARCH_ARM
             error = seL4_ARM_Page_Unify_Instruction(sel4_page, 0, sel4_page_size);
@@ -412,6 +662,11 @@ elf_load_frames(const char *elf_name, CDL_ObjID pd, CDL_Model *spec,
                 ZF_LOGF_IFERR(error, "");
             }
 
+            if (scratch_slot != 0) {
+                error = seL4_CNode_Delete(seL4_CapInitThreadCNode, scratch_slot, CONFIG_WORD_SIZE);
+                ZF_LOGF_IFERR(error, "");
+            }
+
             vaddr += len;
         }
 
@@ -623,30 +878,65 @@ bool isDeviceObject(CDL_Object *obj)
     return (obj->paddr != NULL && (CDL_Obj_Type(obj) == CDL_Frame || CDL_Obj_Type(obj) == CDL_Untyped));
 }
 
-unsigned int
-create_object(CDL_Model *spec, CDL_Object *obj, CDL_ObjID id, seL4_BootInfo *info, seL4_CPtr untyped_slot,
-              unsigned int free_slot)
+static seL4_ArchObjectType
+get_retype_params(CDL_Object *obj, int *obj_size)
 {
-    int obj_size = CDL_Obj_SizeBits(obj);
-    seL4_ArchObjectType obj_type;
+    *obj_size = CDL_Obj_SizeBits(obj);
 
     switch (CDL_Obj_Type(obj)) {
     case CDL_Frame:
-        obj_type = kobject_get_type(KOBJECT_FRAME, obj_size);
-        break;
+        return kobject_get_type(KOBJECT_FRAME, *obj_size);
     case CDL_ASIDPool:
-        obj_type = CDL_Untyped;
-        obj_size = seL4_ASIDPoolBits;
-        break;
+        *obj_size = seL4_ASIDPoolBits;
+        return CDL_Untyped;
 #ifdef CONFIG_KERNEL_RT
     case CDL_SchedContext:
-        obj_size = kobject_get_size(KOBJECT_SCHED_CONTEXT, obj_size);
-        obj_type = (seL4_ArchObjectType) CDL_Obj_Type(obj);
-        break;
+        *obj_size = kobject_get_size(KOBJECT_SCHED_CONTEXT, *obj_size);
+        return (seL4_ArchObjectType) CDL_Obj_Type(obj);
+#endif
+    default:
+        return (seL4_ArchObjectType) CDL_Obj_Type(obj);
+    }
+}
+
+/* Whether creating this object takes memory from a normal untyped */
+static bool
+uses_untyped_memory(CDL_Object *obj)
+{
+#ifdef CONFIG_ARCH_X86
+    if (CDL_Obj_Type(obj) == CDL_IOPorts) {
+        return false;
+    }
 #endif
+    return !isDeviceObject(obj);
+}
+
+/* Whether create_objects leaves this object to be set up along with its IRQ
+ * or IO space caps */
+static bool
+is_created_elsewhere(CDL_Object *obj)
+{
+    switch (CDL_Obj_Type(obj)) {
+    case CDL_Interrupt:
+#ifdef CONFIG_ARCH_X86
+    case CDL_IODevice:
+    case CDL_IOAPICInterrupt:
+    case CDL_MSIInterrupt:
+#else
+    case CDL_ARMIODevice:
+#endif
+        return true;
     default:
-        obj_type = (seL4_ArchObjectType) CDL_Obj_Type(obj);
+        return false;
     }
+}
+
+unsigned int
+create_object(CDL_Model *spec, CDL_Object *obj, CDL_ObjID id, seL4_BootInfo *info, seL4_CPtr untyped_slot,
+              unsigned int free_slot)
+{
+    int obj_size;
+    seL4_ArchObjectType obj_type = get_retype_params(obj, &obj_size);
 
     if (CDL_Obj_Type(obj) == CDL_CNode) {
         ZF_LOGD(" (CNode of size %d bits)", obj_size);
@@ -674,6 +964,55 @@ create_object(CDL_Model *spec, CDL_Object *obj, CDL_ObjID id, seL4_BootInfo *inf
     }
 }
 
+/* Try to create the next objects of an allocation run with a single retype.
+ *
+ * The number of objects that fit is worked out from our own record of how
+ * much of the untyped has been used. If that record disagrees with the
+ * kernel the retype fails with seL4_NotEnoughMemory, and the caller falls
+ * back to creating objects one at a time. Returns the number of objects
+ * created, 0 if the run does not apply here, or -1 if the retype failed.
+ */
+static int
+create_object_run(CDL_Model *spec, CDL_ObjID first, seL4_Word count, seL4_CPtr untyped_slot,
+                  seL4_Word untyped_size_bits, seL4_Word *untyped_used, seL4_CPtr free_slot)
+{
+    CDL_Object *obj = &spec->objects[first];
+
+    /* ASID pools need more than a retype for each object */
+    if (is_created_elsewhere(obj) || !uses_untyped_memory(obj) || CDL_Obj_Type(obj) == CDL_ASIDPool) {
+        return 0;
+    }
+
+    int obj_size;
+    seL4_ArchObjectType obj_type = get_retype_params(obj, &obj_size);
+    seL4_Word size_bits = vka_get_object_size(obj_type, obj_size);
+    if (size_bits == 0 || size_bits > untyped_size_bits) {
+        return 0;
+    }
+
+    seL4_Word start = ROUND_UP(*untyped_used, BIT(size_bits));
+    if (start >= BIT(untyped_size_bits)) {
+        return 0;
+    }
+    seL4_Word n = MIN(count, (BIT(untyped_size_bits) - start) >> size_bits);
+    n = MIN(n, CONFIG_RETYPE_FAN_OUT_LIMIT);
+    if (n < 2) {
+        return 0;
+    }
+
+    int err = seL4_Untyped_Retype(untyped_slot, obj_type, obj_size,
+                                  seL4_CapInitThreadCNode, 0, 0, free_slot, n);
+    if (err != seL4_NoError) {
+        return -1;
+    }
+
+    for (seL4_Word i = 0; i < n; i++) {
+        add_sel4_cap(first + i, ORIG, free_slot + i);
+    }
+    *untyped_used = start + (n << size_bits);
+    return n;
+}
+
 static void
 create_objects(CDL_Model *spec, seL4_BootInfo *bootinfo)
 {
@@ -683,6 +1022,13 @@ create_objects(CDL_Model *spec, seL4_BootInfo *bootinfo)
     unsigned int free_slot_index = 0;
     unsigned int ut_index = 0;
 
+    /* Progress through the precomputed allocation runs, and how much of the
+     * current untyped we believe is in use. Once a retype disagrees with
+     * this the current untyped is only used one object at a time. */
+    unsigned int run_index = 0;
+    seL4_Word ut_used = 0;
+    bool ut_tracked = true;
+
     // Each time through the loop either:
     //  - we successfully create an object, and move to the next object to create
     //    OR
@@ -694,6 +1040,29 @@ create_objects(CDL_Model *spec, seL4_BootInfo *bootinfo)
         seL4_CPtr untyped_cptr = untyped_cptrs[ut_index];
         CDL_Object *obj = &spec->objects[obj_id_index];
         CDL_ObjectType capdl_obj_type = CDL_Obj_Type(obj);
+        seL4_Word ut_size_bits = untyped_cptr == 0 ? 0 :
+                                 bootinfo->untypedList[untyped_cptr - bootinfo->untyped.start].sizeBits;
+
+        while (run_index < spec->num_alloc_runs &&
+               spec->alloc_runs[run_index].first + spec->alloc_runs[run_index].count <= obj_id_index) {
+            run_index++;
+        }
+        if (ut_tracked && run_index < spec->num_alloc_runs && spec->alloc_runs[run_index].first <= obj_id_index) {
+            CDL_AllocRun *run = &spec->alloc_runs[run_index];
+            int created = create_object_run(spec, obj_id_index, run->first + run->count - obj_id_index,
+                                            untyped_cptr, ut_size_bits, &ut_used, free_slot);
+            if (created > 0) {
+                ZF_LOGV("Created %d objects from %s in slots %ld.. from untyped %lx\n", created,
+                        CDL_Obj_Name(obj), (long)free_slot, (long)untyped_cptr);
+                obj_id_index += created;
+                free_slot_index += created;
+                continue;
+            } else if (created < 0) {
+                ZF_LOGD("Allocation run for %s did not match untyped %lx, creating objects individually\n",
+                        CDL_Obj_Name(obj), (long)untyped_cptr);
+                ut_tracked = false;
+            }
+        }
 
         ZF_LOGV("Creating object %s in slot %ld, from untyped %lx...\n", CDL_Obj_Name(obj), (long)free_slot,
                 (long)untyped_cptr);
@@ -723,9 +1092,19 @@ create_objects(CDL_Model *spec, seL4_BootInfo *bootinfo)
                 }
                 add_sel4_cap(obj_id, ORIG, free_slot);
                 free_slot_index++;
+                if (uses_untyped_memory(obj)) {
+                    int obj_size;
+                    seL4_Word size_bits = vka_get_object_size(get_retype_params(obj, &obj_size), obj_size);
+                    if (size_bits == 0) {
+                        ut_tracked = false;
+                    }
+                    ut_used = ROUND_UP(ut_used, BIT(size_bits)) + BIT(size_bits);
+                }
             } else if (err == seL4_NotEnoughMemory) {
                 /* go to the next untyped to allocate objects - this one is empty */
                 ut_index++;
+                ut_used = 0;
+                ut_tracked = true;
                 /* we failed to process the current object, go back 1 */
                 obj_id_index--;
             } else {
@@ -1160,8 +1539,8 @@ init_tcbs(CDL_Model *spec)
     }
 }
 
-static void
-init_elf(CDL_Model *spec, CDL_ObjID tcb, seL4_BootInfo *bootinfo)
+static CDL_ObjID
+get_tcb_vspace_root(CDL_Model *spec, CDL_ObjID tcb)
 {
     CDL_Object *cdl_tcb = get_spec_object(spec, tcb);
 
@@ -1169,10 +1548,321 @@ init_elf(CDL_Model *spec, CDL_ObjID tcb, seL4_BootInfo *bootinfo)
     if (cdl_vspace_root == NULL) {
         ZF_LOGF("Could not find VSpace cap for %s", CDL_Obj_Name(cdl_tcb));
     }
+    return CDL_Cap_ObjID(cdl_vspace_root);
+}
+
+static void
+init_elf(CDL_Model *spec, CDL_ObjID tcb, seL4_BootInfo *bootinfo, uintptr_t window, seL4_CPtr scratch_slot)
+{
+    CDL_Object *cdl_tcb = get_spec_object(spec, tcb);
+    elf_load_frames(CDL_TCB_ElfName(cdl_tcb), get_tcb_vspace_root(spec, tcb), spec, bootinfo,
+                    window, scratch_slot);
+}
+
+#ifdef CAPDL_PARALLEL_LOAD
+
+/* ELF loading is split across one worker per core, with the boot thread
+ * acting as worker 0. TCBs that share a vspace or an ELF are always given
+ * to the same worker: page tables of a vspace are borrowed by the loader
+ * while its frames are filled, and elf_load_frames marks the segments of an
+ * ELF as loaded once done. Workers never allocate cslots themselves: the
+ * boot thread allocates each worker's TCB, scratch slot and notification
+ * before any worker is started, and uses the free slot counter alone again
+ * once they have all finished. */
+#define LOAD_WORKER_STACK_SIZE (PAGE_SIZE_4K * 4)
+
+/* Worker i maps frames at copy_addr + i * COPY_WINDOW_SIZE, so the windows
+ * of all workers are kept within [copy_addr, LOAD_WORKER_WINDOWS_END) */
+#define LOAD_WORKER_WINDOWS_END (copy_addr + CONFIG_MAX_NUM_NODES * COPY_WINDOW_SIZE)
+
+typedef struct {
+    CDL_Model *spec;
+    seL4_BootInfo *bootinfo;
+    unsigned int id;
+    /* each worker maps frames at its own window of COPY_WINDOW_SIZE bytes */
+    uintptr_t window;
+    seL4_CPtr scratch_slot;
+    seL4_CPtr tcb;
+    seL4_CPtr done;
+} load_worker_t;
+
+static load_worker_t load_workers[CONFIG_MAX_NUM_NODES];
+static char load_worker_stacks[CONFIG_MAX_NUM_NODES][LOAD_WORKER_STACK_SIZE]
+__attribute__((aligned(STACK_ALIGNMENT_BYTES)));
+static char load_worker_ipc_buffers[CONFIG_MAX_NUM_NODES][PAGE_SIZE_4K]
+__attribute__((aligned(PAGE_SIZE_4K)));
+
+/* For each TCB, the TCB whose group it was merged into, and then for each
+ * group root, the worker that loads it. */
+static CDL_ObjID elf_load_group[CONFIG_CAPDL_LOADER_MAX_OBJECTS];
+static unsigned int elf_load_worker[CONFIG_CAPDL_LOADER_MAX_OBJECTS];
+
+/* Used while grouping: the first TCB found for each vspace root, TCBs and
+ * then group roots in sorted order, and the pages each group has to load */
+static CDL_ObjID vspace_first_tcb[CONFIG_CAPDL_LOADER_MAX_OBJECTS];
+static CDL_ObjID elf_load_order[CONFIG_CAPDL_LOADER_MAX_OBJECTS];
+static size_t elf_load_pages[CONFIG_CAPDL_LOADER_MAX_OBJECTS];
+static CDL_Model *elf_load_spec;
+
+static CDL_ObjID
+find_elf_load_group(CDL_ObjID tcb)
+{
+    while (elf_load_group[tcb] != tcb) {
+        elf_load_group[tcb] = elf_load_group[elf_load_group[tcb]];
+        tcb = elf_load_group[tcb];
+    }
+    return tcb;
+}
+
+static void
+merge_elf_load_groups(CDL_ObjID a, CDL_ObjID b)
+{
+    a = find_elf_load_group(a);
+    b = find_elf_load_group(b);
+    /* keep the lowest id as the root so the assignment is deterministic */
+    elf_load_group[MAX(a, b)] = MIN(a, b);
+}
+
+static int
+compare_elf_names(const void *a, const void *b)
+{
+    CDL_ObjID x = *(const CDL_ObjID *)a;
+    CDL_ObjID y = *(const CDL_ObjID *)b;
+    int order = strcmp(CDL_TCB_ElfName(&elf_load_spec->objects[x]),
+                       CDL_TCB_ElfName(&elf_load_spec->objects[y]));
+    if (order != 0) {
+        return order;
+    }
+    return x < y ? -1 : x > y;
+}
+
+/* Largest groups first, ties broken by id */
+static int
+compare_elf_load_pages(const void *a, const void *b)
+{
+    CDL_ObjID x = *(const CDL_ObjID *)a;
+    CDL_ObjID y = *(const CDL_ObjID *)b;
+    if (elf_load_pages[x] != elf_load_pages[y]) {
+        return elf_load_pages[x] > elf_load_pages[y] ? -1 : 1;
+    }
+    return x < y ? -1 : x > y;
+}
+
+/* Number of 4K pages covered by the loadable segments of elf_name */
+static size_t
+elf_load_size(const char *elf_name)
+{
+    unsigned long elf_size;
+    void *elf_file = cpio_get_file(_capdl_archive, elf_name, &elf_size);
+    if (elf_file == NULL) {
+        /* elf_load_frames reports the missing file */
+        return 0;
+    }
+
+    compressed_elf_t *image = get_compressed_elf(elf_file, elf_size);
+    if (image != NULL) {
+        elf_file = image + 1;
+    }
+    if (elf_checkFile(elf_file) != 0) {
+        return 0;
+    }
 
-    elf_load_frames(CDL_TCB_ElfName(cdl_tcb), CDL_Cap_ObjID(cdl_vspace_root), spec, bootinfo);
+    size_t pages = 0;
+    for (int i = 0; i < elf_getNumProgramHeaders(elf_file); i++) {
+        if (elf_getProgramHeaderType(elf_file, i) != PT_LOAD) {
+            continue;
+        }
+        uintptr_t start = elf_getProgramHeaderVaddr(elf_file, i);
+        uintptr_t end = start + elf_getProgramHeaderFileSize(elf_file, i);
+        pages += (ROUND_UP(end, PAGE_SIZE_4K) - ROUND_DOWN(start, PAGE_SIZE_4K)) / PAGE_SIZE_4K;
+    }
+    return pages;
 }
 
+static void
+group_elf_loads(CDL_Model *spec, unsigned int num_workers)
+{
+    /* Merge TCBs that share a vspace root, looking each root up once */
+    size_t num_tcbs = 0;
+    for (CDL_ObjID i = 0; i < spec->num; i++) {
+        vspace_first_tcb[i] = spec->num;
+    }
+    for (CDL_ObjID i = 0; i < spec->num; i++) {
+        if (spec->objects[i].type != CDL_TCB) {
+            continue;
+        }
+        elf_load_group[i] = i;
+        elf_load_pages[i] = 0;
+        elf_load_order[num_tcbs++] = i;
+
+        CDL_ObjID root = get_tcb_vspace_root(spec, i);
+        if (vspace_first_tcb[root] == spec->num) {
+            vspace_first_tcb[root] = i;
+        } else {
+            merge_elf_load_groups(i, vspace_first_tcb[root]);
+        }
+    }
+
+    /* TCBs that share an ELF are adjacent once sorted by ELF name */
+    elf_load_spec = spec;
+    qsort(elf_load_order, num_tcbs, sizeof(elf_load_order[0]), compare_elf_names);
+    for (size_t i = 1; i < num_tcbs; i++) {
+        if (strcmp(CDL_TCB_ElfName(&spec->objects[elf_load_order[i]]),
+                   CDL_TCB_ElfName(&spec->objects[elf_load_order[i - 1]])) == 0) {
+            merge_elf_load_groups(elf_load_order[i], elf_load_order[i - 1]);
+        }
+    }
+
+    /* Each distinct ELF is loaded once, by the group that uses it */
+    for (size_t i = 0; i < num_tcbs; i++) {
+        const char *elf_name = CDL_TCB_ElfName(&spec->objects[elf_load_order[i]]);
+        if (i == 0 || strcmp(elf_name, CDL_TCB_ElfName(&spec->objects[elf_load_order[i - 1]])) != 0) {
+            elf_load_pages[find_elf_load_group(elf_load_order[i])] += elf_load_size(elf_name);
+        }
+    }
+
+    /* Hand out the largest groups first, each to the least loaded worker */
+    size_t num_groups = 0;
+    for (CDL_ObjID i = 0; i < spec->num; i++) {
+        if (spec->objects[i].type == CDL_TCB && find_elf_load_group(i) == i) {
+            elf_load_order[num_groups++] = i;
+        }
+    }
+    qsort(elf_load_order, num_groups, sizeof(elf_load_order[0]), compare_elf_load_pages);
+
+    size_t worker_pages[CONFIG_MAX_NUM_NODES] = {0};
+    for (size_t i = 0; i < num_groups; i++) {
+        unsigned int worker = 0;
+        for (unsigned int w = 1; w < num_workers; w++) {
+            if (worker_pages[w] < worker_pages[worker]) {
+                worker = w;
+            }
+        }
+        elf_load_worker[elf_load_order[i]] = worker;
+        worker_pages[worker] += elf_load_pages[elf_load_order[i]];
+    }
+}
+
+static void
+run_load_worker(load_worker_t *worker)
+{
+    CDL_Model *spec = worker->spec;
+    for (CDL_ObjID obj_id = 0; obj_id < spec->num; obj_id++) {
+        if (spec->objects[obj_id].type == CDL_TCB &&
+                elf_load_worker[find_elf_load_group(obj_id)] == worker->id) {
+            init_elf(spec, obj_id, worker->bootinfo, worker->window, worker->scratch_slot);
+        }
+    }
+}
+
+static void
+load_worker_entry(void *arg0, void *arg1 UNUSED, void *arg2 UNUSED)
+{
+    load_worker_t *worker = arg0;
+    run_load_worker(worker);
+    seL4_Signal(worker->done);
+    seL4_TCB_Suspend(worker->tcb);
+}
+
+/* Create a loader-private object from whichever untyped still has room */
+static seL4_CPtr
+create_loader_object(seL4_BootInfo *bootinfo, seL4_ArchObjectType type, int size_bits)
+{
+    seL4_CPtr slot = get_free_slot();
+    for (unsigned int i = 0; i < bootinfo->untyped.end - bootinfo->untyped.start; i++) {
+        if (untyped_cptrs[i] != 0 && retype_untyped(slot, untyped_cptrs[i], type, size_bits) == seL4_NoError) {
+            next_free_slot();
+            return slot;
+        }
+    }
+    ZF_LOGF("Ran out of untyped memory while creating loader objects.");
+    return seL4_CapNull;
+}
+
+static void
+start_load_worker(load_worker_t *worker, seL4_BootInfo *bootinfo)
+{
+    worker->tcb = create_loader_object(bootinfo, seL4_TCBObject, 0);
+
+    void *ipc_buffer = load_worker_ipc_buffers[worker->id];
+    seL4_CPtr ipc_buffer_frame = get_user_image_frame(bootinfo, ipc_buffer);
+    ZF_LOGF_IF(ipc_buffer_frame == seL4_CapNull, "Failed to find IPC buffer frame for load worker");
+    ((seL4_IPCBuffer *) ipc_buffer)->userData = (seL4_Word) ipc_buffer;
+
+    int error = seL4_TCB_Configure(worker->tcb, seL4_CapNull,
+                                   seL4_CapInitThreadCNode, seL4_NilData,
+                                   seL4_CapInitThreadPD, seL4_NilData,
+                                   (seL4_Word) ipc_buffer, ipc_buffer_frame);
+    ZF_LOGF_IFERR(error, "");
+
+    error = seL4_TCB_SetSchedParams(worker->tcb, seL4_CapInitThreadTCB, seL4_MaxPrio, seL4_MaxPrio);
+    ZF_LOGF_IFERR(error, "");
+
+    error = seL4_TCB_SetAffinity(worker->tcb, worker->id);
+    ZF_LOGF_IFERR(error, "");
+
+    seL4_UserContext context = {0};
+    uintptr_t stack_top = (uintptr_t) load_worker_stacks[worker->id] + LOAD_WORKER_STACK_SIZE;
+    error = sel4utils_arch_init_local_context(load_worker_entry, worker, NULL, NULL,
+                                              (void *) stack_top, &context);
+    ZF_LOGF_IFERR(error, "");
+
+    error = seL4_TCB_WriteRegisters(worker->tcb, true, 0, sizeof(context) / sizeof(seL4_Word), &context);
+    ZF_LOGF_IFERR(error, "");
+}
+
+static void
+load_elfs_parallel(CDL_Model *spec, seL4_BootInfo *bootinfo)
+{
+    unsigned int num_workers = MIN(bootinfo->numNodes, CONFIG_MAX_NUM_NODES);
+    ZF_LOGD(" Loading ELFs with %u workers\n", num_workers);
+
+    group_elf_loads(spec, num_workers);
+
+    ZF_LOGF_IF(LOAD_WORKER_WINDOWS_END <= copy_addr, "Load worker windows wrap the address space");
+
+    seL4_CPtr done = num_workers > 1 ? create_loader_object(bootinfo, seL4_NotificationObject, 0) : seL4_CapNull;
+    for (unsigned int i = 0; i < num_workers; i++) {
+        load_workers[i] = (load_worker_t) {
+            .spec = spec,
+            .bootinfo = bootinfo,
+            .id = i,
+            .window = copy_addr + i * COPY_WINDOW_SIZE,
+            .scratch_slot = get_free_slot(),
+        };
+        next_free_slot();
+        assert(load_workers[i].window >= copy_addr &&
+               load_workers[i].window + COPY_WINDOW_SIZE <= LOAD_WORKER_WINDOWS_END);
+        if (i > 0) {
+            /* Each worker signals with its own badge bit, so that signals
+             * which arrive together can still be told apart */
+            load_workers[i].done = get_free_slot();
+            int error = seL4_CNode_Mint(seL4_CapInitThreadCNode, load_workers[i].done, CONFIG_WORD_SIZE,
+                                        seL4_CapInitThreadCNode, done, CONFIG_WORD_SIZE,
+                                        seL4_AllRights, BIT(i));
+            ZF_LOGF_IFERR(error, "Failed to mint load worker notification");
+            next_free_slot();
+        }
+    }
+
+    for (unsigned int i = 1; i < num_workers; i++) {
+        start_load_worker(&load_workers[i], bootinfo);
+    }
+    run_load_worker(&load_workers[0]);
+
+    /* Signals may be coalesced, so collect the badge bits of the workers
+     * that have finished until all of them have */
+    seL4_Word finished = 0;
+    seL4_Word all_finished = MASK(num_workers) & ~BIT(0);
+    while (finished != all_finished) {
+        seL4_Word badge;
+        seL4_Wait(done, &badge);
+        finished |= badge;
+    }
+}
+
+#endif /* CAPDL_PARALLEL_LOAD */
+
 static void
 init_elfs(CDL_Model *spec, seL4_BootInfo *bootinfo)
 {
@@ -1188,12 +1878,17 @@ init_elfs(CDL_Model *spec, seL4_BootInfo *bootinfo)
         ZF_LOGD("  %d: %s, offset: %p, size: %lu\n", j, name,
                 (void*)((uintptr_t)ptr - (uintptr_t)_capdl_archive), size);
     }
+
+#ifdef CAPDL_PARALLEL_LOAD
+    load_elfs_parallel(spec, bootinfo);
+#else
     for (CDL_ObjID obj_id = 0; obj_id < spec->num; obj_id++) {
         if (spec->objects[obj_id].type == CDL_TCB) {
             ZF_LOGD(" Initialising ELF for %s...\n", CDL_Obj_Name(&spec->objects[obj_id]));
-            init_elf(spec, obj_id, bootinfo);
+            init_elf(spec, obj_id, bootinfo, copy_addr, 0);
         }
     }
+#endif
 }
 
 static void
@@ -1786,35 +2481,178 @@ init_scs(CDL_Model *spec)
     }
 }
 
+/* Stages of the loader that are timed for the boot report, in order */
+enum {
+    LOADER_PHASE_ENTRY,
+    LOADER_PHASE_BOOTINFO,
+    LOADER_PHASE_OBJECTS,
+    LOADER_PHASE_CAPS,
+    LOADER_PHASE_ELFS,
+    LOADER_PHASE_FILL_FRAMES,
+    LOADER_PHASE_VSPACE,
+    LOADER_PHASE_TCBS,
+    LOADER_PHASE_CSPACE,
+    LOADER_PHASE_START,
+    LOADER_NUM_PHASES
+};
+
+#ifdef CONFIG_CAPDL_LOADER_BOOT_REPORT
+
+static uint64_t loader_timestamps[LOADER_NUM_PHASES];
+
+/* Returns 0 if the cycle counter cannot be read from user level */
+static uint64_t
+read_cycle_counter(void)
+{
+#if defined(CONFIG_ARCH_X86)
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#elif defined(CONFIG_EXPORT_PMU_USER) && defined(CONFIG_ARCH_AARCH64)
+    uint64_t val;
+    asm volatile("mrs %0, pmccntr_el0" : "=r"(val));
+    return val;
+#elif defined(CONFIG_EXPORT_PMU_USER) && (defined(CONFIG_ARCH_ARM_V7A) || defined(CONFIG_ARCH_ARM_V8A))
+    uint32_t val;
+    asm volatile("mrc p15, 0, %0, c9, c13, 0" : "=r"(val));
+    return val;
+#else
+    return 0;
+#endif
+}
+
+static void
+loader_timestamp(int phase)
+{
+    loader_timestamps[phase] = read_cycle_counter();
+}
+
+/* Print one line per recorded phase with the cycles spent since the previous
+ * recorded phase, which may belong to an earlier stage. All stages read the
+ * same counter, but it may have been reset or wrapped in between, in which case
+ * the delta is left out. */
+static void
+report_phases(const char *stage, const char *const *names, const uint64_t *cycles,
+              int num_phases, uint64_t *prev)
+{
+    for (int i = 0; i < num_phases; i++) {
+        if (cycles[i] == 0) {
+            continue;
+        }
+        printf("boot-report: %s.%s cycles=%"PRIu64, stage, names[i], cycles[i]);
+        if (*prev != 0 && cycles[i] >= *prev) {
+            printf(" delta=%"PRIu64, cycles[i] - *prev);
+        }
+        printf("\n");
+        *prev = cycles[i];
+    }
+}
+
+/* Print the timestamps of every boot stage in a form that is easy to pick
+ * out of a serial log */
+static void
+print_boot_report(simple_t *simple)
+{
+    static const char *const elfloader_phases[] = {
+        [seL4_ElfloaderPhaseEntry] = "entry",
+        [seL4_ElfloaderPhaseKernelLoad] = "kernel_load",
+        [seL4_ElfloaderPhaseUserLoad] = "user_load",
+        [seL4_ElfloaderPhaseHandoff] = "handoff",
+    };
+    static const char *const kernel_phases[] = {
+        [seL4_BootPhaseKernelEntry] = "entry",
+        [seL4_BootPhaseImageLoad] = "image_load",
+        [seL4_BootPhaseCPUInit] = "cpu_init",
+        [seL4_BootPhaseUserImage] = "user_image",
+        [seL4_BootPhaseUntypeds] = "untypeds",
+        [seL4_BootPhaseNodesStarted] = "nodes_started",
+        [seL4_BootPhaseKernelExit] = "exit",
+    };
+    static const char *const loader_phases[] = {
+        [LOADER_PHASE_ENTRY] = "entry",
+        [LOADER_PHASE_BOOTINFO] = "parse_bootinfo",
+        [LOADER_PHASE_OBJECTS] = "create_objects",
+        [LOADER_PHASE_CAPS] = "create_caps",
+        [LOADER_PHASE_ELFS] = "init_elfs",
+        [LOADER_PHASE_FILL_FRAMES] = "init_fill_frames",
+        [LOADER_PHASE_VSPACE] = "init_vspace",
+        [LOADER_PHASE_TCBS] = "init_tcbs",
+        [LOADER_PHASE_CSPACE] = "init_cspace",
+        [LOADER_PHASE_START] = "start_threads",
+    };
+    seL4_BootInfoElfloaderTimestamps elfloader;
+    seL4_BootInfoTimestamps kernel;
+    uint64_t prev = 0;
+
+    printf("boot-report: begin\n");
+#ifdef CONFIG_ARCH_X86
+    printf("boot-report: tsc_hz=%"PRIu32"\n", x86_get_tsc_freq_from_simple(simple));
+#endif
+    if (simple_get_extended_bootinfo(simple, SEL4_BOOTINFO_HEADER_ELFLOADER_TIMESTAMPS,
+                                     &elfloader, sizeof(elfloader)) == sizeof(elfloader)) {
+        report_phases("elfloader", elfloader_phases, elfloader.cycles, seL4_NumElfloaderPhases, &prev);
+    }
+    if (simple_get_extended_bootinfo(simple, SEL4_BOOTINFO_HEADER_BOOT_TIMESTAMPS,
+                                     &kernel, sizeof(kernel)) == sizeof(kernel)) {
+        report_phases("kernel", kernel_phases, kernel.cycles, seL4_NumBootPhases, &prev);
+    }
+    report_phases("loader", loader_phases, loader_timestamps, LOADER_NUM_PHASES, &prev);
+    printf("boot-report: end\n");
+}
+
+#else
+
+static inline void
+loader_timestamp(int phase UNUSED)
+{
+}
+
+#endif /* CONFIG_CAPDL_LOADER_BOOT_REPORT */
+
 static void
 init_system(CDL_Model *spec)
 {
     seL4_BootInfo *bootinfo = platsupport_get_bootinfo();
     simple_t simple;
 
+    loader_timestamp(LOADER_PHASE_ENTRY);
+
     simple_default_init_bootinfo(&simple, bootinfo);
 
     init_copy_frame(bootinfo);
 
     parse_bootinfo(bootinfo);
     sort_untypeds(bootinfo);
+    loader_timestamp(LOADER_PHASE_BOOTINFO);
 
     create_objects(spec, bootinfo);
+    loader_timestamp(LOADER_PHASE_OBJECTS);
     create_irq_caps(spec);
     if (config_set(CONFIG_KERNEL_RT)) {
         create_sched_ctrl_caps(bootinfo);
     }
     duplicate_caps(spec);
+    loader_timestamp(LOADER_PHASE_CAPS);
 
     init_irqs(spec);
     init_pd_asids(spec);
     init_elfs(spec, bootinfo);
+    loader_timestamp(LOADER_PHASE_ELFS);
     init_fill_frames(spec, &simple);
+    loader_timestamp(LOADER_PHASE_FILL_FRAMES);
     init_vspace(spec);
+    loader_timestamp(LOADER_PHASE_VSPACE);
     init_scs(spec);
     init_tcbs(spec);
+    loader_timestamp(LOADER_PHASE_TCBS);
     init_cspace(spec);
+    loader_timestamp(LOADER_PHASE_CSPACE);
     start_threads(spec);
+    loader_timestamp(LOADER_PHASE_START);
+
+#ifdef CONFIG_CAPDL_LOADER_BOOT_REPORT
+    print_boot_report(&simple);
+#endif
 }
 
 int
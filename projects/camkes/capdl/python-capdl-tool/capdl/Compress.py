@@ -0,0 +1,301 @@
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+"""
+Compression of ELF images for the CapDL loader.
+
+A compressed image keeps the ELF header and program headers as they are, so
+the loader can read them in place, followed by the file contents of each
+loadable segment cut into blocks at 4K virtual address boundaries. Each block
+is stored in one of the following ways:
+
+ * zero      - the block is all zero and is not stored, as the loader fills
+               freshly created frames that are already zero
+ * raw       - the block is stored uncompressed
+ * lz4       - the block is stored in the LZ4 block format
+ * duplicate - the block is identical to an earlier block and refers to it
+
+The layout is (all integers in the byte order of the ELF file):
+
+    char magic[4]             "CDLZ"
+    u32  elf_header_size      bytes of ELF header and program headers
+    u32  segments_offset      offset of a u32 first block per program header
+    u32  blocks_offset        offset of a u32 count and the block descriptors
+    ELF header and program headers
+    ...
+
+where each block descriptor is a (u32 offset, u32 info) pair. The top two
+bits of info give the kind of block, and the remaining bits either the
+stored length or, for duplicates, the index of the block it repeats.
+
+This module does not rely on elftools and can be run as a script:
+
+    python Compress.py input.elf output.elf
+"""
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+
+import struct, sys
+
+MAGIC = b'CDLZ'
+BLOCK_SIZE = 4096
+
+BLOCK_ZERO = 0
+BLOCK_RAW = 1
+BLOCK_LZ4 = 2
+BLOCK_DUPLICATE = 3
+
+BLOCK_KIND_SHIFT = 30
+BLOCK_VALUE_MASK = (1 << BLOCK_KIND_SHIFT) - 1
+
+PT_LOAD = 1
+
+# LZ4 block format constraints.
+MIN_MATCH = 4
+LAST_LITERALS = 5
+MATCH_SAFE_DISTANCE = 12
+MAX_OFFSET = 0xffff
+
+def _length_bytes(length):
+    out = bytearray()
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+    return out
+
+def _sequence(literals, offset=None, match_length=0):
+    lit_len = len(literals)
+    token = min(lit_len, 15) << 4
+    if offset is not None:
+        token |= min(match_length - MIN_MATCH, 15)
+    out = bytearray([token])
+    if lit_len >= 15:
+        out += _length_bytes(lit_len - 15)
+    out += literals
+    if offset is not None:
+        out += struct.pack('<H', offset)
+        if match_length - MIN_MATCH >= 15:
+            out += _length_bytes(match_length - MIN_MATCH - 15)
+    return out
+
+def lz4_compress_block(data):
+    '''
+    Compress data into a single LZ4 block. This is a simple greedy matcher,
+    it is not as good as the reference implementation but the output can be
+    read by any LZ4 block decoder.
+    '''
+    data = bytearray(data)
+    n = len(data)
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+    while i < n - MATCH_SAFE_DISTANCE:
+        key = bytes(data[i:i + MIN_MATCH])
+        candidate = table.get(key)
+        table[key] = i
+        if candidate is None or i - candidate > MAX_OFFSET:
+            i += 1
+            continue
+        length = MIN_MATCH
+        limit = n - LAST_LITERALS - i
+        while length < limit and data[candidate + length] == data[i + length]:
+            length += 1
+        out += _sequence(data[anchor:i], i - candidate, length)
+        i += length
+        anchor = i
+    out += _sequence(data[anchor:])
+    return bytes(out)
+
+def lz4_decompress_block(data, size):
+    '''
+    Decompress a single LZ4 block that is expected to produce size bytes.
+    '''
+    data = bytearray(data)
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        token = data[i]
+        i += 1
+        length = token >> 4
+        if length == 15:
+            while True:
+                length += data[i]
+                i += 1
+                if data[i - 1] != 255:
+                    break
+        out += data[i:i + length]
+        i += length
+        if i >= len(data):
+            break
+        offset = data[i] | (data[i + 1] << 8)
+        i += 2
+        length = token & 15
+        if length == 15:
+            while True:
+                length += data[i]
+                i += 1
+                if data[i - 1] != 255:
+                    break
+        length += MIN_MATCH
+        if offset == 0 or offset > len(out):
+            raise ValueError('invalid LZ4 match offset %d' % offset)
+        for _ in range(length):
+            out.append(out[-offset])
+    if len(out) != size:
+        raise ValueError('LZ4 block decompressed to %d bytes, expected %d' % (len(out), size))
+    return bytes(out)
+
+class _ElfLayout(object):
+    '''
+    The minimal view of an ELF file needed to find its loadable segments.
+    '''
+    def __init__(self, elf):
+        if elf[:4] != b'\x7fELF':
+            raise ValueError('not an ELF file')
+        elf_class = bytearray(elf[4:5])[0]
+        self.endian = '<' if bytearray(elf[5:6])[0] == 1 else '>'
+        if elf_class == 1:
+            phoff, = struct.unpack_from(self.endian + 'I', elf, 28)
+            ehsize, phentsize, phnum = struct.unpack_from(self.endian + 'HHH', elf, 40)
+            phdr = 'IIIIII'
+        elif elf_class == 2:
+            phoff, = struct.unpack_from(self.endian + 'Q', elf, 32)
+            ehsize, phentsize, phnum = struct.unpack_from(self.endian + 'HHH', elf, 52)
+            phdr = 'IIQQQQ'
+        else:
+            raise ValueError('unknown ELF class %d' % elf_class)
+        self.header_size = max(ehsize, phoff + phentsize * phnum)
+
+        self.segments = []
+        for i in range(phnum):
+            fields = struct.unpack_from(self.endian + phdr, elf, phoff + i * phentsize)
+            if elf_class == 1:
+                p_type, p_offset, p_vaddr, _, p_filesz, _ = fields
+            else:
+                p_type, _, p_offset, p_vaddr, _, p_filesz = fields
+            self.segments.append((p_type, p_offset, p_vaddr, p_filesz))
+
+def _blocks(vaddr, data):
+    '''
+    Cut segment data starting at vaddr into blocks on BLOCK_SIZE boundaries.
+    '''
+    offset = 0
+    while offset < len(data):
+        end = min(len(data), (vaddr + offset) // BLOCK_SIZE * BLOCK_SIZE + BLOCK_SIZE - vaddr)
+        yield data[offset:end]
+        offset = end
+
+def compress_elf(elf):
+    '''
+    Produce the compressed image of the ELF file contents elf.
+    '''
+    layout = _ElfLayout(elf)
+    e = layout.endian
+
+    first_block = []
+    descriptors = []
+    data = bytearray()
+    seen = {}
+    for p_type, p_offset, p_vaddr, p_filesz in layout.segments:
+        first_block.append(len(descriptors))
+        if p_type != PT_LOAD:
+            continue
+        for block in _blocks(p_vaddr, elf[p_offset:p_offset + p_filesz]):
+            block = bytes(block)
+            if block.count(b'\0') == len(block):
+                descriptors.append((0, BLOCK_ZERO << BLOCK_KIND_SHIFT))
+                continue
+            if block in seen:
+                descriptors.append((0, BLOCK_DUPLICATE << BLOCK_KIND_SHIFT | seen[block]))
+                continue
+            seen[block] = len(descriptors)
+            compressed = lz4_compress_block(block)
+            if len(compressed) < len(block):
+                descriptors.append((len(data), BLOCK_LZ4 << BLOCK_KIND_SHIFT | len(compressed)))
+                data += compressed
+            else:
+                descriptors.append((len(data), BLOCK_RAW << BLOCK_KIND_SHIFT | len(block)))
+                data += block
+
+    def align(x):
+        return (x + 7) & ~7
+
+    header_size = 16
+    segments_offset = align(header_size + layout.header_size)
+    blocks_offset = align(segments_offset + 4 * len(first_block))
+    data_offset = align(blocks_offset + 4 + 8 * len(descriptors))
+
+    out = bytearray(data_offset)
+    struct.pack_into(e + '4sIII', out, 0, MAGIC, layout.header_size, segments_offset, blocks_offset)
+    out[header_size:header_size + layout.header_size] = elf[:layout.header_size]
+    struct.pack_into(e + '%dI' % len(first_block), out, segments_offset, *first_block)
+    struct.pack_into(e + 'I', out, blocks_offset, len(descriptors))
+    for i, (offset, info) in enumerate(descriptors):
+        kind = info >> BLOCK_KIND_SHIFT
+        if kind in (BLOCK_RAW, BLOCK_LZ4):
+            offset += data_offset
+        struct.pack_into(e + 'II', out, blocks_offset + 4 + 8 * i, offset, info)
+    out += data
+    return bytes(out)
+
+def decompress_segments(image):
+    '''
+    Recover the file contents of each loadable segment from a compressed
+    image, as a list of (vaddr, data) in program header order.
+    '''
+    # The byte order is that of the ELF header, which starts at offset 16.
+    e = '<' if bytearray(image[21:22])[0] == 1 else '>'
+    _, header_size, segments_offset, blocks_offset = struct.unpack_from(e + '4sIII', image, 0)
+    layout = _ElfLayout(image[16:16 + header_size])
+
+    first_block = struct.unpack_from(e + '%dI' % len(layout.segments), image, segments_offset)
+    num_blocks, = struct.unpack_from(e + 'I', image, blocks_offset)
+    descriptors = [struct.unpack_from(e + 'II', image, blocks_offset + 4 + 8 * i)
+                   for i in range(num_blocks)]
+
+    def decode(index, size):
+        offset, info = descriptors[index]
+        kind, value = info >> BLOCK_KIND_SHIFT, info & BLOCK_VALUE_MASK
+        if kind == BLOCK_ZERO:
+            return b'\0' * size
+        elif kind == BLOCK_DUPLICATE:
+            return decode(value, size)
+        elif kind == BLOCK_RAW:
+            return image[offset:offset + value]
+        return lz4_decompress_block(image[offset:offset + value], size)
+
+    segments = []
+    for (p_type, _, p_vaddr, p_filesz), index in zip(layout.segments, first_block):
+        if p_type != PT_LOAD:
+            continue
+        data = b''
+        for block in _blocks(p_vaddr, b'\0' * p_filesz):
+            data += decode(index, len(block))
+            index += 1
+        segments.append((p_vaddr, data))
+    return segments
+
+def main(argv):
+    if len(argv) != 3:
+        print('Usage: %s input.elf output.elf' % argv[0], file=sys.stderr)
+        return -1
+    with open(argv[1], 'rb') as f:
+        elf = f.read()
+    with open(argv[2], 'wb') as f:
+        f.write(compress_elf(elf))
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
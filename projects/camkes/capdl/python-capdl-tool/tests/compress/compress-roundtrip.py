@@ -0,0 +1,42 @@
+#!/usr/bin/env python
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+
+import os, struct
+from capdl.Compress import compress_elf, decompress_segments, \
+    lz4_compress_block, lz4_decompress_block
+
+# Blocks with long runs, repeats and no repeats at all should survive LZ4.
+for data in [b'', b'a', b'\0' * 4096, b'abcd' * 1000, os.urandom(4096),
+             b'hello world ' * 50 + os.urandom(100) + b'hello world ' * 50]:
+    assert lz4_decompress_block(lz4_compress_block(data), len(data)) == data
+
+for name in ['../ia32-elf/hello.bin', '../arm-elf/hello.bin']:
+    with open(name, 'rb') as f:
+        elf = f.read()
+    image = compress_elf(elf)
+    assert image[:4] == b'CDLZ'
+    assert len(image) < len(elf)
+
+    # Each loadable segment must decompress to what is in the original file.
+    phoff, = struct.unpack_from('<I', elf, 28)
+    phentsize, phnum = struct.unpack_from('<HH', elf, 42)
+    expected = []
+    for i in range(phnum):
+        p_type, p_offset, p_vaddr, _, p_filesz, _ = \
+            struct.unpack_from('<IIIIII', elf, phoff + i * phentsize)
+        if p_type == 1:
+            expected.append((p_vaddr, elf[p_offset:p_offset + p_filesz]))
+    assert decompress_segments(image) == expected
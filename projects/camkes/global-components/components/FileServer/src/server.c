@@ -11,6 +11,7 @@
  */
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -18,12 +19,44 @@
 
 #include <muslcsys/io.h>
 #include <sel4/sel4.h>
+#include <utils/attribute.h>
 
 #include <camkes.h>
 
 seL4_Word fs_ctrl_get_sender_id(void);
 void *fs_ctrl_buf(seL4_Word);
 size_t fs_ctrl_buf_size(seL4_Word);
+/* The shared archive's size, rounded up to a page. Only generated by
+ * seL4FileServer, which requires the fs_ctrl_archive_size attribute */
+size_t fs_ctrl_archive_bytes(void) WEAK;
+
+/* Clients connected with seL4FileServer can also queue reads in a ring
+ * shared with the file server, which works through them in its control
+ * thread. These are generated by seL4FileServer-to.template.c */
+seL4_CPtr fs_ctrl_doorbell(void) WEAK;
+unsigned int fs_ctrl_async_num_clients(void) WEAK;
+void *fs_ctrl_async_buf(unsigned int client) WEAK;
+seL4_Word fs_ctrl_async_badge(unsigned int client) WEAK;
+unsigned int fs_ctrl_async_slots(unsigned int client) WEAK;
+size_t fs_ctrl_async_slot_size(unsigned int client) WEAK;
+void fs_ctrl_async_emit(unsigned int client) WEAK;
+
+/* This layout is shared with seL4FileServer-from.template.c */
+typedef struct async_request {
+    int32_t fd;
+    uint32_t size;
+    uint64_t offset;
+    int64_t result;
+} async_request_t;
+
+typedef struct async_ring {
+    uint32_t submitted;
+    uint32_t waiting;
+    char client_padding[56];
+    uint32_t completed;
+    char server_padding[60];
+    async_request_t requests[];
+} async_ring_t;
 
 typedef struct cpio_file_data_wrap {
     cpio_file_data_t data;
@@ -32,7 +65,24 @@ typedef struct cpio_file_data_wrap {
 
 extern char _cpio_archive[];
 
+static struct cpio_index archive_index;
+
+static void *index_get_file(void *index, const char *name, unsigned long *size) {
+    return cpio_index_get_file(index, name, size);
+}
+
 void pre_init() {
+    /* index the _cpio_archive so that opens don't scan it */
+    struct cpio_info info;
+    if (cpio_info(_cpio_archive, &info) == 0) {
+        struct cpio_index_entry *entries = malloc(info.file_count * sizeof(*entries));
+        if (entries && cpio_index_init(_cpio_archive, &archive_index, entries, info.file_count) == 0) {
+            muslcsys_install_cpio_interface(&archive_index, index_get_file);
+            return;
+        }
+        ZF_LOGW("Failed to index the archive, falling back to scanning it");
+        free(entries);
+    }
     /* install the _cpio_archive */
     muslcsys_install_cpio_interface(_cpio_archive, cpio_get_file);
 }
@@ -55,7 +105,7 @@ bool validate_client_fd(int fd, seL4_Word client) {
     return true;
 }
 
-int fs_ctrl_open(const char *name, int flags) {
+static int open_locked(const char *name, int flags) {
     /* try the open and return early if we get an error */
     int fd = open(name, flags);
     if (fd < 0) {
@@ -77,32 +127,146 @@ int fs_ctrl_open(const char *name, int flags) {
     return fd;
 }
 
+/* The control thread reads files for queued requests, so the RPC handlers
+ * hold the file server lock while they use the file table */
+int fs_ctrl_open(const char *name, int flags) {
+    int UNUSED error = file_server_lock();
+    int fd = open_locked(name, flags);
+    error = file_server_unlock();
+    return fd;
+}
+
 int64_t fs_ctrl_seek(int fd, int64_t offset, int whence) {
     seL4_Word client = fs_ctrl_get_sender_id();
-    if (!validate_client_fd(fd, client)) {
-        return -1;
+    int UNUSED error = file_server_lock();
+    int64_t ret = -1;
+    if (validate_client_fd(fd, client)) {
+        ret = lseek(fd, offset, whence);
     }
-    return lseek(fd, offset, whence);
+    error = file_server_unlock();
+    return ret;
 }
 
 ssize_t fs_ctrl_read(int fd, size_t size) {
     seL4_Word client = fs_ctrl_get_sender_id();
-    if (!validate_client_fd(fd, client)) {
-        return -1;
-    }
     void *dataport = fs_ctrl_buf(client);
     assert(dataport);
 
     size_t max = fs_ctrl_buf_size(client);
 
     size = MIN(size, max);
-    return read(fd, dataport, size);
+    int UNUSED error = file_server_lock();
+    ssize_t ret = -1;
+    if (validate_client_fd(fd, client)) {
+        ret = read(fd, dataport, size);
+    }
+    error = file_server_unlock();
+    return ret;
 }
 
-int fs_ctrl_close(int fd) {
+int64_t fs_ctrl_map(int fd, uint64_t *size) {
     seL4_Word client = fs_ctrl_get_sender_id();
+    if (fs_ctrl_archive_size == 0) {
+        ZF_LOGE("Client %zu attempted to map fd %d, but the archive is not shared", client, fd);
+        return -ENODEV;
+    }
+    int UNUSED error = file_server_lock();
     if (!validate_client_fd(fd, client)) {
+        error = file_server_unlock();
         return -EBADF;
     }
-    return close(fd);
+    cpio_file_data_wrap_t *data = (cpio_file_data_wrap_t*)get_fd_struct(fd)->data;
+    size_t offset = data->data.start - _cpio_archive;
+    *size = data->data.size;
+    error = file_server_unlock();
+    if (offset + *size > fs_ctrl_archive_bytes()) {
+        ZF_LOGE("Archive is larger than fs_ctrl_archive_size");
+        return -ENODEV;
+    }
+    return offset;
+}
+
+int fs_ctrl_close(int fd) {
+    seL4_Word client = fs_ctrl_get_sender_id();
+    int UNUSED error = file_server_lock();
+    int ret = -EBADF;
+    if (validate_client_fd(fd, client)) {
+        ret = close(fd);
+    }
+    error = file_server_unlock();
+    return ret;
+}
+
+/* Read from fd at offset without moving its file position */
+static int64_t async_read(seL4_Word client, int fd, uint64_t offset, size_t size, void *buf) {
+    int64_t ret = -EBADF;
+    int UNUSED error = file_server_lock();
+    if (validate_client_fd(fd, client)) {
+        cpio_file_data_t *file = &((cpio_file_data_wrap_t*)get_fd_struct(fd)->data)->data;
+        ret = 0;
+        if (offset < file->size) {
+            ret = MIN(size, file->size - offset);
+            memcpy(buf, file->start + offset, ret);
+        }
+    }
+    error = file_server_unlock();
+    return ret;
+}
+
+/* Complete every read queued by a client. Returns whether there were any */
+static bool serve_async_client(unsigned int client) {
+    volatile async_ring_t *ring = fs_ctrl_async_buf(client);
+    unsigned int slots = fs_ctrl_async_slots(client);
+    size_t slot_size = fs_ctrl_async_slot_size(client);
+    char *data = (char *)fs_ctrl_async_buf(client) + PAGE_SIZE_4K;
+    uint32_t completed = ring->completed;
+    uint32_t submitted = __atomic_load_n(&ring->submitted, __ATOMIC_ACQUIRE);
+    bool progress = false;
+
+    while (completed != submitted) {
+        if (submitted - completed > slots) {
+            ZF_LOGE("Client %zu queued more reads than it has slots", fs_ctrl_async_badge(client));
+            return progress;
+        }
+        /* copy the request, as the client can change it at any time */
+        volatile async_request_t *request = &ring->requests[completed % slots];
+        int fd = request->fd;
+        uint64_t offset = request->offset;
+        size_t size = MIN(request->size, slot_size);
+        request->result = async_read(fs_ctrl_async_badge(client), fd, offset, size,
+                                     data + (completed % slots) * slot_size);
+        completed++;
+        __atomic_store_n(&ring->completed, completed, __ATOMIC_RELEASE);
+        progress = true;
+
+        /* Order the store to completed before the loads of waiting and
+         * submitted, which the client stores before checking completed */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (ring->waiting) {
+            fs_ctrl_async_emit(client);
+        }
+        submitted = __atomic_load_n(&ring->submitted, __ATOMIC_ACQUIRE);
+    }
+    return progress;
+}
+
+int run(void) {
+    if (!fs_ctrl_doorbell) {
+        /* not connected with seL4FileServer, there is nothing to do */
+        return 0;
+    }
+    seL4_CPtr doorbell = fs_ctrl_doorbell();
+    unsigned int num_clients = fs_ctrl_async_num_clients();
+    while (1) {
+        seL4_Wait(doorbell, NULL);
+        /* take turns between clients until none has queued anything */
+        bool progress;
+        do {
+            progress = false;
+            for (unsigned int i = 0; i < num_clients; i++) {
+                progress |= serve_async_client(i);
+            }
+        } while (progress);
+    }
+    return 0;
 }
@@ -13,7 +13,9 @@
 #include <autoconf.h>
 #include <camkes.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <sel4/sel4.h>
@@ -38,6 +40,8 @@
 #define MSR_ADDR (6)
 
 #define IER_RESERVED_MASK (BIT(6) | BIT(7))
+#define IER_RDA BIT(0)
+#define IER_THR BIT(1)
 
 #define FCR_ENABLE BIT(0)
 #define FCR_CLEAR_RECEIVE BIT(1)
@@ -67,6 +71,9 @@
 #define ESCAPE_CHAR '@'
 #define MAX_CLIENTS 12
 #define CLIENT_OUTPUT_BUFFER_SIZE 4096
+/* Characters a client with an output ring may write before other clients get
+ * a turn, if it does not finish its line first */
+#define OUTPUT_QUANTUM 256
 
 /* TODO: have the MultiSharedData template generate a header with these */
 void getchar_emit(unsigned int id) WEAK;
@@ -89,6 +96,40 @@ typedef struct getchar_client {
     uint32_t last_head;
 } getchar_client_t;
 
+/* Clients connected with seL4SerialServerOutput queue their output in a ring
+ * in their dataport rather than calling putchar for every character */
+void *processed_putchar_buf(seL4_Word client_id) WEAK;
+size_t processed_putchar_buf_size(seL4_Word client_id) WEAK;
+unsigned int processed_putchar_num_badges(void) WEAK;
+seL4_Word processed_putchar_enumerate_badge(unsigned int i) WEAK;
+seL4_Word processed_putchar_notification_badge(void) WEAK;
+void *raw_putchar_buf(seL4_Word client_id) WEAK;
+size_t raw_putchar_buf_size(seL4_Word client_id) WEAK;
+unsigned int raw_putchar_num_badges(void) WEAK;
+seL4_Word raw_putchar_enumerate_badge(unsigned int i) WEAK;
+seL4_Word raw_putchar_notification_badge(void) WEAK;
+
+/* This layout is shared with seL4SerialServerOutput-from.template.c */
+typedef struct output_ring {
+    uint32_t head;
+    char head_padding[60];
+    uint32_t tail;
+    char tail_padding[60];
+    char data[];
+} output_ring_t;
+
+typedef struct output_client {
+    seL4_Word client_id;
+    volatile output_ring_t *ring;
+    /* number of slots in ring->data */
+    uint32_t size;
+    /* index into all_output_colours */
+    int colour;
+    /* translate \n to \n\r */
+    bool processed;
+    bool pending_cr;
+} output_client_t;
+
 static int last_out = -1;
 
 static int fifo_depth = 1;
@@ -105,6 +146,21 @@ static int has_data = 0;
 static int num_getchar_clients = 0;
 static getchar_client_t *getchar_clients = NULL;
 
+static int num_output_clients = 0;
+static output_client_t *output_clients = NULL;
+static seL4_Word output_badge = 0;
+
+/* The client whose line is being transmitted, and the next client to get a
+ * turn after it */
+static int tx_client = -1;
+static int tx_next = 0;
+static int tx_quantum = 0;
+/* Colour change still to be written before tx_client's output */
+static char tx_escape_buf[32];
+static const char *tx_escape = NULL;
+/* Whether the THR empty interrupt is enabled to drain the output rings */
+static bool tx_active = false;
+
 /* We predefine output colours for clients */
 const char *all_output_colours[MAX_CLIENTS * 2] = {
     /* Processed streams */
@@ -114,7 +170,7 @@ const char *all_output_colours[MAX_CLIENTS * 2] = {
     ANSI_COLOR(MAGENTA),
     ANSI_COLOR(YELLOW),
     ANSI_COLOR(CYAN),
-    ANSI_COLOR(RED, BOLD)
+    ANSI_COLOR(RED, BOLD),
     ANSI_COLOR(GREEN, BOLD),
     ANSI_COLOR(BLUE, BOLD),
     ANSI_COLOR(MAGENTA, BOLD),
@@ -128,7 +184,7 @@ const char *all_output_colours[MAX_CLIENTS * 2] = {
     ANSI_COLOR2(MAGENTA, WHITE),
     ANSI_COLOR2(YELLOW, WHITE),
     ANSI_COLOR2(CYAN, WHITE),
-    ANSI_COLOR2(RED, WHITE, BOLD)
+    ANSI_COLOR2(RED, WHITE, BOLD),
     ANSI_COLOR2(GREEN, WHITE, BOLD),
     ANSI_COLOR2(BLUE, WHITE, BOLD),
     ANSI_COLOR2(MAGENTA, WHITE, BOLD),
@@ -193,6 +249,184 @@ static void serial_putchar(int c) {
     fifo_used++;
 }
 
+static void serial_puts(const char *s) {
+    while (*s != '\0') {
+        serial_putchar(*s++);
+    }
+}
+
+static bool output_pending(output_client_t *client) {
+    return client->pending_cr || client->ring->head != __atomic_load_n(&client->ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Take the next character from a client's ring, or -1 if it is empty */
+static int output_next_char(output_client_t *client) {
+    if (client->pending_cr) {
+        client->pending_cr = false;
+        return '\r';
+    }
+    volatile output_ring_t *ring = client->ring;
+    uint32_t head = ring->head;
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    int c = (uint8_t)ring->data[head];
+    __atomic_store_n(&ring->head, (head + 1) % client->size, __ATOMIC_RELEASE);
+    if (client->processed && c == '\n') {
+        client->pending_cr = true;
+    }
+    return c;
+}
+
+/* Pick the next client with queued output, in round robin order */
+static bool select_tx_client(void) {
+    /* Order our stores to head before the loads of tail. Either we see a
+     * client's new output, or the client sees an empty ring and signals us. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (int i = 0; i < num_output_clients; i++) {
+        int id = (tx_next + i) % num_output_clients;
+        if (output_pending(&output_clients[id])) {
+            tx_client = id;
+            tx_next = (id + 1) % num_output_clients;
+            tx_quantum = OUTPUT_QUANTUM;
+            if (output_clients[id].colour != last_out) {
+                last_out = output_clients[id].colour;
+                snprintf(tx_escape_buf, sizeof(tx_escape_buf), "%s%s", COLOR_RESET, all_output_colours[last_out]);
+                tx_escape = tx_escape_buf;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Fill the empty transmit FIFO from the output rings. A client keeps its turn
+ * until it finishes a line, runs out of output or uses up its quantum.
+ * Returns the number of characters written. */
+static int fill_fifo(void) {
+    int written = 0;
+    while (written < fifo_depth) {
+        if (tx_escape != NULL) {
+            if (*tx_escape == '\0') {
+                tx_escape = NULL;
+            } else {
+                write_thr(*tx_escape++);
+                written++;
+            }
+            continue;
+        }
+        if (tx_client == -1 && !select_tx_client()) {
+            break;
+        }
+        output_client_t *client = &output_clients[tx_client];
+        int c = output_next_char(client);
+        if (c == -1) {
+            tx_client = -1;
+            continue;
+        }
+        write_thr((uint8_t)c);
+        written++;
+        tx_quantum--;
+        if ((c == '\n' && !client->pending_cr) || tx_quantum == 0) {
+            tx_client = -1;
+        }
+    }
+    return written;
+}
+
+static void set_tx_interrupt(bool enable) {
+    tx_active = enable;
+    write_ier(enable ? (IER_RDA | IER_THR) : IER_RDA);
+}
+
+/* Called with the serial lock held when the THR empty interrupt fires */
+static void transmit_output(void) {
+    fifo_used = fill_fifo();
+    if (fifo_used == 0) {
+        set_tx_interrupt(false);
+    }
+}
+
+/* Called with the serial lock held when a client may have queued output.
+ * The THR empty interrupt fires as soon as the FIFO is empty, and drains
+ * the rings from then on. */
+static void start_output(void) {
+    if (!tx_active && (tx_client != -1 || select_tx_client())) {
+        set_tx_interrupt(true);
+    }
+}
+
+static output_client_t *find_output_client(seL4_Word client_id, bool processed) {
+    for (int i = 0; i < num_output_clients; i++) {
+        if (output_clients[i].client_id == client_id && output_clients[i].processed == processed) {
+            return &output_clients[i];
+        }
+    }
+    return NULL;
+}
+
+/* A client's ring is full. Write out everything it has queued and then c,
+ * without waiting for the THR empty interrupt. */
+static void flush_output_client(output_client_t *client, int c) {
+    int UNUSED error;
+    error = serial_lock();
+    if (tx_escape != NULL) {
+        /* don't split a colour change */
+        serial_puts(tx_escape);
+        tx_escape = NULL;
+    }
+    if (client->colour != last_out) {
+        last_out = client->colour;
+        serial_puts(COLOR_RESET);
+        serial_puts(all_output_colours[last_out]);
+    }
+    int next;
+    while ((next = output_next_char(client)) != -1) {
+        serial_putchar(next);
+    }
+    serial_putchar(c);
+    if (client->processed && c == '\n') {
+        serial_putchar('\r');
+    }
+    /* the client's line may continue in the ring */
+    tx_client = client - output_clients;
+    tx_quantum = OUTPUT_QUANTUM;
+    start_output();
+    error = serial_unlock();
+}
+
+static void add_output_clients(unsigned int num_badges, seL4_Word (*enumerate_badge)(unsigned int),
+                               void *(*buf)(seL4_Word), size_t (*buf_size)(seL4_Word), bool processed) {
+    for (unsigned int i = 0; i < num_badges; i++) {
+        output_client_t *client = &output_clients[num_output_clients++];
+        client->client_id = enumerate_badge(i);
+        client->ring = buf(client->client_id);
+        client->size = buf_size(client->client_id) - offsetof(output_ring_t, data);
+        client->colour = client->client_id % MAX_CLIENTS + (processed ? 0 : MAX_CLIENTS);
+        client->processed = processed;
+    }
+}
+
+static void init_output_clients(void) {
+    unsigned int num_processed = processed_putchar_num_badges ? processed_putchar_num_badges() : 0;
+    unsigned int num_raw = raw_putchar_num_badges ? raw_putchar_num_badges() : 0;
+    if (num_processed + num_raw == 0) {
+        return;
+    }
+    output_clients = calloc(num_processed + num_raw, sizeof(output_client_t));
+    ZF_LOGF_IF(output_clients == NULL, "Failed to allocate output clients");
+    if (num_processed > 0) {
+        add_output_clients(num_processed, processed_putchar_enumerate_badge, processed_putchar_buf,
+                           processed_putchar_buf_size, true);
+        output_badge |= processed_putchar_notification_badge();
+    }
+    if (num_raw > 0) {
+        add_output_clients(num_raw, raw_putchar_enumerate_badge, raw_putchar_buf,
+                           raw_putchar_buf_size, false);
+        output_badge |= raw_putchar_notification_badge();
+    }
+}
+
 static void flush_buffer(int b) {
     const char *col = all_output_colours[b];
     int i;
@@ -586,6 +820,9 @@ static void clear_iir(bool initialised) {
             read_msr();
             break;
         case IIR_THR:
+            if (initialised && tx_active) {
+                transmit_output();
+            }
             break;
         case IIR_RDA:
         case IIR_TIME:
@@ -601,7 +838,7 @@ static void clear_iir(bool initialised) {
 }
 
 static void enable_interrupt() {
-    write_ier(1);
+    write_ier(IER_RDA);
 }
 
 void serial_irq_handle() {
@@ -645,8 +882,17 @@ seL4_CPtr timeout_notification(void);
 int run(void) {
     seL4_CPtr notification = timeout_notification();
     while(1) {
-        seL4_Wait(notification, NULL);
-        timer_callback(NULL);
+        seL4_Word badge;
+        seL4_Wait(notification, &badge);
+        if (badge & output_badge) {
+            int UNUSED error;
+            error = serial_lock();
+            start_output();
+            error = serial_unlock();
+        }
+        if (badge & ~output_badge) {
+            timer_callback(NULL);
+        }
     }
     return 0;
 }
@@ -679,6 +925,7 @@ void pre_init(void) {
             getchar_clients[badge].last_head = -1;
         }
     }
+    init_output_clients();
     set_putchar(serial_putchar);
     error = serial_irq_acknowledge();
     /* Start regular heartbeat of 500ms */
@@ -689,6 +936,11 @@ void pre_init(void) {
 seL4_Word processed_putchar_get_sender_id(void) WEAK;
 void processed_putchar_putchar(int c) {
     seL4_Word n = processed_putchar_get_sender_id();
+    output_client_t *client = find_output_client(n, true);
+    if (client != NULL) {
+        flush_output_client(client, c);
+        return;
+    }
     internal_putchar((int)n, c);
     if (c == '\n') {
         internal_putchar(n, '\r');
@@ -698,6 +950,11 @@ void processed_putchar_putchar(int c) {
 seL4_Word raw_putchar_get_sender_id(void) WEAK;
 void raw_putchar_putchar(int c) {
     seL4_Word n = raw_putchar_get_sender_id();
+    output_client_t *client = find_output_client(n, false);
+    if (client != NULL) {
+        flush_output_client(client, c);
+        return;
+    }
     internal_putchar((int)n + MAX_CLIENTS, c);
 }
 
@@ -34,10 +34,13 @@ static ltimer_t ltimer;
 /* time manager for timeout multiplexing */
 static time_manager_t time_manager;
 
-/* declare the memory needed for the clients
- * this field tracks which timeouts have triggered
- * for a specific client */
-uint32_t *client_state = NULL;
+/* clients with newly completed timeouts that have not been notified yet.
+ * While handling an irq, notifications are deferred so that each client is
+ * signalled at most once however many of its timeouts expired. */
+static unsigned int *pending_clients = NULL;
+static unsigned int num_pending_clients = 0;
+static bool *client_pending = NULL;
+static bool coalesce_signals = false;
 
 static uint64_t tsc_frequency = 0;
 
@@ -45,6 +48,8 @@ static uint64_t tsc_frequency = 0;
 seL4_Word the_timer_get_sender_id();
 void the_timer_emit(unsigned int);
 int the_timer_largest_badge(void);
+void the_timer_publish_clock(uint64_t tsc_frequency, uint64_t offset_ns);
+volatile uint32_t *the_timer_completed_state(unsigned int badge);
 
 static inline uint64_t current_time_ns() {
     uint64_t time;
@@ -63,14 +68,30 @@ static int signal_client(uintptr_t token) {
     int cid = ((int) token) / timers_per_client;
     int tid = ((int) token) % timers_per_client;
 
-    assert(client_state != NULL);
+    /* the completion bits are shared with the client, which may consume
+     * them at any time */
+    __atomic_fetch_or(the_timer_completed_state(cid + 1), BIT(tid), __ATOMIC_RELEASE);
 
-    client_state[cid] |= BIT(tid);
-    the_timer_emit(cid + 1);
+    if (!coalesce_signals) {
+        the_timer_emit(cid + 1);
+    } else if (!client_pending[cid]) {
+        client_pending[cid] = true;
+        pending_clients[num_pending_clients++] = cid;
+    }
 
     return 0;
 }
 
+static void signal_pending_clients(void)
+{
+    for (unsigned int i = 0; i < num_pending_clients; i++) {
+        unsigned int cid = pending_clients[i];
+        client_pending[cid] = false;
+        the_timer_emit(cid + 1);
+    }
+    num_pending_clients = 0;
+}
+
 void irq_handle() {
     int error = time_server_lock();
     ZF_LOGF_IF(error, "Failed to lock time server");
@@ -78,8 +99,11 @@ void irq_handle() {
     error = irq_acknowledge();
     ZF_LOGF_IF(error, "irq acknowledge failed");
 
+    coalesce_signals = true;
     error = tm_update(&time_manager);
     ZF_LOGF_IF(error, "Failed to update time manager");
+    coalesce_signals = false;
+    signal_pending_clients();
 
     error = time_server_unlock();
     ZF_LOGF_IF(error, "Failed to unlock time server");
@@ -164,9 +188,7 @@ static unsigned int _completed(int cid) {
     int error = time_server_lock();
     ZF_LOGF_IF(error, "Failed to lock time server");
 
-    assert(client_state != NULL);
-    unsigned int ret = client_state[cid];
-    client_state[cid] = 0;
+    unsigned int ret = __atomic_exchange_n(the_timer_completed_state(cid + 1), 0, __ATOMIC_ACQ_REL);
 
     error = time_server_unlock();
     ZF_LOGF_IF(error, "Failed to unlock time server");
@@ -258,8 +280,11 @@ void post_init() {
     error = ps_new_stdlib_malloc_ops(&ops.malloc_ops);
     ZF_LOGF_IF(error, "Failed to get malloc ops");
 
-    error = ps_calloc(&ops.malloc_ops, the_timer_largest_badge(), sizeof(*client_state), (void **) &client_state);
-    ZF_LOGF_IF(error, "Failed to allocate client state")
+    error = ps_calloc(&ops.malloc_ops, the_timer_largest_badge(), sizeof(*pending_clients), (void **) &pending_clients);
+    ZF_LOGF_IF(error, "Failed to allocate pending clients");
+
+    error = ps_calloc(&ops.malloc_ops, the_timer_largest_badge(), sizeof(*client_pending), (void **) &client_pending);
+    ZF_LOGF_IF(error, "Failed to allocate client state");
 
     error = ltimer_pit_init(&ltimer, ops);
     ZF_LOGF_IF(error, "Failed to get timer");
@@ -288,6 +313,11 @@ void post_init() {
         tsc_frequency = ltimer_pit_get_tsc_freq(&ltimer);
     }
 
+    /* Let clients read the time directly. current_time_ns() converts the
+     * TSC using the PIT calibrated frequency rather than tsc_frequency, so
+     * that is the frequency clients need to agree with our time() */
+    the_timer_publish_clock(ltimer_pit_get_tsc_freq(&ltimer), 0);
+
     error = time_server_unlock();
     ZF_LOGF_IF(error, "Failed to unlock timer server");
 
@@ -0,0 +1,143 @@
+/*#
+ *#Copyright 2017, Data61
+ *#Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ *#ABN 41 687 119 230.
+ *#
+ *#This software may be distributed and modified according to the terms of
+ *#the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ *#See "LICENSE_BSD2.txt" for details.
+ *#
+ *#@TAG(DATA61_BSD)
+  #*/
+/*- include 'seL4RPCDataport-from.template.c' -*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*# The file server's archive is mapped read only into every client #*/
+/*- set archive_size = configuration[me.parent.to_instance.name].get('%s_archive_size' % me.parent.to_interface.name, 0) -*/
+/*- if archive_size == 0 -*/
+  /*? raise(Exception('%s.%s_archive_size must be set to the size of its archive' % (me.parent.to_instance.name, me.parent.to_interface.name))) ?*/
+/*- endif -*/
+/*- set archive_symbol = 'from_%s_archive' % me.interface.name -*/
+struct {
+    char content[ROUND_UP_UNSAFE(/*? archive_size ?*/, PAGE_SIZE_4K)];
+} /*? archive_symbol ?*/
+        __attribute__((aligned(PAGE_SIZE_4K)))
+        __attribute__((section("shared_/*? archive_symbol ?*/")))
+        __attribute__((externally_visible));
+
+/*- do register_shared_variable('%s_archive' % me.parent.name, archive_symbol, 'R') -*/
+/*- do keep_symbol(archive_symbol) -*/
+
+int64_t /*? me.interface.name ?*/_map(int fd, uint64_t *size);
+
+const void * /*? me.interface.name ?*/_mmap(int fd, size_t *size) {
+    uint64_t file_size;
+    int64_t offset = /*? me.interface.name ?*/_map(fd, &file_size);
+    if (offset < 0) {
+        return NULL;
+    }
+    *size = file_size;
+    return &/*? archive_symbol ?*/.content[offset];
+}
+
+/*# Reads can also be queued in a ring shared with the file server, which
+ *# works through them while the client carries on #*/
+#include <sys/types.h>
+#include <sel4/sel4.h>
+
+/*- set index = me.parent.from_ends.index(me) -*/
+/*- set async_slots = configuration[me.instance.name].get('%s_async_slots' % me.interface.name, 8) -*/
+/*- set async_slot_size = configuration[me.instance.name].get('%s_async_slot_size' % me.interface.name, 16384) -*/
+/*- if async_slots < 1 or async_slots > 128 -*/
+  /*? raise(Exception('%s.%s_async_slots must be between 1 and 128' % (me.instance.name, me.interface.name))) ?*/
+/*- endif -*/
+/*- set doorbell_obj = alloc_obj('doorbell', seL4_NotificationObject) -*/
+/*- set doorbell = alloc_cap('doorbell', doorbell_obj, write=True) -*/
+/*- set completion = alloc('completion_%d' % index, seL4_NotificationObject, read=True) -*/
+
+/* This layout is shared with the file server */
+typedef struct {
+    int32_t fd;
+    uint32_t size;
+    uint64_t offset;
+    /* bytes read or a negative error code, set by the file server */
+    int64_t result;
+} /*? me.interface.name ?*/_async_request_t;
+
+typedef struct {
+    /* requests queued by the client */
+    uint32_t submitted;
+    /* whether the client is blocked waiting for a request to complete */
+    uint32_t waiting;
+    char client_padding[56];
+    /* requests completed by the file server */
+    uint32_t completed;
+    char server_padding[60];
+    /*? me.interface.name ?*/_async_request_t requests[/*? async_slots ?*/];
+} /*? me.interface.name ?*/_async_ring_t;
+
+/*- set async_symbol = 'from_%s_async' % me.interface.name -*/
+struct {
+    char content[ROUND_UP_UNSAFE(PAGE_SIZE_4K + /*? async_slots ?*/ * /*? async_slot_size ?*/, PAGE_SIZE_4K)];
+} /*? async_symbol ?*/
+        __attribute__((aligned(PAGE_SIZE_4K)))
+        __attribute__((section("shared_/*? async_symbol ?*/")))
+        __attribute__((externally_visible));
+
+/*- do register_shared_variable('%s_async_%d' % (me.parent.name, index), async_symbol, 'RW') -*/
+/*- do keep_symbol(async_symbol) -*/
+
+static uint32_t /*? me.interface.name ?*/_async_consumed;
+
+size_t /*? me.interface.name ?*/_async_slot_size(void) {
+    return /*? async_slot_size ?*/;
+}
+
+int /*? me.interface.name ?*/_read_async(int fd, uint64_t offset, size_t size) {
+    volatile /*? me.interface.name ?*/_async_ring_t *ring = (volatile void *) &/*? async_symbol ?*/;
+    uint32_t submitted = ring->submitted;
+    if (submitted - /*? me.interface.name ?*/_async_consumed == /*? async_slots ?*/) {
+        return -1;
+    }
+    volatile /*? me.interface.name ?*/_async_request_t *request = &ring->requests[submitted % /*? async_slots ?*/];
+    request->fd = fd;
+    request->offset = offset;
+    request->size = MIN(size, /*? async_slot_size ?*/);
+    __atomic_store_n(&ring->submitted, submitted + 1, __ATOMIC_RELEASE);
+
+    /* Order the store to submitted before the load of completed. Either the
+     * file server sees this request, or we see that it has caught up and wake it. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->completed, __ATOMIC_RELAXED) == submitted) {
+        seL4_Signal(/*? doorbell ?*/);
+    }
+    return 0;
+}
+
+ssize_t /*? me.interface.name ?*/_read_wait(const void **data) {
+    volatile /*? me.interface.name ?*/_async_ring_t *ring = (volatile void *) &/*? async_symbol ?*/;
+    uint32_t consumed = /*? me.interface.name ?*/_async_consumed;
+    if (consumed == ring->submitted) {
+        /* nothing queued */
+        return -1;
+    }
+    while (__atomic_load_n(&ring->completed, __ATOMIC_ACQUIRE) == consumed) {
+        ring->waiting = 1;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->completed, __ATOMIC_ACQUIRE) != consumed) {
+            break;
+        }
+        seL4_Wait(/*? completion ?*/, NULL);
+    }
+    ring->waiting = 0;
+
+    unsigned int slot = consumed % /*? async_slots ?*/;
+    ssize_t result = ring->requests[slot].result;
+    if (data != NULL) {
+        *data = &/*? async_symbol ?*/.content[PAGE_SIZE_4K + slot * /*? async_slot_size ?*/];
+    }
+    /*? me.interface.name ?*/_async_consumed = consumed + 1;
+    return result;
+}
@@ -0,0 +1,94 @@
+/*#
+ *#Copyright 2017, Data61
+ *#Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ *#ABN 41 687 119 230.
+ *#
+ *#This software may be distributed and modified according to the terms of
+ *#the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ *#See "LICENSE_BSD2.txt" for details.
+ *#
+ *#@TAG(DATA61_BSD)
+  #*/
+/*- include 'seL4RPCDataport-to.template.c' -*/
+
+/*# The archive is defined by the source from MakeFileServerArchive #*/
+/*- set archive_size = configuration[me.instance.name].get('%s_archive_size' % me.interface.name, 0) -*/
+/*- do register_shared_variable('%s_archive' % me.parent.name, '_cpio_archive', 'R') -*/
+/*- do keep_symbol('_cpio_archive') -*/
+
+size_t /*? me.interface.name ?*/_archive_bytes(void) {
+    return ROUND_UP_UNSAFE(/*? archive_size ?*/, PAGE_SIZE_4K);
+}
+
+/*# Rings of queued reads, one for each client #*/
+#include <sel4/sel4.h>
+
+/*- set doorbell = alloc('doorbell', seL4_NotificationObject, read=True) -*/
+
+seL4_CPtr /*? me.interface.name ?*/_doorbell(void) {
+    return /*? doorbell ?*/;
+}
+
+/*- set async_clients = [] -*/
+/*- for c in me.parent.from_ends -*/
+    /*- set index = loop.index0 -*/
+    /*- set badge = configuration[c.instance.name].get('%s_attributes' % c.interface.name).strip('"') -*/
+    /*- set async_slots = configuration[c.instance.name].get('%s_async_slots' % c.interface.name, 8) -*/
+    /*- set async_slot_size = configuration[c.instance.name].get('%s_async_slot_size' % c.interface.name, 16384) -*/
+    /*- set async_symbol = 'to_%s_async_%d' % (me.interface.name, index) -*/
+    struct {
+        char content[ROUND_UP_UNSAFE(PAGE_SIZE_4K + /*? async_slots ?*/ * /*? async_slot_size ?*/, PAGE_SIZE_4K)];
+    } /*? async_symbol ?*/
+            __attribute__((aligned(PAGE_SIZE_4K)))
+            __attribute__((section("shared_/*? async_symbol ?*/")))
+            __attribute__((externally_visible));
+
+    /*- do register_shared_variable('%s_async_%d' % (me.parent.name, index), async_symbol, 'RW') -*/
+    /*- do keep_symbol(async_symbol) -*/
+
+    /*- set completion_obj = alloc_obj('completion_%d' % index, seL4_NotificationObject) -*/
+    /*- set completion = alloc_cap('completion_%d' % index, completion_obj, write=True) -*/
+    /*- do async_clients.append((async_symbol, badge, async_slots, async_slot_size, completion)) -*/
+/*- endfor -*/
+
+static const struct {
+    void *buf;
+    seL4_Word badge;
+    unsigned int slots;
+    size_t slot_size;
+    seL4_CPtr completion;
+} /*? me.interface.name ?*/_async_clients[] = {
+    /*- for symbol, badge, slots, slot_size, completion in async_clients -*/
+    {
+        .buf = &/*? symbol ?*/,
+        .badge = /*? badge ?*/,
+        .slots = /*? slots ?*/,
+        .slot_size = /*? slot_size ?*/,
+        .completion = /*? completion ?*/,
+    },
+    /*- endfor -*/
+};
+
+unsigned int /*? me.interface.name ?*/_async_num_clients(void) {
+    return ARRAY_SIZE(/*? me.interface.name ?*/_async_clients);
+}
+
+void * /*? me.interface.name ?*/_async_buf(unsigned int client) {
+    return /*? me.interface.name ?*/_async_clients[client].buf;
+}
+
+seL4_Word /*? me.interface.name ?*/_async_badge(unsigned int client) {
+    return /*? me.interface.name ?*/_async_clients[client].badge;
+}
+
+unsigned int /*? me.interface.name ?*/_async_slots(unsigned int client) {
+    return /*? me.interface.name ?*/_async_clients[client].slots;
+}
+
+size_t /*? me.interface.name ?*/_async_slot_size(unsigned int client) {
+    return /*? me.interface.name ?*/_async_clients[client].slot_size;
+}
+
+void /*? me.interface.name ?*/_async_emit(unsigned int client) {
+    seL4_Signal(/*? me.interface.name ?*/_async_clients[client].completion);
+}
@@ -0,0 +1,60 @@
+/*#
+ *#Copyright 2017, Data61
+ *#Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ *#ABN 41 687 119 230.
+ *#
+ *#This software may be distributed and modified according to the terms of
+ *#the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ *#See "LICENSE_BSD2.txt" for details.
+ *#
+ *#@TAG(DATA61_BSD)
+  #*/
+/*- include 'seL4RPCDataport-from.template.c' -*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sel4/sel4.h>
+
+/*# Output is queued in a ring in the dataport, and the serial server's
+ *# global endpoint is signalled when it may have gone idle #*/
+/*- set is_reader = False -*/
+/*- set instance = me.parent.to_instance.name -*/
+/*- set interface = me.parent.to_interface.name -*/
+/*- include 'global-endpoint.template.c' -*/
+/*- set notification = pop('notification') -*/
+
+/* This layout is shared with the serial server */
+typedef struct {
+    /* next character the serial server will write out */
+    uint32_t head;
+    char head_padding[60];
+    /* next free slot in data */
+    uint32_t tail;
+    char tail_padding[60];
+    char data[];
+} /*? me.interface.name ?*/_ring_t;
+
+void /*? me.interface.name ?*/_putchar(int c);
+
+void /*? me.interface.name ?*/_putchar_fast(int c) {
+    volatile /*? me.interface.name ?*/_ring_t *ring = (volatile void *) /*? me.interface.name ?*/_buf;
+    uint32_t size = /*? me.interface.name ?*/_get_size() - offsetof(/*? me.interface.name ?*/_ring_t, data);
+    uint32_t tail = ring->tail;
+    uint32_t next_tail = (tail + 1) % size;
+
+    if (next_tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+        /* The ring is full. The server writes out what is queued, and then
+         * this character, before returning. */
+        /*? me.interface.name ?*/_putchar(c);
+        return;
+    }
+    ring->data[tail] = (char)c;
+    __atomic_store_n(&ring->tail, next_tail, __ATOMIC_RELEASE);
+
+    /* Order the store to tail before the load of head. Either the server
+     * sees this character, or we see that it has drained the ring and wake it. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) == tail) {
+        seL4_Signal(/*? notification ?*/);
+    }
+}
@@ -0,0 +1,21 @@
+/*#
+ *#Copyright 2017, Data61
+ *#Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ *#ABN 41 687 119 230.
+ *#
+ *#This software may be distributed and modified according to the terms of
+ *#the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ *#See "LICENSE_BSD2.txt" for details.
+ *#
+ *#@TAG(DATA61_BSD)
+  #*/
+/*- include 'seL4RPCDataport-to.template.c' -*/
+
+/*- set badge = configuration[me.instance.name].get('%s_badge' % me.interface.name) -*/
+/*- if badge is none or configuration[me.instance.name].get('%s_global_endpoint' % me.interface.name) is none -*/
+  /*? raise(Exception('%s.%s_global_endpoint and %s.%s_badge must be set' % (me.instance.name, me.interface.name, me.instance.name, me.interface.name))) ?*/
+/*- endif -*/
+
+seL4_Word /*? me.interface.name ?*/_notification_badge(void) {
+    return /*? badge.strip('"') ?*/;
+}
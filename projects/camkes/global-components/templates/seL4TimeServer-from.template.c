@@ -21,4 +21,70 @@ seL4_CPtr /*? me.interface.name ?*/_notification(void) {
     return /*? notification ?*/;
 }
 
+/*# The time server publishes the parameters of its clock in a page shared
+ *# read only with all of its clients, so time can be read without an RPC #*/
+#include <autoconf.h>
+#include <stdint.h>
+#include <utils/util.h>
+#ifdef CONFIG_ARCH_X86
+#include <platsupport/arch/tsc.h>
+#endif
+
+/*- set clock_symbol = 'from_%s_clock' % me.interface.name -*/
+struct {
+    /* odd while the time server is updating the clock */
+    uint32_t seq;
+    /* frequency of the counter used by the time server, 0 if there is none */
+    uint64_t tsc_frequency;
+    /* added to the counter time to get the time server's time */
+    uint64_t offset_ns;
+    char padding[PAGE_SIZE_4K - 3 * sizeof(uint64_t)];
+} /*? clock_symbol ?*/
+        __attribute__((aligned(PAGE_SIZE_4K)))
+        __attribute__((section("shared_/*? clock_symbol ?*/")))
+        __attribute__((externally_visible));
+
+/*- do register_shared_variable('%s_clock' % me.parent.name, clock_symbol, 'R') -*/
+/*- do keep_symbol(clock_symbol) -*/
+
+uint64_t /*? me.interface.name ?*/_time(void);
+
+uint64_t /*? me.interface.name ?*/_time_fast(void) {
+#ifdef CONFIG_ARCH_X86
+    volatile typeof(/*? clock_symbol ?*/) *clock = &/*? clock_symbol ?*/;
+    uint32_t seq;
+    uint64_t tsc_frequency, offset_ns;
+    do {
+        seq = clock->seq;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        tsc_frequency = clock->tsc_frequency;
+        offset_ns = clock->offset_ns;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != clock->seq);
+
+    if (tsc_frequency != 0) {
+        return tsc_get_time(tsc_frequency) + offset_ns;
+    }
+#endif
+    /* no counter to read directly, ask the time server */
+    return /*? me.interface.name ?*/_time();
+}
+
+/*# Timers completed for this client, set by the time server #*/
+/*- set badge = configuration[me.instance.name].get("%s_attributes" % me.interface.name) -*/
+/*- set completed_symbol = 'from_%s_completed' % me.interface.name -*/
+struct {
+    uint32_t completed;
+    char padding[PAGE_SIZE_4K - sizeof(uint32_t)];
+} /*? completed_symbol ?*/
+        __attribute__((aligned(PAGE_SIZE_4K)))
+        __attribute__((section("shared_/*? completed_symbol ?*/")))
+        __attribute__((externally_visible));
+
+/*- do register_shared_variable('%s_%s_completed' % (me.parent.name, badge), completed_symbol, 'RW') -*/
+/*- do keep_symbol(completed_symbol) -*/
+
+unsigned int /*? me.interface.name ?*/_completed_fast(void) {
+    return __atomic_exchange_n(&/*? completed_symbol ?*/.completed, 0, __ATOMIC_ACQ_REL);
+}
 
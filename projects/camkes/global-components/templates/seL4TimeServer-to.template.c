@@ -11,6 +11,9 @@
   #*/
 /*- include 'seL4RPCCall-to.template.c' -*/
 
+#include <stdint.h>
+#include <utils/util.h>
+
 /*- set badges = [] -*/
 /*- for c in me.parent.from_ends -*/
     /*- set is_reader = False -*/
@@ -22,6 +25,19 @@
     void /*? me.interface.name ?*/_emit_/*? badge ?*/(void) {
         seL4_Signal(/*? notification ?*/);
     }
+
+    /*# Completed timers for this client, shared so they can be consumed without an RPC #*/
+    /*- set completed_symbol = 'to_%s_%s_completed' % (me.interface.name, badge) -*/
+    struct {
+        uint32_t completed;
+        char padding[PAGE_SIZE_4K - sizeof(uint32_t)];
+    } /*? completed_symbol ?*/
+            __attribute__((aligned(PAGE_SIZE_4K)))
+            __attribute__((section("shared_/*? completed_symbol ?*/")))
+            __attribute__((externally_visible));
+
+    /*- do register_shared_variable('%s_%s_completed' % (me.parent.name, badge), completed_symbol, 'RW') -*/
+    /*- do keep_symbol(completed_symbol) -*/
     /*- do badges.append(badge) -*/
 /*- endfor -*/
 
@@ -40,6 +56,43 @@ void /*? me.interface.name ?*/_emit(unsigned int badge) {
     lookup[badge]();
 }
 
+volatile uint32_t * /*? me.interface.name ?*/_completed_state(unsigned int badge) {
+    static volatile uint32_t *lookup[] = {
+        /*- for badge in badges -*/
+            [/*? badge ?*/] = &to_/*? me.interface.name ?*/_/*? badge ?*/_completed.completed,
+        /*- endfor -*/
+    };
+    assert(badge < ARRAY_SIZE(lookup));
+    assert(lookup[badge]);
+    return lookup[badge];
+}
+
 int /*? me.interface.name ?*/_largest_badge(void) {
     return /*? badges[len(badges) - 1] ?*/;
 }
+
+/*# Clock parameters shared read only with every client, see the from side #*/
+/*- set clock_symbol = 'to_%s_clock' % me.interface.name -*/
+struct {
+    uint32_t seq;
+    uint64_t tsc_frequency;
+    uint64_t offset_ns;
+    char padding[PAGE_SIZE_4K - 3 * sizeof(uint64_t)];
+} /*? clock_symbol ?*/
+        __attribute__((aligned(PAGE_SIZE_4K)))
+        __attribute__((section("shared_/*? clock_symbol ?*/")))
+        __attribute__((externally_visible));
+
+/*- do register_shared_variable('%s_clock' % me.parent.name, clock_symbol, 'RW') -*/
+/*- do keep_symbol(clock_symbol) -*/
+
+void /*? me.interface.name ?*/_publish_clock(uint64_t tsc_frequency, uint64_t offset_ns) {
+    volatile typeof(/*? clock_symbol ?*/) *clock = &/*? clock_symbol ?*/;
+    clock->seq++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    clock->tsc_frequency = tsc_frequency;
+    clock->offset_ns = offset_ns;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    clock->seq++;
+}
+
@@ -45,6 +45,32 @@ typedef struct sel4utils_elf_region {
     int segment_index;
 } sel4utils_elf_region_t;
 
+typedef struct sel4utils_image_cache sel4utils_image_cache_t;
+
+/* Frames backing the read only segments of one elf image, shared by every process loaded
+ * from that image through the cache */
+typedef struct sel4utils_image_cache_entry {
+    /* name of the image in the cpio archive */
+    char *image_name;
+    /* the image in the cpio archive, which never changes */
+    char *elf_file;
+    /* one frame per 4k page of the read only reservations, sorted by vaddr */
+    size_t num_frames;
+    uintptr_t *vaddrs;
+    vka_object_t *frames;
+    /* number of processes currently mapping these frames */
+    int refcount;
+    sel4utils_image_cache_t *cache;
+    struct sel4utils_image_cache_entry *next;
+} sel4utils_image_cache_entry_t;
+
+struct sel4utils_image_cache {
+    /* allocator and vspace used to create and fill the shared frames */
+    vka_t *vka;
+    vspace_t *vspace;
+    sel4utils_image_cache_entry_t *head;
+};
+
 /**
  * Load an elf file into a vspace.
  *
@@ -101,6 +127,101 @@ sel4utils_elf_load(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka,
 void *
 sel4utils_elf_reserve(vspace_t *loadee, const char *image_name, sel4utils_elf_region_t *regions);
 
+/**
+ * Demand page a single page of an elf image that was reserved, but not loaded, with
+ * sel4utils_elf_reserve.
+ *
+ * A frame is allocated for the page containing vaddr and mapped into the reservation that
+ * covers it. Any file backed segment data on that page is copied in through a temporary
+ * mapping in the loader vspace; pages that are entirely .bss are left zero filled.
+ *
+ * This is intended to be called by whoever handles VM faults for the loadee, after which
+ * the faulting thread can be resumed.
+ *
+ * @param loadee the vspace the elf was reserved in
+ * @param loader the vspace we are loading from
+ * @param loadee_vka allocator to use for allocation in the loadee vspace
+ * @param loader_vka allocator to use for loader vspace. Can be the same as loadee_vka.
+ * @param elf_file the image as returned by sel4utils_elf_get_file.
+ * @param num_regions number of regions as reported by sel4utils_elf_num_regions
+ * @param regions region array as filled in by sel4utils_elf_reserve
+ * @param vaddr faulting virtual address in the loadee vspace
+ *
+ * @return 0 on success, non zero if vaddr is not an unpopulated page of the image or on error.
+ */
+int
+sel4utils_elf_load_page(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka,
+                        void *elf_file, int num_regions, sel4utils_elf_region_t regions[num_regions],
+                        void *vaddr);
+
+/**
+ * Find an image in the cpio archive. The archive is never unmapped, so the image can be
+ * looked up once, when it is reserved, rather than on every call to sel4utils_elf_load_page.
+ *
+ * @param image_name name of the image in the cpio archive.
+ *
+ * @return the start of the image, NULL if there is no such image.
+ */
+void *
+sel4utils_elf_get_file(const char *image_name);
+
+/**
+ * Initialise an image cache for sel4utils_elf_load_shared.
+ *
+ * @param cache cache to initialise
+ * @param vka allocator used to allocate the shared frames. Frame caps are copied out of
+ *            its cspace, so it must share a cspace with the vkas of the loaded processes.
+ * @param vspace the current vspace, used to temporarily map frames while filling them.
+ */
+void sel4utils_image_cache_init(sel4utils_image_cache_t *cache, vka_t *vka, vspace_t *vspace);
+
+/**
+ * Free the shared frames of every cached image that is no longer used by any process.
+ *
+ * @param cache cache to flush
+ */
+void sel4utils_image_cache_flush(sel4utils_image_cache_t *cache);
+
+/**
+ * Load an elf file into a vspace, sharing read only segments with every other vspace that
+ * was loaded from the same image through the same cache.
+ *
+ * Writable segments are given private frames as with sel4utils_elf_load. Read only
+ * segments (such as .text and .rodata) are loaded once into frames owned by the cache; each
+ * loadee is only given read only copies of those frame caps. The mappings of the copies have no
+ * cookie, so tearing down the loadee vspace does not free the shared frames.
+ *
+ * @param loadee the vspace to load the elf file into
+ * @param loader the vspace we are loading from
+ * @param loadee_vka allocator to use for allocation in the loadee vspace
+ * @param loader_vka allocator to use for loader vspace. Can be the same as loadee_vka.
+ * @param cache image cache to share frames through.
+ * @param image_name name of the image in the cpio archive to load.
+ * @param entry returns the cache entry that the loadee now holds a reference to.
+ * @param shared_caps returns the array of frame cap copies mapped into the loadee.
+ *
+ * Both entry and shared_caps must be passed to sel4utils_elf_unload_shared when the loadee is
+ * destroyed, including when this function fails after setting them.
+ *
+ * @return The entry point of the new process, NULL on error
+ */
+void *
+sel4utils_elf_load_shared(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka,
+                          sel4utils_image_cache_t *cache, const char *image_name,
+                          sel4utils_image_cache_entry_t **entry, seL4_CPtr **shared_caps);
+
+/**
+ * Release the shared frames mapped by sel4utils_elf_load_shared.
+ *
+ * Deletes the cap copies (which removes their mappings) and drops the reference on the cache
+ * entry. The frames themselves stay in the cache until sel4utils_image_cache_flush.
+ *
+ * @param loadee_vka allocator the cap copies were allocated from
+ * @param entry cache entry returned by sel4utils_elf_load_shared, may be NULL.
+ * @param shared_caps cap array returned by sel4utils_elf_load_shared.
+ */
+void sel4utils_elf_unload_shared(vka_t *loadee_vka, sel4utils_image_cache_entry_t *entry, seL4_CPtr *shared_caps);
+
 /**
  * Parses an elf file and returns the number of loadable regions. The result of this
  * is used to calculate the number of regions to pass to sel4utils_elf_reserve and
@@ -135,6 +256,20 @@ uintptr_t sel4utils_elf_get_vsyscall(const char *image_name);
  */
 uintptr_t sel4utils_elf_get_section(const char *image_name, const char *section_name, uint64_t* section_size);
 
+/**
+ * Finds a symbol in an elf file and returns its value. Like sections, symbols
+ * are found through an index of the image that is built on first use.
+ *
+ * @param image_name name of the image in the cpio archive to inspect
+ *
+ * @param symbol_name name of the symbol to find
+ *
+ * @param symbol_size optional pointer to uint64_t to return the symbol size
+ *
+ * @return Value of the symbol or 0 if not found
+ */
+uintptr_t sel4utils_elf_get_symbol(const char *image_name, const char *symbol_name, uint64_t* symbol_size);
+
 /**
  * Parses an elf file and returns the number of phdrs. The result of this
  * can be used prior to a call to sel4utils_elf_read_phdrs
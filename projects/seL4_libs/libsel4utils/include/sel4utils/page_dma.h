@@ -22,8 +22,11 @@
 /**
  * Creates an implementation of a dma manager that is designed to allocate at page granularity. Due
  * to implementation details it will round up all allocations to the next power of 2, or 4k (whichever
- * is larger). This allocator will put mappings into the vspace with custom cookie values and you
- * must free all dma allocations before tearing down the vspace
+ * is larger). Each allocation is carved from a single untyped, so it is physically contiguous and
+ * aligned to its size both physically and virtually. With CONFIG_SEL4UTILS_DMA_LARGE_FRAMES,
+ * allocations of at least a large frame are mapped with large frames. This allocator will put
+ * mappings into the vspace with custom cookie values and you must free all dma allocations before
+ * tearing down the vspace
  * @param vka Allocation interface for allocating untypeds (for frames) and slots
  * @param vspace Virtual memory manager used for mapping frames
  * @param dma_man Pointer to dma manager struct that will be filled out
@@ -56,6 +56,15 @@ typedef struct {
      * you want to implement */
     int num_elf_regions;
     sel4utils_elf_region_t *elf_regions;
+    /* name of the image in the cpio archive, if the process was configured from an elf */
+    const char *image_name;
+    /* the image itself, if the elf was reserved rather than loaded, so that
+     * demand paging does not search the archive on every fault */
+    void *elf_file;
+    /* if the elf was loaded through an image cache, the entry and the frame cap
+     * copies that map its shared read only segments */
+    sel4utils_image_cache_entry_t *image_cache_entry;
+    seL4_CPtr *shared_frame_caps;
     bool own_vspace;
     bool own_cspace;
     bool own_ep;
@@ -192,6 +201,24 @@ int sel4utils_configure_process(sel4utils_process_t *process, vka_t *vka, vspace
 int sel4utils_configure_process_custom(sel4utils_process_t *process, vka_t *target_vka,
                                        vspace_t *spawner_vspace, sel4utils_process_config_t config);
 
+/**
+ * Handle a VM fault from a process whose elf was not preloaded (see process_config_elf),
+ * by demand paging the faulting page of the image in.
+ *
+ * Only pages inside the elf reservations that have not been populated yet are handled,
+ * anything else is a genuine fault. On success the caller should reply to the fault to
+ * resume the faulting thread.
+ *
+ * @param process       process that faulted.
+ * @param vka           allocator that was used to configure the process.
+ * @param spawner_vspace the current vspace, used to temporarily map frames for copying.
+ * @param vaddr         faulting virtual address.
+ *
+ * @return 0 if the fault was handled, non zero otherwise.
+ */
+int sel4utils_process_handle_elf_fault(sel4utils_process_t *process, vka_t *vka,
+                                       vspace_t *spawner_vspace, void *vaddr);
+
 /**
  * Copy a cap into a process' cspace.
  *
@@ -23,9 +23,14 @@ typedef struct {
     bool is_elf;
     /* if so what is the image name? */
     const char *image_name;
-    /* Do you want the elf image preloaded? */
+    /* Do you want the elf image preloaded? If not the regions are only reserved and
+     * can be demand paged with sel4utils_process_handle_elf_fault */
     bool do_elf_load;
 
+    /* Share read only segments with other processes loaded from the same image?
+     * Only used when the image is preloaded */
+    sel4utils_image_cache_t *image_cache;
+
     /* otherwise what is the entry point and sysinfo? */
     void *entry_point;
     uintptr_t sysinfo;
@@ -95,6 +100,13 @@ process_config_elf(sel4utils_process_config_t config, const char *image_name, bo
     return config;
 }
 
+static inline sel4utils_process_config_t
+process_config_image_cache(sel4utils_process_config_t config, sel4utils_image_cache_t *image_cache)
+{
+    config.image_cache = image_cache;
+    return config;
+}
+
 static inline sel4utils_process_config_t
 process_config_noelf(sel4utils_process_config_t config, void *entry_point, uintptr_t sysinfo)
 {
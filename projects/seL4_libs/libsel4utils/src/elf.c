@@ -11,10 +11,12 @@
  */
 #include <autoconf.h>
 
+#include <stdlib.h>
 #include <string.h>
 #include <sel4/sel4.h>
 #include <elf/elf.h>
 #include <cpio/cpio.h>
+#include <vka/object.h>
 #include <vka/capops.h>
 #include <sel4utils/thread.h>
 #include <sel4utils/util.h>
@@ -533,27 +535,501 @@ sel4utils_elf_load_record_regions(vspace_t *loadee, vspace_t *loader, vka_t *loa
     return entry_point(elf_file);
 }
 
-uintptr_t sel4utils_elf_get_vsyscall(const char *image_name)
+/**
+ * Find the region whose reservation contains a given page.
+ *
+ * @param num_regions number of regions in the array.
+ * @param regions region array as filled in by sel4utils_elf_reserve.
+ * @param page 4k aligned virtual address in the loadee vspace.
+ *
+ * @return index of the region, or -1 if no reservation covers the page.
+ */
+static int
+find_region_for_page(int num_regions, sel4utils_elf_region_t regions[num_regions], void *page)
 {
-    uintptr_t* addr = (uintptr_t*)sel4utils_elf_get_section(image_name, "__vsyscall", NULL);
-    /* Hope everything is good and just dereference it */
-    return *addr;
+    for (int i = 0; i < num_regions; i++) {
+        if (regions[i].reservation_size == 0) {
+            continue;
+        }
+        if (page >= regions[i].reservation_vstart &&
+            page < regions[i].reservation_vstart + regions[i].reservation_size) {
+            return i;
+        }
+    }
+    return -1;
 }
 
-uintptr_t sel4utils_elf_get_section(const char *image_name, const char *section_name, uint64_t* section_size)
+/**
+ * Copy the file backed contents of every segment that overlaps a page into a mapping of it.
+ *
+ * A page may contain the end of one segment and the start of the next, so every region is
+ * checked. Anything not backed by the file (.bss) is left alone as seL4 gives us zero'd frames.
+ *
+ * @param elf_file pointer to the elf file.
+ * @param num_regions number of regions in the array.
+ * @param regions region array.
+ * @param page 4k aligned virtual address of the page in the loadee vspace.
+ * @param dest mapping of the page in the loader vspace, NULL to only check whether
+ *             there is anything to copy.
+ *
+ * @return true if any file data overlaps the page.
+ */
+static bool
+copy_page_contents(char *elf_file, int num_regions, sel4utils_elf_region_t regions[num_regions],
+                   uintptr_t page, void *dest)
+{
+    bool has_data = false;
+    for (int i = 0; i < num_regions; i++) {
+        int segment_index = regions[i].segment_index;
+        uintptr_t seg_start = (uintptr_t) regions[i].elf_vstart;
+        uintptr_t seg_file_end = seg_start + elf_getProgramHeaderFileSize(elf_file, segment_index);
+        uintptr_t start = MAX(seg_start, page);
+        uintptr_t end = MIN(seg_file_end, page + PAGE_SIZE_4K);
+        if (start >= end) {
+            continue;
+        }
+        has_data = true;
+        if (dest != NULL) {
+            char *src = elf_file + elf_getProgramHeaderOffset(elf_file, segment_index) + (start - seg_start);
+            memcpy(dest + (start - page), src, end - start);
+        }
+    }
+    return has_data;
+}
+
+/**
+ * Allocate a private frame for one page of an elf image and fill it from the elf file.
+ *
+ * @param loadee target vspace to map the frame into.
+ * @param loader vspace of the caller, used to temporarily map the frame.
+ * @param loadee_vka target vka
+ * @param loader_vka caller vka
+ * @param elf_file pointer to elf file.
+ * @param num_regions number of regions in the array.
+ * @param regions region array.
+ * @param reservation reservation in the loadee vspace that covers the page.
+ * @param page 4k aligned virtual address in the loadee vspace.
+ *
+ * @return 0 on success.
+ */
+static int
+load_page(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka, char *elf_file,
+          int num_regions, sel4utils_elf_region_t regions[num_regions], reservation_t reservation, void *page)
+{
+    int error = vspace_new_pages_at_vaddr(loadee, page, 1, seL4_PageBits, reservation);
+    if (error) {
+        ZF_LOGE("ERROR: failed to allocate frame by loadee vka: %d", error);
+        return error;
+    }
+
+    /* pure .bss pages are done, seL4 gives us zero'd frames */
+    if (!copy_page_contents(elf_file, num_regions, regions, (uintptr_t) page, NULL)) {
+        return 0;
+    }
+
+    /* copy the frame cap to map into the loader address space */
+    cspacepath_t loader_frame_cap;
+    error = vka_cspace_alloc_path(loader_vka, &loader_frame_cap);
+    if (error) {
+        ZF_LOGE("Failed to allocate cslot by loader vka: %d", error);
+        goto error_unmap;
+    }
+
+    cspacepath_t loadee_frame_cap;
+    vka_cspace_make_path(loadee_vka, vspace_get_cap(loadee, page), &loadee_frame_cap);
+    error = vka_cnode_copy(&loader_frame_cap, &loadee_frame_cap, seL4_AllRights);
+    if (error != seL4_NoError) {
+        ZF_LOGE("ERROR: failed to copy frame cap into loader cspace: %d", error);
+        vka_cspace_free(loader_vka, loader_frame_cap.capPtr);
+        goto error_unmap;
+    }
+
+    void *loader_vaddr = vspace_map_pages(loader, &loader_frame_cap.capPtr, NULL, seL4_AllRights,
+                                          1, seL4_PageBits, 1);
+    if (loader_vaddr == NULL) {
+        ZF_LOGE("failed to map frame into loader vspace.");
+        error = -1;
+    } else {
+        copy_page_contents(elf_file, num_regions, regions, (uintptr_t) page, loader_vaddr);
+#ifdef CONFIG_ARCH_ARM
+        /* Flush the caches */
+        seL4_ARM_Page_Unify_Instruction(loader_frame_cap.capPtr, 0, PAGE_SIZE_4K);
+        seL4_ARM_Page_Unify_Instruction(loadee_frame_cap.capPtr, 0, PAGE_SIZE_4K);
+#endif /* CONFIG_ARCH_ARM */
+        vspace_unmap_pages(loader, loader_vaddr, 1, seL4_PageBits, VSPACE_PRESERVE);
+    }
+
+    vka_cnode_delete(&loader_frame_cap);
+    vka_cspace_free(loader_vka, loader_frame_cap.capPtr);
+
+    if (error == 0) {
+        return 0;
+    }
+
+error_unmap:
+    /* Don't leave a zeroed frame mapped in place of the file contents, the
+     * next fault on this page would be mistaken for a genuine one */
+    vspace_unmap_pages(loadee, page, 1, seL4_PageBits, VSPACE_FREE);
+    return error;
+}
+
+void *
+sel4utils_elf_get_file(const char *image_name)
+{
+    unsigned long elf_size;
+    char *elf_file = cpio_get_file(_cpio_archive, image_name, &elf_size);
+    if (elf_file == NULL) {
+        ZF_LOGE("ERROR: failed to load elf file %s", image_name);
+    }
+    return elf_file;
+}
+
+int
+sel4utils_elf_load_page(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka,
+                        void *elf_file, int num_regions, sel4utils_elf_region_t regions[num_regions],
+                        void *vaddr)
+{
+    if (elf_file == NULL) {
+        ZF_LOGE("No elf file to load from");
+        return -1;
+    }
+
+    void *page = (void *) ROUND_DOWN((uintptr_t) vaddr, PAGE_SIZE_4K);
+    int region_index = find_region_for_page(num_regions, regions, page);
+    if (region_index < 0) {
+        ZF_LOGD("%p is not inside a reservation of the elf", vaddr);
+        return -1;
+    }
+
+    /* If the page is already there this is a genuine fault, such as a write to text */
+    if (vspace_get_cap(loadee, page) != seL4_CapNull) {
+        ZF_LOGD("%p is already mapped, not an elf demand paging fault", vaddr);
+        return -1;
+    }
+
+    return load_page(loadee, loader, loadee_vka, loader_vka, elf_file, num_regions, regions,
+                     regions[region_index].reservation, page);
+}
+
+static bool
+is_shareable_region(sel4utils_elf_region_t *region)
+{
+    return region->reservation_size > 0 && !seL4_CapRights_get_capAllowWrite(region->rights);
+}
+
+static void
+free_cache_entry(sel4utils_image_cache_entry_t *entry)
+{
+    for (size_t i = 0; i < entry->num_frames; i++) {
+        if (entry->frames[i].cptr != seL4_CapNull) {
+            vka_free_object(entry->cache->vka, &entry->frames[i]);
+        }
+    }
+    free(entry->frames);
+    free(entry->vaddrs);
+    free(entry->image_name);
+    free(entry);
+}
+
+/**
+ * Create a cache entry for an image, allocating and filling a frame for every page of
+ * its read only reservations.
+ *
+ * @param cache cache the entry belongs to.
+ * @param image_name name of the image in the cpio archive.
+ * @param elf_file pointer to elf file.
+ * @param num_regions number of regions in the array.
+ * @param regions region array with reservations already planned by prepare_reservations.
+ *
+ * @return the new entry, NULL on error.
+ */
+static sel4utils_image_cache_entry_t *
+create_cache_entry(sel4utils_image_cache_t *cache, const char *image_name, char *elf_file,
+                   int num_regions, sel4utils_elf_region_t regions[num_regions])
+{
+    sel4utils_image_cache_entry_t *entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        ZF_LOGE("Failed to allocate image cache entry");
+        return NULL;
+    }
+    entry->cache = cache;
+    entry->elf_file = elf_file;
+    entry->image_name = strdup(image_name);
+
+    for (int i = 0; i < num_regions; i++) {
+        if (is_shareable_region(&regions[i])) {
+            entry->num_frames += regions[i].reservation_size / PAGE_SIZE_4K;
+        }
+    }
+    entry->frames = calloc(entry->num_frames, sizeof(*entry->frames));
+    entry->vaddrs = calloc(entry->num_frames, sizeof(*entry->vaddrs));
+    if (entry->image_name == NULL || (entry->num_frames > 0 && (entry->frames == NULL || entry->vaddrs == NULL))) {
+        ZF_LOGE("Failed to allocate image cache entry");
+        free_cache_entry(entry);
+        return NULL;
+    }
+
+    /* regions are sorted, so the vaddrs end up sorted too */
+    size_t frame = 0;
+    for (int i = 0; i < num_regions; i++) {
+        if (!is_shareable_region(&regions[i])) {
+            continue;
+        }
+        uintptr_t res_start = (uintptr_t) regions[i].reservation_vstart;
+        for (uintptr_t page = res_start; page < res_start + regions[i].reservation_size; page += PAGE_SIZE_4K) {
+            int error = vka_alloc_frame(cache->vka, seL4_PageBits, &entry->frames[frame]);
+            if (error) {
+                ZF_LOGE("Failed to allocate shared frame for %s: %d", image_name, error);
+                free_cache_entry(entry);
+                return NULL;
+            }
+            entry->vaddrs[frame] = page;
+
+            if (copy_page_contents(elf_file, num_regions, regions, page, NULL)) {
+                void *mapping = sel4utils_dup_and_map(cache->vka, cache->vspace, entry->frames[frame].cptr,
+                                                      seL4_PageBits);
+                if (mapping == NULL) {
+                    ZF_LOGE("Failed to map shared frame for %s", image_name);
+                    free_cache_entry(entry);
+                    return NULL;
+                }
+                copy_page_contents(elf_file, num_regions, regions, page, mapping);
+#ifdef CONFIG_ARCH_ARM
+                seL4_ARM_Page_Unify_Instruction(entry->frames[frame].cptr, 0, PAGE_SIZE_4K);
+#endif /* CONFIG_ARCH_ARM */
+                sel4utils_unmap_dup(cache->vka, cache->vspace, mapping, seL4_PageBits);
+            }
+            frame++;
+        }
+    }
+
+    return entry;
+}
+
+static sel4utils_image_cache_entry_t *
+get_cache_entry(sel4utils_image_cache_t *cache, const char *image_name, char *elf_file,
+                int num_regions, sel4utils_elf_region_t regions[num_regions])
+{
+    /* The archive never changes, so the same name and file is the same image */
+    for (sel4utils_image_cache_entry_t *entry = cache->head; entry != NULL; entry = entry->next) {
+        if (entry->elf_file == elf_file && strcmp(entry->image_name, image_name) == 0) {
+            return entry;
+        }
+    }
+
+    sel4utils_image_cache_entry_t *entry = create_cache_entry(cache, image_name, elf_file,
+                                                              num_regions, regions);
+    if (entry != NULL) {
+        entry->next = cache->head;
+        cache->head = entry;
+    }
+    return entry;
+}
+
+void
+sel4utils_image_cache_init(sel4utils_image_cache_t *cache, vka_t *vka, vspace_t *vspace)
+{
+    cache->vka = vka;
+    cache->vspace = vspace;
+    cache->head = NULL;
+}
+
+void
+sel4utils_image_cache_flush(sel4utils_image_cache_t *cache)
+{
+    sel4utils_image_cache_entry_t **prev = &cache->head;
+    while (*prev != NULL) {
+        sel4utils_image_cache_entry_t *entry = *prev;
+        if (entry->refcount == 0) {
+            *prev = entry->next;
+            free_cache_entry(entry);
+        } else {
+            prev = &entry->next;
+        }
+    }
+}
+
+static void
+free_reservations(vspace_t *loadee, int num_regions, sel4utils_elf_region_t regions[num_regions])
+{
+    for (int i = 0; i < num_regions; i++) {
+        if (regions[i].reservation_size > 0) {
+            vspace_free_reservation(loadee, regions[i].reservation);
+        }
+    }
+}
+
+void *
+sel4utils_elf_load_shared(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka,
+                          sel4utils_image_cache_t *cache, const char *image_name,
+                          sel4utils_image_cache_entry_t **entry_out, seL4_CPtr **shared_caps)
+{
+    unsigned long elf_size;
+    char *elf_file = cpio_get_file(_cpio_archive, image_name, &elf_size);
+    if (elf_file == NULL) {
+        ZF_LOGE("ERROR: failed to load elf file %s", image_name);
+        return NULL;
+    }
+
+    int num_regions = count_loadable_regions(elf_file);
+    sel4utils_elf_region_t regions[num_regions];
+    int error = elf_reserve_regions_in_vspace(loadee, elf_file, num_regions, regions, 0);
+    if (error) {
+        ZF_LOGE("Failed to reserve regions");
+        return NULL;
+    }
+
+    sel4utils_image_cache_entry_t *entry = get_cache_entry(cache, image_name, elf_file,
+                                                           num_regions, regions);
+    if (entry == NULL) {
+        free_reservations(loadee, num_regions, regions);
+        return NULL;
+    }
+
+    seL4_CPtr *caps = calloc(entry->num_frames, sizeof(*caps));
+    if (entry->num_frames > 0 && caps == NULL) {
+        ZF_LOGE("Failed to allocate shared frame cap list");
+        free_reservations(loadee, num_regions, regions);
+        return NULL;
+    }
+    /* take the reference now so that sel4utils_elf_unload_shared can undo a partial load */
+    entry->refcount++;
+    *entry_out = entry;
+    *shared_caps = caps;
+
+    size_t frame = 0;
+    for (int i = 0; i < num_regions; i++) {
+        if (regions[i].reservation_size == 0) {
+            continue;
+        }
+        bool shared = is_shareable_region(&regions[i]);
+        uintptr_t res_start = (uintptr_t) regions[i].reservation_vstart;
+        for (uintptr_t page = res_start; page < res_start + regions[i].reservation_size; page += PAGE_SIZE_4K) {
+            if (!shared) {
+                error = load_page(loadee, loader, loadee_vka, loader_vka, elf_file, num_regions, regions,
+                                  regions[i].reservation, (void *) page);
+                if (error) {
+                    free_reservations(loadee, num_regions, regions);
+                    return NULL;
+                }
+                continue;
+            }
+
+            assert(entry->vaddrs[frame] == page);
+            /* copy the cap, not the data. The mapping has no cookie so tearing down the
+             * loadee vspace will not free the frame out from under the cache */
+            cspacepath_t src, dest;
+            vka_cspace_make_path(cache->vka, entry->frames[frame].cptr, &src);
+            error = vka_cspace_alloc_path(loadee_vka, &dest);
+            if (error) {
+                ZF_LOGE("Failed to allocate cslot for shared frame: %d", error);
+                free_reservations(loadee, num_regions, regions);
+                return NULL;
+            }
+            error = vka_cnode_copy(&dest, &src, seL4_CanRead);
+            if (error) {
+                ZF_LOGE("Failed to copy shared frame cap: %d", error);
+                vka_cspace_free(loadee_vka, dest.capPtr);
+                free_reservations(loadee, num_regions, regions);
+                return NULL;
+            }
+            caps[frame] = dest.capPtr;
+            error = vspace_map_pages_at_vaddr(loadee, &caps[frame], NULL, (void *) page, 1, seL4_PageBits,
+                                              regions[i].reservation);
+            if (error) {
+                ZF_LOGE("Failed to map shared frame at %p: %d", (void *) page, error);
+                free_reservations(loadee, num_regions, regions);
+                return NULL;
+            }
+            frame++;
+        }
+    }
+
+    free_reservations(loadee, num_regions, regions);
+
+    return entry_point(elf_file);
+}
+
+void
+sel4utils_elf_unload_shared(vka_t *loadee_vka, sel4utils_image_cache_entry_t *entry, seL4_CPtr *shared_caps)
+{
+    if (entry == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; shared_caps != NULL && i < entry->num_frames; i++) {
+        if (shared_caps[i] != seL4_CapNull) {
+            cspacepath_t path;
+            /* deleting the copy also removes its mapping */
+            vka_cspace_make_path(loadee_vka, shared_caps[i], &path);
+            vka_cnode_delete(&path);
+            vka_cspace_free(loadee_vka, shared_caps[i]);
+        }
+    }
+    free(shared_caps);
+
+    assert(entry->refcount > 0);
+    entry->refcount--;
+}
+
+/* Section and symbol indices of the images in the archive, built the first
+ * time an image is inspected. The archive is never unmapped, so neither are
+ * these */
+typedef struct image_index {
+    char *elf_file;
+    elf_index_t index;
+    struct image_index *next;
+} image_index_t;
+
+static image_index_t *image_indices;
+
+static elf_index_t *
+get_image_index(const char *image_name)
 {
     unsigned long elf_size;
     char *elf_file = cpio_get_file(_cpio_archive, image_name, &elf_size);
     if (elf_file == NULL) {
         ZF_LOGE("ERROR: failed to lookup elf file %s", image_name);
+        return NULL;
+    }
+    for (image_index_t *image = image_indices; image != NULL; image = image->next) {
+        if (image->elf_file == elf_file) {
+            return &image->index;
+        }
+    }
+    image_index_t *image = malloc(sizeof(*image));
+    if (image == NULL || elf_indexInit(elf_file, &image->index) != 0) {
+        ZF_LOGE("Failed to index elf file %s", image_name);
+        free(image);
+        return NULL;
+    }
+    image->elf_file = elf_file;
+    image->next = image_indices;
+    image_indices = image;
+    return &image->index;
+}
+
+uintptr_t sel4utils_elf_get_vsyscall(const char *image_name)
+{
+    uintptr_t* addr = (uintptr_t*)sel4utils_elf_get_section(image_name, "__vsyscall", NULL);
+    if (addr == NULL) {
+        return 0;
+    }
+    return *addr;
+}
+
+uintptr_t sel4utils_elf_get_section(const char *image_name, const char *section_name, uint64_t* section_size)
+{
+    elf_index_t *index = get_image_index(image_name);
+    if (index == NULL) {
         return 0;
     }
     /* See if we can find the section */
     int section_id;
-    void *addr = elf_getSectionNamed(elf_file, section_name, &section_id);
+    void *addr = elf_indexGetSectionNamed(index, section_name, &section_id);
     if (addr) {
         if (section_size != NULL) {
-            *section_size = elf_getSectionSize(elf_file, section_id);
+            *section_size = elf_getSectionSize(index->elfFile, section_id);
         }
         return (uintptr_t) addr;
     } else {
@@ -561,6 +1037,16 @@ uintptr_t sel4utils_elf_get_section(const char *image_name, const char *section_
     }
 }
 
+uintptr_t sel4utils_elf_get_symbol(const char *image_name, const char *symbol_name, uint64_t* symbol_size)
+{
+    elf_index_t *index = get_image_index(image_name);
+    uint64_t value;
+    if (index == NULL || !elf_indexGetSymbol(index, symbol_name, &value, symbol_size)) {
+        return 0;
+    }
+    return (uintptr_t) value;
+}
+
 void *
 sel4utils_elf_load(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka, const char *image_name)
 {
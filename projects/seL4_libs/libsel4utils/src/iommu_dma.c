@@ -30,111 +30,176 @@ typedef struct dma_man {
     sel4utils_alloc_data_t *iospace_data;
 } dma_man_t;
 
+/* Number of frames mapped into an iospace with a single reservation and
+ * mapping call */
+#define IOMMU_MAP_BATCH 64
+
+/* The cookie of each frame mapped into an iospace counts the allocations that
+ * are using it */
+static void set_refcount(vspace_t *iospace, uintptr_t addr, uintptr_t count)
+{
+    seL4_CPtr page = vspace_get_cap(iospace, (void*)addr);
+    update_entries(iospace, addr, page, seL4_PageBits, count);
+}
+
+/* Copy the cap to the frame backing addr in the dma manager's vspace */
+static int copy_frame(dma_man_t *dma, uintptr_t addr, seL4_CPtr *copy)
+{
+    cspacepath_t page_path;
+    cspacepath_t copy_path;
+    vka_cspace_make_path(&dma->vka, vspace_get_cap(&dma->vspace, (void*)addr), &page_path);
+    /* allocate slot for the cap */
+    int error = vka_cspace_alloc_path(&dma->vka, &copy_path);
+    if (error) {
+        ZF_LOGE("Failed to allocate slot");
+        return -1;
+    }
+    /* copy the cap */
+    error = vka_cnode_copy(&copy_path, &page_path, seL4_AllRights);
+    if (error) {
+        ZF_LOGE("Failed to copy frame cap");
+        vka_cspace_free(&dma->vka, copy_path.capPtr);
+        return -1;
+    }
+    *copy = copy_path.capPtr;
+    return 0;
+}
+
+static void delete_copy(dma_man_t *dma, seL4_CPtr copy)
+{
+    cspacepath_t copy_path;
+    vka_cspace_make_path(&dma->vka, copy, &copy_path);
+    vka_cnode_delete(&copy_path);
+    vka_cspace_free(&dma->vka, copy);
+}
+
+/* Drop a reference to each frame in [start, end) of an iospace, unmapping the
+ * ones that are no longer used. Frames that are not mapped are skipped, which
+ * happens when undoing a partial mapping */
+static void release_range(dma_man_t *dma, vspace_t *iospace, uintptr_t start, uintptr_t end)
+{
+    for (uintptr_t addr = ROUND_DOWN(start, PAGE_SIZE_4K); addr < end; addr += PAGE_SIZE_4K) {
+        uintptr_t count = vspace_get_cookie(iospace, (void*)addr);
+        if (count > 1) {
+            set_refcount(iospace, addr, count - 1);
+        } else if (count == 1) {
+            seL4_CPtr page = vspace_get_cap(iospace, (void*)addr);
+            assert(page);
+            vspace_unmap_pages(iospace, (void*)addr, 1, seL4_PageBits, NULL);
+            delete_copy(dma, page);
+        }
+    }
+}
+
 static void unmap_range(dma_man_t *dma, uintptr_t addr, size_t size)
 {
-    uintptr_t start = ROUND_DOWN(addr, PAGE_SIZE_4K);
-    uintptr_t end = addr + size;
-    for (uintptr_t addr = start; addr < end; addr += PAGE_SIZE_4K) {
-        for (int i = 0; i < dma->num_iospaces; i++) {
-            uintptr_t *cookie = (uintptr_t*)vspace_get_cookie(dma->iospaces + i, (void*)addr);
-            assert(cookie);
-            (*cookie)--;
-            if (*cookie == 0) {
-                seL4_CPtr page = vspace_get_cap(dma->iospaces + i, (void*)addr);
-                cspacepath_t page_path;
-                assert(page);
-                vspace_unmap_pages(dma->iospaces + i, (void*)addr, 1, seL4_PageBits, NULL);
-                vka_cspace_make_path(&dma->vka, page, &page_path);
-                vka_cnode_delete(&page_path);
-                vka_cspace_free(&dma->vka, page);
-                free(cookie);
+    for (int i = 0; i < dma->num_iospaces; i++) {
+        release_range(dma, dma->iospaces + i, addr, addr + size);
+    }
+}
+
+/* Map a run of consecutive frames, whose caps have already been copied, into
+ * an iospace with a single reservation and mapping call. Copies that did not
+ * get mapped are deleted on failure */
+static int map_run(dma_man_t *dma, vspace_t *iospace, uintptr_t addr, seL4_CPtr *caps, size_t num)
+{
+    uintptr_t cookies[IOMMU_MAP_BATCH];
+    int error = -1;
+    for (size_t i = 0; i < num; i++) {
+        cookies[i] = 1;
+    }
+    reservation_t res = vspace_reserve_range_at(iospace, (void*)addr, num * PAGE_SIZE_4K, seL4_AllRights, 1);
+    if (!res.res) {
+        ZF_LOGE("Failed to create a reservation");
+    } else {
+        error = vspace_map_pages_at_vaddr(iospace, caps, cookies, (void*)addr, num, seL4_PageBits, res);
+        if (error) {
+            ZF_LOGE("Failed to map frames into iospace");
+        }
+        vspace_free_reservation(iospace, res);
+    }
+    if (error) {
+        for (size_t i = 0; i < num; i++) {
+            if (vspace_get_cap(iospace, (void*)(addr + i * PAGE_SIZE_4K)) != caps[i]) {
+                delete_copy(dma, caps[i]);
+            }
+        }
+    }
+    return error;
+}
+
+/* Duplicate the frames backing [start, end) and map them into an iospace.
+ * Pages that are already mapped just gain a reference, the others are
+ * collected into runs that are mapped together. On failure the iospace is left
+ * as it was */
+static int map_into_iospace(dma_man_t *dma, vspace_t *iospace, uintptr_t start, uintptr_t end)
+{
+    seL4_CPtr run[IOMMU_MAP_BATCH];
+    size_t run_len = 0;
+    uintptr_t run_start = start;
+    uintptr_t addr;
+    for (addr = start; addr < end; addr += PAGE_SIZE_4K) {
+        uintptr_t count = vspace_get_cookie(iospace, (void*)addr);
+        if (count || run_len == IOMMU_MAP_BATCH) {
+            if (run_len && map_run(dma, iospace, run_start, run, run_len)) {
+                goto error;
+            }
+            run_len = 0;
+        }
+        if (count) {
+            set_refcount(iospace, addr, count + 1);
+            continue;
+        }
+        if (run_len == 0) {
+            run_start = addr;
+        }
+        if (copy_frame(dma, addr, &run[run_len])) {
+            for (size_t i = 0; i < run_len; i++) {
+                delete_copy(dma, run[i]);
             }
+            goto error;
         }
+        run_len++;
+    }
+    if (run_len && map_run(dma, iospace, run_start, run, run_len)) {
+        goto error;
     }
+    return 0;
+error:
+    release_range(dma, iospace, start, addr);
+    return -1;
 }
 
 int sel4utils_iommu_dma_alloc_iospace(void* cookie, void *vaddr, size_t size)
 {
     dma_man_t *dma = (dma_man_t*)cookie;
-    int error;
-
-    /* for each page duplicate and map it into all the iospaces */
     uintptr_t start = ROUND_DOWN((uintptr_t)vaddr, PAGE_SIZE_4K);
     uintptr_t end = (uintptr_t)vaddr + size;
+
+    /* check that every page has a frame of its own before touching the iospaces */
     seL4_CPtr last_page = 0;
     for (uintptr_t addr = start; addr < end; addr += PAGE_SIZE_4K) {
-        cspacepath_t page_path;
         seL4_CPtr page = vspace_get_cap(&dma->vspace, (void*)addr);
         if (!page) {
             ZF_LOGE("Failed to retrieve frame cap for malloc region. "
                     "Is your malloc backed by the correct vspace? "
                     "If you allocated your own buffer, does the dma manager's vspace "
                     "know about the caps to the frames that back the buffer?");
-            unmap_range(dma, start, addr + 1);
             return -1;
         }
         if (page == last_page) {
             ZF_LOGE("Found the same frame two pages in a row. We only support 4K mappings");
-            unmap_range(dma, start, addr + 1);
             return -1;
         }
         last_page = page;
-        vka_cspace_make_path(&dma->vka, page, &page_path);
-        /* work out the size of this page */
-        for (int i = 0; i < dma->num_iospaces; i++) {
-            /* see if its already mapped */
-            uintptr_t *cookie = (uintptr_t*)vspace_get_cookie(dma->iospaces + i, (void*)addr);
-            if (cookie) {
-                /* increment the counter */
-                (*cookie)++;
-            } else {
-                cspacepath_t copy_path;
-                /* allocate slot for the cap */
-                error = vka_cspace_alloc_path(&dma->vka, &copy_path);
-                if (error) {
-                    ZF_LOGE("Failed to allocate slot");
-                    unmap_range(dma, start, addr + 1);
-                    return -1;
-                }
-                /* copy the cap */
-                error = vka_cnode_copy(&copy_path, &page_path, seL4_AllRights);
-                if (error) {
-                    ZF_LOGE("Failed to copy frame cap");
-                    vka_cspace_free(&dma->vka, copy_path.capPtr);
-                    unmap_range(dma, start, addr + 1);
-                    return -1;
-                }
-                /* now map it in */
-                reservation_t res = vspace_reserve_range_at(dma->iospaces + i, (void*)addr, PAGE_SIZE_4K, seL4_AllRights, 1);
-                if (!res.res) {
-                    ZF_LOGE("Failed to create a reservation");
-                    vka_cnode_delete(&copy_path);
-                    vka_cspace_free(&dma->vka, copy_path.capPtr);
-                    unmap_range(dma, start, addr + 1);
-                    return -1;
-                }
-                cookie = malloc(sizeof(*cookie));
-                if (!cookie) {
-                    ZF_LOGE("Failed to malloc %zu bytes", sizeof(*cookie));
-                    vspace_free_reservation(dma->iospaces + i, res);
-                    vka_cnode_delete(&copy_path);
-                    vka_cspace_free(&dma->vka, copy_path.capPtr);
-                    unmap_range(dma, start, addr + 1);
-                    return -1;
-                }
-                *cookie = 1;
-                error = vspace_map_pages_at_vaddr(dma->iospaces + i, &copy_path.capPtr, (uintptr_t*)&cookie, (void*)addr, 1, seL4_PageBits, res);
-                if (error) {
-                    ZF_LOGE("Failed to map frame into iospace");
-                    free(cookie);
-                    vspace_free_reservation(dma->iospaces + i, res);
-                    vka_cnode_delete(&copy_path);
-                    vka_cspace_free(&dma->vka, copy_path.capPtr);
-                    unmap_range(dma, start, addr + 1);
-                    return -1;
-                }
-                vspace_free_reservation(dma->iospaces + i, res);
+    }
+
+    for (int i = 0; i < dma->num_iospaces; i++) {
+        if (map_into_iospace(dma, dma->iospaces + i, start, end)) {
+            for (int j = 0; j < i; j++) {
+                release_range(dma, dma->iospaces + j, start, end);
             }
+            return -1;
         }
     }
 
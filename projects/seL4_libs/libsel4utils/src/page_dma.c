@@ -30,6 +30,8 @@ typedef struct dma_alloc {
     void *base;
     vka_object_t ut;
     uintptr_t paddr;
+    /* size of the frames the allocation is mapped with */
+    size_t frame_bits;
 } dma_alloc_t;
 
 static void dma_free(void *cookie, void *addr, size_t size)
@@ -38,11 +40,12 @@ static void dma_free(void *cookie, void *addr, size_t size)
     dma_alloc_t *alloc = (dma_alloc_t*)vspace_get_cookie(&dma->vspace, addr);
     assert(alloc);
     assert(alloc->base == addr);
-    int num_pages = BIT(alloc->ut.size_bits) / PAGE_SIZE_4K;
-    for (int i = 0; i < num_pages; i++) {
+    size_t frame_size = BIT(alloc->frame_bits);
+    int num_frames = BIT(alloc->ut.size_bits) / frame_size;
+    for (int i = 0; i < num_frames; i++) {
         cspacepath_t path;
-        seL4_CPtr frame = vspace_get_cap(&dma->vspace, addr + i * PAGE_SIZE_4K);
-        vspace_unmap_pages(&dma->vspace, addr + i * PAGE_SIZE_4K, 1, PAGE_BITS_4K, NULL);
+        seL4_CPtr frame = vspace_get_cap(&dma->vspace, addr + i * frame_size);
+        vspace_unmap_pages(&dma->vspace, addr + i * frame_size, 1, alloc->frame_bits, NULL);
         vka_cspace_make_path(&dma->vka, frame, &path);
         vka_cnode_delete(&path);
         vka_cspace_free(&dma->vka, frame);
@@ -58,22 +61,75 @@ static uintptr_t dma_pin(void *cookie, void *addr, size_t size)
     if (!alloc) {
         return 0;
     }
-    uint32_t diff = addr - alloc->base;
+    uintptr_t diff = addr - alloc->base;
     return alloc->paddr + diff;
 }
 
-static void* dma_alloc(void *cookie, size_t size, int align, int cached, ps_mem_flags_t flags)
+/* Retype the untyped of an allocation into frames of 2^frame_bits bytes and map
+ * them, in a single call, into a range aligned to the size of the allocation.
+ * On failure everything done here is undone, so that the untyped can be retyped
+ * again with a different frame size */
+static void *map_frames(dma_man_t *dma, dma_alloc_t *alloc, size_t frame_bits, int cached)
 {
-    dma_man_t *dma = cookie;
-    cspacepath_t *frames = NULL;
+    size_t size_bits = alloc->ut.size_bits;
+    size_t num_frames = BIT(size_bits - frame_bits);
+    size_t num_retyped = 0;
     reservation_t res = {NULL};
-    dma_alloc_t *alloc = NULL;
-    unsigned int num_frames = 0;
     void *base = NULL;
-    /* We align to the 4K boundary, but do not support more */
-    if (align > PAGE_SIZE_4K) {
-        return NULL;
+    seL4_CPtr *caps = calloc(num_frames, sizeof(*caps));
+    uintptr_t *cookies = calloc(num_frames, sizeof(*cookies));
+    if (!caps || !cookies) {
+        goto handle_error;
     }
+    for (; num_retyped < num_frames; num_retyped++) {
+        cspacepath_t path;
+        int error = vka_cspace_alloc_path(&dma->vka, &path);
+        if (error) {
+            goto handle_error;
+        }
+        error = seL4_Untyped_Retype(alloc->ut.cptr, kobject_get_type(KOBJECT_FRAME, frame_bits), frame_bits, path.root, path.dest, path.destDepth, path.offset, 1);
+        if (error != seL4_NoError) {
+            vka_cspace_free(&dma->vka, path.capPtr);
+            goto handle_error;
+        }
+        caps[num_retyped] = path.capPtr;
+        cookies[num_retyped] = (uintptr_t)alloc;
+    }
+    /* Aligning the mapping to the size of the allocation, as the untyped is
+     * physically, makes every frame size usable and gives the caller its
+     * alignment */
+    res = vspace_reserve_range_aligned(&dma->vspace, BIT(size_bits), size_bits, seL4_AllRights, cached, &base);
+    if (!res.res) {
+        ZF_LOGE("Failed to reserve");
+        goto handle_error;
+    }
+    if (vspace_map_pages_at_vaddr(&dma->vspace, caps, cookies, base, num_frames, frame_bits, res)) {
+        goto handle_error;
+    }
+    /* no longer need the reservation */
+    vspace_free_reservation(&dma->vspace, res);
+    free(caps);
+    free(cookies);
+    return base;
+handle_error:
+    if (res.res) {
+        vspace_unmap_pages(&dma->vspace, base, num_frames, frame_bits, NULL);
+        vspace_free_reservation(&dma->vspace, res);
+    }
+    for (size_t i = 0; i < num_retyped; i++) {
+        cspacepath_t path;
+        vka_cspace_make_path(&dma->vka, caps[i], &path);
+        vka_cnode_delete(&path);
+        vka_cspace_free(&dma->vka, caps[i]);
+    }
+    free(caps);
+    free(cookies);
+    return NULL;
+}
+
+static void* dma_alloc(void *cookie, size_t size, int align, int cached, ps_mem_flags_t flags)
+{
+    dma_man_t *dma = cookie;
     /* Round up to the next page size */
     size = ROUND_UP(size, PAGE_SIZE_4K);
     /* Then round up to the next power of 2 size. This is because untypeds are allocated
@@ -83,7 +139,11 @@ static void* dma_alloc(void *cookie, size_t size, int align, int cached, ps_mem_
         size_bits++;
     }
     size = BIT(size_bits);
-    /* Allocate an untyped */
+    /* Allocations are aligned to their size, but do not support more */
+    if (align > size) {
+        return NULL;
+    }
+    /* Allocate an untyped, which makes the allocation physically contiguous */
     vka_object_t ut;
     int error = vka_alloc_untyped(&dma->vka, size_bits, &ut);
     if (error) {
@@ -94,66 +154,37 @@ static void* dma_alloc(void *cookie, size_t size, int align, int cached, ps_mem_
     uintptr_t paddr = vka_utspace_paddr(&dma->vka, ut.ut, seL4_UntypedObject, size_bits);
     if (paddr == VKA_NO_PADDR) {
         ZF_LOGE("Allocated untyped has no physical address");
-        goto handle_error;
-    }
-    /* Allocate all the frames */
-    num_frames = size / PAGE_SIZE_4K;
-    frames = calloc(num_frames, sizeof(cspacepath_t));
-    if (!frames) {
-        goto handle_error;
-    }
-    for (unsigned i = 0; i < num_frames; i++) {
-        error = vka_cspace_alloc_path(&dma->vka, &frames[i]);
-        if (error) {
-            goto handle_error;
-        }
-        error = seL4_Untyped_Retype(ut.cptr, kobject_get_type(KOBJECT_FRAME, PAGE_BITS_4K), size_bits, frames[i].root, frames[i].dest, frames[i].destDepth, frames[i].offset, 1);
-        if (error != seL4_NoError) {
-            goto handle_error;
-        }
-    }
-    /* Grab a reservation */
-    res = vspace_reserve_range(&dma->vspace, size, seL4_AllRights, cached, &base);
-    if (!res.res) {
-        ZF_LOGE("Failed to reserve");
+        vka_free_object(&dma->vka, &ut);
         return NULL;
     }
-    alloc = malloc(sizeof(*alloc));
+    dma_alloc_t *alloc = malloc(sizeof(*alloc));
     if (alloc == NULL) {
-        goto handle_error;
+        vka_free_object(&dma->vka, &ut);
+        return NULL;
     }
-    alloc->base = base;
     alloc->ut = ut;
     alloc->paddr = paddr;
-    /* Map in all the pages */
-    for (unsigned i = 0; i < num_frames; i++) {
-        error = vspace_map_pages_at_vaddr(&dma->vspace, &frames[i].capPtr, (uintptr_t*)&alloc, base + i * PAGE_SIZE_4K, 1, PAGE_BITS_4K, res);
-        if (error) {
-            goto handle_error;
+    alloc->frame_bits = PAGE_BITS_4K;
+    alloc->base = NULL;
+#ifdef CONFIG_SEL4UTILS_DMA_LARGE_FRAMES
+    if (size_bits >= seL4_LargePageBits) {
+        alloc->frame_bits = seL4_LargePageBits;
+        alloc->base = map_frames(dma, alloc, alloc->frame_bits, cached);
+        if (!alloc->base) {
+            ZF_LOGW("Failed to map DMA allocation of size %zu with large frames, using 4K frames", size);
+            alloc->frame_bits = PAGE_BITS_4K;
         }
     }
-    /* no longer need the reservation */
-    vspace_free_reservation(&dma->vspace, res);
-    return base;
-handle_error:
-    if (alloc) {
-        free(alloc);
-    }
-    if (res.res) {
-        vspace_unmap_pages(&dma->vspace, base, num_frames, PAGE_BITS_4K, NULL);
-        vspace_free_reservation(&dma->vspace, res);
+#endif
+    if (!alloc->base) {
+        alloc->base = map_frames(dma, alloc, alloc->frame_bits, cached);
     }
-    if (frames) {
-        for (int i = 0; i < num_frames; i++) {
-            if (frames[i].capPtr) {
-                vka_cnode_delete(&frames[i]);
-                vka_cspace_free(&dma->vka, frames[i].capPtr);
-            }
-        }
-        free(frames);
+    if (!alloc->base) {
+        free(alloc);
+        vka_free_object(&dma->vka, &ut);
+        return NULL;
     }
-    vka_free_object(&dma->vka, &ut);
-    return NULL;
+    return alloc->base;
 }
 
 static void dma_unpin(void *cookie, void *addr, size_t size)
@@ -580,7 +580,12 @@ sel4utils_configure_process_custom(sel4utils_process_t *process, vka_t *vka,
 
     /* finally elf load */
     if (config.is_elf) {
-        if (config.do_elf_load) {
+        if (config.do_elf_load && config.image_cache != NULL) {
+            process->entry_point = sel4utils_elf_load_shared(&process->vspace, spawner_vspace, vka, vka,
+                                                             config.image_cache, config.image_name,
+                                                             &process->image_cache_entry,
+                                                             &process->shared_frame_caps);
+        } else if (config.do_elf_load) {
             process->entry_point = sel4utils_elf_load(&process->vspace, spawner_vspace, vka, vka, config.image_name);
         } else {
             process->num_elf_regions = sel4utils_elf_num_regions(config.image_name);
@@ -590,12 +595,14 @@ sel4utils_configure_process_custom(sel4utils_process_t *process, vka_t *vka,
                 goto error;
             }
             process->entry_point = sel4utils_elf_reserve(&process->vspace, config.image_name, process->elf_regions);
+            process->elf_file = sel4utils_elf_get_file(config.image_name);
         }
 
         if (process->entry_point == NULL) {
             ZF_LOGE("Failed to load elf file\n");
             goto error;
         }
+        process->image_name = config.image_name;
 
         process->sysinfo = sel4utils_elf_get_vsyscall(config.image_name);
 
@@ -679,6 +686,8 @@ error:
         }
     }
 
+    sel4utils_elf_unload_shared(vka, process->image_cache_entry, process->shared_frame_caps);
+
     if (process->elf_regions) {
         free(process->elf_regions);
     }
@@ -694,6 +703,19 @@ error:
     return -1;
 }
 
+int
+sel4utils_process_handle_elf_fault(sel4utils_process_t *process, vka_t *vka,
+                                   vspace_t *spawner_vspace, void *vaddr)
+{
+    if (process->elf_regions == NULL || process->elf_file == NULL) {
+        /* elf was preloaded (or there isn't one), nothing to demand page */
+        return -1;
+    }
+
+    return sel4utils_elf_load_page(&process->vspace, spawner_vspace, vka, vka, process->elf_file,
+                                   process->num_elf_regions, process->elf_regions, vaddr);
+}
+
 void
 sel4utils_destroy_process(sel4utils_process_t *process, vka_t *vka)
 {
@@ -718,6 +740,9 @@ sel4utils_destroy_process(sel4utils_process_t *process, vka_t *vka)
         clear_objects(process, vka);
     }
 
+    /* drop the shared image frames, the vspace does not own them */
+    sel4utils_elf_unload_shared(vka, process->image_cache_entry, process->shared_frame_caps);
+
     /* destroy the endpoint */
     if (process->own_ep && process->fault_endpoint.cptr != 0) {
         vka_free_object(vka, &process->fault_endpoint);
@@ -713,7 +713,8 @@ sel4utils_get_root(vspace_t *vspace)
 static void free_page(vspace_t *vspace, vka_t *vka, uintptr_t vaddr) {
     sel4utils_alloc_data_t *data = get_alloc_data(vspace);
     vspace_mid_level_t *level = data->top_level;
-    /* see if we should free the thing here or not */
+    /* see if we should free the thing here or not. Pages without a cookie (such as
+     * shared image frames) are owned by someone else and are left alone */
     uintptr_t cookie = get_cookie(level, vaddr);
     int num_4k_entries = 1;
     if (cookie != 0) {
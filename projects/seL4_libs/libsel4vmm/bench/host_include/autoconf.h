@@ -0,0 +1,17 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+
+/* Host build configuration for the benchmarks in bench/ */
+
+#pragma once
+
+#define CONFIG_LIB_UTILS_DEFAULT_ZF_LOG_LEVEL 5
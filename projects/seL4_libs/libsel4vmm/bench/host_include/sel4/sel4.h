@@ -0,0 +1,35 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+
+/* The parts of libsel4 used by the code under benchmark, for host builds */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef uintptr_t seL4_Word;
+typedef seL4_Word seL4_CPtr;
+
+#define seL4_PageBits 12
+
+typedef enum {
+    seL4_NoError = 0,
+} seL4_Error;
+
+/* No IO ports are ever made available to the guest on the host */
+static inline int seL4_X86_VCPU_EnableIOPort(seL4_CPtr vcpu, seL4_CPtr port, seL4_Word start, seL4_Word end) {
+    return -1;
+}
+
+typedef struct seL4_VCPUContext_ {
+    seL4_Word eax, ebx, ecx, edx, esi, edi, ebp;
+} seL4_VCPUContext;
@@ -0,0 +1,27 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+
+/* Host stand in for the parts of libsel4simple used by the VMM io ports */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <sel4/sel4.h>
+#include <vka/vka.h>
+
+typedef struct simple simple_t;
+
+static inline seL4_Error simple_get_IOPort_cap(simple_t *simple, uint16_t start, uint16_t end,
+                                               seL4_Word root, seL4_Word dest, seL4_Word depth) {
+    return -1;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+
+/* Host stand in for the vka paths used when passing IO ports to the guest */
+
+#pragma once
+
+#include <sel4/sel4.h>
+
+typedef struct vka vka_t;
+
+typedef struct {
+    seL4_CPtr root;
+    seL4_CPtr capPtr;
+    seL4_Word capDepth;
+} cspacepath_t;
+
+static inline int vka_cspace_alloc_path(vka_t *vka, cspacepath_t *path) {
+    return -1;
+}
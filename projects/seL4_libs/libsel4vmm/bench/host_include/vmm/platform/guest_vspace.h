@@ -0,0 +1,32 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+
+/* Host stand in for the guest vspace. Guest physical memory is a flat buffer
+ * that the benchmark provides, translated a 4K page at a time as the real
+ * guest vspace does */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sel4/sel4.h>
+
+typedef struct vspace {
+    /* vmm address of each guest page */
+    void **pages;
+    size_t num_pages;
+} vspace_t;
+
+typedef int (*vmm_guest_vspace_touch_callback)(uintptr_t guest_phys, void *vmm_vaddr, size_t size, size_t offset, void *cookie);
+
+int vmm_guest_vspace_touch(vspace_t *guest_vspace, uintptr_t addr, size_t size, vmm_guest_vspace_touch_callback callback, void *cookie);
+void *vmm_guest_vspace_translate(vspace_t *guest_vspace, uintptr_t addr);
@@ -0,0 +1,43 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+
+/* Host stand in for the VMM, with just the parts of the vmm and vcpu that
+ * the io port and mmio exit handlers use */
+
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sel4/sel4.h>
+#include <utils/util.h>
+
+typedef struct vmm vmm_t;
+typedef struct vmm_vcpu vmm_vcpu_t;
+typedef struct guest_memory guest_memory_t;
+
+#include "vmm/io.h"
+#include "vmm/mmio.h"
+#include "vmm/guest_state.h"
+
+struct vmm {
+    vmm_io_port_list_t io_port;
+    vmm_mmio_list_t mmio_list;
+};
+
+struct vmm_vcpu {
+    vmm_t *vmm;
+    seL4_CPtr guest_vcpu;
+    guest_state_t guest_state;
+    int mmio_last;
+};
@@ -30,5 +30,16 @@ typedef struct ethif_virtio_emul {
     int (*notify)(struct ethif_virtio_emul *emul);
 } ethif_virtio_emul_t;
 
+/* The emulator remembers where guest pages are mapped in the vmm: the rings of
+ * each queue from when the guest sets the queue up, and the pages packets were
+ * recently copied through. Guest RAM must therefore stay mapped at the same vmm
+ * address for as long as the device is in use. The guest resetting the device
+ * or moving a queue drops what is remembered about it */
 ethif_virtio_emul_t *ethif_virtio_emul_init(ps_io_ops_t io_ops, int queue_size, vspace_t *guest_vspace, ethif_driver_init driver, void *config);
 
+/* As ethif_virtio_emul_init, but offers the guest up to num_queue_pairs receive and
+ * transmit queue pairs, typically one per vcpu. When the emulator interrupts the guest
+ * it passes the index of the queue pair as the irq to the driver's raw_handleIRQ, so
+ * that the interrupt can be delivered to the vcpu that owns the pair */
+ethif_virtio_emul_t *ethif_virtio_emul_init_mq(ps_io_ops_t io_ops, int queue_size, int num_queue_pairs, vspace_t *guest_vspace, ethif_driver_init driver, void *config);
+
@@ -25,6 +25,9 @@ void wait_for_guest_ready(vmm_vcpu_t *vcpu);
 /* Start an AP vcpu after a sipi with the requested vector */
 void vmm_start_ap_vcpu(vmm_vcpu_t *vcpu, unsigned int sipi_vector);
 
+/* Make the thread running a vcpu stop and look at its lapic */
+void vmm_kick_vcpu(vmm_vcpu_t *vcpu);
+
 /* Got interrupt(s) from PIC, propagate to relevant vcpu lapic */
 void vmm_check_external_interrupt(vmm_t *vmm);
 
@@ -34,10 +34,15 @@ typedef struct ioport_range {
     const char* desc;
 } ioport_range_t;
 
+#define VMM_NUM_IO_PORTS 0x10000
+
 typedef struct vmm_io_list {
     int num_ioports;
     /* Sorted list of ioport functions */
     ioport_range_t *ioports;
+    /* For every port, the index + 1 of the range in ioports that covers it,
+     * or 0 if there is none. Lets IN/OUT exits find their handler directly */
+    uint16_t *port_map;
 } vmm_io_port_list_t;
 
 /* Initialize the io port list manager */
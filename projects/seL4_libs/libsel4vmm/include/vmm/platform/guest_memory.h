@@ -26,6 +26,26 @@ typedef struct guest_ram_region {
     int allocated;
 } guest_ram_region_t;
 
+/* Guest RAM that is only backed by frames when it is first touched, either
+ * by the guest or by the vmm */
+typedef struct guest_lazy_range {
+    uintptr_t start;
+    size_t size;
+    /* Reservation of the range in the guest vspace, held until it is destroyed */
+    reservation_t reservation;
+    /* One bit per large frame sized chunk of the range, set once some of the
+     * chunk had to be backed by small frames */
+    uint8_t *split;
+} guest_lazy_range_t;
+
+typedef struct guest_ram_stats {
+    /* EPT violations resolved by populating lazily backed guest RAM */
+    uint64_t ept_faults;
+    /* Bytes of guest RAM backed by large and by small frames */
+    size_t large_frame_bytes;
+    size_t small_frame_bytes;
+} guest_ram_stats_t;
+
 typedef struct guest_memory {
     /* Guest vspace management. This manages ALL mappings in the guest
      * address space. This may include memory that we may tell the guest
@@ -35,12 +55,21 @@ typedef struct guest_memory {
      * This is memory that we will specifically give the guest as actual RAM */
     int num_ram_regions;
     guest_ram_region_t *ram_regions;
+    /* Parts of the ram regions that have not necessarily been backed yet */
+    int num_lazy_ranges;
+    guest_lazy_range_t *lazy_ranges;
+    guest_ram_stats_t stats;
 } guest_memory_t;
 
 struct vmm;
 
 uintptr_t guest_ram_largest_free_region_start(guest_memory_t *guest_memory);
 void print_guest_ram_regions(guest_memory_t *guest_memory);
+/* Print how guest RAM has been backed so far. The counters are only
+ * meaningful once the guest has been running, so call this on demand
+ * (it is also printed when a vcpu halts forever or hits a fatal EPT
+ * violation) rather than while setting up guest RAM */
+void print_guest_ram_stats(guest_memory_t *guest_memory);
 void guest_ram_mark_allocated(guest_memory_t *guest_memory, uintptr_t start, size_t bytes);
 uintptr_t guest_ram_allocate(guest_memory_t *guest_memory, size_t bytes);
 
@@ -50,3 +79,7 @@ int vmm_map_guest_device_at(struct vmm *vmm, uintptr_t vaddr, uintptr_t paddr, s
 int vmm_alloc_guest_ram_at(struct vmm *vmm, uintptr_t start, size_t bytes);
 int vmm_alloc_guest_ram(struct vmm *vmm, size_t bytes, int onetoone);
 
+/* Back the page containing addr if it is part of lazily allocated guest RAM.
+ * Returns 0 if the page is now mapped */
+int vmm_guest_ram_populate(struct vmm *vmm, uintptr_t addr);
+
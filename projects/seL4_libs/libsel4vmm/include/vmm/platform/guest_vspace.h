@@ -37,6 +37,19 @@ typedef int (*vmm_guest_vspace_touch_callback)(uintptr_t guest_phys, void *vmm_v
  * each equivalent range of addresses in the vmm vspace */
 int vmm_guest_vspace_touch(vspace_t *guest_vspace, uintptr_t addr, size_t size, vmm_guest_vspace_touch_callback callback, void *cookie);
 
+/* Translate a guest physical address to the address it is mapped at in the vmm
+ * vspace, or NULL if it is not mapped. The translation is only valid up to the
+ * end of the 4K page containing addr, as consecutive guest pages need not be
+ * consecutive in the vmm vspace */
+void *vmm_guest_vspace_translate(vspace_t *guest_vspace, uintptr_t addr);
+
+/* Called with the 4K aligned guest physical address of a page that has no
+ * mapping when it is touched or translated. Returns 0 if the page was backed */
+typedef int (*vmm_guest_vspace_populate_fn)(void *cookie, uintptr_t addr);
+
+/* Install a function to back guest pages on demand, for lazily allocated RAM */
+void vmm_guest_vspace_set_populate(vspace_t *guest_vspace, vmm_guest_vspace_populate_fn populate, void *cookie);
+
 #ifdef CONFIG_IOMMU
 /* Attach an additional IO space to the vspace */
 int vmm_guest_vspace_add_iospace(vspace_t *loader, vspace_t *vspace, seL4_CPtr iospace);
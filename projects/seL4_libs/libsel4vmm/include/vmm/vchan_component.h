@@ -44,6 +44,10 @@ struct libvchan {
     int domain_num, port_num;
 
     camkes_vchan_con_t *con;
+
+    /* Shared buffers of this connection, looked up on first use */
+    vchan_buf_t *send_buf;
+    vchan_buf_t *recv_buf;
 };
 
 void init_camkes_vchan(camkes_vchan_con_t *c);
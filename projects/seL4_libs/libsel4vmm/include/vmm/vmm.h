@@ -20,6 +20,8 @@
 #include <simple/simple.h>
 #include <vspace/vspace.h>
 #include <allocman/allocman.h>
+#include <sel4utils/thread.h>
+#include <sync/mutex.h>
 
 typedef struct vmm vmm_t;
 typedef struct vmm_vcpu vmm_vcpu_t;
@@ -38,6 +40,11 @@ typedef struct vmm_vcpu vmm_vcpu_t;
 /* ID of the boot vcpu in a vmm */
 #define BOOT_VCPU 0
 
+/* Badge bit used to make a vcpu thread return from seL4_VMEnter or seL4_Wait
+ * and look at its lapic. Badges passed to vmm_create_async_event_notification_cap
+ * may not use it */
+#define VMM_VCPU_KICK_BADGE BIT(26)
+
 /* System callbacks passed from the user to the library. These need to
  * be passed in as their definitions are invisible to this library */
 typedef struct platform_callbacks {
@@ -91,6 +98,17 @@ typedef struct vmm_vcpu {
 
     /* is the vcpu online */
     int online;
+
+    /* Host thread that runs this vcpu. The boot vcpu runs on the thread that
+     * calls vmm_run, so this is only used for the other vcpus */
+    sel4utils_thread_t thread;
+    /* notification bound to the thread running this vcpu */
+    seL4_CPtr notification;
+    /* badged copy of the above, signalled by other vcpus */
+    seL4_CPtr kick;
+
+    /* index of the mmio range this vcpu last accessed */
+    int mmio_last;
 } vmm_vcpu_t;
 
 /* Represents a vmm instance that runs a single guest with one or more vcpus */
@@ -105,8 +123,7 @@ typedef struct vmm {
     /* due ot limitation of the vka interface we still need an explicit allocman */
     allocman_t *allocman;
 
-    /* TCB of the VMM thread
-     * TODO: Should eventually have one vmm thread per vcpu */
+    /* TCB of the VMM thread, which runs the boot vcpu */
     seL4_CPtr tcb;
     seL4_CPtr sc;
     seL4_CPtr sched_ctrl;
@@ -140,6 +157,12 @@ typedef struct vmm {
     vmcall_handler_t *vmcall_handlers;
     unsigned int vmcall_num_handlers;
 
+    /* Each vcpu runs the guest on its own thread, but everything else,
+     * including exit handling and device emulation, happens with this held */
+    sync_mutex_t lock;
+    /* vcpu whose thread holds the lock */
+    vmm_vcpu_t *lock_owner;
+
     /*TODO add
         map of vcpu affinities
     */
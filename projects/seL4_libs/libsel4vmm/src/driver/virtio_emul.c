@@ -20,63 +20,254 @@
 #include <ethdrivers/virtio/virtio_ring.h>
 #include <ethdrivers/virtio/virtio_config.h>
 
-#define RX_QUEUE 0
-#define TX_QUEUE 1
+/* Queues are laid out as receive and transmit queue pairs, followed by the
+ * control queue if there is more than one pair */
+#define RX_QUEUE(pair) ((pair) * 2)
+#define TX_QUEUE(pair) ((pair) * 2 + 1)
+#define QUEUE_PAIR(queue) ((queue) / 2)
+#define IS_TX_QUEUE(queue) ((queue) % 2 == 1)
 
 #define BUF_SIZE 2048
 
+/* Number of guest pages whose translation is cached for copying packet data */
+#define XLATE_CACHE_SIZE 64
+
+/* Offset of the device specific configuration, as we do not do MSI-X */
+#define CONFIG_OFFSET VIRTIO_PCI_CONFIG_OFF(0)
+
+typedef struct emul_xlate {
+    uintptr_t guest_page;
+    void *vmm_page;
+} emul_xlate_t;
+
+typedef struct emul_queue {
+    /* ring layout in guest physical memory */
+    struct vring vring;
+    /* vmm addresses of each page of the rings, resolved when the guest sets up
+     * the queue. NULL if the queue is not set up. Like the translation cache
+     * this relies on guest RAM never being remapped while the device is live */
+    void **ring_pages;
+    uint16_t size;
+    uint32_t pfn;
+    uint16_t last_idx;
+    /* used index when we last decided whether to interrupt the guest */
+    uint16_t signalled_used;
+} emul_queue_t;
+
 typedef struct ethif_virtio_emul_internal {
     struct eth_driver driver;
     int status;
+    uint32_t host_features;
+    uint32_t guest_features;
     uint8_t mac[6];
     uint16_t queue;
-    struct vring vring[2];
-    uint16_t queue_size[2];
-    uint32_t queue_pfn[2];
-    uint16_t last_idx[2];
+    int num_queues;
+    emul_queue_t *queues;
+    uint16_t max_pairs;
+    /* number of pairs the guest has enabled */
+    uint16_t active_pairs;
+    /* translations of guest pages that packet data was recently copied to or
+     * from. Pages that are not mapped yet are never cached, so lazily backed
+     * RAM is fine, but the cache is only cleared on device reset */
+    emul_xlate_t xlate[XLATE_CACHE_SIZE];
     vspace_t guest_vspace;
     ps_dma_man_t dma_man;
 } ethif_virtio_emul_internal_t;
 
 typedef struct emul_tx_cookie {
+    int queue;
     uint16_t desc_head;
     void *vaddr;
 } emul_tx_cookie_t;
 
-static int read_guest_mem(uintptr_t phys, void *vaddr, size_t size, size_t offset, void *cookie) {
-    memcpy(cookie + offset, vaddr, size);
-    return 0;
+/* Return the vmm address of a field of the rings of a queue, given its guest
+ * address. Fields never cross a page boundary */
+static void *ring_ptr(emul_queue_t *q, void *guest_ptr) {
+    uintptr_t offset = (uintptr_t)guest_ptr - (uintptr_t)q->vring.desc;
+    return q->ring_pages[offset >> seL4_PageBits] + (offset & MASK(seL4_PageBits));
 }
 
-static int write_guest_mem(uintptr_t phys, void *vaddr, size_t size, size_t offset, void *cookie) {
-    memcpy(vaddr, cookie + offset, size);
-    return 0;
+static uint16_t ring_avail_idx(emul_queue_t *q) {
+    /* pairs with the barrier the guest issues before publishing new entries, so
+     * that the entries are read after the index */
+    return __atomic_load_n((uint16_t*)ring_ptr(q, &q->vring.avail->idx), __ATOMIC_ACQUIRE);
+}
+
+static uint16_t ring_avail(emul_queue_t *q, uint16_t idx) {
+    return *(uint16_t*)ring_ptr(q, &q->vring.avail->ring[idx % q->vring.num]);
+}
+
+static struct vring_desc ring_desc(emul_queue_t *q, uint16_t idx) {
+    return *(struct vring_desc*)ring_ptr(q, &q->vring.desc[idx % q->vring.num]);
+}
+
+static void ring_used_add(emul_queue_t *q, struct vring_used_elem elem) {
+    uint16_t *used_idx = ring_ptr(q, &q->vring.used->idx);
+    uint16_t guest_idx = *used_idx;
+    *(struct vring_used_elem*)ring_ptr(q, &q->vring.used->ring[guest_idx % q->vring.num]) = elem;
+    /* the guest must see the element before the index that hands it over */
+    __atomic_store_n(used_idx, guest_idx + 1, __ATOMIC_RELEASE);
+}
+
+/* Tell the guest whether we want to be notified when it adds buffers to a
+ * queue. When enabling, the caller must check the avail ring again afterwards
+ * as the guest may have added buffers before it saw the change */
+static void ring_set_kicks(ethif_virtio_emul_internal_t *net, emul_queue_t *q, int enable) {
+    if (net->guest_features & BIT(VIRTIO_RING_F_EVENT_IDX)) {
+        /* the guest only kicks when it moves its index past the event index.
+         * Leaving it at an index the guest has already passed disables kicks */
+        if (enable) {
+            /* this is vring_avail_event, which sits after the used ring */
+            *(uint16_t*)ring_ptr(q, &q->vring.used->ring[q->vring.num]) = q->last_idx;
+        }
+    } else {
+        *(uint16_t*)ring_ptr(q, &q->vring.used->flags) = enable ? 0 : VRING_USED_F_NO_NOTIFY;
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* Interrupt the guest about the buffers added to a used ring since the last
+ * time we did, unless it has asked not to be */
+static void ring_interrupt(ethif_virtio_emul_internal_t *net, int queue) {
+    emul_queue_t *q = &net->queues[queue];
+    uint16_t used = *(uint16_t*)ring_ptr(q, &q->vring.used->idx);
+    uint16_t old = q->signalled_used;
+    if (used == old) {
+        return;
+    }
+    q->signalled_used = used;
+    /* the used index must be visible before we read what the guest wants */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (net->guest_features & BIT(VIRTIO_RING_F_EVENT_IDX)) {
+        uint16_t event = __atomic_load_n((uint16_t*)ring_ptr(q, &vring_used_event(&q->vring)), __ATOMIC_RELAXED);
+        if (!vring_need_event(event, used, old)) {
+            return;
+        }
+    } else if (*(uint16_t*)ring_ptr(q, &q->vring.avail->flags) & VRING_AVAIL_F_NO_INTERRUPT) {
+        return;
+    }
+    /* the irq number tells the driver which pair, and so which vcpu, this is for */
+    net->driver.i_fn.raw_handleIRQ(&net->driver, QUEUE_PAIR(queue));
+}
+
+/* Translate a guest physical address, remembering the translation of its page */
+static void *guest_to_vmm(ethif_virtio_emul_internal_t *net, uintptr_t addr) {
+    uintptr_t page = PAGE_ALIGN_4K(addr);
+    emul_xlate_t *xlate = &net->xlate[(page >> seL4_PageBits) % XLATE_CACHE_SIZE];
+    if (!xlate->vmm_page || xlate->guest_page != page) {
+        void *vaddr = vmm_guest_vspace_translate(&net->guest_vspace, page);
+        if (!vaddr) {
+            return NULL;
+        }
+        xlate->guest_page = page;
+        xlate->vmm_page = vaddr;
+    }
+    return xlate->vmm_page + (addr - page);
 }
 
-static uint16_t ring_avail_idx(ethif_virtio_emul_t *emul, struct vring *vring) {
-    uint16_t idx;
-    vmm_guest_vspace_touch(&emul->internal->guest_vspace, (uintptr_t)&vring->avail->idx, sizeof(vring->avail->idx), read_guest_mem, &idx);
-    return idx;
+/* Translate a guest physical address, and find how many of the size bytes
+ * from it are also contiguous in the vmm, so that they can be copied at once */
+static void *guest_to_vmm_run(ethif_virtio_emul_internal_t *net, uintptr_t addr, size_t size, size_t *run) {
+    void *vaddr = guest_to_vmm(net, addr);
+    if (!vaddr) {
+        return NULL;
+    }
+    size_t len = MIN(size, PAGE_SIZE_4K - (addr & MASK(seL4_PageBits)));
+    while (len < size && guest_to_vmm(net, addr + len) == vaddr + len) {
+        len += MIN(size - len, PAGE_SIZE_4K);
+    }
+    *run = len;
+    return vaddr;
+}
+
+static void read_guest_mem(ethif_virtio_emul_internal_t *net, uintptr_t addr, void *buf, size_t size) {
+    while (size > 0) {
+        size_t copy;
+        void *vaddr = guest_to_vmm_run(net, addr, size, &copy);
+        if (!vaddr) {
+            ZF_LOGE("Guest address %p is not mapped", (void*)addr);
+            return;
+        }
+        memcpy(buf, vaddr, copy);
+        addr += copy;
+        buf += copy;
+        size -= copy;
+    }
 }
 
-static uint16_t ring_avail(ethif_virtio_emul_t *emul, struct vring *vring, uint16_t idx) {
-    uint16_t elem;
-    vmm_guest_vspace_touch(&emul->internal->guest_vspace, (uintptr_t)&(vring->avail->ring[idx % vring->num]), sizeof(elem), read_guest_mem, &elem);
-    return elem;
+static void write_guest_mem(ethif_virtio_emul_internal_t *net, uintptr_t addr, void *buf, size_t size) {
+    while (size > 0) {
+        size_t copy;
+        void *vaddr = guest_to_vmm_run(net, addr, size, &copy);
+        if (!vaddr) {
+            ZF_LOGE("Guest address %p is not mapped", (void*)addr);
+            return;
+        }
+        memcpy(vaddr, buf, copy);
+        addr += copy;
+        buf += copy;
+        size -= copy;
+    }
 }
 
-static struct vring_desc ring_desc(ethif_virtio_emul_t *emul, struct vring *vring, uint16_t idx) {
-    struct vring_desc desc;
-    vmm_guest_vspace_touch(&emul->internal->guest_vspace, (uintptr_t)&(vring->desc[idx]), sizeof(desc), read_guest_mem, &desc);
-    return desc;
+/* Point a queue at the rings the guest placed at the given page frame number,
+ * and resolve where each of their pages is mapped in the vmm */
+static void setup_queue(ethif_virtio_emul_internal_t *net, int queue, uint32_t pfn) {
+    emul_queue_t *q = &net->queues[queue];
+    free(q->ring_pages);
+    q->ring_pages = NULL;
+    q->pfn = pfn;
+    q->last_idx = 0;
+    q->signalled_used = 0;
+    vring_init(&q->vring, q->size, (void*)((uintptr_t)pfn << seL4_PageBits), VIRTIO_PCI_VRING_ALIGN);
+    if (pfn == 0) {
+        /* the guest is releasing the queue */
+        return;
+    }
+    size_t num_pages = ROUND_UP(vring_size(q->size, VIRTIO_PCI_VRING_ALIGN), PAGE_SIZE_4K) >> seL4_PageBits;
+    void **pages = malloc(sizeof(*pages) * num_pages);
+    if (!pages) {
+        ZF_LOGE("Failed to allocate ring translations for queue %d", queue);
+        return;
+    }
+    for (size_t i = 0; i < num_pages; i++) {
+        pages[i] = vmm_guest_vspace_translate(&net->guest_vspace, ((uintptr_t)pfn << seL4_PageBits) + i * PAGE_SIZE_4K);
+        if (!pages[i]) {
+            ZF_LOGE("Rings of queue %d are not in guest memory", queue);
+            free(pages);
+            return;
+        }
+    }
+    q->ring_pages = pages;
+    if (!IS_TX_QUEUE(queue)) {
+        /* receive buffers are only consumed when packets arrive, so kicks on
+         * a receive queue are of no use to us */
+        ring_set_kicks(net, q, 0);
+    }
 }
 
-static void ring_used_add(ethif_virtio_emul_t *emul, struct vring *vring, struct vring_used_elem elem) {
-    uint16_t guest_idx;
-    vmm_guest_vspace_touch(&emul->internal->guest_vspace, (uintptr_t)&vring->used->idx, sizeof(vring->used->idx), read_guest_mem, &guest_idx);
-    vmm_guest_vspace_touch(&emul->internal->guest_vspace, (uintptr_t)&vring->used->ring[guest_idx % vring->num], sizeof(elem), write_guest_mem, &elem);
-    guest_idx++;
-    vmm_guest_vspace_touch(&emul->internal->guest_vspace, (uintptr_t)&vring->used->idx, sizeof(vring->used->idx), write_guest_mem, &guest_idx);
+/* Pick the receive queue for a packet. The hash is symmetric in the source and
+ * destination so that both directions of a flow use the same pair */
+static int rx_queue_for(ethif_virtio_emul_internal_t *net, void *packet, unsigned int len) {
+    uint8_t *p = packet;
+    if (net->active_pairs <= 1 || len < 34 || p[12] != 0x08 || p[13] != 0x00) {
+        /* not IPv4 */
+        return RX_QUEUE(0);
+    }
+    uint32_t hash = 0;
+    for (int i = 0; i < 4; i++) {
+        hash = (hash << 8) | (p[26 + i] ^ p[30 + i]);
+    }
+    unsigned int ihl = (p[14] & 0xf) * 4;
+    uint8_t proto = p[23];
+    if ((proto == 6 || proto == 17) && len >= 14 + ihl + 4) {
+        /* TCP or UDP, mix in the ports */
+        hash ^= ((p[14 + ihl] ^ p[14 + ihl + 2]) << 8) | (p[14 + ihl + 1] ^ p[14 + ihl + 3]);
+    }
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return RX_QUEUE(hash % net->active_pairs);
 }
 
 static uintptr_t emul_allocate_rx_buf(void *iface, size_t buf_size, void **cookie) {
@@ -97,17 +288,14 @@ static uintptr_t emul_allocate_rx_buf(void *iface, size_t buf_size, void **cooki
 static void emul_rx_complete(void *iface, unsigned int num_bufs, void **cookies, unsigned int *lens) {
     ethif_virtio_emul_t *emul = (ethif_virtio_emul_t*)iface;
     ethif_virtio_emul_internal_t *net = emul->internal;
-    unsigned int tot_len = 0;
     int i;
-    struct vring *vring = &net->vring[RX_QUEUE];
-    for (i = 0; i < num_bufs; i++) {
-        tot_len += lens[i];
-    }
+    int queue = rx_queue_for(net, cookies[0], lens[0]);
+    emul_queue_t *q = &net->queues[queue];
     /* grab the next receive chain */
     struct virtio_net_hdr virtio_hdr;
     memset(&virtio_hdr, 0, sizeof(virtio_hdr));
-    uint16_t guest_idx = ring_avail_idx(emul, vring);
-    uint16_t idx = net->last_idx[RX_QUEUE];
+    uint16_t guest_idx = q->ring_pages ? ring_avail_idx(q) : q->last_idx;
+    uint16_t idx = q->last_idx;
     if (idx != guest_idx) {
         /* total length of the written packet so far */
         size_t tot_written = 0;
@@ -117,12 +305,12 @@ static void emul_rx_complete(void *iface, unsigned int num_bufs, void **cookies,
         size_t buf_written = 0;
         /* the current buffer. -1 indicates the virtio net buffer */
         int current_buf = -1;
-        uint16_t desc_head = ring_avail(emul, vring, idx);
+        uint16_t desc_head = ring_avail(q, idx);
         /* start walking the descriptors */
         struct vring_desc desc;
         uint16_t desc_idx = desc_head;
         do {
-            desc = ring_desc(emul, vring, desc_idx);
+            desc = ring_desc(q, desc_idx);
             /* determine how much we can copy */
             uint32_t copy;
             void *buf_base = NULL;
@@ -135,14 +323,14 @@ static void emul_rx_complete(void *iface, unsigned int num_bufs, void **cookies,
             }
             copy = MIN(copy, desc.len - desc_written);
             /* copy it */
-            vmm_guest_vspace_touch(&net->guest_vspace, (uintptr_t)desc.addr + desc_written, copy, write_guest_mem, buf_base + buf_written);
+            write_guest_mem(net, (uintptr_t)desc.addr + desc_written, buf_base + buf_written, copy);
             /* update amounts */
             tot_written += copy;
             desc_written += copy;
             buf_written += copy;
             /* see what's gone over */
             if (desc_written == desc.len) {
-                if (!desc.flags & VRING_DESC_F_NEXT) {
+                if (!(desc.flags & VRING_DESC_F_NEXT)) {
                     /* descriptor chain is too short to hold the whole packet.
                      * just truncate */
                     break;
@@ -164,12 +352,12 @@ static void emul_rx_complete(void *iface, unsigned int num_bufs, void **cookies,
         } while (current_buf < num_bufs);
         /* now put it in the used ring */
         struct vring_used_elem used_elem = {desc_head, tot_written};
-        ring_used_add(emul, vring, used_elem);
+        ring_used_add(q, used_elem);
 
         /* record that we've used this descriptor chain now */
-        net->last_idx[RX_QUEUE]++;
+        q->last_idx++;
         /* notify the guest that there is something in its used ring */
-        net->driver.i_fn.raw_handleIRQ(&net->driver, 0);
+        ring_interrupt(net, queue);
     }
     for (i = 0; i < num_bufs; i++) {
         ps_dma_unpin(&net->dma_man, cookies[i], BUF_SIZE);
@@ -177,36 +365,44 @@ static void emul_rx_complete(void *iface, unsigned int num_bufs, void **cookies,
     }
 }
 
+/* Return a transmitted buffer to the guest. The caller is responsible for
+ * interrupting the guest */
 static void emul_tx_complete(void *iface, void *cookie) {
     ethif_virtio_emul_t *emul = (ethif_virtio_emul_t*)iface;
     ethif_virtio_emul_internal_t *net = emul->internal;
     emul_tx_cookie_t *tx_cookie = (emul_tx_cookie_t*)cookie;
+    emul_queue_t *q = &net->queues[tx_cookie->queue];
     /* free the dma memory */
     ps_dma_unpin(&net->dma_man, tx_cookie->vaddr, BUF_SIZE);
     ps_dma_free(&net->dma_man, tx_cookie->vaddr, BUF_SIZE);
-    /* put the descriptor chain into the used list */
-    struct vring_used_elem used_elem = {tx_cookie->desc_head, 0};
-    ring_used_add(emul, &net->vring[TX_QUEUE], used_elem);
+    /* put the descriptor chain into the used list, unless the guest has
+     * released the queue in the mean time */
+    if (q->ring_pages) {
+        struct vring_used_elem used_elem = {tx_cookie->desc_head, 0};
+        ring_used_add(q, used_elem);
+    }
     free(tx_cookie);
-    /* notify the guest that we have completed some of its buffers */
-    net->driver.i_fn.raw_handleIRQ(&net->driver, 0);
 }
 
-static void emul_notify_tx(ethif_virtio_emul_t *emul) {
+/* Transmit what we can of a queue. Returns non-zero if we had to stop before
+ * the end of the avail ring */
+static int emul_process_tx(ethif_virtio_emul_t *emul, int queue) {
     ethif_virtio_emul_internal_t *net = emul->internal;
-    struct vring *vring = &net->vring[TX_QUEUE];
+    emul_queue_t *q = &net->queues[queue];
     /* read the index */
-    uint16_t guest_idx = ring_avail_idx(emul, vring);
+    uint16_t guest_idx = ring_avail_idx(q);
     /* process what we can of the ring */
-    uint16_t idx = net->last_idx[TX_QUEUE];
+    uint16_t idx = q->last_idx;
+    int stalled = 0;
     while (idx != guest_idx) {
         uint16_t desc_head;
         /* read the head of the descriptor chain */
-        desc_head = ring_avail(emul, vring, idx);
+        desc_head = ring_avail(q, idx);
         /* allocate a packet */
         void *vaddr = ps_dma_alloc(&net->dma_man, BUF_SIZE, net->driver.dma_alignment, 1, PS_MEM_NORMAL);
         if (!vaddr) {
             /* try again later */
+            stalled = 1;
             break;
         }
         uintptr_t phys = ps_dma_pin(&net->dma_man, vaddr, BUF_SIZE);
@@ -221,7 +417,7 @@ static void emul_notify_tx(ethif_virtio_emul_t *emul) {
         struct vring_desc desc;
         uint16_t desc_idx = desc_head;
         do {
-            desc = ring_desc(emul, vring, desc_idx);
+            desc = ring_desc(q, desc_idx);
             uint32_t skip = 0;
             /* if we haven't yet skipped the full virtio net header, work
              * out how much of this descriptor should be skipped */
@@ -232,13 +428,14 @@ static void emul_notify_tx(ethif_virtio_emul_t *emul) {
             /* truncate packets that are too large */
             uint32_t this_len = desc.len - skip;
             this_len = MIN(BUF_SIZE - len, this_len);
-            vmm_guest_vspace_touch(&net->guest_vspace, (uintptr_t)desc.addr + skip, this_len, read_guest_mem, vaddr + len);
+            read_guest_mem(net, (uintptr_t)desc.addr + skip, vaddr + len, this_len);
             len += this_len;
             desc_idx = desc.next;
         } while (desc.flags & VRING_DESC_F_NEXT);
         /* ship it */
         emul_tx_cookie_t *cookie = malloc(sizeof(*cookie));
         assert(cookie);
+        cookie->queue = queue;
         cookie->desc_head = desc_head;
         cookie->vaddr = vaddr;
         int result = net->driver.i_fn.raw_tx(&net->driver, 1, &phys, &len, cookie);
@@ -256,13 +453,35 @@ static void emul_notify_tx(ethif_virtio_emul_t *emul) {
         idx++;
     }
     /* update which parts of the ring we have processed */
-    net->last_idx[TX_QUEUE] = idx;
+    q->last_idx = idx;
+    return stalled;
+}
+
+static void emul_notify_tx(ethif_virtio_emul_t *emul, int queue) {
+    ethif_virtio_emul_internal_t *net = emul->internal;
+    emul_queue_t *q = &net->queues[queue];
+    if (!q->ring_pages) {
+        return;
+    }
+    int stalled;
+    do {
+        /* there is no point in the guest kicking us for every packet while we
+         * are working through the ring anyway */
+        ring_set_kicks(net, q, 0);
+        stalled = emul_process_tx(emul, queue);
+        ring_set_kicks(net, q, 1);
+        /* the guest may have added packets before it saw kicks were enabled */
+    } while (!stalled && ring_avail_idx(q) != q->last_idx);
+    /* one interrupt for everything that was completed */
+    ring_interrupt(net, queue);
 }
 
 static void emul_tx_complete_external(void *iface, void *cookie) {
+    ethif_virtio_emul_t *emul = (ethif_virtio_emul_t*)iface;
+    int queue = ((emul_tx_cookie_t*)cookie)->queue;
     emul_tx_complete(iface, cookie);
     /* space may have cleared for additional transmits */
-    emul_notify_tx(iface);
+    emul_notify_tx(emul, queue);
 }
 
 static struct raw_iface_callbacks emul_callbacks = {
@@ -271,27 +490,97 @@ static struct raw_iface_callbacks emul_callbacks = {
     .allocate_rx_buf = emul_allocate_rx_buf
 };
 
+/* Carry out a command from the control queue. Returns the ack */
+static virtio_net_ctrl_ack emul_ctrl_command(ethif_virtio_emul_internal_t *net, uint8_t *cmd, size_t len) {
+    struct virtio_net_ctrl_hdr hdr;
+    if (len < sizeof(hdr)) {
+        return VIRTIO_NET_ERR;
+    }
+    memcpy(&hdr, cmd, sizeof(hdr));
+    if (hdr.class == VIRTIO_NET_CTRL_MQ && hdr.cmd == VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET &&
+            len >= sizeof(hdr) + sizeof(uint16_t)) {
+        uint16_t pairs;
+        memcpy(&pairs, cmd + sizeof(hdr), sizeof(pairs));
+        if (pairs < VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN || pairs > net->max_pairs) {
+            return VIRTIO_NET_ERR;
+        }
+        net->active_pairs = pairs;
+        return VIRTIO_NET_OK;
+    }
+    ZF_LOGW("Unsupported control command class %d command %d", hdr.class, hdr.cmd);
+    return VIRTIO_NET_ERR;
+}
+
+static void emul_notify_ctrl(ethif_virtio_emul_internal_t *net, int queue) {
+    emul_queue_t *q = &net->queues[queue];
+    if (!q->ring_pages) {
+        return;
+    }
+    uint16_t guest_idx = ring_avail_idx(q);
+    while (q->last_idx != guest_idx) {
+        uint16_t desc_head = ring_avail(q, q->last_idx);
+        /* commands are small, gather the device readable part and find the
+         * writable descriptor for the ack */
+        uint8_t cmd[64];
+        size_t len = 0;
+        uintptr_t ack_addr = 0;
+        struct vring_desc desc;
+        uint16_t desc_idx = desc_head;
+        int count = 0;
+        do {
+            desc = ring_desc(q, desc_idx);
+            if (desc.flags & VRING_DESC_F_WRITE) {
+                ack_addr = desc.addr;
+            } else {
+                uint32_t copy = MIN(desc.len, sizeof(cmd) - len);
+                read_guest_mem(net, desc.addr, cmd + len, copy);
+                len += copy;
+            }
+            desc_idx = desc.next;
+        } while ((desc.flags & VRING_DESC_F_NEXT) && ++count < q->size);
+        uint32_t written = 0;
+        if (ack_addr) {
+            virtio_net_ctrl_ack ack = emul_ctrl_command(net, cmd, len);
+            write_guest_mem(net, ack_addr, &ack, sizeof(ack));
+            written = sizeof(ack);
+        }
+        struct vring_used_elem used_elem = {desc_head, written};
+        ring_used_add(q, used_elem);
+        q->last_idx++;
+    }
+    ring_interrupt(net, queue);
+}
+
 static int emul_io_in(struct ethif_virtio_emul *emul, unsigned int offset, unsigned int size, unsigned int *result) {
+    ethif_virtio_emul_internal_t *net = emul->internal;
     switch(offset) {
     case VIRTIO_PCI_HOST_FEATURES:
         assert(size == 4);
-        *result = BIT(VIRTIO_NET_F_MAC);
+        *result = net->host_features;
         break;
     case VIRTIO_PCI_STATUS:
         assert(size == 1);
-        *result = emul->internal->status;
+        *result = net->status;
         break;
     case VIRTIO_PCI_QUEUE_NUM:
         assert(size == 2);
-        *result = emul->internal->queue_size[emul->internal->queue];
+        *result = net->queues[net->queue].size;
         break;
-    case 0x14 ... 0x19:
-        assert(size == 1);
-        *result = emul->internal->mac[offset - 0x14];
+    case CONFIG_OFFSET ... CONFIG_OFFSET + sizeof(struct virtio_net_config) - 1: {
+        struct virtio_net_config config = {
+            .status = 0,
+            .max_virtqueue_pairs = net->max_pairs,
+        };
+        memcpy(config.mac, net->mac, sizeof(config.mac));
+        unsigned int config_offset = offset - CONFIG_OFFSET;
+        assert(size <= sizeof(*result) && config_offset + size <= sizeof(config));
+        *result = 0;
+        memcpy(result, (uint8_t*)&config + config_offset, size);
         break;
+    }
     case VIRTIO_PCI_QUEUE_PFN:
         assert(size == 4);
-        *result = emul->internal->queue_pfn[emul->internal->queue];
+        *result = net->queues[net->queue].pfn;
         break;
     case VIRTIO_PCI_ISR:
         assert(size == 1);
@@ -305,34 +594,48 @@ static int emul_io_in(struct ethif_virtio_emul *emul, unsigned int offset, unsig
 }
 
 static int emul_io_out(struct ethif_virtio_emul *emul, unsigned int offset, unsigned int size, unsigned int value) {
+    ethif_virtio_emul_internal_t *net = emul->internal;
     switch(offset) {
     case VIRTIO_PCI_GUEST_FEATURES:
         assert(size == 4);
-        assert(value == BIT(VIRTIO_NET_F_MAC));
+        assert(!(value & ~net->host_features));
+        net->guest_features = value & net->host_features;
         break;
     case VIRTIO_PCI_STATUS:
         assert(size == 1);
-        emul->internal->status = value & 0xff;
+        net->status = value & 0xff;
+        if (net->status == 0) {
+            /* device reset, the guest may reuse its memory for something else */
+            memset(net->xlate, 0, sizeof(net->xlate));
+            net->active_pairs = 1;
+        }
         break;
     case VIRTIO_PCI_QUEUE_SEL:
         assert(size == 2);
-        emul->internal->queue = (value & 0xffff);
-        assert(emul->internal->queue == 0 || emul->internal->queue == 1);
+        if ((value & 0xffff) >= net->num_queues) {
+            /* the guest picks the index, keep the last valid one selected */
+            ZF_LOGE("Guest selected invalid queue %u", value & 0xffff);
+            break;
+        }
+        net->queue = (value & 0xffff);
         break;
     case VIRTIO_PCI_QUEUE_PFN: {
         assert(size == 4);
-        int queue = emul->internal->queue;
-        emul->internal->queue_pfn[queue] = value;
-        vring_init(&emul->internal->vring[queue], emul->internal->queue_size[queue], (void*)(uintptr_t)(value << 12), VIRTIO_PCI_VRING_ALIGN);
+        setup_queue(net, net->queue, value);
         break;
     }
     case VIRTIO_PCI_QUEUE_NOTIFY:
-        if (value == RX_QUEUE) {
+        if (value >= net->num_queues) {
+            break;
+        }
+        if (value == net->num_queues - 1 && net->max_pairs > 1) {
+            emul_notify_ctrl(net, value);
+        } else if (IS_TX_QUEUE(value)) {
+            emul_notify_tx(emul, value);
+        } else {
             /* Currently RX packets will just get dropped if there was no space
              * so we will never have work to do if the client suddenly adds
              * more buffers */
-        } else if (value == TX_QUEUE) {
-            emul_notify_tx(emul);
         }
         break;
     default:
@@ -346,30 +649,47 @@ static int emul_notify(ethif_virtio_emul_t *emul) {
     if (emul->internal->status != VIRTIO_CONFIG_S_DRIVER_OK) {
         return -1;
     }
-    emul_notify_tx(emul);
+    for (int pair = 0; pair < emul->internal->max_pairs; pair++) {
+        emul_notify_tx(emul, TX_QUEUE(pair));
+    }
     return 0;
 }
 
-ethif_virtio_emul_t *ethif_virtio_emul_init(ps_io_ops_t io_ops, int queue_size, vspace_t *guest_vspace, ethif_driver_init driver, void *config) {
+ethif_virtio_emul_t *ethif_virtio_emul_init_mq(ps_io_ops_t io_ops, int queue_size, int num_queue_pairs, vspace_t *guest_vspace, ethif_driver_init driver, void *config) {
     ethif_virtio_emul_t *emul = NULL;
     ethif_virtio_emul_internal_t *internal = NULL;
     int err;
-    emul = malloc(sizeof(*emul));
-    internal = malloc(sizeof(*internal));
+    if (num_queue_pairs < VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN || num_queue_pairs > VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MAX) {
+        ZF_LOGE("Invalid number of queue pairs %d", num_queue_pairs);
+        return NULL;
+    }
+    emul = calloc(1, sizeof(*emul));
+    internal = calloc(1, sizeof(*internal));
     if (!emul || !internal) {
         goto error;
     }
-    memset(emul, 0, sizeof(*emul));
-    memset(internal, 0, sizeof(*internal));
     emul->internal = internal;
     emul->io_in = emul_io_in;
     emul->io_out = emul_io_out;
     emul->notify = emul_notify;
-    internal->queue_size[RX_QUEUE] = queue_size;
-    internal->queue_size[TX_QUEUE] = queue_size;
-    /* create dummy rings. we never actually dereference the rings so they can be null */
-    vring_init(&internal->vring[RX_QUEUE], emul->internal->queue_size[RX_QUEUE], 0, VIRTIO_PCI_VRING_ALIGN);
-    vring_init(&internal->vring[TX_QUEUE], emul->internal->queue_size[RX_QUEUE], 0, VIRTIO_PCI_VRING_ALIGN);
+    internal->max_pairs = num_queue_pairs;
+    internal->active_pairs = 1;
+    internal->host_features = BIT(VIRTIO_NET_F_MAC) | BIT(VIRTIO_RING_F_EVENT_IDX);
+    internal->num_queues = num_queue_pairs * 2;
+    if (num_queue_pairs > 1) {
+        /* the guest enables the additional pairs through the control queue */
+        internal->host_features |= BIT(VIRTIO_NET_F_CTRL_VQ) | BIT(VIRTIO_NET_F_MQ);
+        internal->num_queues++;
+    }
+    internal->queues = calloc(internal->num_queues, sizeof(*internal->queues));
+    if (!internal->queues) {
+        goto error;
+    }
+    for (int i = 0; i < internal->num_queues; i++) {
+        internal->queues[i].size = queue_size;
+        /* the rings are not usable until the guest tells us where they are */
+        vring_init(&internal->queues[i].vring, queue_size, 0, VIRTIO_PCI_VRING_ALIGN);
+    }
     internal->driver.cb_cookie = emul;
     internal->driver.i_cb = emul_callbacks;
     internal->guest_vspace = *guest_vspace;
@@ -387,7 +707,12 @@ error:
         free(emul);
     }
     if (internal) {
+        free(internal->queues);
         free(internal);
     }
     return NULL;
 }
+
+ethif_virtio_emul_t *ethif_virtio_emul_init(ps_io_ops_t io_ops, int queue_size, vspace_t *guest_vspace, ethif_driver_init driver, void *config) {
+    return ethif_virtio_emul_init_mq(io_ops, queue_size, 1, guest_vspace, driver, config);
+}
@@ -22,12 +22,21 @@
 #include <sel4/sel4.h>
 #include <simple/simple.h>
 #include <vka/capops.h>
+#include <vka/object.h>
+#include <sel4utils/thread.h>
+#include <sel4utils/thread_config.h>
 
 #include "vmm/platform/boot.h"
 #include "vmm/platform/guest_vspace.h"
 #include "vmm/processor/apicdef.h"
 #include "vmm/processor/lapic.h"
 
+#ifdef CONFIG_VMM_LAZY_GUEST_RAM
+static int populate_guest_ram(void *cookie, uintptr_t addr) {
+    return vmm_guest_ram_populate((vmm_t*)cookie, addr);
+}
+#endif
+
 int vmm_init(vmm_t *vmm, allocman_t *allocman, simple_t simple, vka_t vka, vspace_t vspace, platform_callbacks_t callbacks) {
     int err;
     memset(vmm, 0, sizeof(vmm_t));
@@ -65,10 +74,77 @@ int vmm_init_host(vmm_t *vmm) {
     return 0;
 }
 
+/* Mint the cap other vcpus use to kick this one */
+static int vmm_init_vcpu_kick(vmm_t *vmm, vmm_vcpu_t *vcpu) {
+    cspacepath_t ntfn_path, kick_path;
+    vka_cspace_make_path(&vmm->vka, vcpu->notification, &ntfn_path);
+    int error = vka_cspace_alloc_path(&vmm->vka, &kick_path);
+    if (error) {
+        ZF_LOGE("Failed to allocate slot");
+        return error;
+    }
+    error = vka_cnode_mint(&kick_path, &ntfn_path, seL4_AllRights, VMM_VCPU_KICK_BADGE);
+    if (error != seL4_NoError) {
+        ZF_LOGE("Failed to mint kick cap for vcpu %d", vcpu->vcpu_id);
+        return error;
+    }
+    vcpu->kick = kick_path.capPtr;
+    return 0;
+}
+
+/* Every vcpu other than the boot vcpu gets its own thread to run the guest
+ * on. It is started by vmm_run */
+static int vmm_init_vcpu_thread(vmm_t *vmm, vmm_vcpu_t *vcpu, int priority) {
+    int error;
+    seL4_Word data = api_make_guard_skip_word(seL4_WordBits - simple_get_cnode_size_bits(&vmm->host_simple));
+    sel4utils_thread_config_t config = thread_config_default(&vmm->host_simple,
+            simple_get_cnode(&vmm->host_simple), data, seL4_CapNull, priority);
+    error = sel4utils_configure_thread_config(&vmm->vka, &vmm->host_vspace, &vmm->host_vspace,
+            config, &vcpu->thread);
+    if (error) {
+        ZF_LOGE("Failed to create thread for vcpu %d", vcpu->vcpu_id);
+        return error;
+    }
+    seL4_CPtr tcb = sel4utils_get_tcb(&vcpu->thread);
+    error = seL4_TCB_SetEPTRoot(tcb, vmm->guest_pd);
+    if (error != seL4_NoError) {
+        ZF_LOGE("Failed to set EPT root for vcpu %d", vcpu->vcpu_id);
+        return error;
+    }
+#if CONFIG_MAX_NUM_NODES > 1
+    /* New threads run on the core that created them, so spread the vcpus
+     * over the cores or they would all share the boot vcpu's */
+    error = seL4_TCB_SetAffinity(tcb, vcpu->vcpu_id % CONFIG_MAX_NUM_NODES);
+    if (error != seL4_NoError) {
+        ZF_LOGE("Failed to set affinity for vcpu %d", vcpu->vcpu_id);
+        return error;
+    }
+#endif
+
+    vka_object_t notification;
+    error = vka_alloc_notification(&vmm->vka, &notification);
+    if (error) {
+        ZF_LOGE("Failed to allocate notification for vcpu %d", vcpu->vcpu_id);
+        return error;
+    }
+    vcpu->notification = notification.cptr;
+    error = seL4_TCB_BindNotification(tcb, vcpu->notification);
+    if (error != seL4_NoError) {
+        ZF_LOGE("Failed to bind notification for vcpu %d", vcpu->vcpu_id);
+        return error;
+    }
+    return 0;
+}
+
 static int vmm_init_vcpu(vmm_t *vmm, unsigned int vcpu_num, int priority) {
-    int UNUSED error;
+    int error;
     assert(vcpu_num < vmm->num_vcpus);
     vmm_vcpu_t *vcpu = &vmm->vcpus[vcpu_num];
+    memset(vcpu, 0, sizeof(*vcpu));
+
+    vcpu->vmm = vmm;
+    vcpu->vcpu_id = vcpu_num;
+    vcpu->mmio_last = 0;
 
     /* sel4 vcpu (vmcs) */
     vcpu->guest_vcpu = vka_alloc_vcpu_leaky(&vmm->vka);
@@ -76,12 +152,25 @@ static int vmm_init_vcpu(vmm_t *vmm, unsigned int vcpu_num, int priority) {
         return -1;
     }
 
-    /* bind the VCPU to the VMM thread */
-    error = seL4_X86_VCPU_SetTCB(vcpu->guest_vcpu, vmm->tcb);
-    assert(error == seL4_NoError);
+    seL4_CPtr tcb;
+    if (vcpu_num == BOOT_VCPU) {
+        tcb = vmm->tcb;
+        vcpu->notification = vmm->plat_callbacks.get_async_event_notification();
+    } else {
+        error = vmm_init_vcpu_thread(vmm, vcpu, priority);
+        if (error) {
+            return error;
+        }
+        tcb = sel4utils_get_tcb(&vcpu->thread);
+    }
+    error = vmm_init_vcpu_kick(vmm, vcpu);
+    if (error) {
+        return error;
+    }
 
-    vcpu->vmm = vmm;
-    vcpu->vcpu_id = vcpu_num;
+    /* bind the VCPU to the thread that will run it */
+    error = seL4_X86_VCPU_SetTCB(vcpu->guest_vcpu, tcb);
+    assert(error == seL4_NoError);
 
     /* All LAPICs are created enabled, in virtual wire mode */
     vmm_create_lapic(vcpu, 1);
@@ -125,14 +214,29 @@ int vmm_init_guest_multi(vmm_t *vmm, int priority, int num_vcpus) {
         return error;
     }
 
+    error = sync_mutex_new(&vmm->vka, &vmm->lock);
+    if (error) {
+        ZF_LOGE("Failed to create vmm lock");
+        return error;
+    }
+
     for (int i = 0; i < num_vcpus; i++) {
-        vmm_init_vcpu(vmm, i, priority);
+        error = vmm_init_vcpu(vmm, i, priority);
+        if (error) {
+            return error;
+        }
     }
 
     /* Init guest memory information.
      * TODO: should probably done elsewhere */
     vmm->guest_mem.num_ram_regions = 0;
     vmm->guest_mem.ram_regions = malloc(0);
+    vmm->guest_mem.num_lazy_ranges = 0;
+    vmm->guest_mem.lazy_ranges = malloc(0);
+    memset(&vmm->guest_mem.stats, 0, sizeof(vmm->guest_mem.stats));
+#ifdef CONFIG_VMM_LAZY_GUEST_RAM
+    vmm_guest_vspace_set_populate(&vmm->guest_mem.vspace, populate_guest_ram, vmm);
+#endif
 
     vmm_mmio_add_handler(&vmm->mmio_list, APIC_DEFAULT_PHYS_BASE,
             APIC_DEFAULT_PHYS_BASE + sizeof(struct local_apic_regs) - 1,
@@ -442,76 +442,45 @@ void vmm_init_guest_thread_state(vmm_vcpu_t *vcpu) {
 }
 
 /* TODO: Refactor and stop rewriting fucking elf loading code */
+typedef struct load_segment {
+    FILE *file;
+    seL4_Word source_offset;
+    size_t file_size;
+} load_segment_t;
+
+static int load_guest_segment_page(uintptr_t guest_phys, void *vaddr, size_t size, size_t offset, void *cookie) {
+    load_segment_t *segment = cookie;
+    if (offset >= segment->file_size) {
+        memset(vaddr, 0, size);
+        return 0;
+    }
+    /* Don't copy past end of data. */
+    size_t copy_len = MIN(size, segment->file_size - offset);
+    DPRINTF(5, "load page src %zu dest %p copy vaddr %p copy len %zu\n",
+            (size_t)(segment->source_offset + offset), (void*)guest_phys, vaddr, copy_len);
+    fseek(segment->file, segment->source_offset + offset, SEEK_SET);
+    size_t result = fread(vaddr, copy_len, 1, segment->file);
+    ZF_LOGF_IF(result != 1, "Read failed unexpectedly");
+    memset(vaddr + copy_len, 0, size - copy_len);
+    return 0;
+}
+
 static int vmm_load_guest_segment(vmm_t *vmm, seL4_Word source_offset,
         seL4_Word dest_addr, unsigned int segment_size, unsigned int file_size, FILE *file) {
-
-    int ret;
-    unsigned int page_size = vmm->page_size;
     assert(file_size <= segment_size);
-
-    /* Allocate a cslot for duplicating frame caps */
-    cspacepath_t dup_slot;
-    ret = vka_cspace_alloc_path(&vmm->vka, &dup_slot);
+    /* Go through the guest's own mappings in the vmm vspace, rather than
+     * mapping each frame again, as guest RAM may be backed by large frames or
+     * not be backed at all until it is first touched */
+    load_segment_t segment = {
+        .file = file,
+        .source_offset = source_offset,
+        .file_size = file_size,
+    };
+    int ret = vmm_guest_vspace_touch(&vmm->guest_mem.vspace, dest_addr, segment_size, load_guest_segment_page, &segment);
     if (ret) {
-        ZF_LOGE("Failed to allocate slot");
-        return ret;
-    }
-
-    size_t current = 0;
-    size_t remain = file_size;
-    while (current < segment_size) {
-        /* Retrieve the mapping */
-        seL4_CPtr cap;
-        cap = vspace_get_cap(&vmm->guest_mem.vspace, (void*)dest_addr);
-        if (!cap) {
-            ZF_LOGE("Failed to find frame cap while loading elf segment at %p", (void*)dest_addr);
-            return -1;
-        }
-        cspacepath_t cap_path;
-        vka_cspace_make_path(&vmm->vka, cap, &cap_path);
-
-        /* Copy cap and map into our vspace */
-        vka_cnode_copy(&dup_slot, &cap_path, seL4_AllRights);
-        void *map_vaddr = vspace_map_pages(&vmm->host_vspace, &dup_slot.capPtr, NULL, seL4_AllRights, 1, page_size, 1);
-        if (!map_vaddr) {
-            ZF_LOGE("Failed to map page into host vspace");
-            return -1;
-        }
-
-        /* Copy the contents of page from ELF into the mapped frame. */
-        size_t offset = dest_addr & ((BIT(page_size)) - 1);
-
-        void *copy_vaddr = map_vaddr + offset;
-        size_t copy_len = (BIT(page_size)) - offset;
-
-        if (remain > 0) {
-            if (copy_len > remain) {
-                /* Don't copy past end of data. */
-                copy_len = remain;
-            }
-
-            DPRINTF(5, "load page src %zu dest %p remain %zu offset %zu copy vaddr %p "
-                    "copy len %zu\n", source_offset, (void*)dest_addr, remain, offset, copy_vaddr, copy_len);
-
-            fseek(file, source_offset, SEEK_SET);
-            size_t result = fread(copy_vaddr, copy_len, 1, file);
-            ZF_LOGF_IF(result != 1, "Read failed unexpectedly");
-            source_offset += copy_len;
-            remain -= copy_len;
-        } else {
-            memset(copy_vaddr, 0, copy_len);
-        }
-
-        dest_addr += copy_len;
-
-        current += copy_len;
-
-        /* Unamp the page and delete the temporary cap */
-        vspace_unmap_pages(&vmm->host_vspace, map_vaddr, 1, page_size, NULL);
-        vka_cnode_delete(&dup_slot);
+        ZF_LOGE("Failed to load elf segment at %p", (void*)dest_addr);
     }
-
-    return 0;
+    return ret;
 }
 
 /* Load the actual ELF file contents into pre-allocated frames.
@@ -214,27 +214,173 @@ static int vmm_alloc_guest_ram_one_to_one(vmm_t *vmm, size_t bytes) {
     return 0;
 }
 
+/* Whether a large frame could back the guest at addr without going past end */
+static bool large_frame_fits(vmm_t *vmm, uintptr_t addr, uintptr_t end) {
+#ifdef CONFIG_VMM_GUEST_RAM_LARGE_PAGES
+    return vmm->page_size < seL4_LargePageBits && IS_ALIGNED(addr, seL4_LargePageBits) &&
+           end - addr >= BIT(seL4_LargePageBits);
+#else
+    return false;
+#endif
+}
+
+/* Allocate a frame of size_bits and map it into the guest at vaddr, which must
+ * be covered by reservation. Nothing is reported on failure as the caller may
+ * still be able to fall back to smaller frames */
+static int alloc_guest_frame(vmm_t *vmm, uintptr_t vaddr, int size_bits, reservation_t reservation, bool can_use_dev) {
+    guest_memory_t *guest_memory = &vmm->guest_mem;
+    seL4_Word cookie;
+    cspacepath_t path;
+    int error = vka_cspace_alloc_path(&vmm->vka, &path);
+    if (error) {
+        return error;
+    }
+    cookie = allocman_utspace_alloc(vmm->allocman, size_bits, kobject_get_type(KOBJECT_FRAME, size_bits), &path, can_use_dev, &error);
+    if (error) {
+        vka_cspace_free(&vmm->vka, path.capPtr);
+        return error;
+    }
+    error = vspace_map_pages_at_vaddr(&guest_memory->vspace, &path.capPtr, &cookie, (void*)vaddr, 1, size_bits, reservation);
+    if (error) {
+        vka_cnode_delete(&path);
+        vka_cspace_free(&vmm->vka, path.capPtr);
+        allocman_utspace_free(vmm->allocman, cookie, size_bits);
+        return error;
+    }
+    if (size_bits > seL4_PageBits) {
+        guest_memory->stats.large_frame_bytes += BIT(size_bits);
+    } else {
+        guest_memory->stats.small_frame_bytes += BIT(size_bits);
+    }
+    return 0;
+}
+
+/* Back [start, end) of the guest, which must be covered by reservation. Large
+ * frames are used wherever the alignment allows and one can be allocated */
+static int alloc_guest_pages(vmm_t *vmm, uintptr_t start, uintptr_t end, reservation_t reservation, bool can_use_dev) {
+    int page_size = vmm->page_size;
+    uintptr_t addr = start;
+    while (addr < end) {
+        if (large_frame_fits(vmm, addr, end) &&
+            !alloc_guest_frame(vmm, addr, seL4_LargePageBits, reservation, can_use_dev)) {
+            addr += BIT(seL4_LargePageBits);
+            continue;
+        }
+        int error = alloc_guest_frame(vmm, addr, page_size, reservation, can_use_dev);
+        if (error) {
+            ZF_LOGE("Failed to create page 0x%x size %d in guest memory region", (unsigned int)addr, page_size);
+            return error;
+        }
+        addr += BIT(page_size);
+    }
+    return 0;
+}
+
+static int add_lazy_range(guest_memory_t *guest_memory, uintptr_t start, size_t size, reservation_t reservation) {
+    size_t chunks = (ROUND_UP(start + size, BIT(seL4_LargePageBits)) - ROUND_DOWN(start, BIT(seL4_LargePageBits))) >> seL4_LargePageBits;
+    uint8_t *split = calloc(ROUND_UP(chunks, 8) / 8, 1);
+    if (!split) {
+        ZF_LOGE("Failed to allocate lazy guest RAM bookkeeping");
+        return -1;
+    }
+    guest_lazy_range_t *ranges = realloc(guest_memory->lazy_ranges, sizeof(guest_lazy_range_t) * (guest_memory->num_lazy_ranges + 1));
+    if (!ranges) {
+        ZF_LOGE("Failed to allocate lazy guest RAM bookkeeping");
+        free(split);
+        return -1;
+    }
+    ranges[guest_memory->num_lazy_ranges] = (guest_lazy_range_t) {
+        .start = start,
+        .size = size,
+        .reservation = reservation,
+        .split = split,
+    };
+    guest_memory->lazy_ranges = ranges;
+    guest_memory->num_lazy_ranges++;
+    return 0;
+}
+
+int vmm_guest_ram_populate(vmm_t *vmm, uintptr_t addr) {
+    guest_memory_t *guest_memory = &vmm->guest_mem;
+    guest_lazy_range_t *range = NULL;
+    for (int i = 0; i < guest_memory->num_lazy_ranges; i++) {
+        if (addr >= guest_memory->lazy_ranges[i].start &&
+            addr - guest_memory->lazy_ranges[i].start < guest_memory->lazy_ranges[i].size) {
+            range = &guest_memory->lazy_ranges[i];
+            break;
+        }
+    }
+    if (!range) {
+        return -1;
+    }
+    if (vspace_get_cap(&guest_memory->vspace, (void*)addr)) {
+        /* Another vcpu got here first */
+        return 0;
+    }
+    uintptr_t chunk = ROUND_DOWN(addr, BIT(seL4_LargePageBits));
+    size_t index = (chunk - ROUND_DOWN(range->start, BIT(seL4_LargePageBits))) >> seL4_LargePageBits;
+    if (chunk >= range->start && !(range->split[index / 8] & BIT(index % 8)) &&
+        large_frame_fits(vmm, chunk, range->start + range->size)) {
+        if (!alloc_guest_frame(vmm, chunk, seL4_LargePageBits, range->reservation, true)) {
+            return 0;
+        }
+        /* Don't try again for the rest of this chunk */
+        range->split[index / 8] |= BIT(index % 8);
+    }
+    uintptr_t page = ROUND_DOWN(addr, BIT(vmm->page_size));
+    int error = alloc_guest_frame(vmm, page, vmm->page_size, range->reservation, true);
+    if (error) {
+        ZF_LOGE("Failed to back guest RAM at 0x%x", (unsigned int)page);
+    }
+    return error;
+}
+
+void print_guest_ram_stats(guest_memory_t *guest_memory) {
+    guest_ram_stats_t *stats = &guest_memory->stats;
+    size_t total = stats->large_frame_bytes + stats->small_frame_bytes;
+    printf("Guest RAM: %zuK backed, %zuK by large frames (%zu%%), %llu EPT faults populated\n",
+           total >> 10, stats->large_frame_bytes >> 10,
+           total ? (size_t)((uint64_t)stats->large_frame_bytes * 100 / total) : 0,
+           (unsigned long long)stats->ept_faults);
+}
+
 int vmm_alloc_guest_device_at(vmm_t *vmm, uintptr_t start, size_t bytes) {
     int page_size = vmm->page_size;
     int num_pages = ROUND_UP(bytes, BIT(page_size)) >> page_size;
     int ret;
-    int i;
     guest_memory_t *guest_memory = &vmm->guest_mem;
     uintptr_t page_start = ROUND_DOWN(start, BIT(page_size));
+    uintptr_t end = page_start + num_pages * BIT(page_size);
     printf("Add guest memory region 0x%x-0x%x\n", (unsigned int)start, (unsigned int)(start + bytes));
-    printf("Will be allocating region 0x%x-0x%x after page alignment\n", (unsigned int)page_start, (unsigned int)(page_start + num_pages * BIT(page_size)));
-    for (i = 0; i < num_pages; i++) {
-        reservation_t reservation = vspace_reserve_range_at(&guest_memory->vspace, (void*)(page_start + i * BIT(page_size)), 1, seL4_AllRights, 1);
+    printf("Will be allocating region 0x%x-0x%x after page alignment\n", (unsigned int)page_start, (unsigned int)end);
+    uintptr_t addr = page_start;
+    while (addr < end) {
+        if (large_frame_fits(vmm, addr, end)) {
+            /* A large frame can only go where nothing in the chunk is mapped yet */
+            reservation_t reservation = vspace_reserve_range_at(&guest_memory->vspace, (void*)addr, BIT(seL4_LargePageBits), seL4_AllRights, 1);
+            if (reservation.res) {
+                ret = alloc_guest_pages(vmm, addr, addr + BIT(seL4_LargePageBits), reservation, false);
+                vspace_free_reservation(&guest_memory->vspace, reservation);
+                if (ret) {
+                    return -1;
+                }
+                addr += BIT(seL4_LargePageBits);
+                continue;
+            }
+        }
+        reservation_t reservation = vspace_reserve_range_at(&guest_memory->vspace, (void*)addr, 1, seL4_AllRights, 1);
         if (!reservation.res) {
-            ZF_LOGI("Failed to create reservation for guest memory page 0x%x size %d, assuming already allocated", (unsigned int)(page_start + i * BIT(page_size)), page_size);
+            ZF_LOGI("Failed to create reservation for guest memory page 0x%x size %d, assuming already allocated", (unsigned int)addr, page_size);
+            addr += BIT(page_size);
             continue;
         }
-        ret = vspace_new_pages_at_vaddr(&guest_memory->vspace, (void*)(page_start + i * BIT(page_size)), 1, page_size, reservation);
+        ret = alloc_guest_frame(vmm, addr, page_size, reservation, false);
+        vspace_free_reservation(&guest_memory->vspace, reservation);
         if (ret) {
-            ZF_LOGE("Failed to create page 0x%x size %d in guest memory region", (unsigned int)(page_start + i * BIT(page_size)), page_size);
+            ZF_LOGE("Failed to create page 0x%x size %d in guest memory region", (unsigned int)addr, page_size);
             return -1;
         }
-        vspace_free_reservation(&guest_memory->vspace, reservation);
+        addr += BIT(page_size);
     }
     return 0;
 }
@@ -319,7 +465,20 @@ int vmm_map_guest_device_at(vmm_t *vmm, uintptr_t vaddr, uintptr_t paddr, size_t
 
 int vmm_alloc_guest_ram_at(vmm_t *vmm, uintptr_t start, size_t bytes) {
     int ret;
+#ifdef CONFIG_VMM_LAZY_GUEST_RAM
+    guest_memory_t *guest_memory = &vmm->guest_mem;
+    uintptr_t page_start = ROUND_DOWN(start, BIT(vmm->page_size));
+    size_t size = ROUND_UP(start + bytes, BIT(vmm->page_size)) - page_start;
+    reservation_t reservation = vspace_reserve_range_at(&guest_memory->vspace, (void*)page_start, size, seL4_AllRights, 1);
+    if (reservation.res) {
+        ret = add_lazy_range(guest_memory, page_start, size, reservation);
+    } else {
+        /* Some of the range is already mapped, so just back the rest now */
+        ret = vmm_alloc_guest_device_at(vmm, start, bytes);
+    }
+#else
     ret = vmm_alloc_guest_device_at(vmm, start, bytes);
+#endif
     if (ret) {
         return ret;
     }
@@ -341,37 +500,31 @@ int vmm_alloc_guest_ram(vmm_t *vmm, size_t bytes, int onetoone) {
     int page_size = vmm->page_size;
     uintptr_t base;
     int error;
-    int num_pages = ROUND_UP(bytes, BIT(page_size)) >> page_size;
-    reservation_t reservation = vspace_reserve_range(&guest_memory->vspace, num_pages * BIT(page_size), seL4_AllRights, 1, (void**)&base);
+    size_t size = ROUND_UP(bytes, BIT(page_size));
+    /* Align the base so that large frames can be used for as much as possible */
+    int align_bits = large_frame_fits(vmm, 0, size) ? seL4_LargePageBits : page_size;
+    reservation_t reservation = vspace_reserve_range_aligned(&guest_memory->vspace, size, align_bits, seL4_AllRights, 1, (void**)&base);
     if (!reservation.res) {
         ZF_LOGE("Failed to create reservation for %zu guest ram bytes", bytes);
         return -1;
     }
-    /* Create pages */
-    for (int i = 0 ; i < num_pages; i++) {
-        seL4_Word cookie;
-        cspacepath_t path;
-        error = vka_cspace_alloc_path(&vmm->vka, &path);
-        if (error) {
-            ZF_LOGE("Failed to allocate path");
-            return -1;
-        }
-        cookie = allocman_utspace_alloc(vmm->allocman, page_size, kobject_get_type(KOBJECT_FRAME, page_size), &path, true, &error);
-        if (error) {
-            ZF_LOGE("Failed to allocate page");
-            return -1;
-        }
-        error = vspace_map_pages_at_vaddr(&guest_memory->vspace, &path.capPtr, &cookie, (void*)(base + i * BIT(page_size)), 1, page_size, reservation);
-        if (error) {
-            ZF_LOGE("Failed to map page");
-            return -1;
-        }
+#ifdef CONFIG_VMM_LAZY_GUEST_RAM
+    error = add_lazy_range(guest_memory, base, size, reservation);
+    if (error) {
+        vspace_free_reservation(&guest_memory->vspace, reservation);
+        return error;
     }
+#else
+    error = alloc_guest_pages(vmm, base, base + size, reservation, true);
+    vspace_free_reservation(&guest_memory->vspace, reservation);
+    if (error) {
+        return error;
+    }
+#endif
     error = expand_guest_ram_region(&vmm->guest_mem, base, bytes);
     if (error) {
         return error;
     }
-    vspace_free_reservation(&guest_memory->vspace, reservation);
     printf("Guest RAM regions after allocating range 0x%x-0x%x:\n", (unsigned int)base, (unsigned int)(base + bytes));
     print_guest_ram_regions(&vmm->guest_mem);
     return 0;
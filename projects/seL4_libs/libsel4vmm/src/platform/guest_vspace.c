@@ -41,6 +41,9 @@ typedef struct guest_vspace {
      * the translation from guest to vmm */
     struct sel4utils_alloc_data translation_vspace_data;
     vspace_t translation_vspace;
+    /* called to back a guest page that has no translation yet */
+    vmm_guest_vspace_populate_fn populate;
+    void *populate_cookie;
 #ifdef CONFIG_IOMMU
     /* debug flag for checking if we add io spaces late */
     int done_mapping;
@@ -81,11 +84,14 @@ guest_vspace_map(vspace_t *vspace, seL4_CPtr cap, void *vaddr, seL4_CapRights_t
         return -1;
     }
     /* add translation information. give dummy cap value of 42 as it cannot be zero
-     * but we really just want to store information in the cookie */
-    error = update_entries(&guest_vspace->translation_vspace, (uintptr_t)vaddr, 42, size_bits, (uintptr_t)vmm_vaddr);
-    if (error){
-        ZF_LOGE("Failed to add translation information");
-        return error;
+     * but we really just want to store information in the cookie. Each 4K page gets
+     * its own translation so that lookups do not need to know the size of the frame */
+    for (uintptr_t offset = 0; offset < BIT(size_bits); offset += PAGE_SIZE_4K) {
+        error = update_entries(&guest_vspace->translation_vspace, (uintptr_t)vaddr + offset, 42, seL4_PageBits, (uintptr_t)vmm_vaddr + offset);
+        if (error){
+            ZF_LOGE("Failed to add translation information");
+            return error;
+        }
     }
 #ifdef CONFIG_IOMMU
     /* set the mapping bit */
@@ -228,6 +234,7 @@ int vmm_get_guest_vspace(vspace_t *loader, vspace_t *vmm, vspace_t *new_vspace,
     assert(vspace->iospaces);
 #endif
     vspace->vmm_vspace = *vmm;
+    vspace->populate = NULL;
     error = sel4utils_get_vspace(loader, &vspace->translation_vspace, &vspace->translation_vspace_data, vka, page_directory, NULL, NULL);
     if (error) {
         ZF_LOGE("Failed to create translation vspace");
@@ -259,6 +266,35 @@ int vmm_guest_set_phys_data_help(uintptr_t addr, void *vaddr, size_t size,
     return 0;
 }
 
+void vmm_guest_vspace_set_populate(vspace_t *vspace, vmm_guest_vspace_populate_fn populate, void *cookie) {
+    struct sel4utils_alloc_data *data = get_alloc_data(vspace);
+    guest_vspace_t *guest_vspace = (guest_vspace_t*) data;
+    guest_vspace->populate = populate;
+    guest_vspace->populate_cookie = cookie;
+}
+
+/* Find where the 4K guest page at addr is mapped in the vmm vspace, backing
+ * it first if need be */
+static void *guest_vspace_lookup(guest_vspace_t *guest_vspace, uintptr_t page) {
+    void *vaddr = (void*)sel4utils_get_cookie(&guest_vspace->translation_vspace, (void*)page);
+    if (!vaddr && guest_vspace->populate &&
+        !guest_vspace->populate(guest_vspace->populate_cookie, page)) {
+        vaddr = (void*)sel4utils_get_cookie(&guest_vspace->translation_vspace, (void*)page);
+    }
+    return vaddr;
+}
+
+void *vmm_guest_vspace_translate(vspace_t *vspace, uintptr_t addr) {
+    struct sel4utils_alloc_data *data = get_alloc_data(vspace);
+    guest_vspace_t *guest_vspace = (guest_vspace_t*) data;
+    uintptr_t page = PAGE_ALIGN_4K(addr);
+    void *vaddr = guest_vspace_lookup(guest_vspace, page);
+    if (!vaddr) {
+        return NULL;
+    }
+    return vaddr + (addr - page);
+}
+
 int vmm_guest_vspace_touch(vspace_t *vspace, uintptr_t addr, size_t size, vmm_guest_vspace_touch_callback callback, void *cookie) {
     struct sel4utils_alloc_data *data = get_alloc_data(vspace);
     guest_vspace_t *guest_vspace = (guest_vspace_t*) data;
@@ -269,7 +305,7 @@ int vmm_guest_vspace_touch(vspace_t *vspace, uintptr_t addr, size_t size, vmm_gu
         uintptr_t current_aligned = PAGE_ALIGN_4K(current_addr);
         uintptr_t next_page_start = current_aligned + PAGE_SIZE_4K;
         next_addr = MIN(end_addr, next_page_start);
-        void *vaddr = (void*)sel4utils_get_cookie(&guest_vspace->translation_vspace, (void*)current_aligned);
+        void *vaddr = guest_vspace_lookup(guest_vspace, current_aligned);
         if (!vaddr) {
             ZF_LOGE("Failed to get cookie at %p", (void*)current_aligned);
             return -1;
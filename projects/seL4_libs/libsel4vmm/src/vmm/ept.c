@@ -12,6 +12,8 @@
 
 /*vm exits related with ept violations*/
 
+#include <autoconf.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -28,10 +30,21 @@ int vmm_ept_violation_handler(vmm_vcpu_t *vcpu) {
     uintptr_t guest_phys = vmm_guest_exit_get_physical(&vcpu->guest_state);
     unsigned int qualification = vmm_guest_exit_get_qualification(&vcpu->guest_state);
 
+#ifdef CONFIG_VMM_LAZY_GUEST_RAM
+    if (vmm_guest_ram_populate(vcpu->vmm, guest_phys) == 0) {
+        /* Guest RAM touched for the first time, so just retry the access */
+        DPRINTF(5, "EPT violation handled by populating guest RAM\n");
+        vcpu->vmm->guest_mem.stats.ept_faults++;
+        return 0;
+    }
+#endif
+
     int e = vmm_mmio_exit_handler(vcpu, guest_phys, qualification);
 
     if (e == 0) {
         DPRINTF(5, "EPT violation handled by mmio\n");
+        vmm_guest_exit_next_instruction(&vcpu->guest_state, vcpu->guest_vcpu);
+        return 0;
     } else {
         /* Read linear address that guest is trying to access. */
         unsigned int linear_address = vmm_vmcs_read(vcpu->guest_vcpu, VMX_DATA_GUEST_LINEAR_ADDRESS);
@@ -41,6 +54,7 @@ int vmm_ept_violation_handler(vmm_vcpu_t *vcpu) {
         printf("        Guest-Physical address 0x%x.\n", vmm_guest_exit_get_physical(&vcpu->guest_state));
         printf("        Instruction pointer 0x%x.\n", vmm_guest_state_get_eip(&vcpu->guest_state));
         printf("    This is most likely due to a bug or misconfiguration.\n" COLOUR_RESET);
+        print_guest_ram_stats(&vcpu->vmm->guest_mem);
     }
 
 #ifndef CONFIG_VMM_IGNORE_EPT_VIOLATION
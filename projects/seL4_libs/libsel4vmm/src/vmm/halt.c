@@ -23,6 +23,7 @@
 int vmm_hlt_handler(vmm_vcpu_t *vcpu) {
     if (!(vmm_guest_state_get_rflags(&vcpu->guest_state, vcpu->guest_vcpu) & BIT(9))) {
         printf("vcpu %d is halted forever :(\n", vcpu->vcpu_id);
+        print_guest_ram_stats(&vcpu->vmm->guest_mem);
     }
 
     if (vmm_apic_has_interrupt(vcpu) == -1) {
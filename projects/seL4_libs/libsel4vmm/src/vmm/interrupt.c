@@ -128,8 +128,14 @@ void vmm_start_ap_vcpu(vmm_vcpu_t *vcpu, unsigned int sipi_vector)
     vmm_sync_guest_context(vcpu);
     vmm_sync_guest_state(vcpu);
 
-    assert(!"no tcb");
-//    seL4_TCB_Resume(vcpu->guest_tcb);
+    /* The vcpu thread is waiting for this */
+    vcpu->online = 1;
+    vmm_kick_vcpu(vcpu);
+}
+
+void vmm_kick_vcpu(vmm_vcpu_t *vcpu)
+{
+    seL4_Signal(vcpu->kick);
 }
 
 /* Got interrupt(s) from PIC, propagate to relevant vcpu lapic */
@@ -154,6 +160,13 @@ void vmm_vcpu_accept_interrupt(vmm_vcpu_t *vcpu)
         return;
     }
 
+    if (vcpu != vcpu->vmm->lock_owner && vcpu->kick != seL4_CapNull) {
+        /* The guest state belongs to the thread running that vcpu, which may
+         * be in the guest right now. Get it to do the injection */
+        vmm_kick_vcpu(vcpu);
+        return;
+    }
+
     /* in an exit, can call the regular injection method */
     vmm_have_pending_interrupt(vcpu);
 }
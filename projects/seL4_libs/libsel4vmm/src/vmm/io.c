@@ -14,6 +14,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sel4/sel4.h>
 #include <sel4utils/util.h>
@@ -23,18 +24,6 @@
 #include "vmm/io.h"
 #include "vmm/vmm.h"
 
-static int io_port_cmp(const void *pkey, const void *pelem) {
-    unsigned int key = (unsigned int)(uintptr_t)pkey;
-    const ioport_range_t *elem = (const ioport_range_t*)pelem;
-    if (key < elem->port_start) {
-        return -1;
-    }
-    if (key > elem->port_end) {
-        return 1;
-    }
-    return 0;
-}
-
 static int io_port_cmp2(const void *a, const void *b) {
     const ioport_range_t *aa = (const ioport_range_t*) a;
     const ioport_range_t *bb = (const ioport_range_t*) b;
@@ -42,7 +31,23 @@ static int io_port_cmp2(const void *a, const void *b) {
 }
 
 static ioport_range_t *search_port(vmm_io_port_list_t *io_port, unsigned int port_no) {
-    return (ioport_range_t*)bsearch((void*)(uintptr_t)port_no, io_port->ioports, io_port->num_ioports, sizeof(ioport_range_t), io_port_cmp);
+    if (port_no >= VMM_NUM_IO_PORTS) {
+        return NULL;
+    }
+    uint16_t index = io_port->port_map[port_no];
+    return index ? &io_port->ioports[index - 1] : NULL;
+}
+
+/* Sorting the ranges moves them around, so the whole map is rebuilt whenever
+ * a range is added. This only happens while the guest is being set up */
+static void build_port_map(vmm_io_port_list_t *io_port) {
+    memset(io_port->port_map, 0, sizeof(uint16_t) * VMM_NUM_IO_PORTS);
+    for (int i = 0; i < io_port->num_ioports; i++) {
+        ioport_range_t *port = &io_port->ioports[i];
+        for (unsigned int p = port->port_start; p <= port->port_end && p < VMM_NUM_IO_PORTS; p++) {
+            io_port->port_map[p] = i + 1;
+        }
+    }
 }
 
 /* Debug helper function for port no. */
@@ -132,6 +137,15 @@ int vmm_io_instruction_handler(vmm_vcpu_t *vcpu) {
 }
 
 static int add_io_port_range(vmm_io_port_list_t *io_list, ioport_range_t port) {
+    if (port.port_start > port.port_end || port.port_end >= VMM_NUM_IO_PORTS) {
+        ZF_LOGE("Invalid ioport range 0x%x-0x%x for %s", port.port_start, port.port_end,
+                port.desc ? port.desc : "Unknown IO Port");
+        return -1;
+    }
+    if (io_list->num_ioports + 1 >= VMM_NUM_IO_PORTS) {
+        ZF_LOGE("Too many ioport ranges");
+        return -1;
+    }
     /* ensure this range does not overlap */
     for (int i = 0; i < io_list->num_ioports; i++) {
         if (io_list->ioports[i].port_end >= port.port_start && io_list->ioports[i].port_start <= port.port_end) {
@@ -148,6 +162,7 @@ static int add_io_port_range(vmm_io_port_list_t *io_list, ioport_range_t port) {
     io_list->num_ioports++;
     /* sort */
     qsort(io_list->ioports, io_list->num_ioports, sizeof(ioport_range_t), io_port_cmp2);
+    build_port_map(io_list);
     return 0;
 }
 
@@ -192,5 +207,10 @@ int vmm_io_port_init(vmm_io_port_list_t *io_list) {
     io_list->num_ioports = 0;
     io_list->ioports = malloc(0);
     assert(io_list->ioports);
+    io_list->port_map = calloc(VMM_NUM_IO_PORTS, sizeof(uint16_t));
+    if (!io_list->port_map) {
+        ZF_LOGE("Failed to allocate ioport map");
+        return -1;
+    }
     return 0;
 }
@@ -17,6 +17,7 @@
 #include <string.h>
 
 #include <sel4/sel4.h>
+#include <utils/util.h>
 
 #include "vmm/debug.h"
 #include "vmm/vmm.h"
@@ -37,6 +38,55 @@ int vmm_mmio_init(vmm_mmio_list_t *list) {
     return 0;
 }
 
+static vmm_mmio_range_t *find_range(vmm_vcpu_t *vcpu, uintptr_t addr) {
+    vmm_mmio_list_t *list = &vcpu->vmm->mmio_list;
+
+    // Guests tend to hit the same device many times in a row
+    if (vcpu->mmio_last < list->num_ranges) {
+        vmm_mmio_range_t *range = &list->ranges[vcpu->mmio_last];
+        if (addr >= range->start && addr <= range->end) {
+            return range;
+        }
+    }
+
+    // Find the last range starting at or below addr. The ranges are sorted
+    // and do not overlap, so it is the only one that can hold addr. Picking
+    // the half with a conditional move rather than a branch avoids a
+    // mispredict at each step when exits are spread over many devices
+    int n = list->num_ranges;
+    if (n == 0) {
+        return NULL;
+    }
+    int lo = 0;
+    while (n > 1) {
+        int half = n / 2;
+        lo = list->ranges[lo + half].start <= addr ? lo + half : lo;
+        n -= half;
+    }
+    vmm_mmio_range_t *range = &list->ranges[lo];
+    if (addr < range->start || addr > range->end) {
+        return NULL;
+    }
+    vcpu->mmio_last = lo;
+    return range;
+}
+
+// Work out which part of which register a decoded operand refers to. Byte
+// operands 4-7 are the high bytes of eax, ecx, edx and ebx
+static int operand_reg(int reg, int size, int *shift) {
+    *shift = 0;
+    if (reg < 0 || reg >= 8) {
+        return -1;
+    }
+    if (size == 1) {
+        if (reg >= 4) {
+            *shift = 8;
+        }
+        return vmm_decoder_reg_mapb[reg];
+    }
+    return vmm_decoder_reg_mapw[reg];
+}
+
 // Returns 0 if the exit was handled
 int vmm_mmio_exit_handler(vmm_vcpu_t *vcpu, uintptr_t addr, unsigned int qualification) {
     int read = EPT_VIOL_READ(qualification);
@@ -51,84 +101,87 @@ int vmm_mmio_exit_handler(vmm_vcpu_t *vcpu, uintptr_t addr, unsigned int qualifi
         return -1;
     }
 
-    // Search the list
-    for (int i = 0; i < vcpu->vmm->mmio_list.num_ranges; i++) {
-        vmm_mmio_range_t *range = &vcpu->vmm->mmio_list.ranges[i];
+    vmm_mmio_range_t *range = find_range(vcpu, addr);
+    if (!range) {
+        return -1;
+    }
+    if (read && range->read_handler == NULL) {
+        return -1;
+    }
+    if (write && range->write_handler == NULL) {
+        return -1;
+    }
 
-        if (addr < range->start) {
+    // Decode instruction
+    uint8_t ibuf[15];
+    int instr_len = vmm_guest_exit_get_int_len(&vcpu->guest_state);
+    vmm_fetch_instruction(vcpu,
+            vmm_guest_state_get_eip(&vcpu->guest_state),
+            vmm_guest_state_get_cr3(&vcpu->guest_state, vcpu->guest_vcpu),
+            instr_len, ibuf);
+
+    int reg;
+    uint32_t imm;
+    int size;
+    vmm_decode_instruction(ibuf, instr_len, &reg, &imm, &size);
+    if (size != 1 && size != 2 && size != 4) {
+        ZF_LOGE("Unsupported %d byte access to %s at 0x%x", size, range->name, (unsigned int)addr);
+        return -1;
+    }
+    uint32_t mask = size == 4 ? 0xffffffff : MASK(size * 8);
+
+    int shift;
+    int vcpu_reg = operand_reg(reg, size, &shift);
+
+    // Call handler
+    if (read) {
+        if (vcpu_reg < 0) {
             return -1;
         }
-
-        if (addr <= range->end) {
-            // Found a match
-            if (read && range->read_handler == NULL) {
+        uint32_t result = 0;
+        range->read_handler(vcpu, range->cookie, addr - range->start, size, &result);
+
+        // Inject into register, leaving the bytes the access did not cover
+        uint32_t value = vmm_read_user_context(&vcpu->guest_state, vcpu_reg);
+        value &= ~(mask << shift);
+        value |= (result & mask) << shift;
+        vmm_set_user_context(&vcpu->guest_state, vcpu_reg, value);
+    } else {
+        // Get value to pass in
+        uint32_t value = imm;
+        if (reg >= 0) {
+            if (vcpu_reg < 0) {
                 return -1;
             }
-            if (write && range->write_handler == NULL) {
-                return -1;
-            }
-
-            // Decode instruction
-            uint8_t ibuf[15];
-            int instr_len = vmm_guest_exit_get_int_len(&vcpu->guest_state);
-            vmm_fetch_instruction(vcpu,
-                    vmm_guest_state_get_eip(&vcpu->guest_state),
-                    vmm_guest_state_get_cr3(&vcpu->guest_state, vcpu->guest_vcpu),
-                    instr_len, ibuf);
-
-            int reg;
-            uint32_t imm;
-            int size;
-            vmm_decode_instruction(ibuf, instr_len, &reg, &imm, &size);
-assert(size == 4); // we don't support non-32 bit accesses. TODO fix this
-
-            // Call handler
-            if (read) {
-                uint32_t result;
-                range->read_handler(vcpu, range->cookie, addr - range->start, size, &result);
-
-                // Inject into register
-                assert(reg >= 0 && reg < 8);
-                int vcpu_reg = vmm_decoder_reg_mapw[reg];
-                assert(vcpu_reg >= 0);
-                vmm_set_user_context(&vcpu->guest_state,
-                        vcpu_reg, result);
-            } else {
-                // Get value to pass in
-                uint32_t value = imm;
-                assert (reg >= 0);
-                int vcpu_reg =  vmm_decoder_reg_mapw[reg];
-                assert(vcpu_reg >= 0);
-                value = vmm_read_user_context(&vcpu->guest_state,
-                        vcpu_reg);
-
-                range->write_handler(vcpu, range->cookie, addr - range->start, size, value);
-            }
-
-            return 0;
+            value = vmm_read_user_context(&vcpu->guest_state, vcpu_reg) >> shift;
         }
+
+        range->write_handler(vcpu, range->cookie, addr - range->start, size, value & mask);
     }
 
-    return -1;
+    return 0;
 }
 
 static int range_cmp(const void *a, const void *b) {
-    return ((const vmm_mmio_range_t *)a)->start - ((const vmm_mmio_range_t *)b)->start;
+    uintptr_t start_a = ((const vmm_mmio_range_t *)a)->start;
+    uintptr_t start_b = ((const vmm_mmio_range_t *)b)->start;
+    // The difference of two addresses does not fit in an int
+    return (start_a > start_b) - (start_a < start_b);
 }
 
 int vmm_mmio_add_handler(vmm_mmio_list_t *list, uintptr_t start, uintptr_t end,
         void *cookie, const char *name,
         vmm_mmio_read_fn read_handler, vmm_mmio_write_fn write_handler) {
-    vmm_mmio_range_t *new = malloc(sizeof(*new));
-    new->start = start;
-    new->end = end;
-    new->cookie = cookie;
-    new->read_handler = read_handler;
-    new->write_handler = write_handler;
-    new->name = name;
-
     list->ranges = realloc(list->ranges, sizeof(vmm_mmio_range_t) * (list->num_ranges + 1));
-    memcpy(&list->ranges[list->num_ranges++], new, sizeof(vmm_mmio_range_t));
+    assert(list->ranges);
+    list->ranges[list->num_ranges++] = (vmm_mmio_range_t) {
+        .start = start,
+        .end = end,
+        .read_handler = read_handler,
+        .write_handler = write_handler,
+        .cookie = cookie,
+        .name = name,
+    };
 
     qsort(list->ranges, list->num_ranges, sizeof(vmm_mmio_range_t), range_cmp);
 
@@ -70,6 +70,8 @@ libvchan_t *vchan_init(int domain, int port, int server) {
     new_connection->domain_num = domain;
     new_connection->port_num = port;
     new_connection->con = vchan_comp_con;
+    new_connection->send_buf = NULL;
+    new_connection->recv_buf = NULL;
 
     /* Perform vchan component initialisation */
     vchan_connect_t t = {
@@ -142,55 +144,72 @@ vchan_buf_t *get_vchan_ctrl_databuf(libvchan_t *ctrl, int action) {
     return get_vchan_buf(&args, ctrl->con, action);
 }
 
+/*
+    The buffers of a connection stay where they are until it is closed, so
+    they are only looked up once. Until the other end has connected there
+    may not be a buffer yet, in which case we ask again next time
+*/
+static vchan_buf_t *vchan_ctrl_buf(libvchan_t *ctrl, int action) {
+    vchan_buf_t **buf = action == VCHAN_SEND ? &ctrl->send_buf : &ctrl->recv_buf;
+    if(*buf == NULL) {
+        *buf = get_vchan_ctrl_databuf(ctrl, action);
+    }
+    return *buf;
+}
+
+/*
+    Each vchan buffer is a single producer, single consumer byte ring.
+    write_pos and read_pos count the bytes ever written and read, and are
+    only ever updated by the producer and the consumer respectively, so
+    the amount of data in the ring is their difference, even once they
+    wrap.
+
+    A reader only waits on an empty ring and a writer only on a full one.
+    So after moving its own position, each side only alerts the other if
+    the ring was empty (or full) up to that point, and the other side may
+    be waiting for it. Both sides publish their position and then look at
+    the other's with a full barrier in between, so one of them always sees
+    the other's update.
+*/
+static inline uint32_t ring_pos(int *pos) {
+    return (uint32_t) __atomic_load_n(pos, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t ring_filled(vchan_buf_t *b) {
+    return ring_pos(&b->write_pos) - ring_pos(&b->read_pos);
+}
+
 /*
     Perform a vchan read/write action into a given buffer
      This function is intended for non Init components, Init components have a different method
 */
 int libvchan_readwrite_action(libvchan_t *ctrl, void *data, size_t size, int stream, int action) {
-    int *update;
-    vchan_buf_t *b = get_vchan_ctrl_databuf(ctrl, action);
+    vchan_buf_t *b = vchan_ctrl_buf(ctrl, action);
     if(b == NULL) {
         return -1;
     }
 
-    /*
-        How data is stored in a given vchan buffer
-
-        Position of data in buffer is given by
-            (either b->write_pos or b->read_pos) % VCHAN_BUF_SIZE
-            read_pos is incremented by x when x bytes are read from the buffer
-            write_pos is incremented by x when x bytes are read from the buffer
-
-        Amount of bytes in buffer is given by the difference between read_pos and write_pos
-            if write_pos > read_pos, there is data yet to be read
-    */
-    size_t filled = abs(b->write_pos - b->read_pos);
-    if(action == VCHAN_SEND) {
-        while(filled == VCHAN_BUF_SIZE) {
-            ctrl->con->wait();
-            filled = abs(b->write_pos - b->read_pos);
-        }
-
-        if(stream) {
-            size = MIN(VCHAN_BUF_SIZE - filled, size);
-        } else if(size > VCHAN_BUF_SIZE - filled) {
-            return -1;
-        }
-
-        update = &b->write_pos;
-    } else {
-        while(filled == 0) {
-            ctrl->con->wait();
-            filled = abs(b->write_pos - b->read_pos);
-        }
-
-        if(stream) {
-            size = MIN(filled, size);
-        } else if(size > filled) {
-            return -1;
+    int send = action == VCHAN_SEND;
+    int *update = send ? &b->write_pos : &b->read_pos;
+    int *other = send ? &b->read_pos : &b->write_pos;
+    /* We are the only one who changes our position */
+    uint32_t pos = (uint32_t) *update;
+    size_t avail;
+
+    while(1) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        uint32_t filled = send ? pos - ring_pos(other) : ring_pos(other) - pos;
+        avail = send ? VCHAN_BUF_SIZE - filled : filled;
+        if(avail > 0) {
+            break;
         }
+        ctrl->con->wait();
+    }
 
-        update = &b->read_pos;
+    if(stream) {
+        size = MIN(avail, size);
+    } else if(size > avail) {
+        return -1;
     }
 
     /*
@@ -212,48 +231,43 @@ int libvchan_readwrite_action(libvchan_t *ctrl, void *data, size_t size, int str
             [xxxooooxxxxx]
 
     */
-    off_t start = (*update % VCHAN_BUF_SIZE);
-    off_t remain = 0;
-
-    if(start + size > VCHAN_BUF_SIZE) {
-        remain = (start + size) - VCHAN_BUF_SIZE;
-        size -= remain;
-    }
+    size_t start = pos % VCHAN_BUF_SIZE;
+    size_t first = MIN(size, VCHAN_BUF_SIZE - start);
 
-    void *dbuf = &b->sync_data;
+    char *dbuf = b->sync_data;
 
-    if(action == VCHAN_SEND) {
-        memcpy(dbuf + start, data, size);
-        memcpy(dbuf, data + size, remain);
+    if(send) {
+        memcpy(dbuf + start, data, first);
+        memcpy(dbuf, (char *) data + first, size - first);
     } else {
-        memcpy(data, ((void *) dbuf) + start, size);
-        memcpy(data + size, dbuf, remain);
+        memcpy(data, dbuf + start, first);
+        memcpy((char *) data + first, dbuf, size - first);
     }
-    __sync_synchronize();
 
     /*
         Update either the read byte counter or the written byte counter
             With how much was written or read
     */
-    *update += (size + remain);
+    __atomic_store_n(update, (int) (pos + size), __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-    ctrl->con->alert();
+    uint32_t other_pos = ring_pos(other);
+    if(send ? other_pos == pos : other_pos - pos == VCHAN_BUF_SIZE) {
+        ctrl->con->alert();
+    }
 
-    return (size + remain);
+    return size;
 }
 
 /*
     Wait for data to arrive to a component from a given vchan
 */
 int libvchan_wait(libvchan_t *ctrl) {
-    vchan_buf_t *b = get_vchan_ctrl_databuf(ctrl, VCHAN_RECV);
+    vchan_buf_t *b = vchan_ctrl_buf(ctrl, VCHAN_RECV);
     assert(b != NULL);
 
-    size_t filled = abs(b->write_pos - b->read_pos);
-    while(filled == 0) {
+    while(ring_filled(b) == 0) {
         ctrl->con->wait();
-        b = get_vchan_ctrl_databuf(ctrl, VCHAN_RECV);
-        filled = abs(b->write_pos - b->read_pos);
     }
 
     return 0;
@@ -287,16 +301,20 @@ int libvchan_is_open(libvchan_t *ctrl) {
     How much data can be read from the vchan
 */
 int libvchan_data_ready(libvchan_t *ctrl) {
-    vchan_buf_t *b = get_vchan_ctrl_databuf(ctrl, VCHAN_RECV);
-    size_t filled = abs(b->write_pos - b->read_pos);
-    return filled;
+    vchan_buf_t *b = vchan_ctrl_buf(ctrl, VCHAN_RECV);
+    if(b == NULL) {
+        return 0;
+    }
+    return ring_filled(b);
 }
 
 /*
     How much data can be written to the vchan
 */
 int libvchan_buffer_space(libvchan_t *ctrl) {
-    vchan_buf_t *b = get_vchan_ctrl_databuf(ctrl, VCHAN_SEND);
-    size_t filled = abs(b->write_pos - b->read_pos);
-    return VCHAN_BUF_SIZE - filled;
+    vchan_buf_t *b = vchan_ctrl_buf(ctrl, VCHAN_SEND);
+    if(b == NULL) {
+        return 0;
+    }
+    return VCHAN_BUF_SIZE - ring_filled(b);
 }
@@ -138,91 +138,137 @@ static void vmm_update_guest_state_from_fault(vmm_vcpu_t *vcpu, seL4_Word *msg)
     MACHINE_STATE_READ(vcpu->guest_state.machine.context, context);
 }
 
-/* Entry point of of VMM main host module. */
-void vmm_run(vmm_t *vmm) {
-    int UNUSED error;
-    DPRINTF(2, "VMM MAIN HOST MODULE STARTED\n");
-
-    for (int i = 0; i < vmm->num_vcpus; i++) {
-        vmm_vcpu_t *vcpu = &vmm->vcpus[i];
-
-        vcpu->guest_state.virt.interrupt_halt = 0;
-        vcpu->guest_state.exit.in_exit = 0;
-
-        /* sync the existing guest state */
-        vmm_sync_guest_state(vcpu);
-        vmm_sync_guest_context(vcpu);
-        /* now invalidate everything */
-        assert(vmm_guest_state_no_modified(&vcpu->guest_state));
-        vmm_guest_state_invalidate_all(&vcpu->guest_state);
-    }
+static void vmm_lock(vmm_vcpu_t *vcpu) {
+    int UNUSED error = sync_mutex_lock(&vcpu->vmm->lock);
+    assert(!error);
+    vcpu->vmm->lock_owner = vcpu;
+}
 
-    /* Start the boot vcpu guest thread running */
-    vmm->vcpus[BOOT_VCPU].online = 1;
+static void vmm_unlock(vmm_vcpu_t *vcpu) {
+    vcpu->vmm->lock_owner = NULL;
+    int UNUSED error = sync_mutex_unlock(&vcpu->vmm->lock);
+    assert(!error);
+}
 
-    /* Get our interrupt pending callback happening */
-    seL4_CPtr notification = vmm->plat_callbacks.get_async_event_notification();
-    error = seL4_TCB_BindNotification(simple_get_init_cap(&vmm->host_simple, seL4_CapInitThreadTCB), vmm->plat_callbacks.get_async_event_notification());
-    assert(error == seL4_NoError);
+/* Run a vcpu on the current thread. Only the guest itself runs without the
+ * vmm lock held */
+static void vmm_vcpu_loop(vmm_vcpu_t *vcpu) {
+    vmm_t *vmm = vcpu->vmm;
 
     while (1) {
         /* Block and wait for incoming msg or VM exits. */
         seL4_Word badge;
         int fault;
+        seL4_Word msg[SEL4_VMENTER_RESULT_FAULT_LEN];
+
+        vmm_lock(vcpu);
+        int runnable = vcpu->online && !vcpu->guest_state.virt.interrupt_halt && !vcpu->guest_state.exit.in_exit;
+        seL4_Word eip = vmm_guest_state_get_eip(&vcpu->guest_state);
+        seL4_Word control_ppc = vmm_guest_state_get_control_ppc(&vcpu->guest_state);
+        seL4_Word control_entry = vmm_guest_state_get_control_entry(&vcpu->guest_state);
+        vmm_unlock(vcpu);
+
+        if (runnable) {
+            seL4_SetMR(0, eip);
+            seL4_SetMR(1, control_ppc);
+            seL4_SetMR(2, control_entry);
+            fault = seL4_VMEnter(&badge);
 
-        vmm_vcpu_t *vcpu = &vmm->vcpus[BOOT_VCPU];
+            int len = fault == SEL4_VMENTER_RESULT_FAULT ? SEL4_VMENTER_RESULT_FAULT_LEN : SEL4_VMENTER_RESULT_NOTIF_LEN;
+            for (int i = 0 ; i < len; i++) {
+                msg[i] = seL4_GetMR(i);
+            }
+        } else {
+            /* Wait until another vcpu or an interrupt gives us something to do */
+            seL4_Wait(vcpu->notification, &badge);
+            fault = SEL4_VMENTER_RESULT_NOTIF;
+        }
 
-        if (vcpu->online && !vcpu->guest_state.virt.interrupt_halt && !vcpu->guest_state.exit.in_exit) {
-            seL4_SetMR(0, vmm_guest_state_get_eip(&vcpu->guest_state));
-            seL4_SetMR(1, vmm_guest_state_get_control_ppc(&vcpu->guest_state));
-            seL4_SetMR(2, vmm_guest_state_get_control_entry(&vcpu->guest_state));
-            fault = seL4_VMEnter(&badge);
+        vmm_lock(vcpu);
 
+        if (runnable) {
             if (fault == SEL4_VMENTER_RESULT_FAULT) {
                 /* We in a fault */
                 vcpu->guest_state.exit.in_exit = 1;
 
                 /* Update the guest state from a fault */
-                seL4_Word fault_message[SEL4_VMENTER_RESULT_FAULT_LEN];
-                for (int i = 0 ; i < SEL4_VMENTER_RESULT_FAULT_LEN; i++) {
-                    fault_message[i] = seL4_GetMR(i);
-                }
                 vmm_guest_state_invalidate_all(&vcpu->guest_state);
-                vmm_update_guest_state_from_fault(vcpu, fault_message);
+                vmm_update_guest_state_from_fault(vcpu, msg);
             } else {
                 /* update the guest state from a non fault */
-                seL4_Word int_message[SEL4_VMENTER_RESULT_NOTIF_LEN];
-                for (int i = 0 ; i < SEL4_VMENTER_RESULT_NOTIF_LEN; i++) {
-                    int_message[i] = seL4_GetMR(i);
-                }
                 vmm_guest_state_invalidate_all(&vcpu->guest_state);
-                vmm_update_guest_state_from_interrupt(vcpu, int_message);
+                vmm_update_guest_state_from_interrupt(vcpu, msg);
             }
-        } else {
-            seL4_Wait(notification, &badge);
-            fault = SEL4_VMENTER_RESULT_NOTIF;
         }
 
         if (fault == SEL4_VMENTER_RESULT_NOTIF) {
-            assert(badge >= vmm->num_vcpus);
-            /* assume interrupt */
-            int raise = vmm->plat_callbacks.do_async(badge);
-            if (raise == 0) {
-                /* Check if this caused PIC to generate interrupt */
-                vmm_check_external_interrupt(vmm);
+            if (badge & VMM_VCPU_KICK_BADGE) {
+                /* Another vcpu has raised an interrupt in our lapic */
+                badge &= ~VMM_VCPU_KICK_BADGE;
+                vmm_vcpu_accept_interrupt(vcpu);
+            }
+            if (badge) {
+                /* Only the boot vcpu has the async event notification bound */
+                assert(vcpu->vcpu_id == BOOT_VCPU);
+                /* assume interrupt */
+                int raise = vmm->plat_callbacks.do_async(badge);
+                if (raise == 0) {
+                    /* Check if this caused PIC to generate interrupt */
+                    vmm_check_external_interrupt(vmm);
+                }
             }
+        } else {
+            /* Handle the vm exit */
+            vmm_handle_vm_exit(vcpu);
 
-            continue;
+            vmm_check_external_interrupt(vmm);
         }
 
-        /* Handle the vm exit */
-        vmm_handle_vm_exit(vcpu);
+        vmm_unlock(vcpu);
+
+        DPRINTF(5, "VMM vcpu %d blocking for another message...\n", vcpu->vcpu_id);
+    }
+}
+
+static void vmm_vcpu_thread_entry(void *arg0, void *arg1, void *ipc_buf) {
+    vmm_vcpu_loop((vmm_vcpu_t *)arg0);
+}
+
+/* Entry point of of VMM main host module. */
+void vmm_run(vmm_t *vmm) {
+    int UNUSED error;
+    DPRINTF(2, "VMM MAIN HOST MODULE STARTED\n");
 
-        vmm_check_external_interrupt(vmm);
+    for (int i = 0; i < vmm->num_vcpus; i++) {
+        vmm_vcpu_t *vcpu = &vmm->vcpus[i];
+
+        vcpu->guest_state.virt.interrupt_halt = 0;
+        vcpu->guest_state.exit.in_exit = 0;
 
-        DPRINTF(5, "VMM main host blocking for another message...\n");
+        /* sync the existing guest state */
+        vmm_sync_guest_state(vcpu);
+        vmm_sync_guest_context(vcpu);
+        /* now invalidate everything */
+        assert(vmm_guest_state_no_modified(&vcpu->guest_state));
+        vmm_guest_state_invalidate_all(&vcpu->guest_state);
+    }
+
+    /* Start the boot vcpu guest thread running. The others wait for a SIPI */
+    vmm->vcpus[BOOT_VCPU].online = 1;
+
+    /* Get our interrupt pending callback happening */
+    error = seL4_TCB_BindNotification(simple_get_init_cap(&vmm->host_simple, seL4_CapInitThreadTCB), vmm->plat_callbacks.get_async_event_notification());
+    assert(error == seL4_NoError);
+
+    for (int i = 0; i < vmm->num_vcpus; i++) {
+        if (i == BOOT_VCPU) {
+            continue;
+        }
+        error = sel4utils_start_thread(&vmm->vcpus[i].thread, vmm_vcpu_thread_entry, &vmm->vcpus[i], NULL, 1);
+        assert(error == 0);
     }
 
+    vmm_vcpu_loop(&vmm->vcpus[BOOT_VCPU]);
 }
 
 static void vmm_exit_init(vmm_t *vmm) {
@@ -259,7 +305,7 @@ int vmm_finalize(vmm_t *vmm) {
 
 seL4_CPtr vmm_create_async_event_notification_cap(vmm_t *vmm, seL4_Word badge) {
 
-    if (!(badge & BIT(27))) {
+    if (!(badge & BIT(27)) || (badge & VMM_VCPU_KICK_BADGE)) {
         ZF_LOGE("Invalid badge");
         return seL4_CapNull;
     }
@@ -44,6 +44,31 @@ struct cpio_info {
     unsigned int max_path_sz;
 };
 
+/**
+ * An entry in a CPIO index
+ */
+struct cpio_index_entry {
+    /// Hash of the file name. Entries are sorted by this
+    unsigned int hash;
+    /// The file name, which is NULL terminated in the archive
+    const char *name;
+    /// The location of the file in memory
+    void *data;
+    /// The size of the file
+    unsigned long size;
+};
+
+/**
+ * A table for finding files in a CPIO archive by name without parsing
+ * the headers of every file before them.
+ */
+struct cpio_index {
+    /// Entries sorted by name hash and then by position in the archive
+    struct cpio_index_entry *entries;
+    /// The number of entries
+    unsigned int count;
+};
+
 /**
  * Retrieve file information from a provided CPIO list index
  * @param[in] archive  The location of the CPIO archive
@@ -84,3 +109,27 @@ int cpio_info(void *archive, struct cpio_info *info);
  */
 void cpio_ls(void *archive, char **buf, unsigned long buf_len);
 
+/**
+ * Index the files in a CPIO archive so that they can be looked up by name
+ * @param[in] archive      The location of the CPIO archive
+ * @param[out] index       The index to initialise
+ * @param[in] entries      Storage for the index entries, which must remain valid
+ *                         as long as the index is used
+ * @param[in] max_entries  The number of entries that fit in entries. This must
+ *                         be at least the file_count reported by cpio_info.
+ * @return                 Non-zero on error, or if there are more than
+ *                         max_entries files in the archive.
+ */
+int cpio_index_init(void *archive, struct cpio_index *index,
+                    struct cpio_index_entry *entries, unsigned int max_entries);
+
+/**
+ * Retrieve file information from a CPIO index. This finds the same file as
+ * cpio_get_file does in the archive the index was built from.
+ * @param[in] index  An index initialised by cpio_index_init
+ * @param[in] name   The name of the file in question.
+ * @param[out] size  The retrieved size of the file in question
+ * @return           The location of the file in memory; NULL if the file
+ *                   does not exist.
+ */
+void *cpio_index_get_file(struct cpio_index *index, const char *name, unsigned long *size);
@@ -225,3 +225,137 @@ void cpio_ls(void *archive, char **buf, unsigned long buf_len) {
         header = next;
     }
 }
+
+/* FNV-1a hash of a file name. */
+static unsigned int cpio_hash(const char *name)
+{
+    unsigned int hash = 2166136261u;
+    while (*name != 0) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+        name++;
+    }
+    return hash;
+}
+
+/*
+ * Order index entries by hash. Entries with the same hash keep the order of
+ * the archive, so that lookups find the same file as cpio_get_file.
+ */
+static int cpio_index_less(struct cpio_index_entry *a, struct cpio_index_entry *b)
+{
+    if (a->hash != b->hash) {
+        return a->hash < b->hash;
+    }
+    return (unsigned long)a->data < (unsigned long)b->data;
+}
+
+static void cpio_index_sift_down(struct cpio_index_entry *entries, unsigned int root, unsigned int count)
+{
+    while (2 * root + 1 < count) {
+        unsigned int child = 2 * root + 1;
+        if (child + 1 < count && cpio_index_less(&entries[child], &entries[child + 1])) {
+            child++;
+        }
+        if (!cpio_index_less(&entries[root], &entries[child])) {
+            return;
+        }
+        struct cpio_index_entry tmp = entries[root];
+        entries[root] = entries[child];
+        entries[child] = tmp;
+        root = child;
+    }
+}
+
+/*
+ * Heap sort, as it needs neither recursion nor extra memory.
+ *
+ * Runs in O(n log n) time.
+ */
+static void cpio_index_sort(struct cpio_index_entry *entries, unsigned int count)
+{
+    unsigned int i;
+    for (i = count / 2; i > 0; i--) {
+        cpio_index_sift_down(entries, i - 1, count);
+    }
+    for (i = count; i > 1; i--) {
+        struct cpio_index_entry tmp = entries[0];
+        entries[0] = entries[i - 1];
+        entries[i - 1] = tmp;
+        cpio_index_sift_down(entries, 0, i - 1);
+    }
+}
+
+int cpio_index_init(void *archive, struct cpio_index *index,
+                    struct cpio_index_entry *entries, unsigned int max_entries)
+{
+    struct cpio_header *header = archive;
+    unsigned int count = 0;
+
+    if (index == NULL) return 1;
+
+    while (1) {
+        struct cpio_header *next;
+        const char *current_filename;
+        unsigned long size;
+        void *result;
+
+        int error = cpio_parse_header(header, &current_filename, &size,
+                &result, &next);
+        if (error == -1) {
+            return error;
+        } else if (error == 1) {
+            /* EOF */
+            break;
+        }
+        if (count == max_entries) {
+            return 1;
+        }
+        entries[count].hash = cpio_hash(current_filename);
+        entries[count].name = current_filename;
+        entries[count].data = result;
+        entries[count].size = size;
+        count++;
+        header = next;
+    }
+
+    cpio_index_sort(entries, count);
+    index->entries = entries;
+    index->count = count;
+    return 0;
+}
+
+/*
+ * Find the location and size of the file named "name" in an index.
+ *
+ * Return NULL if the entry doesn't exist.
+ *
+ * Runs in O(log n) time.
+ */
+void *cpio_index_get_file(struct cpio_index *index, const char *name, unsigned long *size)
+{
+    unsigned int hash = cpio_hash(name);
+    unsigned int low = 0;
+    unsigned int high = index->count;
+
+    /* Find the first entry with this hash. */
+    while (low < high) {
+        unsigned int mid = low + (high - low) / 2;
+        if (index->entries[mid].hash < hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    for (; low < index->count && index->entries[low].hash == hash; low++) {
+        struct cpio_index_entry *entry = &index->entries[low];
+        if (cpio_strncmp(entry->name, name, -1) == 0) {
+            if (size) {
+                *size = entry->size;
+            }
+            return entry->data;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/*
+ * Host benchmark of section and symbol lookup, comparing linear scans with
+ * lookups through an elf_index_t. Every section and every defined symbol of
+ * each file is looked up, and the results of both methods are checked to
+ * agree. Build on the host with:
+ *
+ *   cc -O2 -Iinclude -o elf_bench bench/elf_bench.c src/elf.c src/elf32.c \
+ *       src/elf64.c src/elf_index.c
+ *   ./elf_bench file.elf [file.elf ...]
+ */
+
+#include <elf/elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+read_file(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	void *data = malloc(size);
+	if (data != NULL && fread(data, 1, size, f) != (size_t) size) {
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	return data;
+}
+
+/* Collect the names of the defined symbols in .symtab, or .dynsym if the
+ * file is stripped, along with their values */
+static unsigned
+symbol_names(void *elf, const char ***names, uint64_t **values)
+{
+	int id;
+	char *syms = elf_getSectionNamed(elf, ".symtab", &id);
+	const char *strings = elf_getSectionNamed(elf, ".strtab", NULL);
+	if (syms == NULL) {
+		syms = elf_getSectionNamed(elf, ".dynsym", &id);
+		strings = elf_getSectionNamed(elf, ".dynstr", NULL);
+	}
+	if (syms == NULL || strings == NULL) {
+		return 0;
+	}
+	int is32 = ((struct Elf32_Header *) elf)->e_ident[EI_CLASS] == ELFCLASS32;
+	size_t entsize = is32 ? sizeof(Elf32_Sym) : sizeof(Elf64_Sym);
+	unsigned count = elf_getSectionSize(elf, id) / entsize;
+	unsigned n = 0;
+	*names = calloc(count, sizeof(**names));
+	*values = calloc(count, sizeof(**values));
+	for (unsigned i = 1; i < count; i++) {
+		uint32_t name = is32 ? ((Elf32_Sym *) syms)[i].st_name : ((Elf64_Sym *) syms)[i].st_name;
+		uint16_t shndx = is32 ? ((Elf32_Sym *) syms)[i].st_shndx : ((Elf64_Sym *) syms)[i].st_shndx;
+		unsigned char info = is32 ? ((Elf32_Sym *) syms)[i].st_info : ((Elf64_Sym *) syms)[i].st_info;
+		if (name == 0 || shndx == SHN_UNDEF || ELF32_ST_BIND(info) == STB_LOCAL) {
+			continue;
+		}
+		(*names)[n] = strings + name;
+		(*values)[n] = is32 ? ((Elf32_Sym *) syms)[i].st_value : ((Elf64_Sym *) syms)[i].st_value;
+		n++;
+	}
+	return n;
+}
+
+/* The lookup the index replaces */
+static int
+linear_symbol(const char **names, uint64_t *values, unsigned n, const char *name, uint64_t *value)
+{
+	for (unsigned i = 0; i < n; i++) {
+		if (strcmp(names[i], name) == 0) {
+			*value = values[i];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+bench(const char *path)
+{
+	void *elf = read_file(path);
+	if (elf == NULL || elf_checkFile(elf) != 0) {
+		fprintf(stderr, "%s: not an ELF file\n", path);
+		return -1;
+	}
+	unsigned num_sections = elf_getNumSections(elf);
+	const char **names = NULL;
+	uint64_t *values = NULL;
+	unsigned num_symbols = symbol_names(elf, &names, &values);
+	int errors = 0;
+
+	double start = now();
+	for (unsigned i = 0; i < num_sections; i++) {
+		int id;
+		if (elf_getSectionNamed(elf, elf_getSectionName(elf, i), &id) == NULL) {
+			errors++;
+		}
+	}
+	double linear_sections = now() - start;
+
+	start = now();
+	uint64_t value;
+	for (unsigned i = 0; i < num_symbols; i++) {
+		if (!linear_symbol(names, values, num_symbols, names[i], &value)) {
+			errors++;
+		}
+	}
+	double linear_symbols = now() - start;
+
+	start = now();
+	elf_index_t index;
+	if (elf_indexInit(elf, &index) != 0) {
+		fprintf(stderr, "%s: failed to build index\n", path);
+		return -1;
+	}
+	double init = now() - start;
+
+	for (unsigned i = 0; i < num_sections; i++) {
+		int linear_id, id;
+		const char *name = elf_getSectionName(elf, i);
+		void *expected = elf_getSectionNamed(elf, name, &linear_id);
+		if (elf_indexGetSectionNamed(&index, name, &id) != expected || id != linear_id) {
+			fprintf(stderr, "%s: section %s differs\n", path, name);
+			errors++;
+		}
+	}
+	start = now();
+	for (unsigned i = 0; i < num_sections; i++) {
+		elf_indexGetSectionNamed(&index, elf_getSectionName(elf, i), NULL);
+	}
+	double index_sections = now() - start;
+
+	for (unsigned i = 0; i < num_symbols; i++) {
+		uint64_t expected = 0;
+		linear_symbol(names, values, num_symbols, names[i], &expected);
+		if (!elf_indexGetSymbol(&index, names[i], &value, NULL) || value != expected) {
+			fprintf(stderr, "%s: symbol %s differs\n", path, names[i]);
+			errors++;
+		}
+	}
+	start = now();
+	for (unsigned i = 0; i < num_symbols; i++) {
+		elf_indexGetSymbol(&index, names[i], &value, NULL);
+	}
+	double index_symbols = now() - start;
+
+	printf("%s: %u sections, %u symbols\n", path, num_sections, num_symbols);
+	printf("  index build        %10.6f s\n", init);
+	printf("  sections  linear   %10.6f s  indexed %10.6f s\n", linear_sections, index_sections);
+	printf("  symbols   linear   %10.6f s  indexed %10.6f s\n", linear_symbols, index_symbols);
+
+	elf_indexFree(&index);
+	free(names);
+	free(values);
+	free(elf);
+	return errors ? -1 : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s file.elf [file.elf ...]\n", argv[0]);
+		return 1;
+	}
+	for (int i = 1; i < argc; i++) {
+		if (bench(argv[i]) != 0) {
+			ret = 1;
+		}
+	}
+	return ret;
+}
@@ -304,6 +304,70 @@ uint32_t elf_getSectionFlags(void *elfFile, int i);
 uint32_t elf_getSectionType(void *elfFile, int i);
 
 void *elf_getSection(void *elfFile, int i);
+
+/**
+ * Index of the sections and symbols of an ELF file, for images that are
+ * searched repeatedly. Lookups through an index find the same sections as
+ * elf_getSectionNamed without scanning every section header.
+ *
+ * The fields are private to libelf.
+ */
+typedef struct elf_index {
+	void *elfFile;
+	int is32;
+	/* Open addressed tables of section numbers plus one, and of .symtab
+	 * symbol numbers, keyed by name. The symbol table is built on the
+	 * first symbol lookup that needs it. */
+	uint32_t *sections;
+	uint32_t section_mask;
+	uint32_t *symbols;
+	uint32_t symbol_mask;
+	/* Section numbers of .symtab, .gnu.hash and .hash, or 0 if absent */
+	unsigned symtab;
+	unsigned gnu_hash;
+	unsigned sysv_hash;
+} elf_index_t;
+
+/**
+ * Build an index of an ELF file. The file must remain valid while the index
+ * is used.
+ *
+ * @param elfFile Pointer to a valid ELF file
+ * @param index Index to initialise, released with elf_indexFree
+ *
+ * \return 0 on success, -1 if memory for the index could not be allocated.
+ */
+int elf_indexInit(void *elfFile, elf_index_t *index);
+
+/**
+ * Release the memory held by an index.
+ */
+void elf_indexFree(elf_index_t *index);
+
+/**
+ * Find a section by name, as elf_getSectionNamed does.
+ *
+ * @param index Index of the ELF file
+ * @param str Name of the section
+ * @param i If not NULL, returns the number of the section
+ *
+ * \return Pointer to the contents of the section, or NULL if there is none.
+ */
+void *elf_indexGetSectionNamed(elf_index_t *index, const char *str, int *i);
+
+/**
+ * Find a defined symbol by name. Dynamic symbols are found through .gnu.hash
+ * or .hash when the file has either, other symbols through .symtab.
+ *
+ * @param index Index of the ELF file
+ * @param name Name of the symbol
+ * @param value If not NULL, returns the value of the symbol
+ * @param size If not NULL, returns the size of the symbol
+ *
+ * \return true if the symbol was found, false otherwise.
+ */
+int elf_indexGetSymbol(elf_index_t *index, const char *name, uint64_t *value, uint64_t *size);
+
 void elf_getProgramHeaderInfo(void *elfFile, uint16_t ph, uint64_t *p_vaddr,
 			      uint64_t *p_paddr, uint64_t *p_filesz,
 			      uint64_t *p_offset, uint64_t *p_memsz);
@@ -0,0 +1,401 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/*
+ * Section and symbol lookup through a per-image index.
+ *
+ * Section names are kept in an open addressed hash table that is built when
+ * the index is created. Symbols are looked up through the .gnu.hash or .hash
+ * section of the image when it has one, and otherwise (or if the symbol is
+ * not dynamic) through a hash table over .symtab that is built on the first
+ * symbol lookup.
+ */
+
+#include <elf/elf.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ISELF32(elfFile) ( ((struct Elf32_Header*)elfFile)->e_ident[EI_CLASS] == ELFCLASS32 )
+
+/* The parts of a section header that the index needs */
+struct section {
+	uint32_t type;
+	uint32_t link;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t entsize;
+};
+
+/* The parts of a symbol that the index needs */
+struct symbol {
+	uint32_t name;
+	unsigned char info;
+	uint16_t shndx;
+	uint64_t value;
+	uint64_t size;
+};
+
+static void
+get_section(void *elfFile, unsigned i, struct section *section)
+{
+	if (ISELF32(elfFile)) {
+		struct Elf32_Shdr *shdr = &elf32_getSectionTable(elfFile)[i];
+		*section = (struct section) {
+			.type = shdr->sh_type,
+			.link = shdr->sh_link,
+			.offset = shdr->sh_offset,
+			.size = shdr->sh_size,
+			.entsize = shdr->sh_entsize,
+		};
+	} else {
+		struct Elf64_Shdr *shdr = &elf64_getSectionTable(elfFile)[i];
+		*section = (struct section) {
+			.type = shdr->sh_type,
+			.link = shdr->sh_link,
+			.offset = shdr->sh_offset,
+			.size = shdr->sh_size,
+			.entsize = shdr->sh_entsize,
+		};
+	}
+}
+
+static void
+get_symbol(elf_index_t *index, const void *symbols, uint32_t i, struct symbol *sym)
+{
+	if (index->is32) {
+		const Elf32_Sym *s = &((const Elf32_Sym *) symbols)[i];
+		*sym = (struct symbol) {
+			.name = s->st_name,
+			.info = s->st_info,
+			.shndx = s->st_shndx,
+			.value = s->st_value,
+			.size = s->st_size,
+		};
+	} else {
+		const Elf64_Sym *s = &((const Elf64_Sym *) symbols)[i];
+		*sym = (struct symbol) {
+			.name = s->st_name,
+			.info = s->st_info,
+			.shndx = s->st_shndx,
+			.value = s->st_value,
+			.size = s->st_size,
+		};
+	}
+}
+
+/* The hash function of .gnu.hash, which is also used for the tables that
+ * are built here */
+static uint32_t
+gnu_hash(const char *name)
+{
+	uint32_t h = 5381;
+	for (const unsigned char *c = (const unsigned char *) name; *c; c++) {
+		h = h * 33 + *c;
+	}
+	return h;
+}
+
+static uint32_t
+sysv_hash(const char *name)
+{
+	uint32_t h = 0;
+	for (const unsigned char *c = (const unsigned char *) name; *c; c++) {
+		h = (h << 4) + *c;
+		h ^= (h >> 24) & 0xf0;
+	}
+	return h & 0x0fffffff;
+}
+
+/* Smallest power of two that leaves a table at most half full */
+static uint32_t
+table_size(uint32_t entries)
+{
+	uint32_t size = 8;
+	while (size < entries * 2) {
+		size *= 2;
+	}
+	return size;
+}
+
+int
+elf_indexInit(void *elfFile, elf_index_t *index)
+{
+	memset(index, 0, sizeof(*index));
+	index->elfFile = elfFile;
+	index->is32 = ISELF32(elfFile);
+
+	unsigned num_sections = elf_getNumSections(elfFile);
+	index->section_mask = table_size(num_sections) - 1;
+	index->sections = calloc(index->section_mask + 1, sizeof(*index->sections));
+	if (index->sections == NULL) {
+		return -1;
+	}
+
+	/* Sections are stored as their number plus one, so zero is empty. If
+	 * several sections share a name the first one wins, like
+	 * elf_getSectionNamed. */
+	for (unsigned i = 0; i < num_sections; i++) {
+		const char *name = elf_getSectionName(elfFile, i);
+		uint32_t slot = gnu_hash(name) & index->section_mask;
+		while (index->sections[slot] != 0 &&
+		       strcmp(name, elf_getSectionName(elfFile, index->sections[slot] - 1)) != 0) {
+			slot = (slot + 1) & index->section_mask;
+		}
+		if (index->sections[slot] == 0) {
+			index->sections[slot] = i + 1;
+		}
+
+		struct section section;
+		get_section(elfFile, i, &section);
+		if (section.type == SHT_SYMTAB && index->symtab == 0) {
+			index->symtab = i;
+		} else if (section.type == SHT_GNU_HASH && index->gnu_hash == 0) {
+			index->gnu_hash = i;
+		} else if (section.type == SHT_HASH && index->sysv_hash == 0) {
+			index->sysv_hash = i;
+		}
+	}
+	return 0;
+}
+
+void
+elf_indexFree(elf_index_t *index)
+{
+	free(index->sections);
+	free(index->symbols);
+	index->sections = NULL;
+	index->symbols = NULL;
+}
+
+void *
+elf_indexGetSectionNamed(elf_index_t *index, const char *str, int *id)
+{
+	uint32_t slot = gnu_hash(str) & index->section_mask;
+	while (index->sections[slot] != 0) {
+		int i = index->sections[slot] - 1;
+		if (strcmp(str, elf_getSectionName(index->elfFile, i)) == 0) {
+			if (id != NULL) {
+				*id = i;
+			}
+			return elf_getSection(index->elfFile, i);
+		}
+		slot = (slot + 1) & index->section_mask;
+	}
+	return NULL;
+}
+
+/* A symbol table along with its string table */
+struct symbol_table {
+	const void *symbols;
+	uint32_t count;
+	const char *strings;
+};
+
+/* Get the symbol table a hash or symbol section refers to through sh_link */
+static int
+linked_symbols(elf_index_t *index, unsigned i, struct symbol_table *table)
+{
+	struct section section, symbols, strings;
+	unsigned num_sections = elf_getNumSections(index->elfFile);
+
+	get_section(index->elfFile, i, &section);
+	if (section.type == SHT_SYMTAB || section.type == SHT_DYNSYM) {
+		symbols = section;
+	} else if (section.link != 0 && section.link < num_sections) {
+		get_section(index->elfFile, section.link, &symbols);
+	} else {
+		return 0;
+	}
+	if (symbols.link == 0 || symbols.link >= num_sections || symbols.entsize == 0) {
+		return 0;
+	}
+	get_section(index->elfFile, symbols.link, &strings);
+	table->symbols = (char *) index->elfFile + symbols.offset;
+	table->count = symbols.size / symbols.entsize;
+	table->strings = (char *) index->elfFile + strings.offset;
+	return 1;
+}
+
+static int
+defined(const struct symbol *sym)
+{
+	return sym->shndx != SHN_UNDEF && sym->name != 0;
+}
+
+/* Look up a symbol through .gnu.hash. Returns the symbol number or 0 */
+static uint32_t
+gnu_hash_lookup(elf_index_t *index, const struct symbol_table *table, const char *name)
+{
+	const uint32_t *header = (const uint32_t *) elf_getSection(index->elfFile, index->gnu_hash);
+	uint32_t nbuckets = header[0];
+	uint32_t symoffset = header[1];
+	uint32_t bloom_size = header[2];
+	uint32_t bloom_shift = header[3];
+	uint32_t word_bits = index->is32 ? 32 : 64;
+	const uint32_t *buckets;
+	uint32_t h = gnu_hash(name);
+
+	if (nbuckets == 0 || bloom_size == 0) {
+		return 0;
+	}
+	/* The bloom filter rules out most names that are not in the table
+	 * without touching the buckets or the symbols */
+	uint32_t bit1 = h % word_bits;
+	uint32_t bit2 = (h >> bloom_shift) % word_bits;
+	if (index->is32) {
+		const uint32_t *bloom = header + 4;
+		uint32_t word = bloom[(h / word_bits) % bloom_size];
+		if (!((word >> bit1) & (word >> bit2) & 1)) {
+			return 0;
+		}
+		buckets = bloom + bloom_size;
+	} else {
+		const uint64_t *bloom = (const uint64_t *) (header + 4);
+		uint64_t word = bloom[(h / word_bits) % bloom_size];
+		if (!((word >> bit1) & (word >> bit2) & 1)) {
+			return 0;
+		}
+		buckets = (const uint32_t *) (bloom + bloom_size);
+	}
+	const uint32_t *chain = buckets + nbuckets;
+
+	uint32_t i = buckets[h % nbuckets];
+	if (i < symoffset) {
+		return 0;
+	}
+	for (; i < table->count; i++) {
+		uint32_t h2 = chain[i - symoffset];
+		if ((h | 1) == (h2 | 1)) {
+			struct symbol sym;
+			get_symbol(index, table->symbols, i, &sym);
+			if (defined(&sym) && strcmp(name, table->strings + sym.name) == 0) {
+				return i;
+			}
+		}
+		if (h2 & 1) {
+			break;
+		}
+	}
+	return 0;
+}
+
+/* Look up a symbol through .hash. Returns the symbol number or 0 */
+static uint32_t
+sysv_hash_lookup(elf_index_t *index, const struct symbol_table *table, const char *name)
+{
+	const uint32_t *header = (const uint32_t *) elf_getSection(index->elfFile, index->sysv_hash);
+	uint32_t nbucket = header[0];
+	uint32_t nchain = header[1];
+	const uint32_t *buckets = header + 2;
+	const uint32_t *chain = buckets + nbucket;
+
+	if (nbucket == 0) {
+		return 0;
+	}
+	for (uint32_t i = buckets[sysv_hash(name) % nbucket]; i != STN_UNDEF && i < nchain && i < table->count;
+	     i = chain[i]) {
+		struct symbol sym;
+		get_symbol(index, table->symbols, i, &sym);
+		if (defined(&sym) && strcmp(name, table->strings + sym.name) == 0) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+/* Build the hash table over .symtab. Global symbols take precedence over
+ * local ones of the same name, otherwise the first symbol wins. */
+static int
+index_symtab(elf_index_t *index, const struct symbol_table *table)
+{
+	index->symbol_mask = table_size(table->count) - 1;
+	index->symbols = calloc(index->symbol_mask + 1, sizeof(*index->symbols));
+	if (index->symbols == NULL) {
+		return -1;
+	}
+	for (uint32_t i = 1; i < table->count; i++) {
+		struct symbol sym;
+		get_symbol(index, table->symbols, i, &sym);
+		if (!defined(&sym)) {
+			continue;
+		}
+		const char *name = table->strings + sym.name;
+		uint32_t slot = gnu_hash(name) & index->symbol_mask;
+		while (index->symbols[slot] != 0) {
+			struct symbol other;
+			get_symbol(index, table->symbols, index->symbols[slot], &other);
+			if (strcmp(name, table->strings + other.name) == 0) {
+				break;
+			}
+			slot = (slot + 1) & index->symbol_mask;
+		}
+		if (index->symbols[slot] == 0) {
+			index->symbols[slot] = i;
+		} else {
+			struct symbol other;
+			get_symbol(index, table->symbols, index->symbols[slot], &other);
+			if (ELF32_ST_BIND(other.info) == STB_LOCAL && ELF32_ST_BIND(sym.info) != STB_LOCAL) {
+				index->symbols[slot] = i;
+			}
+		}
+	}
+	return 0;
+}
+
+static uint32_t
+symtab_lookup(elf_index_t *index, const struct symbol_table *table, const char *name)
+{
+	if (index->symbols == NULL && index_symtab(index, table) != 0) {
+		return 0;
+	}
+	uint32_t slot = gnu_hash(name) & index->symbol_mask;
+	while (index->symbols[slot] != 0) {
+		struct symbol sym;
+		get_symbol(index, table->symbols, index->symbols[slot], &sym);
+		if (strcmp(name, table->strings + sym.name) == 0) {
+			return index->symbols[slot];
+		}
+		slot = (slot + 1) & index->symbol_mask;
+	}
+	return 0;
+}
+
+int
+elf_indexGetSymbol(elf_index_t *index, const char *name, uint64_t *value, uint64_t *size)
+{
+	struct symbol_table table;
+	uint32_t i = 0;
+	struct symbol sym;
+
+	if (index->gnu_hash != 0 && linked_symbols(index, index->gnu_hash, &table)) {
+		i = gnu_hash_lookup(index, &table, name);
+	} else if (index->sysv_hash != 0 && linked_symbols(index, index->sysv_hash, &table)) {
+		i = sysv_hash_lookup(index, &table, name);
+	}
+	/* Static images and symbols that are not exported only appear in
+	 * .symtab */
+	if (i == 0 && index->symtab != 0 && linked_symbols(index, index->symtab, &table)) {
+		i = symtab_lookup(index, &table, name);
+	}
+	if (i == 0) {
+		return 0;
+	}
+
+	get_symbol(index, table.symbols, i, &sym);
+	if (value != NULL) {
+		*value = sym.value;
+	}
+	if (size != NULL) {
+		*size = sym.size;
+	}
+	return 1;
+}
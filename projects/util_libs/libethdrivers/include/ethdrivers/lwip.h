@@ -83,6 +83,21 @@ static inline void ethif_lwip_poll(lwip_iface_t *iface) {
     iface->driver.i_fn.raw_poll(&iface->driver);
 }
 
+/* Wrapper function for an LWIP driver for asking the underlying
+ * eth driver to process at most 'budget' received packets. Returns
+ * the number processed, if this equals budget there may be more
+ * work and the caller should poll again before waiting for an IRQ */
+static inline int ethif_lwip_poll_budget(lwip_iface_t *iface, int budget) {
+    return ethif_poll_budget(&iface->driver, budget);
+}
+
+/* Wrapper function for a LWIP driver for asking whether the underlying
+ * eth driver left receive interrupts masked after running out of budget,
+ * in which case the caller must keep polling before waiting for an IRQ */
+static inline int ethif_lwip_rx_polling(lwip_iface_t *iface) {
+    return ethif_rx_polling(&iface->driver);
+}
+
 /* Retrieve the netif_init_fn for this iface for passing to netif_add */
 static inline netif_init_fn ethif_get_ethif_init(lwip_iface_t *iface) {
     return iface->ethif_init;
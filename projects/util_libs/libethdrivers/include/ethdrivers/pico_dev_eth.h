@@ -55,4 +55,19 @@ static inline void ethif_pico_handle_irq(pico_device_eth *iface, int irq) {
     iface->driver.i_fn.raw_handleIRQ(&iface->driver, irq);
 }
 
+/* Wrapper function for a picotcp driver for asking the underlying
+ * eth driver to process at most 'budget' received packets. Returns
+ * the number processed, if this equals budget there may be more
+ * work and the caller should poll again before waiting for an IRQ */
+static inline int ethif_pico_poll_budget(pico_device_eth *iface, int budget) {
+    return ethif_poll_budget(&iface->driver, budget);
+}
+
+/* Wrapper function for a picotcp driver for asking whether the underlying
+ * eth driver left receive interrupts masked after running out of budget,
+ * in which case the caller must keep polling before waiting for an IRQ */
+static inline int ethif_pico_rx_polling(pico_device_eth *iface) {
+    return ethif_rx_polling(&iface->driver);
+}
+
 #endif // CONFIG_LIB_PICOTCP
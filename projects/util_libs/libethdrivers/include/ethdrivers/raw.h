@@ -40,6 +40,30 @@ struct eth_driver;
  */
 typedef int (*ethif_raw_tx)(struct eth_driver *driver, unsigned int num, uintptr_t *phys, unsigned int *len, void *cookie);
 
+/* A single packet in a burst given to ethif_raw_tx_burst. The fields
+ * have the same meaning as the arguments to ethif_raw_tx */
+struct ethif_tx_packet {
+    unsigned int num;
+    uintptr_t *phys;
+    unsigned int *len;
+    void *cookie;
+};
+
+/**
+ * Transmit a burst of packets. The driver places as many of the packets
+ * as it has room for in its ring and notifies the device once for the
+ * whole burst.
+ *
+ * @param driver    Pointer to ethernet driver
+ * @param num       Number of packets in 'packets'
+ * @param packets   Array of length 'num' describing each packet
+ *
+ * @return          Number of packets, starting from the first, that were
+ *                  enqueued. ethif_raw_tx_complete will be called for each
+ *                  of them. The remaining packets were not touched.
+ */
+typedef int (*ethif_raw_tx_burst)(struct eth_driver *driver, unsigned int num, struct ethif_tx_packet *packets);
+
 /**
  * Handle an IRQ event
  *
@@ -69,6 +93,35 @@ typedef void (*ethif_print_state_t)(struct eth_driver* driver);
  */
 typedef void (*ethif_raw_poll)(struct eth_driver *driver);
 
+/**
+ * Request the driver to process at most 'budget' received packets.
+ * This is intended to be used to keep polling a device whose receive
+ * interrupts were masked by the driver after an interrupt, see
+ * CONFIG_LIB_ETHDRIVER_NAPI.
+ *
+ * @param driver    Pointer to ethernet driver
+ * @param budget    Maximum number of packets to complete
+ *
+ * @return          Number of packets completed, or -EINVAL if budget is
+ *                  not positive. If this is less than budget the receive
+ *                  ring was drained and the driver has unmasked its receive
+ *                  interrupts, otherwise there may be more work and the
+ *                  caller should poll again.
+ */
+typedef int (*ethif_raw_poll_budget)(struct eth_driver *driver, int budget);
+
+/**
+ * Ask whether the driver has left its receive interrupts masked because a
+ * budgeted poll, possibly the one done by raw_handleIRQ, ran out of budget.
+ * While this is true no receive interrupt arrives and the caller must keep
+ * calling ethif_raw_poll_budget, for instance after handling an IRQ.
+ *
+ * @param driver    Pointer to ethernet driver
+ *
+ * @return          Non-zero if the driver is waiting to be polled
+ */
+typedef int (*ethif_raw_rx_polling)(struct eth_driver *driver);
+
 /**
  * Function called by the driver to allocate receive buffers.
  * Must respect the dma_alignment specified by the driver in
@@ -84,6 +137,22 @@ typedef void (*ethif_raw_poll)(struct eth_driver *driver);
  */
 typedef uintptr_t (*ethif_raw_allocate_rx_buf)(void *cb_cookie, size_t buf_size, void **cookie);
 
+/**
+ * Function called by the driver to allocate a batch of receive buffers.
+ * Same as ethif_raw_allocate_rx_buf, but for up to 'num' buffers at once.
+ *
+ * @param cb_cookie     Cookie given in eth_driver struct
+ * @param buf_size      Size of each buffer to allocate
+ * @param num           Number of buffers wanted
+ * @param phys          Array of length 'num' to fill with the physical
+ *                      address of each buffer
+ * @param cookies       Array of length 'num' to fill with a buffer specific
+ *                      cookie for each buffer
+ *
+ * @return              Number of buffers allocated
+ */
+typedef unsigned int (*ethif_raw_allocate_rx_bufs)(void *cb_cookie, size_t buf_size, unsigned int num, uintptr_t *phys, void **cookies);
+
 /**
  * Function called by the driver upon successful RX
  *
@@ -98,6 +167,21 @@ typedef uintptr_t (*ethif_raw_allocate_rx_buf)(void *cb_cookie, size_t buf_size,
  */
 typedef void (*ethif_raw_rx_complete)(void *cb_cookie, unsigned int num_bufs, void **cookies, unsigned int *lens);
 
+/**
+ * Function called by the driver upon successful RX of a burst of packets
+ *
+ * @param cb_cookie     Cookie given in the eth_driver struct
+ * @param num_packets   Number of packets received
+ * @param num_bufs      Array of size 'num_packets' containing the number
+ *                      of buffers used by each packet
+ * @param cookies       Cookies of the buffers of all packets, one packet
+ *                      after the other. This array will be freed upon
+ *                      completion of the callback
+ * @param lens          Lengths of the buffers in 'cookies'. This array
+ *                      will be freed upon completion of the callback
+ */
+typedef void (*ethif_raw_rx_complete_burst)(void *cb_cookie, unsigned int num_packets, unsigned int *num_bufs, void **cookies, unsigned int *lens);
+
 /**
  * Function called by the driver upon successful TX
  *
@@ -122,22 +206,30 @@ typedef void (*ethif_raw_tx_complete)(void *cb_cookie, void *cookie);
 typedef int (*ethif_driver_init)(struct eth_driver *driver, ps_io_ops_t io_ops, void *config);
 
 /* Structure defining the set of functions an ethernet driver
- * must implement and expose */
+ * must implement and expose. The burst and budget functions
+ * are optional and may be NULL */
 struct raw_iface_funcs {
     ethif_raw_tx raw_tx;
     ethif_raw_handleIRQ_t raw_handleIRQ;
     ethif_raw_poll        raw_poll;
     ethif_print_state_t print_state;
     ethif_low_level_init_t low_level_init;
+    ethif_raw_tx_burst raw_tx_burst;
+    ethif_raw_poll_budget raw_poll_budget;
+    ethif_raw_rx_polling  raw_rx_polling;
 };
 
 /* Structure defining the set of functions an ethernet driver
  * expects to be given to it for handling memory allocation
- * and receive/transmit completions */
+ * and receive/transmit completions. The batched allocate_rx_bufs
+ * and rx_complete_burst are optional, drivers that support them
+ * fall back to the single versions when they are NULL */
 struct raw_iface_callbacks {
     ethif_raw_tx_complete tx_complete;
     ethif_raw_rx_complete rx_complete;
     ethif_raw_allocate_rx_buf allocate_rx_buf;
+    ethif_raw_allocate_rx_bufs allocate_rx_bufs;
+    ethif_raw_rx_complete_burst rx_complete_burst;
 };
 
 /* Structure to hold the interface for an ethernet driver */
@@ -150,6 +242,43 @@ struct eth_driver {
     int dma_alignment;
 };
 
+/* Transmit a burst of packets, falling back to one ethif_raw_tx call per
+ * packet for drivers that do not implement ethif_raw_tx_burst. Has the
+ * same return value as ethif_raw_tx_burst */
+static inline int ethif_tx_burst(struct eth_driver *driver, unsigned int num, struct ethif_tx_packet *packets) {
+    if (driver->i_fn.raw_tx_burst) {
+        return driver->i_fn.raw_tx_burst(driver, num, packets);
+    }
+    unsigned int i;
+    for (i = 0; i < num; i++) {
+        int status = driver->i_fn.raw_tx(driver, packets[i].num, packets[i].phys, packets[i].len, packets[i].cookie);
+        if (status == ETHIF_TX_FAILED) {
+            break;
+        }
+        if (status == ETHIF_TX_COMPLETE) {
+            driver->i_cb.tx_complete(driver->cb_cookie, packets[i].cookie);
+        }
+    }
+    return i;
+}
+
+/* Process at most 'budget' received packets, falling back to ethif_raw_poll
+ * for drivers that do not implement ethif_raw_poll_budget. Has the same
+ * return value as ethif_raw_poll_budget */
+static inline int ethif_poll_budget(struct eth_driver *driver, int budget) {
+    if (driver->i_fn.raw_poll_budget) {
+        return driver->i_fn.raw_poll_budget(driver, budget);
+    }
+    driver->i_fn.raw_poll(driver);
+    return 0;
+}
+
+/* Whether the driver's receive interrupts are masked until it is polled with
+ * ethif_poll_budget, see ethif_raw_rx_polling */
+static inline int ethif_rx_polling(struct eth_driver *driver) {
+    return driver->i_fn.raw_rx_polling && driver->i_fn.raw_rx_polling(driver);
+}
+
 struct dma_buf_cookie {
     void* vbuf;
     void* pbuf;
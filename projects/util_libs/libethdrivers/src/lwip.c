@@ -82,6 +82,27 @@ static uintptr_t lwip_allocate_rx_buf(void *iface, size_t buf_size, void **cooki
     return buf->phys;
 }
 
+static unsigned int lwip_allocate_rx_bufs(void *iface, size_t buf_size, unsigned int num, uintptr_t *phys, void **cookies) {
+    lwip_iface_t *lwip_iface = (lwip_iface_t*)iface;
+    if (num == 0) {
+        return 0;
+    }
+    /* the first allocation does the size check and any lazy initialization */
+    phys[0] = lwip_allocate_rx_buf(iface, buf_size, &cookies[0]);
+    if (!phys[0]) {
+        return 0;
+    }
+    unsigned int i;
+    for (i = 1; i < num && lwip_iface->num_free_bufs > 0; i++) {
+        lwip_iface->num_free_bufs--;
+        dma_addr_t *buf = lwip_iface->bufs[lwip_iface->num_free_bufs];
+        ps_dma_cache_invalidate(&lwip_iface->dma_man, buf->virt, buf_size);
+        cookies[i] = (void*)buf;
+        phys[i] = buf->phys;
+    }
+    return i;
+}
+
 static void lwip_tx_complete(void *iface, void *cookie) {
     lwip_iface_t *lwip_iface = (lwip_iface_t*)iface;
     lwip_iface->bufs[lwip_iface->num_free_bufs] = cookie;
@@ -392,7 +413,8 @@ ethif_pbuf_link_output(struct netif *netif, struct pbuf *p)
 static struct raw_iface_callbacks lwip_prealloc_callbacks = {
     .tx_complete = lwip_tx_complete,
     .rx_complete = lwip_rx_complete,
-    .allocate_rx_buf = lwip_allocate_rx_buf
+    .allocate_rx_buf = lwip_allocate_rx_buf,
+    .allocate_rx_bufs = lwip_allocate_rx_bufs
 };
 
 static struct raw_iface_callbacks lwip_pbuf_callbacks = {
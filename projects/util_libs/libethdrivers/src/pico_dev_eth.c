@@ -159,6 +159,27 @@ static uintptr_t pico_allocate_rx_buf(void *iface, size_t buf_size, void **cooki
     return buf->phys;
 }
 
+static unsigned int pico_allocate_rx_bufs(void *iface, size_t buf_size, unsigned int num, uintptr_t *phys, void **cookies) {
+    pico_device_eth *pico_iface = (pico_device_eth*)iface;
+    if (num == 0) {
+        return 0;
+    }
+    /* the first allocation does the size check and any lazy initialization */
+    phys[0] = pico_allocate_rx_buf(iface, buf_size, &cookies[0]);
+    if (!phys[0]) {
+        return 0;
+    }
+    unsigned int i;
+    for (i = 1; i < num && pico_iface->next_free_buf != -1; i++) {
+        int buf_no = alloc_buf_pool(pico_iface);
+        dma_addr_t *buf = pico_iface->bufs[buf_no];
+        ps_dma_cache_invalidate(&pico_iface->dma_man, buf->virt, buf_size);
+        cookies[i] = (void*)(uintptr_t)buf_no;
+        phys[i] = buf->phys;
+    }
+    return i;
+}
+
 static void pico_tx_complete(void *iface, void *cookie) {
     pico_device_eth *pico_iface = (pico_device_eth*)iface;
     free_buf_pool(iface, (int)cookie);
@@ -261,7 +282,8 @@ static int pico_eth_poll(struct pico_device *dev, int loop_score) {
 static struct raw_iface_callbacks pico_prealloc_callbacks = {
     .tx_complete = pico_tx_complete,
     .rx_complete = pico_rx_complete,
-    .allocate_rx_buf = pico_allocate_rx_buf
+    .allocate_rx_buf = pico_allocate_rx_buf,
+    .allocate_rx_bufs = pico_allocate_rx_bufs
 };
 
 struct pico_device *pico_eth_create_no_malloc(char *name,
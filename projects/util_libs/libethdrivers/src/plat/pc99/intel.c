@@ -12,6 +12,7 @@
 
 #include <ethdrivers/intel.h>
 #include <assert.h>
+#include <errno.h>
 #include <ethdrivers/helpers.h>
 
 typedef enum e1000_family {
@@ -23,6 +24,8 @@ typedef enum e1000_family {
 #define DMA_ALIGN 128
 /* This driver is hard coded to use 2k buffers, don't just change this */
 #define BUF_SIZE 2048
+/* Number of receive buffers requested from the allocation callback at once */
+#define RX_ALLOC_CHUNK 32
 
 // TX Descriptor Status Bits
 #define TX_DD BIT(0) /* Descriptor Done */
@@ -74,6 +77,7 @@ typedef enum e1000_family {
 #define REG_82574_IMS(x) REG(x, 0xD0)
 #define REG_82580_ICR(x) REG(x, 0x1500)
 #define REG_82574_ICR(x) REG(x, 0xC0)
+#define REG_82574_ITR(x) REG(x, 0xC4)
 #define REG_TIPG(x) REG(x, 0x410)
 #define REG_82574_RDTR(x) REG(x, 0x2820)
 #define REG_82574_RADV(x) REG(x, 0x282c)
@@ -150,6 +154,11 @@ typedef enum e1000_family {
 #define IMS_82574_TXDW BIT(0)
 #define IMS_82574_ACK BIT(17)
 #define IMS_82574_LSC BIT(2)
+#define IMS_82580_RX (IMS_82580_RXDW)
+#define IMS_82574_RX (IMS_82574_RXQ0 | IMS_82574_RXTO | IMS_82574_RXDMT0 | IMS_82574_ACK)
+
+/* ITR counts in units of 256 nanoseconds */
+#define ITR_82574_INTERVAL(us) (((us) * 1000) / 256)
 
 #define ICR_82580_RXDW BIT(7)
 #define ICR_82580_TXDW BIT(0)
@@ -200,6 +209,10 @@ typedef struct e1000_dev {
     unsigned int rx_size;
     unsigned int rx_remain;
     void **rx_cookies;
+    /* completed receive buffers gathered up to be handed over in one burst */
+    void **rx_burst_cookies;
+    unsigned int *rx_burst_lens;
+    unsigned int *rx_burst_bufs;
     volatile struct legacy_tx_ldesc *tx_ring;
     unsigned int tx_size;
     unsigned int tx_remain;
@@ -208,6 +221,8 @@ typedef struct e1000_dev {
     uint32_t tx_cmd_bits;
     /* whether we believe the link is up or not */
     int link_up;
+    /* receive interrupts are masked until raw_poll_budget drains the ring */
+    int rx_polling;
 }e1000_dev_t;
 
 static void disable_all_interrupts(e1000_dev_t *dev) {
@@ -455,7 +470,7 @@ static void initialize_RXDCTL(e1000_dev_t *dev) {
         temp |= 32 << RXDCTL_82574_HTHRESH_OFFSET;
         /* write back 4 at a time */
         temp |= 4 << RXDCTL_82574_WTHRESH_OFFSET;
-        REG_82574_TXDCTL(dev, 0) = temp;
+        REG_82574_RXDCTL(dev, 0) = temp;
         break;
     default:
         assert(!"Unknown device");
@@ -467,10 +482,18 @@ static void initialize_receive_timers(e1000_dev_t *dev) {
     case e1000_82580:
         break;
     case e1000_82574:
+#if CONFIG_LIB_ETHDRIVER_IRQ_MODERATION_US > 0
+        /* let the interrupt throttle batch up receives instead of the
+         * per packet delay timers */
+        REG_82574_RDTR(dev) = 0;
+        REG_82574_RADV(dev) = 0;
+        REG_82574_ITR(dev) = ITR_82574_INTERVAL(CONFIG_LIB_ETHDRIVER_IRQ_MODERATION_US);
+#else
         /* set a base delay of 20 microseconds */
         REG_82574_RDTR(dev) = 20;
         /* force descriptor write back after 20 microseconds */
         REG_82574_RADV(dev) = 20;
+#endif
         REG_82574_RAID(dev) = 0;
         break;
     default:
@@ -492,12 +515,34 @@ static void initialize_receive(e1000_dev_t *dev) {
 static void enable_interrupts(e1000_dev_t *dev) {
     switch(dev->family) {
     case e1000_82580:
-        REG_82580_IMS(dev) = IMS_82580_RXDW | IMS_82580_TXDW | IMS_82580_GPHY;
+        REG_82580_IMS(dev) = IMS_82580_RX | IMS_82580_TXDW | IMS_82580_GPHY;
         /* enable link status change interrupts in the phy */
         phy_write(dev, 0, 24, BIT(2));
         break;
     case e1000_82574:
-        REG_82574_IMS(dev) = IMS_82574_RXQ0 | IMS_82574_RXTO | IMS_82574_RXDMT0 | IMS_82574_ACK | IMS_82574_TXDW | IMS_82574_LSC;
+        REG_82574_IMS(dev) = IMS_82574_RX | IMS_82574_TXDW | IMS_82574_LSC;
+        break;
+    default:
+        assert(!"Unknown device");
+        break;
+    }
+}
+
+static void set_rx_interrupts(e1000_dev_t *dev, int enable) {
+    switch(dev->family) {
+    case e1000_82580:
+        if (enable) {
+            REG_82580_IMS(dev) = IMS_82580_RX;
+        } else {
+            REG_82580_IMC(dev) = IMS_82580_RX;
+        }
+        break;
+    case e1000_82574:
+        if (enable) {
+            REG_82574_IMS(dev) = IMS_82574_RX;
+        } else {
+            REG_82574_IMC(dev) = IMS_82574_RX;
+        }
         break;
     default:
         assert(!"Unknown device");
@@ -687,6 +732,18 @@ static void free_desc_ring(e1000_dev_t *dev, ps_dma_man_t *dma_man) {
         free(dev->tx_lengths);
         dev->tx_lengths = NULL;
     }
+    if (dev->rx_burst_cookies) {
+        free(dev->rx_burst_cookies);
+        dev->rx_burst_cookies = NULL;
+    }
+    if (dev->rx_burst_lens) {
+        free(dev->rx_burst_lens);
+        dev->rx_burst_lens = NULL;
+    }
+    if (dev->rx_burst_bufs) {
+        free(dev->rx_burst_bufs);
+        dev->rx_burst_bufs = NULL;
+    }
 }
 
 static int initialize_desc_ring(e1000_dev_t *dev, ps_dma_man_t *dma_man) {
@@ -702,24 +759,19 @@ static int initialize_desc_ring(e1000_dev_t *dev, ps_dma_man_t *dma_man) {
         free_desc_ring(dev, dma_man);
         return -1;
     }
+    dev->tx_ring = tx_ring.virt;
     dev->rx_cookies = malloc(sizeof(void*) * dev->rx_size);
     dev->tx_cookies = malloc(sizeof(void*) * dev->tx_size);
     dev->tx_lengths = malloc(sizeof(unsigned int) * dev->tx_size);
-    if (!dev->rx_cookies || !dev->tx_cookies || !dev->tx_lengths) {
-        if (dev->rx_cookies) {
-            free(dev->rx_cookies);
-        }
-        if (dev->tx_cookies) {
-            free(dev->tx_cookies);
-        }
-        if (dev->tx_lengths) {
-            free(dev->tx_lengths);
-        }
+    dev->rx_burst_cookies = malloc(sizeof(void*) * dev->rx_size);
+    dev->rx_burst_lens = malloc(sizeof(unsigned int) * dev->rx_size);
+    dev->rx_burst_bufs = malloc(sizeof(unsigned int) * dev->rx_size);
+    if (!dev->rx_cookies || !dev->tx_cookies || !dev->tx_lengths ||
+        !dev->rx_burst_cookies || !dev->rx_burst_lens || !dev->rx_burst_bufs) {
         LOG_ERROR("Failed to malloc");
         free_desc_ring(dev, dma_man);
         return -1;
     }
-    dev->tx_ring = tx_ring.virt;
     /* Remaining needs to be 2 less than size as we cannot actually enqueue size many descriptors,
      * since then the head and tail pointers would be equal, indicating empty. */
     dev->rx_remain = dev->rx_size - 2;
@@ -743,16 +795,14 @@ static int initialize_desc_ring(e1000_dev_t *dev, ps_dma_man_t *dma_man) {
     return 0;
 }
 
-static void complete_rx(struct eth_driver *driver) {
+/* Hand at most 'budget' completed packets back in one burst and return how many */
+static int complete_rx(struct eth_driver *driver, unsigned int budget) {
     e1000_dev_t *dev = (e1000_dev_t*)driver->eth_data;
-    if (dev->rdh == dev->rdt) {
-        /* We haven't enqueued anything */
-        return;
-    }
-    unsigned int i, j;
-    unsigned int count = 1;
-    unsigned int rdt = dev->rdt;
-    for (i = dev->rdh; i != rdt; i = (i + 1) % dev->rx_size, count++) {
+    unsigned int i;
+    unsigned int packets = 0;
+    unsigned int bufs = 0;
+    unsigned int count = 0;
+    for (i = dev->rdh; i != dev->rdt && packets < budget; i = (i + 1) % dev->rx_size) {
         unsigned int status = dev->rx_ring[i].status;
         /* Ensure no memory references get ordered before we checked the descriptor was written back */
         asm volatile("lfence" ::: "memory");
@@ -760,21 +810,35 @@ static void complete_rx(struct eth_driver *driver) {
             /* not complete yet */
             break;
         }
+        dev->rx_burst_cookies[bufs + count] = dev->rx_cookies[i];
+        dev->rx_burst_lens[bufs + count] = dev->rx_ring[i].length;
+        count++;
         if (status & RX_EOP) {
-            void *cookies[count];
-            unsigned int len[count];
-            for (j = 0; j < count; j++) {
-                cookies[j] = dev->rx_cookies[(dev->rdh + j) % dev->rx_size];
-                len[j] = dev->rx_ring[(dev->rdh + j) % dev->rx_size].length;
-            }
-            /* update rdh */
-            dev->rdh = (dev->rdh + count) % dev->rx_size;
-            dev->rx_remain += count;
-            /* Give the buffers back */
-            driver->i_cb.rx_complete(driver->cb_cookie, count, cookies, len);
+            dev->rx_burst_bufs[packets] = count;
+            packets++;
+            bufs += count;
             count = 0;
         }
     }
+    if (packets == 0) {
+        return 0;
+    }
+    /* update rdh, the descriptors of a partially received packet are left for next time */
+    dev->rdh = (dev->rdh + bufs) % dev->rx_size;
+    dev->rx_remain += bufs;
+    /* Give the buffers back */
+    if (driver->i_cb.rx_complete_burst) {
+        driver->i_cb.rx_complete_burst(driver->cb_cookie, packets, dev->rx_burst_bufs,
+                                       dev->rx_burst_cookies, dev->rx_burst_lens);
+    } else {
+        bufs = 0;
+        for (i = 0; i < packets; i++) {
+            driver->i_cb.rx_complete(driver->cb_cookie, dev->rx_burst_bufs[i],
+                                     &dev->rx_burst_cookies[bufs], &dev->rx_burst_lens[bufs]);
+            bufs += dev->rx_burst_bufs[i];
+        }
+    }
+    return packets;
 }
 
 static void complete_tx(struct eth_driver *driver) {
@@ -798,19 +862,9 @@ static void complete_tx(struct eth_driver *driver) {
     }
 }
 
-static int raw_tx(struct eth_driver *driver, unsigned int num, uintptr_t *phys, unsigned int *len, void *cookie) {
-    e1000_dev_t *dev = (e1000_dev_t*)driver->eth_data;
-    if (!dev->link_up) {
-        return ETHIF_TX_FAILED;
-    }
-    /* Ensure we have room */
-    if (dev->tx_remain < num) {
-        /* try and complete some */
-        complete_tx(driver);
-        if (dev->tx_remain < num) {
-            return ETHIF_TX_FAILED;
-        }
-    }
+/* Write the descriptors for a packet. The caller must have checked there is room and is
+ * responsible for telling the hardware about the new tail */
+static void enqueue_tx(e1000_dev_t *dev, unsigned int num, uintptr_t *phys, unsigned int *len, void *cookie) {
     unsigned int i;
     for (i = 0; i < num; i++) {
         dev->tx_ring[(dev->tdt + i) % dev->tx_size] = (struct legacy_tx_ldesc) {
@@ -826,39 +880,98 @@ static int raw_tx(struct eth_driver *driver, unsigned int num, uintptr_t *phys,
     }
     dev->tx_cookies[dev->tdt] = cookie;
     dev->tx_lengths[dev->tdt] = num;
-    /* ensure update to descriptors visible before updating tdt */
-    asm volatile("mfence" ::: "memory");
     dev->tdt = (dev->tdt + num) % dev->tx_size;
     dev->tx_remain -= num;
+}
+
+static int raw_tx(struct eth_driver *driver, unsigned int num, uintptr_t *phys, unsigned int *len, void *cookie) {
+    e1000_dev_t *dev = (e1000_dev_t*)driver->eth_data;
+    if (!dev->link_up) {
+        return ETHIF_TX_FAILED;
+    }
+    /* Ensure we have room */
+    if (dev->tx_remain < num) {
+        /* try and complete some */
+        complete_tx(driver);
+        if (dev->tx_remain < num) {
+            return ETHIF_TX_FAILED;
+        }
+    }
+    enqueue_tx(dev, num, phys, len, cookie);
+    /* ensure update to descriptors visible before updating tdt */
+    asm volatile("mfence" ::: "memory");
     set_tdt(dev, dev->tdt);
     return ETHIF_TX_ENQUEUED;
 }
 
+static int raw_tx_burst(struct eth_driver *driver, unsigned int num, struct ethif_tx_packet *packets) {
+    e1000_dev_t *dev = (e1000_dev_t*)driver->eth_data;
+    if (!dev->link_up) {
+        return 0;
+    }
+    unsigned int i;
+    for (i = 0; i < num; i++) {
+        if (dev->tx_remain < packets[i].num) {
+            complete_tx(driver);
+            if (dev->tx_remain < packets[i].num) {
+                break;
+            }
+        }
+        enqueue_tx(dev, packets[i].num, packets[i].phys, packets[i].len, packets[i].cookie);
+    }
+    if (i > 0) {
+        /* ensure update to descriptors visible before updating tdt, which
+         * only needs to happen once for the whole burst */
+        asm volatile("mfence" ::: "memory");
+        set_tdt(dev, dev->tdt);
+    }
+    return i;
+}
+
+static void install_rx_buf(e1000_dev_t *dev, uintptr_t phys, void *cookie) {
+    dev->rx_cookies[dev->rdt] = cookie;
+    /* zery the descriptor */
+    dev->rx_ring[dev->rdt] = (struct legacy_rx_ldesc) {
+        .bufferAddress = phys,
+        .length = BUF_SIZE,
+        .packetChecksum = 0,
+        .status = 0,
+        .error = 0,
+        .VLAN = 0
+    };
+    dev->rdt = (dev->rdt + 1) % dev->rx_size;
+    dev->rx_remain--;
+}
+
 static int fill_rx_bufs(struct eth_driver *driver) {
     e1000_dev_t *dev = (e1000_dev_t*)driver->eth_data;
     int rdt = dev->rdt;
     /* We want to install buffers in bursts for performance reasons.
      * constantly enqueueing single buffers is expensive */
-    if (dev->rx_remain < 32) return 0;
+    if (dev->rx_remain < CONFIG_LIB_ETHDRIVER_RX_REFILL_BATCH) return 0;
     while (dev->rx_remain > 0) {
-        /* request a buffer */
-        void *cookie;
-        uintptr_t phys = driver->i_cb.allocate_rx_buf(driver->cb_cookie, BUF_SIZE, &cookie);
-        if (!phys) {
+        uintptr_t phys[RX_ALLOC_CHUNK];
+        void *cookies[RX_ALLOC_CHUNK];
+        unsigned int num = MIN(dev->rx_remain, RX_ALLOC_CHUNK);
+        unsigned int got;
+        /* request the buffers */
+        if (driver->i_cb.allocate_rx_bufs) {
+            got = driver->i_cb.allocate_rx_bufs(driver->cb_cookie, BUF_SIZE, num, phys, cookies);
+        } else {
+            for (got = 0; got < num; got++) {
+                phys[got] = driver->i_cb.allocate_rx_buf(driver->cb_cookie, BUF_SIZE, &cookies[got]);
+                if (!phys[got]) {
+                    break;
+                }
+            }
+        }
+        unsigned int i;
+        for (i = 0; i < got; i++) {
+            install_rx_buf(dev, phys[i], cookies[i]);
+        }
+        if (got < num) {
             break;
         }
-        dev->rx_cookies[dev->rdt] = cookie;
-        /* zery the descriptor */
-        dev->rx_ring[dev->rdt] = (struct legacy_rx_ldesc) {
-            .bufferAddress = phys,
-            .length = BUF_SIZE,
-            .packetChecksum = 0,
-            .status = 0,
-            .error = 0,
-            .VLAN = 0
-        };
-        dev->rdt = (dev->rdt + 1) % dev->rx_size;
-        dev->rx_remain--;
     }
     if (dev->rdt != rdt) {
         /* ensure update to descriptor visible before updating rdt */
@@ -868,11 +981,55 @@ static int fill_rx_bufs(struct eth_driver *driver) {
     return dev->rx_remain != 0;
 }
 
+static int raw_poll_budget(struct eth_driver *driver, int budget) {
+    e1000_dev_t *dev = (e1000_dev_t*)driver->eth_data;
+    if (budget <= 0) {
+        /* complete_rx takes the budget unsigned */
+        return -EINVAL;
+    }
+    int done = complete_rx(driver, budget);
+    fill_rx_bufs(driver);
+    complete_tx(driver);
+    if (done < budget) {
+        /* Ring is drained. Anything that arrived since we looked is still
+         * pending in the ICR and raises an interrupt once unmasked */
+        dev->rx_polling = 0;
+        set_rx_interrupts(dev, 1);
+    } else {
+        dev->rx_polling = 1;
+    }
+    return done;
+}
+
+static int raw_rx_polling(struct eth_driver *driver) {
+    e1000_dev_t *dev = (e1000_dev_t*)driver->eth_data;
+    return dev->rx_polling;
+}
+
 static void raw_poll(struct eth_driver *driver) {
-    complete_rx(driver);
+    e1000_dev_t *dev = (e1000_dev_t*)driver->eth_data;
+    complete_rx(driver, dev->rx_size);
     complete_tx(driver);
     fill_rx_bufs(driver);
-    check_link_status(driver->eth_data);
+    check_link_status(dev);
+#ifdef CONFIG_LIB_ETHDRIVER_NAPI
+    dev->rx_polling = 0;
+    set_rx_interrupts(dev, 1);
+#endif
+}
+
+static void handle_rx_irq(struct eth_driver *driver) {
+    e1000_dev_t *dev = (e1000_dev_t*)driver->eth_data;
+#ifdef CONFIG_LIB_ETHDRIVER_NAPI
+    /* stop further receive interrupts until polling finds the ring empty.
+     * If this poll runs out of budget they stay masked and the caller keeps
+     * polling while ethif_rx_polling says so */
+    set_rx_interrupts(dev, 0);
+    raw_poll_budget(driver, CONFIG_LIB_ETHDRIVER_RX_POLL_BUDGET);
+#else
+    complete_rx(driver, dev->rx_size);
+    fill_rx_bufs(driver);
+#endif
 }
 
 static void handle_irq(struct eth_driver *driver, int irq) {
@@ -882,8 +1039,7 @@ static void handle_irq(struct eth_driver *driver, int irq) {
     case e1000_82580:
         icr = REG_82580_ICR(dev);
         if (icr & ICR_82580_RXDW) {
-            complete_rx(driver);
-            fill_rx_bufs(driver);
+            handle_rx_irq(driver);
         }
         if (icr & ICR_82580_TXDW) {
             complete_tx(driver);
@@ -900,8 +1056,7 @@ static void handle_irq(struct eth_driver *driver, int irq) {
         /* ack */
         REG_82574_ICR(dev) = icr;
         if(icr & (ICR_82574_RXQ0 | ICR_82574_RXTO | ICR_82574_ACK | ICR_82574_RXDMT0)) {
-            complete_rx(driver);
-            fill_rx_bufs(driver);
+            handle_rx_irq(driver);
         }
         if (icr & ICR_82574_TXDW) {
             complete_tx(driver);
@@ -923,7 +1078,10 @@ static struct raw_iface_funcs iface_fns = {
     .print_state = print_state,
     .low_level_init = low_level_init,
     .raw_tx = raw_tx,
-    .raw_poll = raw_poll
+    .raw_poll = raw_poll,
+    .raw_tx_burst = raw_tx_burst,
+    .raw_poll_budget = raw_poll_budget,
+    .raw_rx_polling = raw_rx_polling
 };
 
 static int
@@ -931,8 +1089,8 @@ common_init(struct eth_driver *driver, ps_io_ops_t io_ops, void *config, e1000_d
     int err;
     ethif_intel_config_t *eth_config = (ethif_intel_config_t*) config;
     dev->iobase = eth_config->bar0;
-    dev->tx_size = CONFIG_LIB_ETHDRIVER_RX_DESC_COUNT;
-    dev->rx_size = CONFIG_LIB_ETHDRIVER_TX_DESC_COUNT;
+    dev->tx_size = CONFIG_LIB_ETHDRIVER_TX_DESC_COUNT;
+    dev->rx_size = CONFIG_LIB_ETHDRIVER_RX_DESC_COUNT;
 
     /* technically we support alignemtn of 1, but get better performance with some alignment */
     driver->dma_alignment = 16;
@@ -964,7 +1122,7 @@ common_init(struct eth_driver *driver, ps_io_ops_t io_ops, void *config, e1000_d
 
 int
 ethif_e82580_init(struct eth_driver *driver, ps_io_ops_t io_ops, void *config) {
-    e1000_dev_t *dev = malloc(sizeof(*dev));
+    e1000_dev_t *dev = calloc(1, sizeof(*dev));
     if (!dev) {
         LOG_ERROR("Failed to malloc");
         return -1;
@@ -976,7 +1134,7 @@ ethif_e82580_init(struct eth_driver *driver, ps_io_ops_t io_ops, void *config) {
 
 int
 ethif_e82574_init(struct eth_driver *driver, ps_io_ops_t io_ops, void *config) {
-    e1000_dev_t *dev = malloc(sizeof(*dev));
+    e1000_dev_t *dev = calloc(1, sizeof(*dev));
     if (!dev) {
         LOG_ERROR("Failed to malloc");
         return -1;
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/*
+ * Host benchmark of the timeout queue. For each queue size, every id is
+ * registered with a random timeout, every timeout is then cancelled and
+ * re-registered at a new time (as happens when a client moves a timeout),
+ * and finally the queue is drained in steps with tqueue_update. Timeouts
+ * are checked to fire exactly once and in order. Build and run from the
+ * root of libplatsupport with:
+ *
+ *   cc -O2 -Ibench/host_include -Iinclude -I../libutils/include \
+ *       -I../libutils/arch_include/x86 -o tqueue_bench bench/tqueue_bench.c \
+ *       src/tqueue.c ../libutils/src/zf_log.c
+ *   ./tqueue_bench [size ...]
+ *
+ * bench/host_include holds the build configuration used on the host.
+ */
+
+#include <platsupport/tqueue.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static uint64_t last_fired;
+static unsigned int num_fired;
+static int out_of_order;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int host_calloc(void *cookie, size_t nmemb, size_t size, void **ptr)
+{
+    *ptr = calloc(nmemb, size);
+    return *ptr == NULL ? ENOMEM : 0;
+}
+
+static int host_free(void *cookie, size_t size, void *ptr)
+{
+    free(ptr);
+    return 0;
+}
+
+/* the token is the absolute time of the timeout */
+static int fired(uintptr_t token)
+{
+    if (token < last_fired) {
+        out_of_order++;
+    }
+    last_fired = token;
+    num_fired++;
+    return 0;
+}
+
+static int bench(int size)
+{
+    ps_malloc_ops_t mops = { .calloc = host_calloc, .free = host_free };
+    tqueue_t tq;
+    int error = tqueue_init_static(&tq, &mops, size);
+    if (error) {
+        fprintf(stderr, "failed to init tqueue of size %d\n", size);
+        return -1;
+    }
+
+    uint64_t range = (uint64_t) size * 1000;
+    timeout_t timeout = { .period = 0, .callback = fired };
+
+    for (int i = 0; i < size; i++) {
+        error |= tqueue_alloc_id_at(&tq, i);
+    }
+
+    double start = now();
+    for (int i = 0; i < size; i++) {
+        timeout.abs_time = 1 + (uint64_t) rand() % range;
+        timeout.token = timeout.abs_time;
+        error |= tqueue_register(&tq, i, &timeout);
+    }
+    double registering = now() - start;
+
+    start = now();
+    for (int i = 0; i < size; i++) {
+        timeout.abs_time = 1 + (uint64_t) rand() % range;
+        timeout.token = timeout.abs_time;
+        error |= tqueue_cancel(&tq, i);
+        error |= tqueue_register(&tq, i, &timeout);
+    }
+    double moving = now() - start;
+
+    last_fired = 0;
+    num_fired = 0;
+    out_of_order = 0;
+    start = now();
+    uint64_t next = 0;
+    for (uint64_t time = 0; time <= range; time += range / 100) {
+        error |= tqueue_update(&tq, time, &next);
+    }
+    double draining = now() - start;
+
+    printf("%d timeouts\n", size);
+    printf("  register           %10.6f s\n", registering);
+    printf("  cancel + register  %10.6f s\n", moving);
+    printf("  update             %10.6f s\n", draining);
+
+    if (error || next != 0 || num_fired != (unsigned int) size || out_of_order) {
+        fprintf(stderr, "%d timeouts: error %d, %u fired, %d out of order\n",
+                size, error, num_fired, out_of_order);
+        return -1;
+    }
+    free(tq.array);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const int default_sizes[] = { 1000, 10000, 100000 };
+    int ret = 0;
+
+    srand(1);
+    if (argc < 2) {
+        for (size_t i = 0; i < sizeof(default_sizes) / sizeof(default_sizes[0]); i++) {
+            if (bench(default_sizes[i]) != 0) {
+                ret = 1;
+            }
+        }
+        return ret;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (bench(atoi(argv[i])) != 0) {
+            ret = 1;
+        }
+    }
+    return ret;
+}
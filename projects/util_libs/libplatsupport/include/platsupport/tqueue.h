@@ -37,13 +37,16 @@ struct tqueue_node {
     bool allocated;
     /* is this timeout in the callback queue? */
     bool active;
-    /* next ptr for queue */
+    /* pairing heap links: first child, next sibling, and the previous
+     * sibling (or the parent, for a first child) */
+    struct tqueue_node *child;
     struct tqueue_node *next;
+    struct tqueue_node *prev;
 };
 typedef struct tqueue_node tqueue_node_t;
 
 typedef struct {
-    /* head of ordered list of timeouts */
+    /* root of a pairing heap of timeouts ordered by abs_time */
     tqueue_node_t *queue;
     /* id indexed array of timeouts */
     tqueue_node_t *array;
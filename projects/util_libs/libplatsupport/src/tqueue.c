@@ -10,32 +10,93 @@
  * @TAG(DATA61_BSD)
  */
 
-#include <utils/sglib.h>
 #include <platsupport/tqueue.h>
 
-static int cmp(uint64_t a, uint64_t b)
+/*
+ * Timeouts are kept in a pairing heap, which gives O(1) insertion, and
+ * O(log n) amortised removal of the earliest or any other timeout. This keeps
+ * registering, cancelling and re-arming periodic timeouts cheap with a large
+ * number of outstanding timeouts.
+ */
+
+/* Link two heap roots, returning the new root */
+static tqueue_node_t *meld(tqueue_node_t *a, tqueue_node_t *b)
 {
-     if (a > b) {
-         return 1;
-     } else if (a < b) {
-         return -1;
-     } else {
-         return 0;
-     }
+    if (a == NULL) {
+        return b;
+    }
+    if (b == NULL) {
+        return a;
+    }
+    if (b->timeout.abs_time < a->timeout.abs_time) {
+        tqueue_node_t *tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    /* b becomes the first child of a */
+    b->prev = a;
+    b->next = a->child;
+    if (a->child != NULL) {
+        a->child->prev = b;
+    }
+    a->child = b;
+    return a;
 }
 
-#define TIMEOUT_CMP(t1, t2) (cmp(t1->timeout.abs_time, t2->timeout.abs_time))
+/* Combine a list of sibling heaps into one with the standard two pass merge */
+static tqueue_node_t *merge_pairs(tqueue_node_t *first)
+{
+    /* meld pairs from left to right, collecting the results in reverse */
+    tqueue_node_t *pairs = NULL;
+    while (first != NULL) {
+        tqueue_node_t *a = first;
+        tqueue_node_t *b = a->next;
+        first = b ? b->next : NULL;
+
+        a->next = a->prev = NULL;
+        if (b != NULL) {
+            b->next = b->prev = NULL;
+        }
+        tqueue_node_t *pair = meld(a, b);
+        pair->next = pairs;
+        pairs = pair;
+    }
+
+    /* then meld the results from right to left */
+    tqueue_node_t *root = NULL;
+    while (pairs != NULL) {
+        tqueue_node_t *pair = pairs;
+        pairs = pair->next;
+        pair->next = NULL;
+        root = meld(root, pair);
+    }
+    return root;
+}
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-variable"
-SGLIB_DEFINE_SORTED_LIST_PROTOTYPES(tqueue_node_t, TIMEOUT_CMP, next)
-SGLIB_DEFINE_SORTED_LIST_FUNCTIONS(tqueue_node_t, TIMEOUT_CMP, next)
-#pragma GCC diagnostic pop
+static void heap_add(tqueue_t *tq, tqueue_node_t *node)
+{
+    node->child = node->next = node->prev = NULL;
+    tq->queue = meld(tq->queue, node);
+}
 
-static tqueue_node_t *head(tqueue_node_t *list)
+static void heap_delete(tqueue_t *tq, tqueue_node_t *node)
 {
-    struct sglib_tqueue_node_t_iterator it;
-    return sglib_tqueue_node_t_it_init(&it, list);
+    if (node == tq->queue) {
+        tq->queue = merge_pairs(node->child);
+    } else {
+        /* unlink the subtree rooted at node from its parent or sibling */
+        if (node->prev->child == node) {
+            node->prev->child = node->next;
+        } else {
+            node->prev->next = node->next;
+        }
+        if (node->next != NULL) {
+            node->next->prev = node->prev;
+        }
+        tq->queue = meld(tq->queue, merge_pairs(node->child));
+    }
+    node->child = node->next = node->prev = NULL;
 }
 
 int tqueue_alloc_id(tqueue_t *tq, unsigned int *id)
@@ -88,7 +149,7 @@ int tqueue_free_id(tqueue_t *tq, unsigned int id)
 
     /* remove from queue */
     if (tq->array[id].active) {
-        sglib_tqueue_node_t_delete(&tq->queue, &tq->array[id]);
+        heap_delete(tq, &tq->array[id]);
         tq->array[id].active = false;
     }
 
@@ -109,7 +170,7 @@ int tqueue_register(tqueue_t *tq, unsigned int id, timeout_t *timeout)
 
     /* delete the callback from the queue if its present */
     if (tq->array[id].active) {
-        sglib_tqueue_node_t_delete(&tq->queue, &tq->array[id]);
+        heap_delete(tq, &tq->array[id]);
     }
 
     /* update node */
@@ -117,7 +178,7 @@ int tqueue_register(tqueue_t *tq, unsigned int id, timeout_t *timeout)
     tq->array[id].timeout = *timeout;
 
     /* add to data structure */
-    sglib_tqueue_node_t_add(&tq->queue, &tq->array[id]);
+    heap_add(tq, &tq->array[id]);
     return 0;
 }
 
@@ -135,7 +196,7 @@ int tqueue_cancel(tqueue_t *tq, unsigned int id) {
 
     /* delete the callback from the queue if its present */
     if (tq->array[id].active) {
-        sglib_tqueue_node_t_delete(&tq->queue, &tq->array[id]);
+        heap_delete(tq, &tq->array[id]);
     }
 
     tq->array[id].active = false;
@@ -148,7 +209,7 @@ int tqueue_update(tqueue_t *tq, uint64_t curr_time, uint64_t *next_time) {
     }
 
     /* keep checking the head of this queue */
-    tqueue_node_t *t = head(tq->queue);
+    tqueue_node_t *t = tq->queue;
     while (t != NULL && t->timeout.abs_time <= curr_time) {
         if (t->active) {
             t->timeout.callback(t->timeout.token);
@@ -156,15 +217,15 @@ int tqueue_update(tqueue_t *tq, uint64_t curr_time, uint64_t *next_time) {
 
         /* check if it is active again, as callback may have deactivated the timeout */
         if (t->active) {
-            sglib_tqueue_node_t_delete(&tq->queue, t);
+            heap_delete(tq, t);
             if (t->timeout.period > 0) {
                 t->timeout.abs_time += t->timeout.period;
-                sglib_tqueue_node_t_add(&tq->queue, t);
+                heap_add(tq, t);
             } else {
                 t->active = false;
             }
         }
-        t = head(tq->queue);
+        t = tq->queue;
     }
 
     if (next_time) {
@@ -0,0 +1,22 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/* The parts of libsel4 used by the code under benchmark, for host builds */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef uintptr_t seL4_Word;
+typedef seL4_Word seL4_CPtr;
+
+#define seL4_CapNull 0
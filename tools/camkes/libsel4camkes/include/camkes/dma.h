@@ -30,7 +30,8 @@ int camkes_dma_init(void *dma_pool, size_t dma_pool_sz, size_t page_size,
     NONNULL(1, 4) WARN_UNUSED_RESULT;
 
 /**
- * Allocate memory to be used for DMA.
+ * Allocate memory to be used for DMA. Requests of up to 4K, including their
+ * alignment, are served from size-class slabs and never cross a 4K page.
  *
  * @param size Size in bytes to allocate
  * @param align Alignment constraint in bytes (0 == none)
@@ -132,6 +133,14 @@ typedef struct {
     /* Minimum alignment constraint (succeeded or failed) in bytes. */
     int minimum_alignment;
 
+    /* Number of allocations served by the size-class slabs rather than the
+     * general free list.
+     */
+    uint64_t slab_allocations;
+
+    /* Number of 4K pages currently held by the slabs. */
+    size_t slab_pages;
+
 } camkes_dma_stats_t;
 
 /* Retrieve the above statistics for the current DMA heap. This function is
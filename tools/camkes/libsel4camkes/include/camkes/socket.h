@@ -0,0 +1,153 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+#ifndef _CAMKES_SOCKET_H_
+#define _CAMKES_SOCKET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/util.h>
+
+/* Zero-copy socket transport.
+ *
+ * Besides the `sock_data` dataport used by the socket system calls, a client
+ * may share a `sock_pool` dataport with its network stack server. The pool
+ * starts with a header page laid out as `struct camkes_sock_pool`, followed by
+ * `num_bufs` packet buffers of `buf_size` bytes each. The server fills in
+ * these two fields before the client first touches the pool.
+ *
+ * Buffers are named by their index. All buffers initially belong to the
+ * client. A buffer passed to `sock_send_buf` belongs to the server until the
+ * server pushes its index onto the `returned` ring. A buffer passed to
+ * `sock_recv_buf` is only borrowed for the duration of the call. A blocking
+ * write() with every buffer in flight sets `ready_waiting` and waits for
+ * `sock_ready`, which the server emits when it returns a buffer.
+ *
+ * The server reports sockets becoming readable or writable by pushing
+ * `struct camkes_sock_event`s onto the `ready` ring. The client forgets that
+ * a socket is readable after every read or accept on it, and writable after
+ * every write, so the server posts the event again whenever such a call
+ * leaves the socket readable or writable. If the client has set
+ * `ready_waiting` it also emits the `sock_ready` notification. When the ring
+ * is full the server drops the event and increments `ready_overflows`
+ * instead, and the client then treats every socket it watches as ready.
+ *
+ * `sock_ready` is either connected with seL4Notification, or with
+ * seL4GlobalAsynch sharing its notification with a `sock_timer` Timer
+ * interface connected with seL4TimeServer. Only the latter lets epoll_wait
+ * block until its timeout. Otherwise a timeout is polled against the timer or
+ * `clk_get_time`, if either is connected.
+ *
+ * Each ring has a single producer and a single consumer. The producer writes
+ * the entry, then the tail with release ordering. The consumer reads the tail
+ * with acquire ordering, then the entry, then writes the head.
+ */
+
+#define CAMKES_SOCK_RING_SIZE 256
+#define CAMKES_SOCK_POOL_HEADER_SIZE 4096
+
+struct camkes_sock_event {
+    int32_t sockfd;
+    /* EPOLLIN, EPOLLOUT, EPOLLERR and EPOLLHUP bits */
+    uint32_t events;
+};
+
+struct camkes_sock_pool {
+    /* Written by the server during initialisation. num_bufs may not exceed
+     * CAMKES_SOCK_RING_SIZE */
+    uint32_t num_bufs;
+    uint32_t buf_size;
+    uint32_t padding0[14];
+
+    /* Indices of buffers given back by the server */
+    uint32_t returned_tail;
+    uint32_t padding1[15];
+    uint32_t returned_head;
+    uint32_t padding2[15];
+    uint32_t returned[CAMKES_SOCK_RING_SIZE];
+
+    /* Readiness changes reported by the server */
+    uint32_t ready_tail;
+    uint32_t ready_overflows;
+    uint32_t padding3[14];
+    uint32_t ready_head;
+    uint32_t ready_waiting;
+    uint32_t padding4[14];
+    struct camkes_sock_event ready[CAMKES_SOCK_RING_SIZE];
+};
+
+compile_time_assert(camkes_sock_pool_header_fits,
+                    sizeof(struct camkes_sock_pool) <= CAMKES_SOCK_POOL_HEADER_SIZE);
+
+static inline void *camkes_sock_pool_buf(struct camkes_sock_pool *pool, unsigned int index)
+{
+    return (char*)pool + CAMKES_SOCK_POOL_HEADER_SIZE + (size_t)index * pool->buf_size;
+}
+
+/* Server side: hand a buffer back to the client once it is no longer needed.
+ * Returns non-zero if the client is waiting and the `sock_ready` notification
+ * must be emitted */
+static inline int camkes_sock_pool_return(struct camkes_sock_pool *pool, uint32_t index)
+{
+    uint32_t tail = pool->returned_tail;
+    /* The ring holds every buffer, so it never fills */
+    pool->returned[tail % CAMKES_SOCK_RING_SIZE] = index;
+    __atomic_store_n(&pool->returned_tail, tail + 1, __ATOMIC_RELEASE);
+    /* Pairs with the fence in the client between setting ready_waiting and
+     * checking the ring one last time */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&pool->ready_waiting, __ATOMIC_RELAXED);
+}
+
+/* Server side: report a change in the readiness of a socket. Returns non-zero
+ * if the client is waiting and the `sock_ready` notification must be emitted */
+static inline int camkes_sock_pool_post(struct camkes_sock_pool *pool, int sockfd, uint32_t events)
+{
+    uint32_t tail = pool->ready_tail;
+    if (tail - __atomic_load_n(&pool->ready_head, __ATOMIC_ACQUIRE) == CAMKES_SOCK_RING_SIZE) {
+        __atomic_store_n(&pool->ready_overflows, pool->ready_overflows + 1, __ATOMIC_RELEASE);
+    } else {
+        pool->ready[tail % CAMKES_SOCK_RING_SIZE] = (struct camkes_sock_event) {
+            .sockfd = sockfd,
+            .events = events,
+        };
+        __atomic_store_n(&pool->ready_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    /* Pairs with the fence in the client between setting ready_waiting and
+     * checking the ring one last time */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&pool->ready_waiting, __ATOMIC_RELAXED);
+}
+
+/* Client side: take a free buffer from the pool. Returns NULL if the pool is
+ * not connected or every buffer is currently held by the server. The size of
+ * the buffer is stored in `size` if it is not NULL. */
+void *camkes_sock_buf_alloc(size_t *size);
+
+/* Client side: give a buffer obtained from camkes_sock_buf_alloc or
+ * camkes_sock_recv_buf back to the pool */
+void camkes_sock_buf_free(void *buf);
+
+/* Client side: send `len` bytes from a pool buffer on socket `fd` without
+ * copying them. On success the buffer belongs to the server and must not be
+ * touched or freed. On failure it still belongs to the caller. Returns the
+ * number of bytes sent or a negative errno. */
+ssize_t camkes_sock_send_buf(int fd, void *buf, size_t len);
+
+/* Client side: receive data from socket `fd` into a fresh pool buffer, which
+ * is returned in `buf` and must be released with camkes_sock_buf_free. Returns
+ * the number of bytes received or a negative errno, in which case no buffer is
+ * returned. */
+ssize_t camkes_sock_recv_buf(int fd, void **buf);
+
+#endif
@@ -42,6 +42,10 @@ long camkes_sys_mincore(va_list ap);
 long camkes_sys_pause(va_list ap);
 long camkes_sys_clock_gettime(va_list ap);
 long camkes_sys__newselect(va_list ap);
+long camkes_sys_epoll_create(va_list ap);
+long camkes_sys_epoll_create1(va_list ap);
+long camkes_sys_epoll_ctl(va_list ap);
+long camkes_sys_epoll_pwait(va_list ap);
 long camkes_sys_sigaction(va_list ap);
 long camkes_sys_rt_sigaction(va_list ap);
 long camkes_sys_uname(va_list ap);
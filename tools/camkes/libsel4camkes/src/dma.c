@@ -141,6 +141,7 @@ static void grow_node(region_t *node, size_t by) {
  * to be a no-op when NDEBUG is defined.
  */
 static void check_consistency(void) {
+#ifndef NDEBUG
     if (head == NULL) {
         /* Empty free list. */
         return;
@@ -196,6 +197,7 @@ static void check_consistency(void) {
                 "two regions overlap in physical address space");
         }
     }
+#endif
 }
 
 #ifdef NDEBUG
@@ -219,6 +221,214 @@ static void check_consistency(void) {
     }
 #endif
 
+/* Size-class slabs. Small allocations, which for network drivers are mostly
+ * the same few buffer sizes allocated and freed at a high rate, are served
+ * from 4K pages taken from the region allocator above and cut into equal
+ * power-of-2 sized objects. Each class keeps a list of its pages that have
+ * free objects, so allocation and free are O(1) and never touch the region
+ * free list. Objects never straddle a page, so they are physically
+ * contiguous and naturally aligned to their size. A page whose objects are
+ * all free is given back to the region allocator unless it is the last one
+ * of its class.
+ */
+#define SLAB_MIN_BITS 6  /* 64 bytes */
+#define SLAB_MAX_BITS PAGE_BITS_4K
+#define SLAB_CLASSES (SLAB_MAX_BITS - SLAB_MIN_BITS + 1)
+#define SLAB_OBJECT_SIZE(class) (1u << ((class) + SLAB_MIN_BITS))
+
+/* Upper bound on the number of pages used for slabs */
+#define SLAB_MAX_PAGES 4096
+
+typedef struct {
+    /* Free objects in this page, linked through their first word. */
+    void *free;
+
+    /* Physical address and frame cap of the page, looked up on first use. */
+    uintptr_t paddr;
+    seL4_CPtr cptr;
+
+    /* Number of objects handed out. */
+    uint16_t in_use;
+
+    /* Size class of the page. */
+    uint8_t class;
+
+    /* Links in the list of pages with free objects of the same class, or in
+     * the list of unused slab descriptors. -1 terminates a list.
+     */
+    int16_t prev;
+    int16_t next;
+} slab_t;
+
+static slab_t *slabs;
+static int16_t free_slabs = -1;
+static int16_t partial_slabs[SLAB_CLASSES];
+
+/* For each 4K page of the DMA pool, the index of the slab using it plus one,
+ * or 0 if the page belongs to the region allocator.
+ */
+static uint16_t *slab_index;
+static uintptr_t pool_base;
+static size_t pool_pages;
+
+static void slab_list_push(int16_t *list, int16_t i) {
+    slabs[i].prev = -1;
+    slabs[i].next = *list;
+    if (*list != -1) {
+        slabs[*list].prev = i;
+    }
+    *list = i;
+}
+static void slab_list_remove(int16_t *list, int16_t i) {
+    if (slabs[i].prev == -1) {
+        *list = slabs[i].next;
+    } else {
+        slabs[slabs[i].prev].next = slabs[i].next;
+    }
+    if (slabs[i].next != -1) {
+        slabs[slabs[i].next].prev = slabs[i].prev;
+    }
+}
+
+/* Return the slab backing 'ptr', or NULL if it is not a slab object. */
+static slab_t *slab_of(void *ptr) {
+    if (slab_index == NULL || (uintptr_t)ptr < pool_base) {
+        return NULL;
+    }
+    size_t page = ((uintptr_t)ptr - pool_base) >> PAGE_BITS_4K;
+    if (page >= pool_pages || slab_index[page] == 0) {
+        return NULL;
+    }
+    return &slabs[slab_index[page] - 1];
+}
+
+static void *slab_page(void *ptr) {
+    return (void*)ROUND_DOWN((uintptr_t)ptr, PAGE_SIZE_4K);
+}
+
+/* Return the class that can satisfy this request, or -1 if it is too large
+ * for the slabs.
+ */
+static int slab_class(size_t size, int align) {
+    if (slab_index == NULL) {
+        return -1;
+    }
+    size_t need = MAX(size, (size_t)align);
+    if (need > SLAB_OBJECT_SIZE(SLAB_CLASSES - 1)) {
+        return -1;
+    }
+    int class = 0;
+    while (SLAB_OBJECT_SIZE(class) < need) {
+        class++;
+    }
+    return class;
+}
+
+static void *region_alloc(size_t size, int align);
+static void region_free(void *ptr, size_t size);
+
+/* Take a page from the region allocator and add it to a class. */
+static int16_t slab_grow(int class) {
+    if (free_slabs == -1) {
+        return -1;
+    }
+    void *page = region_alloc(PAGE_SIZE_4K, PAGE_SIZE_4K);
+    if (page == NULL) {
+        return -1;
+    }
+    int16_t i = free_slabs;
+    free_slabs = slabs[i].next;
+
+    slab_t *slab = &slabs[i];
+    slab->free = NULL;
+    slab->paddr = 0;
+    slab->cptr = seL4_CapNull;
+    slab->in_use = 0;
+    slab->class = class;
+    size_t object_size = SLAB_OBJECT_SIZE(class);
+    for (size_t offset = PAGE_SIZE_4K; offset > 0; offset -= object_size) {
+        void **object = (void **)((char *)page + offset - object_size);
+        *object = slab->free;
+        slab->free = object;
+    }
+    slab_index[((uintptr_t)page - pool_base) >> PAGE_BITS_4K] = i + 1;
+    slab_list_push(&partial_slabs[class], i);
+    STATS(stats.slab_pages++);
+    return i;
+}
+
+static void *slab_alloc(int class) {
+    int16_t i = partial_slabs[class];
+    if (i == -1) {
+        i = slab_grow(class);
+        if (i == -1) {
+            return NULL;
+        }
+    }
+    slab_t *slab = &slabs[i];
+    void **object = slab->free;
+    slab->free = *object;
+    slab->in_use++;
+    if (slab->free == NULL) {
+        /* The page is now full. */
+        slab_list_remove(&partial_slabs[class], i);
+    }
+    return object;
+}
+
+static void slab_free(slab_t *slab, void *ptr) {
+    int16_t i = slab - slabs;
+    void **object = ptr;
+    if (slab->free == NULL) {
+        /* The page was full and now has a free object again. */
+        slab_list_push(&partial_slabs[slab->class], i);
+    }
+    *object = slab->free;
+    slab->free = object;
+    slab->in_use--;
+    if (slab->in_use == 0 && (slab->prev != -1 || slab->next != -1)) {
+        /* Every object in this page is free and the class has other pages to
+         * allocate from, so let the region allocator have it back.
+         */
+        void *page = slab_page(ptr);
+        slab_list_remove(&partial_slabs[slab->class], i);
+        slab_index[((uintptr_t)page - pool_base) >> PAGE_BITS_4K] = 0;
+        slab->next = free_slabs;
+        free_slabs = i;
+        STATS(stats.slab_pages--);
+        region_free(page, PAGE_SIZE_4K);
+    }
+}
+
+/* Set up the slab bookkeeping for a pool. If this fails all allocations are
+ * served by the region allocator.
+ */
+static void slab_init(void *dma_pool, size_t dma_pool_sz) {
+    for (int class = 0; class < SLAB_CLASSES; class++) {
+        partial_slabs[class] = -1;
+    }
+    if ((uintptr_t)dma_pool % PAGE_SIZE_4K != 0 || dma_pool_sz < PAGE_SIZE_4K) {
+        return;
+    }
+    size_t pages = dma_pool_sz >> PAGE_BITS_4K;
+    size_t num_slabs = MIN(pages, SLAB_MAX_PAGES);
+    slabs = malloc(sizeof(*slabs) * num_slabs);
+    slab_index = calloc(pages, sizeof(*slab_index));
+    if (slabs == NULL || slab_index == NULL) {
+        free(slabs);
+        free(slab_index);
+        slabs = NULL;
+        slab_index = NULL;
+        return;
+    }
+    for (int16_t i = num_slabs - 1; i >= 0; i--) {
+        slabs[i].next = free_slabs;
+        free_slabs = i;
+    }
+    pool_base = (uintptr_t)dma_pool;
+    pool_pages = pages;
+}
+
 /* Defragment the free list. Can safely be called at any time. The complexity
  * of this function is at least O(n²).
  *
@@ -422,16 +632,35 @@ int camkes_dma_init(void *dma_pool, size_t dma_pool_sz, size_t page_size,
 
     check_consistency();
 
+    slab_init(dma_pool, dma_pool_sz);
+
     return 0;
 }
 
 uintptr_t camkes_dma_get_paddr(void *ptr) {
     assert(to_paddr != NULL);
+    slab_t *slab = slab_of(ptr);
+    if (slab != NULL) {
+        /* Translate through the slab's cached address rather than the
+         * generated lookup, which scans the frames of the pool.
+         */
+        if (slab->paddr == 0) {
+            slab->paddr = to_paddr(slab_page(ptr));
+        }
+        return slab->paddr + ((uintptr_t)ptr & MASK(PAGE_BITS_4K));
+    }
     return to_paddr(ptr);
 }
 
 seL4_CPtr camkes_dma_get_cptr(void *ptr) {
     assert(to_cptr != NULL);
+    slab_t *slab = slab_of(ptr);
+    if (slab != NULL) {
+        if (slab->cptr == seL4_CapNull) {
+            slab->cptr = to_cptr(slab_page(ptr));
+        }
+        return slab->cptr;
+    }
     return to_cptr(ptr);
 }
 
@@ -538,28 +767,13 @@ static void *alloc(size_t size, int align) {
     return NULL;
 }
 
-void *camkes_dma_alloc(size_t size, int align) {
-
-    STATS(({
-        stats.total_allocations++;
-        if (size < stats.minimum_allocation) {
-            stats.minimum_allocation = size;
-        }
-        if (size > stats.maximum_allocation) {
-            stats.maximum_allocation = size;
-        }
-        if (align < stats.minimum_alignment) {
-            stats.minimum_alignment = align;
-        }
-        if (align > stats.maximum_alignment) {
-            stats.maximum_alignment = align;
-        }
-        total_allocation_bytes += size;
-    }));
+/* Allocate from the region free list, trying again after defragmenting it if
+ * necessary.
+ */
+static void *region_alloc(size_t size, int align) {
 
     if (head == NULL) {
         /* Nothing in the free list. */
-        STATS(stats.failed_allocations_out_of_memory++);
         return NULL;
     }
 
@@ -609,8 +823,52 @@ void *camkes_dma_alloc(size_t size, int align) {
 
     check_consistency();
 
+    return p;
+}
+
+void *camkes_dma_alloc(size_t size, int align) {
+
+    STATS(({
+        stats.total_allocations++;
+        if (size < stats.minimum_allocation) {
+            stats.minimum_allocation = size;
+        }
+        if (size > stats.maximum_allocation) {
+            stats.maximum_allocation = size;
+        }
+        if (align < stats.minimum_alignment) {
+            stats.minimum_alignment = align;
+        }
+        if (align > stats.maximum_alignment) {
+            stats.maximum_alignment = align;
+        }
+        total_allocation_bytes += size;
+    }));
+
+    void *p = NULL;
+    int class = slab_class(size, align);
+    if (class != -1) {
+        p = slab_alloc(class);
+        if (p != NULL) {
+            STATS(stats.slab_allocations++);
+            size = SLAB_OBJECT_SIZE(class);
+        }
+    }
+
     if (p == NULL) {
-        STATS(stats.failed_allocations_other++);
+        /* Too large for the slabs, or there was no page left to start a new
+         * slab with. In the latter case the region allocator may still be
+         * able to find room.
+         */
+        p = region_alloc(size, align);
+    }
+
+    if (p == NULL) {
+        if (head == NULL) {
+            STATS(stats.failed_allocations_out_of_memory++);
+        } else {
+            STATS(stats.failed_allocations_other++);
+        }
     } else {
         STATS(({
             stats.current_outstanding += size;
@@ -623,12 +881,7 @@ void *camkes_dma_alloc(size_t size, int align) {
     return p;
 }
 
-void camkes_dma_free(void *ptr, size_t size) {
-
-    /* Allow the user to free NULL. */
-    if (ptr == NULL) {
-        return;
-    }
+static void region_free(void *ptr, size_t size) {
 
     /* If the user allocated a region that was too small, we would have rounded
      * up the size during allocation.
@@ -649,6 +902,29 @@ void camkes_dma_free(void *ptr, size_t size) {
      */
     assert((uintptr_t)ptr % alignof(region_t) == 0);
 
+    region_t *p = ptr;
+    p->paddr_upper = 0;
+    p->size = size;
+    prepend_node(p);
+
+    check_consistency();
+}
+
+void camkes_dma_free(void *ptr, size_t size) {
+
+    /* Allow the user to free NULL. */
+    if (ptr == NULL) {
+        return;
+    }
+
+    /* The size of a slab object is that of its class, which the caller may
+     * not know if it asked for a stricter alignment than its size.
+     */
+    slab_t *slab = slab_of(ptr);
+    if (slab != NULL) {
+        size = SLAB_OBJECT_SIZE(slab->class);
+    }
+
     STATS(({
             if (size >= stats.current_outstanding) {
                 stats.current_outstanding = 0;
@@ -657,12 +933,11 @@ void camkes_dma_free(void *ptr, size_t size) {
             }
         }));
 
-    region_t *p = ptr;
-    p->paddr_upper = 0;
-    p->size = size;
-    prepend_node(p);
-
-    check_consistency();
+    if (slab != NULL) {
+        slab_free(slab, ptr);
+    } else {
+        region_free(ptr, size);
+    }
 }
 
 /* The remaining functions are to comply with the ps_io_ops-related interface
@@ -0,0 +1,263 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/* Client side of the zero-copy socket transport described in camkes/socket.h */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sel4/sel4.h>
+#include <camkes/socket.h>
+#include <muslcsys/io.h>
+#include <utils/util.h>
+
+#include "sys_io.h"
+
+int sock_send_buf(int sockfd, int index, int len) __attribute__((weak));
+int sock_recv_buf(int sockfd, int index, int size) __attribute__((weak));
+int sock_fcntl(int sockfd, int cmd, int val) __attribute__((weak));
+void sock_ready_wait(void) __attribute__((weak));
+seL4_CPtr sock_ready_notification(void) __attribute__((weak));
+
+/* Stack of the buffers held by the client that are not in use. This is
+ * set up from the pool header the first time the pool is used */
+static uint32_t free_bufs[CAMKES_SOCK_RING_SIZE];
+static int num_free_bufs = -1;
+
+static struct camkes_sock_pool *get_pool(void)
+{
+    if (!sock_pool) {
+        return NULL;
+    }
+    struct camkes_sock_pool *pool = sock_pool;
+    if (num_free_bufs == -1) {
+        if (pool->num_bufs == 0 || pool->num_bufs > CAMKES_SOCK_RING_SIZE || pool->buf_size == 0) {
+            ZF_LOGE("Socket buffer pool is not initialised (%u buffers)", pool->num_bufs);
+            return NULL;
+        }
+        for (int i = 0; i < pool->num_bufs; i++) {
+            free_bufs[i] = i;
+        }
+        num_free_bufs = pool->num_bufs;
+    }
+    return pool;
+}
+
+/* Take back the buffers the server is done with */
+static void collect_returned(struct camkes_sock_pool *pool)
+{
+    uint32_t head = pool->returned_head;
+    uint32_t tail = __atomic_load_n(&pool->returned_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        uint32_t index = pool->returned[head % CAMKES_SOCK_RING_SIZE];
+        if (index < pool->num_bufs && num_free_bufs < pool->num_bufs) {
+            free_bufs[num_free_bufs++] = index;
+        } else {
+            ZF_LOGE("Server returned invalid socket buffer %u", index);
+        }
+        head++;
+    }
+    __atomic_store_n(&pool->returned_head, head, __ATOMIC_RELEASE);
+}
+
+static int returned_empty(struct camkes_sock_pool *pool)
+{
+    return __atomic_load_n(&pool->returned_tail, __ATOMIC_ACQUIRE) == pool->returned_head;
+}
+
+/* Block until the server gives back a buffer */
+static void wait_for_returned(struct camkes_sock_pool *pool)
+{
+    __atomic_store_n(&pool->ready_waiting, 1, __ATOMIC_RELAXED);
+    /* Pairs with the fence in camkes_sock_pool_return, so that either we see
+     * the buffer or the server sees that we are waiting */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (returned_empty(pool)) {
+        camkes_sock_ready_wait();
+    }
+    __atomic_store_n(&pool->ready_waiting, 0, __ATOMIC_RELAXED);
+}
+
+static int nonblocking(int sockfd)
+{
+    if (!sock_fcntl) {
+        return 0;
+    }
+    int flags = sock_fcntl(sockfd, F_GETFL, 0);
+    return flags >= 0 && (flags & O_NONBLOCK);
+}
+
+static int buf_index(struct camkes_sock_pool *pool, void *buf)
+{
+    uintptr_t base = (uintptr_t)camkes_sock_pool_buf(pool, 0);
+    uintptr_t offset = (uintptr_t)buf - base;
+    if ((uintptr_t)buf < base || offset % pool->buf_size != 0 ||
+        offset / pool->buf_size >= pool->num_bufs) {
+        return -1;
+    }
+    return offset / pool->buf_size;
+}
+
+void camkes_sock_ready_wait(void)
+{
+    if (sock_ready_wait) {
+        sock_ready_wait();
+    } else if (sock_ready_notification) {
+        seL4_Wait(sock_ready_notification(), NULL);
+    } else {
+        /* the server has no way to wake us, all we can do is poll */
+        seL4_Yield();
+    }
+}
+
+int camkes_sockfd(int fd)
+{
+    if (!valid_fd(fd)) {
+        return -EBADF;
+    }
+    muslcsys_fd_t *fdt = get_fd_struct(fd);
+    if (fdt->filetype != FILE_TYPE_SOCKET) {
+        return -EBADF;
+    }
+    return *(int*)fdt->data;
+}
+
+void *camkes_sock_buf_alloc(size_t *size)
+{
+    struct camkes_sock_pool *pool = get_pool();
+    if (!pool) {
+        return NULL;
+    }
+    if (num_free_bufs == 0) {
+        collect_returned(pool);
+        if (num_free_bufs == 0) {
+            return NULL;
+        }
+    }
+    num_free_bufs--;
+    if (size) {
+        *size = pool->buf_size;
+    }
+    return camkes_sock_pool_buf(pool, free_bufs[num_free_bufs]);
+}
+
+void camkes_sock_buf_free(void *buf)
+{
+    struct camkes_sock_pool *pool = get_pool();
+    if (!pool || !buf) {
+        return;
+    }
+    int index = buf_index(pool, buf);
+    if (index < 0 || num_free_bufs >= pool->num_bufs) {
+        ZF_LOGE("Freeing %p which is not a socket buffer", buf);
+        return;
+    }
+    free_bufs[num_free_bufs++] = index;
+}
+
+ssize_t camkes_sock_send_buf(int fd, void *buf, size_t len)
+{
+    struct camkes_sock_pool *pool = get_pool();
+    if (!pool || !sock_send_buf) {
+        return -ENOSYS;
+    }
+    int sockfd = camkes_sockfd(fd);
+    if (sockfd < 0) {
+        return sockfd;
+    }
+    int index = buf_index(pool, buf);
+    if (index < 0 || len > pool->buf_size) {
+        return -EINVAL;
+    }
+    int ret = sock_send_buf(sockfd, index, len);
+    camkes_sock_clear_ready(sockfd, EPOLLOUT);
+    return ret;
+}
+
+/* Receive at most 'max' bytes into a fresh buffer */
+static ssize_t recv_buf(int fd, size_t max, void **buf)
+{
+    struct camkes_sock_pool *pool = get_pool();
+    if (!pool || !sock_recv_buf) {
+        return -ENOSYS;
+    }
+    int sockfd = camkes_sockfd(fd);
+    if (sockfd < 0) {
+        return sockfd;
+    }
+    size_t size;
+    void *data = camkes_sock_buf_alloc(&size);
+    if (!data) {
+        return -ENOBUFS;
+    }
+    int ret = sock_recv_buf(sockfd, buf_index(pool, data), MIN(size, max));
+    camkes_sock_clear_ready(sockfd, EPOLLIN);
+    if (ret < 0) {
+        camkes_sock_buf_free(data);
+        return ret;
+    }
+    *buf = data;
+    return ret;
+}
+
+ssize_t camkes_sock_recv_buf(int fd, void **buf)
+{
+    return recv_buf(fd, SIZE_MAX, buf);
+}
+
+long camkes_sock_pool_write(int fd, const void *buf, size_t count)
+{
+    size_t size;
+    struct camkes_sock_pool *pool = get_pool();
+    if (!pool || !sock_send_buf) {
+        return -ENOSYS;
+    }
+    int sockfd = camkes_sockfd(fd);
+    if (sockfd < 0) {
+        return sockfd;
+    }
+    void *data = camkes_sock_buf_alloc(&size);
+    while (!data) {
+        /* every buffer is in flight */
+        if (nonblocking(sockfd)) {
+            return -EAGAIN;
+        }
+        wait_for_returned(pool);
+        data = camkes_sock_buf_alloc(&size);
+    }
+    size = MIN(size, count);
+    memcpy(data, buf, size);
+    long ret = camkes_sock_send_buf(fd, data, size);
+    if (ret < 0) {
+        camkes_sock_buf_free(data);
+    }
+    return ret;
+}
+
+long camkes_sock_pool_read(int fd, void *buf, size_t count)
+{
+    void *data;
+    if (!get_pool() || !sock_recv_buf) {
+        return -ENOSYS;
+    }
+    /* never ask for more than the caller can take, or the rest of a
+     * stream would be lost */
+    long ret = recv_buf(fd, count, &data);
+    if (ret < 0) {
+        return ret;
+    }
+    memcpy(buf, data, ret);
+    camkes_sock_buf_free(data);
+    return ret;
+}
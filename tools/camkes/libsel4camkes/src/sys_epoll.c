@@ -0,0 +1,455 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/* epoll for sockets, fed by the readiness ring in the socket buffer pool.
+ * Rather than asking the server about every descriptor on each wait, the
+ * client accumulates the readiness changes the server posts and only looks
+ * at the sockets that changed. A socket may be registered with one epoll
+ * instance at a time. */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sel4/sel4.h>
+#include <camkes/socket.h>
+#include <muslcsys/io.h>
+#include <utils/time.h>
+#include <utils/util.h>
+
+#include "sys_io.h"
+
+/* Timer used for epoll_wait timeouts, see camkes/socket.h */
+#define SOCK_TIMER_ID 0
+seL4_CPtr sock_ready_notification(void) __attribute__((weak));
+seL4_CPtr sock_timer_notification(void) __attribute__((weak));
+int sock_timer_oneshot_absolute(int tid, uint64_t ns) __attribute__((weak));
+int sock_timer_stop(int tid) __attribute__((weak));
+uint64_t sock_timer_time(void) __attribute__((weak));
+int clk_get_time(void) __attribute__((weak));
+
+typedef struct epoll_instance {
+    /* list of sockets that may have events to report, linked through
+     * watch_t.next. -1 when empty */
+    int head;
+    int tail;
+    int count;
+} epoll_instance_t;
+
+/* What we know about a socket, indexed by the server's socket descriptor */
+typedef struct watch {
+    epoll_instance_t *ep;
+    int fd;
+    uint32_t events;
+    epoll_data_t data;
+    /* readiness reported by the server and not yet consumed */
+    uint32_t pending;
+    /* a one-shot registration that has fired and not been re-armed with
+     * EPOLL_CTL_MOD, which reports nothing at all */
+    int disarmed;
+    int queued;
+    int next;
+} watch_t;
+
+static watch_t *watches;
+static int num_watches;
+static uint32_t overflows_seen;
+
+static watch_t *get_watch(int sockfd)
+{
+    if (sockfd < 0) {
+        return NULL;
+    }
+    if (sockfd >= num_watches) {
+        int new_num = MAX(sockfd + 1, num_watches * 2);
+        watch_t *new_watches = realloc(watches, sizeof(*watches) * new_num);
+        if (!new_watches) {
+            ZF_LOGE("Failed to grow epoll watch table");
+            return NULL;
+        }
+        memset(new_watches + num_watches, 0, sizeof(*watches) * (new_num - num_watches));
+        watches = new_watches;
+        num_watches = new_num;
+    }
+    return &watches[sockfd];
+}
+
+/* Events that would be reported for a socket, errors and hangups are reported
+ * whether or not they were asked for */
+static uint32_t reportable(watch_t *w)
+{
+    if (w->disarmed) {
+        return 0;
+    }
+    return w->pending & (w->events | EPOLLERR | EPOLLHUP);
+}
+
+static void queue_if_ready(int sockfd)
+{
+    watch_t *w = &watches[sockfd];
+    epoll_instance_t *ep = w->ep;
+    if (!ep || w->queued || !reportable(w)) {
+        return;
+    }
+    w->queued = 1;
+    w->next = -1;
+    if (ep->tail == -1) {
+        ep->head = sockfd;
+    } else {
+        watches[ep->tail].next = sockfd;
+    }
+    ep->tail = sockfd;
+    ep->count++;
+}
+
+static int dequeue(epoll_instance_t *ep)
+{
+    int sockfd = ep->head;
+    ep->head = watches[sockfd].next;
+    if (ep->head == -1) {
+        ep->tail = -1;
+    }
+    ep->count--;
+    watches[sockfd].queued = 0;
+    return sockfd;
+}
+
+static void unqueue(epoll_instance_t *ep, int sockfd)
+{
+    int prev = -1;
+    for (int i = ep->head; i != -1; prev = i, i = watches[i].next) {
+        if (i != sockfd) {
+            continue;
+        }
+        if (prev == -1) {
+            ep->head = watches[i].next;
+        } else {
+            watches[prev].next = watches[i].next;
+        }
+        if (ep->tail == i) {
+            ep->tail = prev;
+        }
+        ep->count--;
+        watches[i].queued = 0;
+        return;
+    }
+}
+
+static void unwatch(int sockfd)
+{
+    watch_t *w = &watches[sockfd];
+    if (w->ep && w->queued) {
+        unqueue(w->ep, sockfd);
+    }
+    w->ep = NULL;
+    w->events = 0;
+    w->disarmed = 0;
+}
+
+/* Consume the readiness changes the server has posted. Returns non-zero if
+ * there were any */
+static int drain_ready_ring(struct camkes_sock_pool *pool)
+{
+    uint32_t head = pool->ready_head;
+    uint32_t tail = __atomic_load_n(&pool->ready_tail, __ATOMIC_ACQUIRE);
+    uint32_t overflows = __atomic_load_n(&pool->ready_overflows, __ATOMIC_ACQUIRE);
+    int changed = head != tail;
+    while (head != tail) {
+        struct camkes_sock_event event = pool->ready[head % CAMKES_SOCK_RING_SIZE];
+        watch_t *w = get_watch(event.sockfd);
+        if (w) {
+            w->pending |= event.events;
+            queue_if_ready(event.sockfd);
+        }
+        head++;
+    }
+    __atomic_store_n(&pool->ready_head, head, __ATOMIC_RELEASE);
+    if (overflows != overflows_seen) {
+        /* Events were dropped, so we no longer know which sockets are ready.
+         * Report everything that is watched and let the operations that
+         * would block clear it again */
+        overflows_seen = overflows;
+        for (int i = 0; i < num_watches; i++) {
+            if (watches[i].ep) {
+                watches[i].pending |= watches[i].events & (EPOLLIN | EPOLLOUT);
+                queue_if_ready(i);
+            }
+        }
+        changed = 1;
+    }
+    return changed;
+}
+
+static int ring_empty(struct camkes_sock_pool *pool)
+{
+    return __atomic_load_n(&pool->ready_tail, __ATOMIC_ACQUIRE) == pool->ready_head &&
+           __atomic_load_n(&pool->ready_overflows, __ATOMIC_ACQUIRE) == overflows_seen;
+}
+
+/* sock_ready and sock_timer signal the same notification, so we can block
+ * until either an event or a deadline */
+static int have_timer(void)
+{
+    return sock_timer_oneshot_absolute && sock_timer_stop && sock_timer_time &&
+           sock_timer_notification && sock_ready_notification &&
+           sock_timer_notification() == sock_ready_notification();
+}
+
+static int have_clock(void)
+{
+    return sock_timer_time || clk_get_time;
+}
+
+/* in nanoseconds */
+static uint64_t time_now(void)
+{
+    if (sock_timer_time) {
+        return sock_timer_time();
+    }
+    return (uint64_t)clk_get_time() * NS_IN_MS;
+}
+
+/* Wait for the server to post something. If timed, wake up by the deadline,
+ * or give up the processor for a while if nothing can wake us by then */
+static void wait_for_events(struct camkes_sock_pool *pool, int timed, uint64_t deadline)
+{
+    __atomic_store_n(&pool->ready_waiting, 1, __ATOMIC_RELAXED);
+    /* Pairs with the fence in camkes_sock_pool_post, so that either we see
+     * the new event or the server sees that we are waiting */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!timed) {
+        if (ring_empty(pool)) {
+            camkes_sock_ready_wait();
+        }
+    } else if (have_timer() && sock_timer_oneshot_absolute(SOCK_TIMER_ID, deadline) == 0) {
+        if (ring_empty(pool) && time_now() < deadline) {
+            seL4_Wait(sock_timer_notification(), NULL);
+        }
+        sock_timer_stop(SOCK_TIMER_ID);
+    } else if (ring_empty(pool)) {
+        seL4_Yield();
+    }
+    __atomic_store_n(&pool->ready_waiting, 0, __ATOMIC_RELAXED);
+}
+
+static int collect_events(epoll_instance_t *ep, struct epoll_event *events, int maxevents)
+{
+    int n = 0;
+    /* level triggered sockets go back on the end of the list, so only look
+     * at what was there to begin with */
+    for (int budget = ep->count; budget > 0 && n < maxevents; budget--) {
+        int sockfd = dequeue(ep);
+        watch_t *w = &watches[sockfd];
+        uint32_t ready = reportable(w);
+        if (!ready) {
+            continue;
+        }
+        events[n].events = ready;
+        events[n].data = w->data;
+        n++;
+        if (w->events & EPOLLONESHOT) {
+            w->disarmed = 1;
+        } else if (w->events & EPOLLET) {
+            w->pending &= ~ready;
+        } else {
+            queue_if_ready(sockfd);
+        }
+    }
+    return n;
+}
+
+void camkes_sock_clear_ready(int sockfd, uint32_t events)
+{
+    if (sockfd >= 0 && sockfd < num_watches) {
+        watches[sockfd].pending &= ~events;
+    }
+}
+
+void camkes_sock_forget(int sockfd)
+{
+    if (sockfd >= 0 && sockfd < num_watches) {
+        unwatch(sockfd);
+        watches[sockfd].pending = 0;
+    }
+}
+
+void camkes_epoll_close(void *epoll)
+{
+    epoll_instance_t *ep = epoll;
+    for (int i = 0; i < num_watches; i++) {
+        if (watches[i].ep == ep) {
+            unwatch(i);
+        }
+    }
+    free(ep);
+}
+
+static epoll_instance_t *get_epoll(int epfd)
+{
+    if (!valid_fd(epfd)) {
+        return NULL;
+    }
+    muslcsys_fd_t *fdt = get_fd_struct(epfd);
+    if (fdt->filetype != FILE_TYPE_EPOLL) {
+        return NULL;
+    }
+    return fdt->data;
+}
+
+static long create_epoll(void)
+{
+    epoll_instance_t *ep = malloc(sizeof(*ep));
+    if (!ep) {
+        return -ENOMEM;
+    }
+    *ep = (epoll_instance_t) {
+        .head = -1,
+        .tail = -1,
+        .count = 0,
+    };
+    int fd = allocate_fd();
+    if (fd < 0) {
+        free(ep);
+        return fd;
+    }
+    muslcsys_fd_t *fdt = get_fd_struct(fd);
+    fdt->filetype = FILE_TYPE_EPOLL;
+    fdt->data = ep;
+    return fd;
+}
+
+long camkes_sys_epoll_create1(va_list ap)
+{
+    int flags = va_arg(ap, int);
+    if (flags & ~EPOLL_CLOEXEC) {
+        return -EINVAL;
+    }
+    return create_epoll();
+}
+
+long camkes_sys_epoll_create(va_list ap)
+{
+    int size = va_arg(ap, int);
+    if (size <= 0) {
+        return -EINVAL;
+    }
+    return create_epoll();
+}
+
+long camkes_sys_epoll_ctl(va_list ap)
+{
+    int epfd = va_arg(ap, int);
+    int op = va_arg(ap, int);
+    int fd = va_arg(ap, int);
+    struct epoll_event *event = va_arg(ap, struct epoll_event*);
+
+    epoll_instance_t *ep = get_epoll(epfd);
+    if (!ep) {
+        return -EBADF;
+    }
+    int sockfd = camkes_sockfd(fd);
+    if (sockfd < 0) {
+        /* only sockets can be watched */
+        return valid_fd(fd) ? -EPERM : -EBADF;
+    }
+    watch_t *w = get_watch(sockfd);
+    if (!w) {
+        return -ENOMEM;
+    }
+
+    if ((op == EPOLL_CTL_ADD || op == EPOLL_CTL_MOD) && !event) {
+        return -EFAULT;
+    }
+
+    switch (op) {
+    case EPOLL_CTL_ADD:
+        if (w->ep) {
+            return -EEXIST;
+        }
+        w->ep = ep;
+        w->fd = fd;
+        w->events = event->events;
+        w->data = event->data;
+        w->disarmed = 0;
+        queue_if_ready(sockfd);
+        return 0;
+    case EPOLL_CTL_MOD:
+        if (w->ep != ep) {
+            return -ENOENT;
+        }
+        w->events = event->events;
+        w->data = event->data;
+        w->disarmed = 0;
+        queue_if_ready(sockfd);
+        return 0;
+    case EPOLL_CTL_DEL:
+        if (w->ep != ep) {
+            return -ENOENT;
+        }
+        unwatch(sockfd);
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+long camkes_sys_epoll_pwait(va_list ap)
+{
+    int epfd = va_arg(ap, int);
+    struct epoll_event *events = va_arg(ap, struct epoll_event*);
+    int maxevents = va_arg(ap, int);
+    int timeout = va_arg(ap, int);
+    /* There are no signals to mask, so the sigmask argument is ignored */
+
+    epoll_instance_t *ep = get_epoll(epfd);
+    if (!ep) {
+        return -EBADF;
+    }
+    if (maxevents <= 0) {
+        return -EINVAL;
+    }
+    struct camkes_sock_pool *pool = sock_pool;
+    if (!pool) {
+        assert(!"sys_epoll_pwait not implemented");
+        return -ENOSYS;
+    }
+
+    int timed = timeout > 0;
+    uint64_t deadline = 0;
+    if (timed && have_clock()) {
+        deadline = time_now() + timeout * NS_IN_MS;
+    }
+
+    /* Wakeups are shared with returned buffers and stale timer completions,
+     * so keep going until there is something to report or the time is up */
+    while (1) {
+        drain_ready_ring(pool);
+        int n = collect_events(ep, events, maxevents);
+        if (n > 0 || timeout == 0) {
+            return n;
+        }
+        if (timed && !have_clock()) {
+            /* there is no way to tell when the timeout passes, so only look
+             * once more after letting the server run */
+            seL4_Yield();
+            drain_ready_ring(pool);
+            return collect_events(ep, events, maxevents);
+        }
+        if (timed && time_now() >= deadline) {
+            return 0;
+        }
+        wait_for_events(pool, timed, deadline);
+    }
+}
@@ -29,6 +29,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <bits/syscall.h>
 #include <muslcsys/vsyscall.h>
 #include <muslcsys/io.h>
@@ -47,9 +48,16 @@ camkes_sys_close(va_list ap)
     va_list copy;
     va_copy(copy, ap);
     int fd = va_arg(ap, int);
-    if (sock_close && valid_fd(fd)) {
+    if (valid_fd(fd)) {
         muslcsys_fd_t *fds =  get_fd_struct(fd);
-        if (fds->filetype == FILE_TYPE_SOCKET) {
+        if (fds->filetype == FILE_TYPE_EPOLL) {
+            camkes_epoll_close(fds->data);
+            add_free_fd(fd);
+            va_end(copy);
+            return 0;
+        }
+        if (sock_close && fds->filetype == FILE_TYPE_SOCKET) {
+            camkes_sock_forget(*(int*)fds->data);
             sock_close(*(int*)fds->data);
         }
     }
@@ -65,13 +73,22 @@ static long camkes_sys_write(va_list ap)
     void *buf = va_arg(ap, void*);
     size_t count = va_arg(ap, size_t);
 
+    if (camkes_sockfd(fd) >= 0) {
+        long ret = camkes_sock_pool_write(fd, buf, count);
+        if (ret != -ENOSYS) {
+            return ret;
+        }
+    }
+
     if (sock_write && sock_data && valid_fd(fd)) {
         muslcsys_fd_t *fds = get_fd_struct(fd);
         if (fds->filetype == FILE_TYPE_SOCKET) {
             int sockfd = *(int*)fds->data;
             ssize_t size = count > PAGE_SIZE_4K ? PAGE_SIZE_4K : count;
             memcpy((char*)sock_data, buf, size);
-            return sock_write(sockfd, size);
+            int ret = sock_write(sockfd, size);
+            camkes_sock_clear_ready(sockfd, EPOLLOUT);
+            return ret;
         }
     }
     return -ENOSYS;
@@ -85,12 +102,20 @@ static long camkes_sys_read(va_list ap)
     int fd = va_arg(ap, int);
     void *buf = va_arg(ap, void*);
     size_t count = va_arg(ap, size_t);
+    if (camkes_sockfd(fd) >= 0) {
+        long ret = camkes_sock_pool_read(fd, buf, count);
+        if (ret != -ENOSYS) {
+            va_end(copy);
+            return ret;
+        }
+    }
     if (sock_read && sock_data && valid_fd(fd)) {
         muslcsys_fd_t *fds = get_fd_struct(fd);
         if (fds->filetype == FILE_TYPE_SOCKET) {
             int sockfd = *(int*)fds->data;
             int size = count > PAGE_SIZE_4K ? PAGE_SIZE_4K : count;
             int ret = sock_read(sockfd, size);
+            camkes_sock_clear_ready(sockfd, EPOLLIN);
             memcpy(buf, (char*)sock_data, ret);
             return ret;
         }
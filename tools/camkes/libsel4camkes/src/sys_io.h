@@ -13,12 +13,41 @@
 #ifndef __LIBSEL4MUSLCCAMKES_H__
 #define __LIBSEL4MUSLCCAMKES_H__
 
+#include <stddef.h>
+#include <stdint.h>
 #include <utils/page.h>
 #include <camkes/dataport.h>
+#include <camkes/socket.h>
 
 #define FILE_TYPE_SOCKET  1
+#define FILE_TYPE_EPOLL   2
 
 /* CAmkES dataport for socket interface. */
 extern Buf* sock_data __attribute__((weak));
 
+/* CAmkES dataport for the zero-copy packet buffer pool, see camkes/socket.h */
+extern struct camkes_sock_pool *sock_pool __attribute__((weak));
+
+/* Translate a file descriptor into the network stack's socket descriptor,
+ * returns -EBADF if fd is not a socket */
+int camkes_sockfd(int fd);
+
+/* read and write through the buffer pool. Return -ENOSYS if the pool is not
+ * connected, in which case the caller should fall back to sock_data */
+long camkes_sock_pool_write(int fd, const void *buf, size_t count);
+long camkes_sock_pool_read(int fd, void *buf, size_t count);
+
+/* Wait for the server to emit sock_ready. The caller sets ready_waiting in
+ * the pool and checks the ring it is waiting on once more beforehand */
+void camkes_sock_ready_wait(void);
+
+/* Readiness tracking for epoll. A socket is no longer considered ready for
+ * 'events' after an operation that consumes them, until the server reports it
+ * ready again, and is forgotten once closed */
+void camkes_sock_clear_ready(int sockfd, uint32_t events);
+void camkes_sock_forget(int sockfd);
+
+/* Release an epoll instance created by epoll_create */
+void camkes_epoll_close(void *epoll);
+
 #endif
@@ -18,6 +18,7 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <muslcsys/io.h>
 
 #include "sys_io.h"
@@ -129,6 +130,9 @@ long camkes_sys_accept(va_list ap)
 		}
 
 		newsockfd = sock_accept(sockfd);
+		/* The server reports the listening socket again if another
+		 * connection is waiting */
+		camkes_sock_clear_ready(sockfd, EPOLLIN);
 
 		/* -1 is returned when the call fails. */
 		if (newsockfd == -1) {
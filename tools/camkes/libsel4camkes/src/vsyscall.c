@@ -41,6 +41,18 @@ struct {
 #ifdef __NR__newselect
     {__NR__newselect, camkes_sys__newselect},
 #endif
+#ifdef __NR_epoll_create
+    {__NR_epoll_create, camkes_sys_epoll_create},
+#endif
+#ifdef __NR_epoll_create1
+    {__NR_epoll_create1, camkes_sys_epoll_create1},
+#endif
+#ifdef __NR_epoll_ctl
+    {__NR_epoll_ctl, camkes_sys_epoll_ctl},
+#endif
+#ifdef __NR_epoll_pwait
+    {__NR_epoll_pwait, camkes_sys_epoll_pwait},
+#endif
 #ifdef __NR_sigcation
     {__NR_sigaction, camkes_sys_sigaction},
 #endif
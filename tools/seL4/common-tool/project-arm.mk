@@ -16,6 +16,9 @@ ifeq ($(wildcard ${SHELL}),)
 $(error Prerequisite ${SHELL} not found)
 endif
 
+PYTHON_CAPDL_PATH ?= ${PWD}/projects/capdl/python-capdl-tool
+PYTHON ?= python
+
 elfloader: export STAGE_DIR=$(STAGE_BASE)
 elfloader: export BUILD_DIR=$(BUILD_BASE)/$@
 elfloader: export SOURCE_DIR=${TOOLS_ROOT}/elfloader
@@ -40,6 +43,9 @@ elfloader: libcpio common FORCE
 %-image: export STRIP=$(CONFIG_REMOVE_SYMBOLS)
 %-image: export HASH=$(CONFIG_HASH_INSTRUCTIONS)
 %-image: export HASH_SHA=$(CONFIG_HASH_SHA)
+%-image: export COMPRESS=$(CONFIG_COMPRESS_IMAGES)
+%-image: export COMPRESS_TOOL=$(PYTHON_CAPDL_PATH)/capdl/Compress.py
+%-image: export PYTHON:=$(PYTHON)
 %-image: export V
 %-image: % kernel_elf common elfloader FORCE
 	@echo "[GEN_IMAGE] $@-$(ARCH)-$(PLAT)"
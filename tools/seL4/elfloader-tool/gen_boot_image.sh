@@ -152,6 +152,17 @@ if [ "${STRIP}" = "y" ]; then
     ${TOOLPREFIX}strip --strip-all ${TEMP_DIR}/cpio/*
 fi
 
+if [ "${COMPRESS}" = "y" ]; then
+    # Compress the images with the capDL tool. The archive keeps the names.
+    if [ ! -e "${COMPRESS_TOOL}" ]; then
+        echo "Compression tool '${COMPRESS_TOOL}' does not exist."; fail
+    fi
+    for IMAGE in ${TEMP_DIR}/cpio/kernel.elf ${TEMP_DIR}/cpio/$(basename ${USER_IMAGE}); do
+        ${PYTHON:-python} ${COMPRESS_TOOL} ${IMAGE} ${IMAGE}.lz4 || fail
+        mv -f ${IMAGE}.lz4 ${IMAGE}
+    done
+fi
+
 if [ "${HASH}" = "y" ]; then
     if [ "${HASH_SHA}" = "y" ]; then
         # (2 Invocations so the hash gets printed on the terminal)
@@ -12,6 +12,8 @@
 
 #pragma once
 
+#include <types.h>
+
 static inline void wfi(void)
 {
     asm volatile("mcr p15, 0, %0, c7, c0, 4" : : "r"(0) : "memory");
@@ -32,3 +34,18 @@ static inline void isb(void)
     asm volatile("mcr p15, 0, %0, c7, c5, 4" : : "r"(0) : "memory");
 }
 
+/* Start the cycle counter without resetting it */
+static inline void enable_cycle_counter(void)
+{
+    uint32_t val;
+    asm volatile("mrc p15, 0, %0, c15, c12, 0" : "=r"(val));
+    val |= 1;
+    asm volatile("mcr p15, 0, %0, c15, c12, 0" :: "r"(val));
+}
+
+static inline uint64_t read_cycle_counter(void)
+{
+    uint32_t val;
+    asm volatile("mrc p15, 0, %0, c15, c12, 1" : "=r"(val));
+    return val;
+}
@@ -12,6 +12,8 @@
 
 #pragma once
 
+#include <types.h>
+
 static inline void wfi(void)
 {
     asm volatile("wfi" ::: "memory");
@@ -32,3 +34,19 @@ static inline void isb(void)
     asm volatile("isb" ::: "memory");
 }
 
+/* Start the cycle counter without resetting it */
+static inline void enable_cycle_counter(void)
+{
+    uint32_t val;
+    asm volatile("mrc p15, 0, %0, c9, c12, 0" : "=r"(val));
+    val |= 1;
+    asm volatile("mcr p15, 0, %0, c9, c12, 0" :: "r"(val));
+    asm volatile("mcr p15, 0, %0, c9, c12, 1" :: "r"(1u << 31));
+}
+
+static inline uint64_t read_cycle_counter(void)
+{
+    uint32_t val;
+    asm volatile("mrc p15, 0, %0, c9, c13, 0" : "=r"(val));
+    return val;
+}
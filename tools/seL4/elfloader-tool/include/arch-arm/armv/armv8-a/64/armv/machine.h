@@ -12,6 +12,8 @@
 
 #pragma once
 
+#include <types.h>
+
 static inline void wfi(void)
 {
     asm volatile("wfi" ::: "memory");
@@ -39,3 +41,19 @@ static inline void isb(void)
         word_t _v = v;                             \
         asm volatile("msr " reg ",%0" :: "r" (_v));\
     } while(0)
+
+/* Start the cycle counter without resetting it */
+static inline void enable_cycle_counter(void)
+{
+    word_t val;
+    MRS("pmcr_el0", val);
+    MSR("pmcr_el0", val | 1);
+    MSR("pmcntenset_el0", (word_t)1 << 31);
+}
+
+static inline uint64_t read_cycle_counter(void)
+{
+    uint64_t val;
+    MRS("pmccntr_el0", val);
+    return val;
+}
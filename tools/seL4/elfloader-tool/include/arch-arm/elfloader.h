@@ -12,6 +12,7 @@
 #pragma once
 
 #include <elfloader_common.h>
+#include <armv/machine.h>
 
 typedef void (*init_arm_kernel_t)(paddr_t ui_p_reg_start,
                               paddr_t ui_p_reg_end,
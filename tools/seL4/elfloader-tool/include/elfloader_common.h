@@ -12,6 +12,7 @@
 
 #pragma once
 
+#include <autoconf.h>
 #include <types.h>
 
 typedef uintptr_t paddr_t;
@@ -70,3 +71,27 @@ void load_images(struct image_info *kernel_info, struct image_info *user_info,
 void platform_init(void);
 void init_cpus(void);
 
+/*
+ * Boot phase timestamps.
+ *
+ * The cycle counter is sampled at each of these points and the values are
+ * left for the kernel in the frame after the user image's ELF headers. The
+ * phases and the record layout match seL4_ElfloaderPhase and
+ * seL4_BootInfoElfloaderTimestamps in libsel4.
+ */
+enum {
+    ELFLOADER_PHASE_ENTRY,
+    ELFLOADER_PHASE_KERNEL_LOAD,
+    ELFLOADER_PHASE_USER_LOAD,
+    ELFLOADER_PHASE_HANDOFF,
+    ELFLOADER_NUM_PHASES
+};
+
+#ifdef CONFIG_BOOT_TIMESTAMPS
+void elfloader_timestamp(int phase);
+void write_elfloader_timestamps(struct image_info *user_info);
+#else
+static inline void elfloader_timestamp(__attribute__((unused)) int phase) {}
+static inline void write_elfloader_timestamps(__attribute__((unused)) struct image_info *user_info) {}
+#endif
+
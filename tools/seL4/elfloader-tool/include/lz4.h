@@ -0,0 +1,23 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+
+#pragma once
+
+#include <types.h>
+
+/*
+ * Decode a single block in the LZ4 block format into dst.
+ *
+ * Returns the number of bytes produced, or 0 if the block is malformed or
+ * does not fit in dst_len bytes.
+ */
+size_t lz4_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len);
@@ -37,6 +37,11 @@ void main(void)
 {
     int num_apps;
 
+#ifdef CONFIG_BOOT_TIMESTAMPS
+    enable_cycle_counter();
+#endif
+    elfloader_timestamp(ELFLOADER_PHASE_ENTRY);
+
 #ifdef CONFIG_IMAGE_EFI
     if (efi_exit_boot_services() != EFI_SUCCESS) {
         printf("Unable to exit UEFI boot services!\n");
@@ -81,6 +86,11 @@ void main(void)
     smp_boot();
 #endif /* CONFIG_MAX_NUM_NODES */
 
+    /* Once the MMU is on the user image may no longer be mapped, so hand the
+     * timestamps over now */
+    elfloader_timestamp(ELFLOADER_PHASE_HANDOFF);
+    write_elfloader_timestamps(&user_info);
+
     if(is_hyp_mode()){
         printf("Enabling hypervisor MMU and paging\n");
         arm_enable_hyp_mmu();
@@ -18,6 +18,7 @@
 #include <strops.h>
 #include <binaries/elf/elf.h>
 #include <cpio/cpio.h>
+#include <lz4.h>
 
 #include <elfloader.h>
 
@@ -59,14 +60,256 @@ static void ensure_phys_range_valid(paddr_t paddr_min, paddr_t paddr_max)
     }
 }
 
+/*
+ * Images in the archive are either plain ELF files or compressed ELF files,
+ * in the format produced by Compress.py in the capDL tool. A compressed image
+ * starts with the header below, followed by the ELF header and program
+ * headers as they are, so that they can be read in place. The file contents
+ * of each loadable segment are cut into blocks at 4K virtual address
+ * boundaries, and each block is stored as all zeros, raw, LZ4 compressed or as
+ * a reference to an identical earlier block.
+ */
+#define COMPRESSED_ELF_MAGIC "CDLZ"
+#define COMPRESSED_BLOCK_BITS 12
+
+enum {
+    COMPRESSED_BLOCK_ZERO,
+    COMPRESSED_BLOCK_RAW,
+    COMPRESSED_BLOCK_LZ4,
+    COMPRESSED_BLOCK_DUPLICATE,
+};
+
+#define COMPRESSED_BLOCK_KIND(info) ((info) >> 30)
+#define COMPRESSED_BLOCK_VALUE(info) ((info) & MASK(30))
+
+typedef struct {
+    char magic[4];
+    uint32_t elf_header_size;
+    uint32_t segments_offset;
+    uint32_t blocks_offset;
+} compressed_elf_t;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t info;
+} compressed_block_t;
+
+/*
+ * An image being unpacked from the archive.
+ *
+ * The whole file is hashed, but it is hashed as it is consumed rather than in
+ * a separate pass, so that each part of the file is read from memory once.
+ */
+struct archive_image {
+    const char *file;
+    unsigned long size;
+    /* The ELF headers, which are in the middle of compressed images */
+    void *elf;
+    /* NULL if the image is a plain ELF file */
+    compressed_elf_t *compressed;
+#ifdef CONFIG_HASH_INSTRUCTIONS
+    hashes_t hashes;
+    /* Bytes at the start of the file that have been hashed */
+    unsigned long hashed;
+#endif
+};
+
+static void init_archive_image(struct archive_image *image, void *file, unsigned long size)
+{
+    image->file = file;
+    image->size = size;
+    image->elf = file;
+    image->compressed = NULL;
+    if (size >= sizeof(compressed_elf_t) && strncmp(file, COMPRESSED_ELF_MAGIC, 4) == 0) {
+        image->compressed = file;
+        image->elf = (char *)file + sizeof(compressed_elf_t);
+    }
+}
+
+/* Hash the file up to the byte before end, if it has not been hashed yet. */
+static void hash_image_to(struct archive_image *image, unsigned long end)
+{
+#ifdef CONFIG_HASH_INSTRUCTIONS
+    if (end > image->size) {
+        end = image->size;
+    }
+    if (end > image->hashed) {
+        hash_update(&image->hashes, image->file + image->hashed, end - image->hashed);
+        image->hashed = end;
+    }
+#else
+    (void)image;
+    (void)end;
+#endif
+}
+
+/* Bytes at image->elf that hold the ELF header and program headers */
+static unsigned long elf_headers_size(struct archive_image *image)
+{
+    if (image->compressed) {
+        return image->compressed->elf_header_size;
+    }
+    return image->size;
+}
+
+/*
+ * Everything that is read in place from the image, the ELF headers and the
+ * tables of a compressed image, must lie within the file. This is checked
+ * before anything is read from it, as when hashing is enabled the hash is
+ * only checked after the image has been unpacked.
+ */
+static void check_image(const char *name, struct archive_image *image)
+{
+    unsigned long headers_size = elf_headers_size(image);
+    unsigned long phoff, phsize, phnum;
+
+    if (image->compressed && headers_size > image->size - sizeof(compressed_elf_t)) {
+        printf("ELF headers of '%s' lie outside of the file!\n", name);
+        abort();
+    }
+    if (headers_size < sizeof(struct Elf32_Header) || elf_checkFile(image->elf) != 0) {
+        printf("Attempting to load invalid ELF file '%s'.\n", name);
+        abort();
+    }
+    if (ISELF32(image->elf)) {
+        phoff = ((struct Elf32_Header *)image->elf)->e_phoff;
+        phsize = ((struct Elf32_Header *)image->elf)->e_phentsize;
+    } else {
+        if (headers_size < sizeof(struct Elf64_Header)) {
+            printf("Attempting to load invalid ELF file '%s'.\n", name);
+            abort();
+        }
+        phoff = ((struct Elf64_Header *)image->elf)->e_phoff;
+        phsize = ((struct Elf64_Header *)image->elf)->e_phentsize;
+    }
+    phnum = elf_getNumProgramHeaders(image->elf);
+    if (phoff > headers_size || phnum * phsize > headers_size - phoff) {
+        printf("Program headers of '%s' lie outside of the file!\n", name);
+        abort();
+    }
+    for (unsigned long i = 0; i < phnum; i++) {
+        /* the memory bounds of the image only cover the memory size */
+        if (elf_getProgramHeaderType(image->elf, i) == PT_LOAD &&
+            elf_getProgramHeaderFileSize(image->elf, i) > elf_getProgramHeaderMemorySize(image->elf, i)) {
+            printf("Segment %lu of '%s' is larger in the file than in memory!\n", i, name);
+            abort();
+        }
+    }
+
+    if (image->compressed) {
+        compressed_elf_t *header = image->compressed;
+        uint32_t num_blocks;
+        if (!IS_ALIGNED(header->segments_offset, 2) || !IS_ALIGNED(header->blocks_offset, 2) ||
+            header->segments_offset > image->size ||
+            phnum > (image->size - header->segments_offset) / sizeof(uint32_t) ||
+            header->blocks_offset > image->size ||
+            image->size - header->blocks_offset < sizeof(uint32_t)) {
+            printf("Compressed tables of '%s' lie outside of the file!\n", name);
+            abort();
+        }
+        num_blocks = *(uint32_t *)(image->file + header->blocks_offset);
+        if (num_blocks > (image->size - header->blocks_offset - sizeof(uint32_t)) / sizeof(compressed_block_t)) {
+            printf("Compressed tables of '%s' lie outside of the file!\n", name);
+            abort();
+        }
+    }
+}
+
+static compressed_block_t *compressed_block(struct archive_image *image, uint32_t index)
+{
+    const char *blocks = image->file + image->compressed->blocks_offset;
+    if (index >= *(uint32_t *)blocks) {
+        printf("Compressed block %u out of range!\n", index);
+        abort();
+    }
+    return &((compressed_block_t *)(blocks + sizeof(uint32_t)))[index];
+}
+
+/* Decode the compressed block 'index' into len bytes at dest */
+static void decode_block(struct archive_image *image, uint32_t index, char *dest, size_t len)
+{
+    compressed_block_t *block = compressed_block(image, index);
+    uint32_t value = COMPRESSED_BLOCK_VALUE(block->info);
+    unsigned int kind = COMPRESSED_BLOCK_KIND(block->info);
+
+    if ((kind == COMPRESSED_BLOCK_RAW || kind == COMPRESSED_BLOCK_LZ4) &&
+        (block->offset > image->size || value > image->size - block->offset)) {
+        printf("Compressed block %u outside of image!\n", index);
+        abort();
+    }
+
+    switch (kind) {
+    case COMPRESSED_BLOCK_ZERO:
+        memset(dest, 0, len);
+        break;
+    case COMPRESSED_BLOCK_RAW:
+        if (value != len) {
+            printf("Compressed block %u has the wrong size!\n", index);
+            abort();
+        }
+        hash_image_to(image, block->offset + value);
+        memcpy(dest, image->file + block->offset, len);
+        break;
+    case COMPRESSED_BLOCK_LZ4:
+        hash_image_to(image, block->offset + value);
+        if (lz4_decompress((const uint8_t *)image->file + block->offset, value,
+                           (uint8_t *)dest, len) != len) {
+            printf("Failed to decompress block %u!\n", index);
+            abort();
+        }
+        break;
+    case COMPRESSED_BLOCK_DUPLICATE:
+        if (value >= index) {
+            printf("Compressed block %u refers to a later block!\n", index);
+            abort();
+        }
+        decode_block(image, value, dest, len);
+        break;
+    }
+}
+
+/*
+ * Write the file contents of a loadable segment to dest, a page at a time.
+ */
+static void unpack_segment(struct archive_image *image, uint16_t segment, char *dest)
+{
+    vaddr_t vaddr = elf_getProgramHeaderVaddr(image->elf, segment);
+    size_t data_size = elf_getProgramHeaderFileSize(image->elf, segment);
+    size_t data_offset = elf_getProgramHeaderOffset(image->elf, segment);
+    uint32_t index = 0;
+    size_t offset, len;
+
+    if (image->compressed) {
+        index = ((uint32_t *)(image->file + image->compressed->segments_offset))[segment];
+    } else if (data_offset > image->size || data_size > image->size - data_offset) {
+        printf("Segment %u lies outside of the ELF file!\n", segment);
+        abort();
+    }
+
+    for (offset = 0; offset < data_size; offset += len) {
+        /* Compressed blocks end on the same boundaries */
+        len = MIN(BIT(COMPRESSED_BLOCK_BITS) - ((vaddr + offset) & MASK(COMPRESSED_BLOCK_BITS)),
+                  data_size - offset);
+        if (image->compressed) {
+            decode_block(image, index++, dest + offset, len);
+        } else {
+            hash_image_to(image, data_offset + offset + len);
+            memcpy(dest + offset, image->file + data_offset + offset, len);
+        }
+    }
+}
+
 /*
  * Unpack an ELF file to the given physical address.
  */
-static void unpack_elf_to_paddr(void *elf, paddr_t dest_paddr)
+static void unpack_elf_to_paddr(struct archive_image *image, paddr_t dest_paddr)
 {
+    void *elf = image->elf;
     uint16_t i;
     uint64_t min_vaddr, max_vaddr;
     size_t image_size;
+    paddr_t zeroed_to;
+    vaddr_t last_vaddr = 0;
 
     word_t phys_virt_offset;
 
@@ -75,13 +318,26 @@ static void unpack_elf_to_paddr(void *elf, paddr_t dest_paddr)
     image_size = (size_t)(max_vaddr - min_vaddr);
     phys_virt_offset = dest_paddr - (paddr_t)min_vaddr;
 
-    /* Zero out all memory in the region, as the ELF file may be sparse. */
-    memset((char *)dest_paddr, 0, image_size);
+    /* The ELF file may be sparse, so everything that is not loaded from it
+     * must be zeroed. This is done as we go when segments are in address
+     * order, which is almost always. Otherwise zero everything first. */
+    zeroed_to = dest_paddr;
+    for (i = 0; i < elf_getNumProgramHeaders(elf); i++) {
+        if (elf_getProgramHeaderType(elf, i) != PT_LOAD) {
+            continue;
+        }
+        if (elf_getProgramHeaderVaddr(elf, i) < last_vaddr) {
+            memset((char *)dest_paddr, 0, image_size);
+            zeroed_to = dest_paddr + image_size;
+            break;
+        }
+        last_vaddr = elf_getProgramHeaderVaddr(elf, i);
+    }
 
     /* Load each segment in the ELF file. */
     for (i = 0; i < elf_getNumProgramHeaders(elf); i++) {
-        vaddr_t dest_vaddr;
-        size_t data_size, data_offset;
+        paddr_t seg_paddr;
+        size_t data_size, mem_size;
 
         /* Skip segments that are not marked as being loadable. */
         if (elf_getProgramHeaderType(elf, i) != PT_LOAD) {
@@ -89,13 +345,26 @@ static void unpack_elf_to_paddr(void *elf, paddr_t dest_paddr)
         }
 
         /* Parse size/length headers. */
-        dest_vaddr = elf_getProgramHeaderVaddr(elf, i);
+        seg_paddr = elf_getProgramHeaderVaddr(elf, i) + phys_virt_offset;
         data_size = elf_getProgramHeaderFileSize(elf, i);
-        data_offset = elf_getProgramHeaderOffset(elf, i);
+        mem_size = elf_getProgramHeaderMemorySize(elf, i);
+
+        if (zeroed_to < seg_paddr) {
+            memset((char *)zeroed_to, 0, seg_paddr - zeroed_to);
+        }
 
         /* Load data into memory. */
-        memcpy((char *)dest_vaddr + phys_virt_offset,
-               (char *)elf + data_offset, data_size);
+        unpack_segment(image, i, (char *)seg_paddr);
+
+        if (mem_size > data_size && zeroed_to < seg_paddr + mem_size) {
+            memset((char *)seg_paddr + data_size, 0, mem_size - data_size);
+        }
+        if (zeroed_to < seg_paddr + mem_size) {
+            zeroed_to = seg_paddr + mem_size;
+        }
+    }
+    if (zeroed_to < dest_paddr + image_size) {
+        memset((char *)zeroed_to, 0, dest_paddr + image_size - zeroed_to);
     }
 }
 
@@ -104,14 +373,20 @@ static void unpack_elf_to_paddr(void *elf, paddr_t dest_paddr)
  *
  * Return the byte past the last byte of the physical address used.
  */
-static paddr_t load_elf(const char *name, void *elf, paddr_t dest_paddr,
+static paddr_t load_elf(const char *name, void *file, paddr_t dest_paddr,
                         struct image_info *info, int keep_headers,
-                        __attribute__((unused)) unsigned long size,
+                        unsigned long size,
                         __attribute__((unused)) const char *hash)
 {
+    struct archive_image image;
+    void *elf;
     uint64_t min_vaddr, max_vaddr;
     size_t image_size;
 
+    init_archive_image(&image, file, size);
+    elf = image.elf;
+    check_image(name, &image);
+
     /* Fetch image info. */
     elf_getMemoryBounds(elf, 0, &min_vaddr, &max_vaddr);
     max_vaddr = ROUND_UP(max_vaddr, PAGE_BITS);
@@ -135,58 +410,36 @@ static paddr_t load_elf(const char *name, void *elf, paddr_t dest_paddr,
     /* Get the binary file that contains the SHA256 Hash */
     unsigned long unused;
     void *file_hash = cpio_get_file(_archive_start, (const char *)hash, &unused);
-    uint8_t *print_hash_pointer = (uint8_t *)file_hash;
 
     /* If the file hash doesn't have a pointer, the file doesn't exist, so we cannot confirm the file is what we expect. Abort */
     if(file_hash == NULL) {
         printf("Cannot compare hashes for %s, expected hash, %s, doesn't exist\n", name, hash);
         abort();
     }
-    else {
-
-        hashes_t hashes;
 
 #ifdef CONFIG_HASH_SHA
-        int hash_len = 32;
-        hashes.hash_type = SHA_256;
+    int hash_len = 32;
+    image.hashes.hash_type = SHA_256;
 #else
-        int hash_len = 16;
-        hashes.hash_type = MD5;
+    int hash_len = 16;
+    image.hashes.hash_type = MD5;
 #endif
 
-        uint8_t calculated_hash[hash_len];
-
-        /* Print the Hash for the user to see */
-        printf("Hash from ELF File: ");
-        print_hash(print_hash_pointer, hash_len);
-
-        get_hash(hashes, elf, size, calculated_hash);
-
-        /* Print the hash so the user can see they're the same or different */
-        printf("Hash for ELF Input: ");
-        print_hash(calculated_hash, hash_len);
-
-        /* Check to make sure the hashes are the same */
-        if(strncmp((char *)file_hash, (char *)calculated_hash, hash_len) != 0) {
-            printf("Hashes are different. Load failure\n");
-            abort();
-        }
-    }
+    /* The file is hashed while it is unpacked and checked afterwards. The
+     * image is not run before then, and the archive itself is not touched.
+     * check_image has already made sure that unpacking an altered file can
+     * not read outside of it or write outside of the image's region. */
+    hash_init(&image.hashes);
+    image.hashed = 0;
 
 #endif  /* CONFIG_HASH_INSTRUCTIONS */
 
     /* Print diagnostics. */
-    printf("ELF-loading image '%s'\n", name);
+    printf("ELF-loading image '%s'%s\n", name, image.compressed ? " (compressed)" : "");
     printf("  paddr=[%lx..%lx]\n", dest_paddr, dest_paddr + image_size - 1);
     printf("  vaddr=[%lx..%lx]\n", (vaddr_t)min_vaddr, (vaddr_t)max_vaddr - 1);
     printf("  virt_entry=%lx\n", (vaddr_t)elf_getEntryPoint(elf));
 
-    /* Ensure the ELF file is valid. */
-    if (elf_checkFile(elf) != 0) {
-        printf("Attempting to load invalid ELF file '%s'.\n", name);
-        abort();
-    }
-
     /* Ensure sane alignment of the image. */
     if (!IS_ALIGNED(min_vaddr, PAGE_BITS)) {
         printf("Start of image '%s' is not 4K-aligned!\n", name);
@@ -197,7 +450,29 @@ static paddr_t load_elf(const char *name, void *elf, paddr_t dest_paddr,
     ensure_phys_range_valid(dest_paddr, dest_paddr + image_size);
 
     /* Copy the data. */
-    unpack_elf_to_paddr(elf, dest_paddr);
+    unpack_elf_to_paddr(&image, dest_paddr);
+
+#ifdef CONFIG_HASH_INSTRUCTIONS
+    {
+        uint8_t calculated_hash[hash_len];
+
+        /* Whatever was not part of a segment */
+        hash_image_to(&image, image.size);
+        hash_sum(&image.hashes, calculated_hash);
+
+        /* Print the hashes so the user can see they're the same or different */
+        printf("Hash from ELF File: ");
+        print_hash((uint8_t *)file_hash, hash_len);
+        printf("Hash for ELF Input: ");
+        print_hash(calculated_hash, hash_len);
+
+        /* Check to make sure the hashes are the same */
+        if(strncmp((char *)file_hash, (char *)calculated_hash, hash_len) != 0) {
+            printf("Hashes are different. Load failure\n");
+            abort();
+        }
+    }
+#endif  /* CONFIG_HASH_INSTRUCTIONS */
 
     /* Record information about the placement of the image. */
     info->phys_region_start = dest_paddr;
@@ -235,6 +510,47 @@ static paddr_t load_elf(const char *name, void *elf, paddr_t dest_paddr,
     return dest_paddr;
 }
 
+#ifdef CONFIG_BOOT_TIMESTAMPS
+
+static uint64_t timestamps[ELFLOADER_NUM_PHASES];
+
+void elfloader_timestamp(int phase)
+{
+    timestamps[phase] = read_cycle_counter();
+}
+
+/*
+ * Leave the timestamps for the kernel in the frame after the user image's ELF
+ * headers. As with the headers themselves there is no way of sharing the
+ * definition with the kernel, so this mirrors seL4_BootInfoElfloaderTimestamps:
+ * a header of two words (id 7 and the length of the record) followed by the
+ * 64-bit cycle counts.
+ */
+void write_elfloader_timestamps(struct image_info *user_info)
+{
+    struct {
+        word_t id;
+        word_t len;
+        uint64_t cycles[ELFLOADER_NUM_PHASES];
+    } __attribute__((packed)) record;
+    /* The end of the image need not be page aligned, and the ELF headers
+     * take up the whole of the frame that follows it */
+    paddr_t dest_paddr = ROUND_UP(user_info->phys_region_end, PAGE_BITS) + BIT(PAGE_BITS);
+
+    /* Timestamps are not worth failing the boot over */
+    if (regions_overlap(dest_paddr, dest_paddr + BIT(PAGE_BITS) - 1,
+                        (word_t)_start, (word_t)_end - 1)) {
+        return;
+    }
+
+    record.id = 7;
+    record.len = sizeof(record);
+    memcpy(record.cycles, timestamps, sizeof(timestamps));
+    memcpy((void*)dest_paddr, &record, sizeof(record));
+}
+
+#endif /* CONFIG_BOOT_TIMESTAMPS */
+
 /*
  * ELF-loader for ARM systems.
  *
@@ -271,6 +587,7 @@ void load_images(struct image_info *kernel_info, struct image_info *user_info,
     paddr_t next_phys_addr;
     const char *elf_filename;
     unsigned long unused;
+    struct archive_image kernel_image;
 
     /* Load kernel. */
     void *kernel_elf = cpio_get_file(_archive_start, "kernel.elf", &unused);
@@ -278,14 +595,16 @@ void load_images(struct image_info *kernel_info, struct image_info *user_info,
         printf("No kernel image present in archive!\n");
         abort();
     }
-    if (elf_checkFile(kernel_elf)) {
+    init_archive_image(&kernel_image, kernel_elf, unused);
+    if (elf_checkFile(kernel_image.elf)) {
         printf("Kernel image not a valid ELF file!\n");
         abort();
     }
 
-    elf_getMemoryBounds(kernel_elf, 1, &kernel_phys_start, &kernel_phys_end);
+    elf_getMemoryBounds(kernel_image.elf, 1, &kernel_phys_start, &kernel_phys_end);
     next_phys_addr = load_elf("kernel", kernel_elf,
                               (paddr_t)kernel_phys_start, kernel_info, 0, unused, "kernel.bin");
+    elfloader_timestamp(ELFLOADER_PHASE_KERNEL_LOAD);
 
     /*
      * Load userspace images.
@@ -312,4 +631,5 @@ void load_images(struct image_info *kernel_info, struct image_info *user_info,
                                   next_phys_addr, &user_info[*num_images], 1, unused, "app.bin");
         *num_images = i + 1;
     }
+    elfloader_timestamp(ELFLOADER_PHASE_USER_LOAD);
 }
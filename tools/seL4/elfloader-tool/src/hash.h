@@ -35,5 +35,11 @@ typedef struct {
 } hashes_t;
 
 void get_hash(hashes_t hashes, const void *file_to_hash, unsigned long bytes_to_hash, uint8_t *outputted_hash);
+
+/* Incremental hashing, for when a file is hashed piece by piece as it is read.
+ * hash_type must be set before calling hash_init */
+void hash_init(hashes_t *hashes);
+void hash_update(hashes_t *hashes, const void *data, unsigned long len);
+void hash_sum(hashes_t *hashes, uint8_t *outputted_hash);
 void print_hash(uint8_t *hash_to_print, int bytes_to_print);
 
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the GNU General Public License version 2. Note that NO WARRANTY is provided.
+ * See "LICENSE_GPLv2.txt" for details.
+ *
+ * @TAG(DATA61_GPL)
+ */
+
+#include <types.h>
+#include <strops.h>
+#include <lz4.h>
+
+/* Read the extension bytes of a length field. Returns 0 if src runs out */
+static int read_length(const uint8_t **ip, const uint8_t *iend, size_t *length)
+{
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            return 0;
+        }
+        b = *(*ip)++;
+        *length += b;
+    } while (b == 255);
+    return 1;
+}
+
+size_t lz4_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + src_len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_len;
+
+    while (ip < iend) {
+        unsigned int token = *ip++;
+        size_t length = token >> 4;
+
+        if (length == 15 && !read_length(&ip, iend, &length)) {
+            return 0;
+        }
+        if (length > (size_t)(iend - ip) || length > (size_t)(oend - op)) {
+            return 0;
+        }
+        memcpy(op, ip, length);
+        op += length;
+        ip += length;
+
+        /* The last sequence has only literals */
+        if (ip >= iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return 0;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return 0;
+        }
+
+        length = token & 15;
+        if (length == 15 && !read_length(&ip, iend, &length)) {
+            return 0;
+        }
+        length += 4;
+        if (length > (size_t)(oend - op)) {
+            return 0;
+        }
+        /* Matches may overlap the bytes they produce, so copy forwards */
+        const uint8_t *match = op - offset;
+        while (length-- > 0) {
+            *op++ = *match++;
+        }
+    }
+    return op - dst;
+}
@@ -28,17 +28,38 @@
  */
 void get_hash(hashes_t hashes, const void *file_to_hash, unsigned long bytes_to_hash, uint8_t *outputted_hash)
 {
-    if (hashes.hash_type == SHA_256) {
-        sha256_t calculated_hash = hashes.sha_structure;
-        sha256_init(&calculated_hash);
-        sha256_update(&calculated_hash, file_to_hash, bytes_to_hash);
-        sha256_sum(&calculated_hash, outputted_hash);
+    hash_init(&hashes);
+    hash_update(&hashes, file_to_hash, bytes_to_hash);
+    hash_sum(&hashes, outputted_hash);
+}
+
+void hash_init(hashes_t *hashes)
+{
+    if (hashes->hash_type == SHA_256) {
+        sha256_init(&hashes->sha_structure);
+    }
+    else {
+        md5_init(&hashes->md5_structure);
+    }
+}
+
+void hash_update(hashes_t *hashes, const void *data, unsigned long len)
+{
+    if (hashes->hash_type == SHA_256) {
+        sha256_update(&hashes->sha_structure, data, len);
+    }
+    else {
+        md5_update(&hashes->md5_structure, data, len);
+    }
+}
+
+void hash_sum(hashes_t *hashes, uint8_t *outputted_hash)
+{
+    if (hashes->hash_type == SHA_256) {
+        sha256_sum(&hashes->sha_structure, outputted_hash);
     }
     else {
-        md5_t calculated_hash = hashes.md5_structure;
-        md5_init(&calculated_hash);
-        md5_update(&calculated_hash, file_to_hash, bytes_to_hash);
-        md5_sum(&calculated_hash, outputted_hash);
+        md5_sum(&hashes->md5_structure, outputted_hash);
     }
 }
 